@@ -1,18 +1,33 @@
 import socket
 import re
+import struct
 import random
+import argparse
+import os
+import sys
 from math import sqrt
 import time
+import zlib
 from typing import Tuple
 from scipy.optimize import differential_evolution
 import matplotlib.pyplot as plt
 import matplotlib.animation as animation
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "host"))
+from snapshot_reader import SnapshotReader
+
 
 class CommandTransmission():
     # If received messages contain the following strings, don't print the message
     filters = [] # ["AT+RANGE", "Response: OK"]
 
+    # Binary telemetry packets, see lib/utils/src/telemetry.h for the layout
+    TELEMETRY_MAGIC = 0x5353
+    TELEMETRY_VERSION = 1
+    TELEMETRY_RANGES = 1
+    TELEMETRY_HEADER = struct.Struct('<HBBBBBB')
+    TELEMETRY_FRAME = struct.Struct('<II')
+
     def __init__(self):
         # TODO: leave this functionality for sending messages to the boards
         # self.esp_id = {
@@ -38,10 +53,51 @@ class CommandTransmission():
             print("No echo received.")
 
 
+    def decode_telemetry(self, data):
+        """Decodes a binary telemetry packet.
+
+        Returns:
+            list: (device_id, seq, timestamp_us, ranges) per frame, or None if
+            the datagram isn't a telemetry packet.
+        """
+        if len(data) < self.TELEMETRY_HEADER.size:
+            return None
+
+        magic, version, kind, device_id, count, anchors, _ = self.TELEMETRY_HEADER.unpack_from(data)
+        if magic != self.TELEMETRY_MAGIC or version != self.TELEMETRY_VERSION:
+            return None
+        # Position fixes solved on the tag are for the C++ tools, skip them
+        if kind != self.TELEMETRY_RANGES:
+            return []
+
+        frame_len = self.TELEMETRY_FRAME.size + 2 * anchors
+        if len(data) < self.TELEMETRY_HEADER.size + count * frame_len:
+            return None
+
+        frames = []
+        for i in range(count):
+            offset = self.TELEMETRY_HEADER.size + i * frame_len
+            seq, timestamp_us = self.TELEMETRY_FRAME.unpack_from(data, offset)
+            ranges = list(struct.unpack_from(f'<{anchors}h', data, offset + self.TELEMETRY_FRAME.size))
+            frames.append((device_id, seq, timestamp_us, ranges))
+
+        return frames
+
+
     def get_range_data(self):
         # Receives commands from any ip addresses (not just the ones in esp_id)
         try:
-            data, addr = self.sock.recvfrom(1024)
+            data, addr = self.sock.recvfrom(2048)
+
+            # Tags batch several frames per datagram, the newest one wins
+            frames = self.decode_telemetry(data)
+            if frames is not None:
+                if not frames:
+                    return
+                distances = frames[-1][3]
+                print(distances)
+                return distances
+
             message = data.decode('utf-8', errors='ignore').strip()
             
             for blacklisted_string in self.filters:
@@ -62,6 +118,51 @@ class CommandTransmission():
 
 
 
+# Calibration file, see lib/utils/src/calibration_cache.h for the layout
+CALIBRATION_MAGIC = 0x4B43
+CALIBRATION_VERSION = 1
+CALIBRATION_POSITIONS = 0x01
+CALIBRATION_HEADER = struct.Struct('<HBBIB')
+CALIBRATION_NO_DISTANCE = -1
+
+
+def load_calibration(path):
+    """Reads the calibration file uwb_aggregator --calibration keeps, so the
+    anchors are placed without measuring or solving anything.
+
+    Returns:
+        dict: "saved_unix", "distances" (n x n, cm, None where not measured),
+        "antenna_delays" (0 where not known) and "positions" ((x, y) cm per
+        device, None if they weren't solved), or None if the file isn't a
+        calibration.
+    """
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < CALIBRATION_HEADER.size + 4:
+        return None
+
+    magic, version, n, saved_unix, flags = CALIBRATION_HEADER.unpack_from(data)
+    if magic != CALIBRATION_MAGIC or version != CALIBRATION_VERSION:
+        return None
+    has_positions = flags & CALIBRATION_POSITIONS
+    body = CALIBRATION_HEADER.size + 2 * n * n + 2 * n + (8 * n if has_positions else 0)
+    if len(data) < body + 4 or zlib.crc32(data[:body]) != struct.unpack_from('<I', data, body)[0]:
+        return None
+
+    offset = CALIBRATION_HEADER.size
+    matrix = struct.unpack_from(f'<{n * n}h', data, offset)
+    offset += 2 * n * n
+    delays = list(struct.unpack_from(f'<{n}H', data, offset))
+    offset += 2 * n
+    positions = None
+    if has_positions:
+        mm = struct.unpack_from(f'<{2 * n}i', data, offset)
+        positions = [(mm[2 * i] / 10, mm[2 * i + 1] / 10) for i in range(n)]
+
+    distances = [[None if d == CALIBRATION_NO_DISTANCE else d for d in matrix[a * n:(a + 1) * n]] for a in range(n)]
+    return {"saved_unix": saved_unix, "distances": distances, "antenna_delays": delays, "positions": positions}
+
+
 class UserInterface:
     
     def __init__(self, fig, ax, base_station):
@@ -154,11 +255,20 @@ class Device():
 class BaseStation():
     """Sets up CommandTransmission, UserInterface, and facilitates getting 
     distances, calculating positions, and plotting coordinates.
+
+    With a snapshot name, positions come from uwb_aggregator's shared-memory
+    snapshot instead: the aggregator owns the socket and solves the fixes, so
+    drawing a frame is a memory read rather than a recvfrom and an optimizer
+    run.
     """
      
-    def __init__(self):
+    def __init__(self, snapshot_name=None, rescuer_id=4):
+        self.snapshot = SnapshotReader(snapshot_name) if snapshot_name else None
+        self.rescuer_id = rescuer_id
+        self.snapshot_generation = 0
+
         # Used to facilitate WiFi transmission between boards and the computer
-        self.data_obj = CommandTransmission()
+        self.data_obj = None if self.snapshot else CommandTransmission()
         self.points = {}        
         self.init_static_points()
         self.main()
@@ -276,7 +386,40 @@ class BaseStation():
             print("No solution found.")
 
 
+    def update_from_snapshot(self):
+        """Takes the anchors and every tag's newest fix from the snapshot.
+        Tags that have gone stale are dropped from the plot.
+        """
+        if self.snapshot.generation() == self.snapshot_generation:
+            return
+
+        snapshot = self.snapshot.read()
+        if snapshot is None:
+            return
+        self.snapshot_generation = snapshot["generation"]
+
+        points = {label: xy for label, xy in self.points.items() if not label.startswith(("anchor", "tag"))}
+        points.pop("rescuer", None)
+        for index, (x, y, _) in snapshot["anchors"].items():
+            points[f"anchor{index}"] = (x, y)
+
+        for device_id, device in snapshot["devices"].items():
+            if device["position"] is None or device["stale"]:
+                continue
+            x, y, _ = device["position"]
+            label = "rescuer" if device_id == self.rescuer_id else f"tag{device_id}"
+            points[label] = (x, y)
+            if label == "rescuer":
+                rescuer_tag.set_coordinates(x, y)
+
+        self.points = points
+        self.visual_obj.update_data(self.points)
+
+
     def trilateration(self):
+        if self.snapshot is not None:
+            self.update_from_snapshot()
+            return
         
         # TODO: Need to add functionality to accommodate the distances from 
         #TODO: either a victim or rescuer
@@ -339,16 +482,30 @@ class BaseStation():
 
 if __name__=="__main__":
 
-    # For now, hard code these locations
-    anchor0 = Device(0, 0)
-    anchor1 = Device(980, 0)
-    anchor2 = Device(1035, 719)
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--shm", nargs="?", const=SnapshotReader.DEFAULT_NAME,
+                        help="read positions from uwb_aggregator --shm instead of the UDP port")
+    parser.add_argument("--rescuer-id", type=int, default=4, help="uwb_index of the rescuer tag")
+    parser.add_argument("--calibration", help="place the anchors from uwb_aggregator's --calibration file")
+    args = parser.parse_args()
+
+    # Without a calibration, hard code these locations
+    anchor_positions = [(0, 0), (980, 0), (1035, 719)]
+    if args.calibration:
+        calibration = load_calibration(args.calibration)
+        if calibration is None or calibration["positions"] is None or len(calibration["positions"]) < 3:
+            sys.exit(f"{args.calibration}: no anchor positions")
+        anchor_positions = calibration["positions"][:3]
+        saved = time.strftime("%Y-%m-%d %H:%M", time.localtime(calibration["saved_unix"]))
+        print(f"Anchors from {args.calibration}, calibrated {saved}")
+
+    anchor0, anchor1, anchor2 = (Device(x, y) for x, y in anchor_positions)
     # These two tags need to be initialized
     victim = Device(162, 961)
     rescuer_tag = Device(0, 0)
 
     # Run the program
-    obj = BaseStation()
+    obj = BaseStation(args.shm, args.rescuer_id)
 
 
 """
@@ -0,0 +1,433 @@
+#include "aggregator.h"
+
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry_decoder.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+static const int EPOLL_TIMEOUT_MS = 100; // How soon a worker notices stop()
+static const size_t CONTROL_LEN = CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+struct Aggregator::Worker {
+    int sock = -1;
+    int epoll = -1;
+    std::thread thread;
+    TelemetryDecoder decoder;
+    uint64_t received_ns = 0; // Of the datagram being decoded
+
+    // The datagram's frames, for AggregatorLatency once it is decoded
+    uint32_t datagram_us[TELEMETRY_MAX_FRAMES];
+    size_t datagram_frames = 0;
+    ClockMapping datagram_clock;
+    AggregatorLatency latency; // Written by this worker only
+
+    std::atomic<uint64_t> datagrams{ 0 };
+    std::atomic<uint64_t> frames{ 0 };
+    std::atomic<uint64_t> malformed{ 0 };
+    std::atomic<uint64_t> kernel_drops{ 0 };
+    std::atomic<uint64_t> recv_calls{ 0 };
+    std::atomic<uint64_t> queue_ns_total{ 0 };
+    std::atomic<uint64_t> queue_ns_max{ 0 };
+};
+
+
+uint64_t Aggregator::now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+Aggregator::Aggregator(int port, size_t worker_count)
+    : port(port), running(false), tracking(false), recorder(nullptr), calibration_ready(false), calibration_devices(0) {
+    for (size_t i = 0; i < (worker_count ? worker_count : 1); i++) workers.emplace_back(new Worker);
+    for (Shard& shard : shards) {
+        memset(shard.devices, 0, sizeof(shard.devices));
+        memset(shard.clocks, 0, sizeof(shard.clocks));
+    }
+}
+
+
+Aggregator::~Aggregator() {
+    stop();
+    for (auto& w : workers) {
+        if (w->epoll >= 0) close(w->epoll);
+        if (w->sock >= 0) close(w->sock);
+    }
+}
+
+
+void Aggregator::set_anchor(size_t i, const float position[2]) {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& tracker : shard.trackers) tracker.set_anchor(i, position);
+    }
+    tracking = true;
+}
+
+
+bool Aggregator::take_calibration(int* distances, size_t& devices) {
+    std::lock_guard<std::mutex> lock(calibration_mutex);
+    if (!calibration_ready) return false;
+    calibration_ready = false;
+    devices = calibration_devices;
+    memcpy(distances, calibration_matrix, devices * devices * sizeof(int));
+    return true;
+}
+
+
+bool Aggregator::open() {
+    for (auto& w : workers) {
+        w->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (w->sock < 0) return false;
+
+        int on = 1;
+        // Only when sharing the port between our own workers, so a second
+        // copy of the daemon fails to bind instead of silently taking half
+        if (workers.size() > 1) setsockopt(w->sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        setsockopt(w->sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        setsockopt(w->sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+        int size = AGGREGATOR_RCVBUF;
+        setsockopt(w->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(w->sock, (sockaddr*)&addr, sizeof(addr)) < 0) return false;
+
+        w->epoll = epoll_create1(0);
+        if (w->epoll < 0) return false;
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = w->sock;
+        if (epoll_ctl(w->epoll, EPOLL_CTL_ADD, w->sock, &ev) < 0) return false;
+
+        Worker* worker = w.get();
+        w->decoder.on_frame([this, worker](const TelemetryHeader& header, const TelemetryFrame& frame) {
+            apply(*worker, header.device_id, frame);
+        });
+        w->decoder.on_position([this, worker](const TelemetryHeader& header, const TelemetryPosition& fix) {
+            apply(*worker, header.device_id, fix);
+        });
+        w->decoder.on_stats([this](const TelemetryHeader& header, const TraceReport& report) {
+            apply(header.device_id, report);
+        });
+        w->decoder.on_calibration([this](const TelemetryHeader&, const int* distances, size_t devices) {
+            apply(distances, devices);
+        });
+    }
+    return true;
+}
+
+
+void Aggregator::start() {
+    if (running.exchange(true)) return;
+    for (auto& w : workers) {
+        Worker* worker = w.get();
+        w->thread = std::thread([this, worker] { run(*worker); });
+    }
+}
+
+
+void Aggregator::stop() {
+    if (!running.exchange(false)) return;
+    for (auto& w : workers) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+}
+
+
+////////////
+// WORKER //
+////////////
+
+void Aggregator::run(Worker& w) {
+    static thread_local uint8_t buffers[AGGREGATOR_BATCH][AGGREGATOR_MAX_DATAGRAM];
+    static thread_local uint8_t control[AGGREGATOR_BATCH][CONTROL_LEN];
+    mmsghdr msgs[AGGREGATOR_BATCH];
+    iovec iov[AGGREGATOR_BATCH];
+    sockaddr_in senders[AGGREGATOR_BATCH];
+    uint64_t received[AGGREGATOR_BATCH];
+
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < AGGREGATOR_BATCH; i++) {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = AGGREGATOR_MAX_DATAGRAM;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_name = &senders[i];
+    }
+
+    epoll_event event;
+    while (running) {
+        if (epoll_wait(w.epoll, &event, 1, EPOLL_TIMEOUT_MS) <= 0) continue;
+
+        // Drain everything queued, a batch per syscall
+        while (true) {
+            for (size_t i = 0; i < AGGREGATOR_BATCH; i++) {
+                msgs[i].msg_hdr.msg_controllen = CONTROL_LEN;
+                msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            }
+
+            int n = recvmmsg(w.sock, msgs, AGGREGATOR_BATCH, MSG_DONTWAIT, nullptr);
+            if (n <= 0) break;
+
+            uint64_t now = now_ns();
+            uint64_t frames = 0, malformed = 0, queue_total = 0, queue_max = 0;
+
+            for (int i = 0; i < n; i++) {
+                msghdr& h = msgs[i].msg_hdr;
+                w.received_ns = now;
+
+                for (cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+                    if (c->cmsg_level != SOL_SOCKET) continue;
+                    if (c->cmsg_type == SO_TIMESTAMPNS) {
+                        timespec ts;
+                        memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                        w.received_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+                    } else if (c->cmsg_type == SO_RXQ_OVFL) {
+                        uint32_t dropped;
+                        memcpy(&dropped, CMSG_DATA(c), sizeof(dropped));
+                        w.kernel_drops.store(dropped, std::memory_order_relaxed); // Running total
+                    }
+                }
+
+                received[i] = w.received_ns;
+                uint64_t waited = now > w.received_ns ? now - w.received_ns : 0;
+                queue_total += waited;
+                if (waited > queue_max) queue_max = waited;
+                w.latency.queue.record((uint32_t)(waited / 1000));
+
+                int delivered = w.decoder.decode(buffers[i], msgs[i].msg_len);
+                if (delivered < 0) malformed++;
+                else frames += delivered;
+                finish_datagram(w);
+
+                TelemetryHeader header;
+                if (delivered >= 0 && telemetry_decode_header(buffers[i], msgs[i].msg_len, header)) heard(w, header);
+            }
+
+            if (recorder) {
+                std::lock_guard<std::mutex> lock(recorder_mutex);
+                for (int i = 0; i < n; i++) {
+                    recorder->append(received[i], ntohl(senders[i].sin_addr.s_addr), buffers[i], msgs[i].msg_len);
+                }
+            }
+
+            w.datagrams.fetch_add(n, std::memory_order_relaxed);
+            w.frames.fetch_add(frames, std::memory_order_relaxed);
+            w.malformed.fetch_add(malformed, std::memory_order_relaxed);
+            w.recv_calls.fetch_add(1, std::memory_order_relaxed);
+            w.queue_ns_total.fetch_add(queue_total, std::memory_order_relaxed);
+            if (queue_max > w.queue_ns_max.load(std::memory_order_relaxed)) {
+                w.queue_ns_max.store(queue_max, std::memory_order_relaxed);
+            }
+
+            if (n < AGGREGATOR_BATCH) break; // Queue is empty, back to epoll
+        }
+    }
+}
+
+
+// Link counters come from the decoder of the worker the device lands on;
+// SO_REUSEPORT hashes on the sender's address, so that is always the same one.
+static void copy_link_stats(DeviceState& s, const DeviceLinkStats& link) {
+    s.packets = link.packets;
+    s.frames = link.frames;
+    s.lost = link.lost;
+    s.duplicates = link.duplicates;
+    s.restarts = link.restarts;
+}
+
+
+void Aggregator::apply(Worker& w, uint8_t id, const TelemetryFrame& frame) {
+    uint64_t start_ns = now_ns();
+    const DeviceLinkStats& link = w.decoder.stats(id);
+    Shard& shard = shards[id % AGGREGATOR_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    DeviceState& s = slot(id);
+    copy_link_stats(s, link);
+
+    // Late or not, the frame took its time getting here
+    w.datagram_clock = shard.clocks[id / AGGREGATOR_SHARDS];
+    if (w.datagram_frames < TELEMETRY_MAX_FRAMES) w.datagram_us[w.datagram_frames++] = frame.timestamp_us;
+
+    // Newest wins. The decoder has already dropped duplicates, and its highest
+    // sequence number follows restarts, so anything else is a late frame
+    if (frame.seq != link.highest_seq) {
+        s.late++;
+        return;
+    }
+
+    s.seen = true;
+    s.seq = frame.seq;
+    s.timestamp_us = frame.timestamp_us;
+    memcpy(s.ranges, frame.ranges, sizeof(s.ranges));
+    s.received_ns = w.received_ns;
+    if (!w.datagram_clock.to_host_ns(frame.timestamp_us, s.host_timestamp_ns)) s.host_timestamp_ns = 0;
+
+    // On the device's clock, so queueing on the way here doesn't skew the motion
+    if (tracking) {
+        PositionTracker<NUM_ANCHORS>& tracker = shard.trackers[id / AGGREGATOR_SHARDS];
+        tracker.update(frame.ranges, frame.timestamp_us);
+        s.has_track = tracker.estimate(frame.timestamp_us, s.track);
+    }
+
+    uint64_t done_ns = now_ns();
+    if (tracking) w.latency.solve.record((uint32_t)((done_ns - start_ns) / 1000));
+    if (s.host_timestamp_ns) {
+        w.latency.total.record(done_ns > s.host_timestamp_ns ? (uint32_t)((done_ns - s.host_timestamp_ns) / 1000) : 0);
+    }
+}
+
+
+void Aggregator::finish_datagram(Worker& w) {
+    if (w.datagram_frames == 0) return;
+
+    // The newest frame went out about as soon as it was batched, the rest waited for it
+    uint32_t newest = w.datagram_us[0];
+    for (size_t i = 1; i < w.datagram_frames; i++) {
+        if ((int32_t)(w.datagram_us[i] - newest) > 0) newest = w.datagram_us[i];
+    }
+    for (size_t i = 0; i < w.datagram_frames; i++) w.latency.batch.record(newest - w.datagram_us[i]);
+
+    // A sync error can put the send a little before the frame; that counts as 0
+    uint64_t newest_ns;
+    if (w.datagram_clock.to_host_ns(newest, newest_ns)) {
+        w.latency.send.record(w.received_ns > newest_ns ? (uint32_t)((w.received_ns - newest_ns) / 1000) : 0);
+    }
+    w.datagram_frames = 0;
+}
+
+
+void Aggregator::apply(const Worker& w, uint8_t id, const TelemetryPosition& fix) {
+    const DeviceLinkStats& link = w.decoder.stats(id, TELEMETRY_POSITION);
+    Shard& shard = shards[id % AGGREGATOR_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    DeviceState& s = slot(id);
+
+    if (fix.seq != link.highest_seq) {
+        s.late++;
+        return;
+    }
+    s.has_position = true;
+    s.position = fix;
+    s.position_received_ns = w.received_ns;
+}
+
+
+void Aggregator::apply(uint8_t id, const TraceReport& report) {
+    for (size_t i = 0; i < report.count; i++) {
+        const TraceEntry& e = report.entries[i];
+        if (e.kind != TRACE_KIND_STAGE || e.id != TRACE_UART_LINE) continue;
+
+        Shard& shard = shards[id % AGGREGATOR_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        DeviceState& s = slot(id);
+        s.uart_line_p50_us = (uint32_t)report.to_us(e, e.histogram.percentile(0.5));
+        s.uart_line_p99_us = (uint32_t)report.to_us(e, e.histogram.percentile(0.99));
+    }
+}
+
+
+void Aggregator::apply(const int* distances, size_t devices) {
+    if (devices > CAL_MAX_DEVICES) return;
+
+    std::lock_guard<std::mutex> lock(calibration_mutex);
+    calibration_devices = devices;
+    memcpy(calibration_matrix, distances, devices * devices * sizeof(int));
+    calibration_ready = true;
+}
+
+
+void Aggregator::heard(const Worker& w, const TelemetryHeader& header) {
+    Shard& shard = shards[header.device_id % AGGREGATOR_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    DeviceState& s = slot(header.device_id);
+    s.heard_ns = w.received_ns;
+    if (header.type == TELEMETRY_BOOT) s.booted_ns = w.received_ns;
+}
+
+
+void Aggregator::set_clock(uint8_t id, const ClockMapping& mapping) {
+    Shard& shard = shards[id % AGGREGATOR_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.clocks[id / AGGREGATOR_SHARDS] = mapping;
+}
+
+
+////////////
+// READERS //
+////////////
+
+
+bool Aggregator::device(uint8_t id, DeviceState& out) const {
+    const Shard& shard = shards[id % AGGREGATOR_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    out = shard.devices[id / AGGREGATOR_SHARDS];
+    return out.seen || out.has_position;
+}
+
+
+size_t Aggregator::stale_devices(uint64_t now, uint32_t stale_ms) const {
+    size_t stale = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const DeviceState& s : shard.devices) {
+            if (s.seen && now - s.received_ns > (uint64_t)stale_ms * 1000000ULL) stale++;
+        }
+    }
+    return stale;
+}
+
+
+size_t Aggregator::seen_devices() const {
+    size_t seen = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const DeviceState& s : shard.devices) seen += s.seen || s.has_position;
+    }
+    return seen;
+}
+
+
+AggregatorStats Aggregator::stats() const {
+    AggregatorStats out;
+    memset(&out, 0, sizeof(out));
+    for (const auto& w : workers) {
+        out.datagrams += w->datagrams.load(std::memory_order_relaxed);
+        out.frames += w->frames.load(std::memory_order_relaxed);
+        out.malformed += w->malformed.load(std::memory_order_relaxed);
+        out.kernel_drops += w->kernel_drops.load(std::memory_order_relaxed);
+        out.recv_calls += w->recv_calls.load(std::memory_order_relaxed);
+        out.queue_ns_total += w->queue_ns_total.load(std::memory_order_relaxed);
+        uint64_t max = w->queue_ns_max.load(std::memory_order_relaxed);
+        if (max > out.queue_ns_max) out.queue_ns_max = max;
+    }
+    return out;
+}
+
+
+AggregatorLatency Aggregator::latency() const {
+    AggregatorLatency out;
+    for (const auto& w : workers) {
+        out.batch.merge(w->latency.batch);
+        out.send.merge(w->latency.send);
+        out.queue.merge(w->latency.queue);
+        out.solve.merge(w->latency.solve);
+        out.total.merge(w->latency.total);
+    }
+    return out;
+}
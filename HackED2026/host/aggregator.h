@@ -0,0 +1,183 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "calibration.h"
+#include "clock_sync.h"
+#include "position_tracker.h"
+#include "range_log.h"
+#include "telemetry.h"
+#include "trace.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define AGGREGATOR_BATCH 64 // Datagrams per recvmmsg() call
+#define AGGREGATOR_SHARDS 16 // Device state locks, by uwb_index
+#define AGGREGATOR_MAX_DATAGRAM 2048
+#define AGGREGATOR_RCVBUF (4 << 20)
+#define AGGREGATOR_DEFAULT_STALE_MS 500
+
+// Everything known about one device: only its newest frame and fix are kept.
+struct DeviceState {
+    bool seen;
+    uint32_t seq;
+    uint32_t timestamp_us; // Device clock, from the frame
+    int ranges[NUM_ANCHORS];
+    uint64_t received_ns; // Host clock, when the frame's datagram arrived
+    /// @brief timestamp_us on the host clock, 0 until the device's clock is
+    /// synced, see Aggregator::set_clock().
+    uint64_t host_timestamp_ns;
+
+    bool has_position;
+    TelemetryPosition position;
+    uint64_t position_received_ns;
+
+    /// @brief From the device's PositionTracker, as of its newest frame. Only
+    /// with anchors set, see Aggregator::set_anchor().
+    bool has_track;
+    TrackerEstimate track;
+
+    uint64_t heard_ns; // Any datagram, stats and boot reports too
+    uint64_t booted_ns; // Newest TELEMETRY_BOOT, 0 if none
+    uint32_t uart_line_p50_us; // Module -> MCU, TRACE_UART_LINE from the device's stats
+    uint32_t uart_line_p99_us;
+
+    uint64_t packets;
+    uint64_t frames;
+    uint64_t lost; // Sequence gaps, net of late arrivals that filled them
+    uint64_t late; // Arrived after a newer frame, so never became the latest
+    uint64_t duplicates;
+    uint64_t restarts;
+};
+
+struct AggregatorStats {
+    uint64_t datagrams;
+    uint64_t frames;
+    uint64_t malformed; // Not telemetry, e.g. send_wifi_data() text
+    uint64_t kernel_drops; // Socket buffer overflows, from SO_RXQ_OVFL
+    uint64_t recv_calls; // recvmmsg() calls that returned data
+    /// @brief Time datagrams sat in the socket buffer before being decoded,
+    /// from the kernel's SO_TIMESTAMPNS receive time.
+    uint64_t queue_ns_total;
+    uint64_t queue_ns_max;
+};
+
+/// @brief Where a range frame's time goes on its way from the module to a
+/// position here, in us. send and total need the device's clock synced.
+struct AggregatorLatency {
+    LogHistogram batch; // UART arrival to the arrival of its datagram's newest frame, board clock
+    LogHistogram send; // That newest frame's arrival to the kernel's receive: the MCU's send and WiFi
+    LogHistogram queue; // Kernel receive to decode, as in AggregatorStats
+    LogHistogram solve; // PositionTracker update, with anchors set
+    LogHistogram total; // UART arrival to the frame being in the device's state, solved
+};
+
+/// @brief The host side of UWB_TAG_COUNT tags: one or more epoll workers pull
+/// datagrams off TARGET_PORT in recvmmsg() batches and fold every frame into
+/// its device's state, newest-wins, so a reader always gets the current
+/// ranges and never a backlog. Several workers share the port through
+/// SO_REUSEPORT; the kernel keeps each sender on one of them.
+///
+/// Device state is split into AGGREGATOR_SHARDS lock-striped shards by
+/// uwb_index, so readers (the display, a snapshot writer) rarely wait on a
+/// worker and workers never wait on each other for different devices.
+class Aggregator {
+public:
+    explicit Aggregator(int port, size_t workers = 1);
+    ~Aggregator();
+
+    /// @brief Places an anchor and turns on tracking: from then on every
+    /// frame that becomes a device's newest also updates its PositionTracker.
+    /// Any thread, any time, e.g. again once a calibration has moved it.
+    void set_anchor(size_t i, const float position[2]);
+
+    /// @brief The newest distance matrix a tag sent (TELEMETRY_CALIBRATION),
+    /// for whoever keeps the calibration file (see calibration_file.h).
+    /// @param distances At least CAL_MAX_DEVICES x CAL_MAX_DEVICES, filled
+    /// row-major, devices x devices.
+    /// @return False if none has arrived since the last call.
+    bool take_calibration(int* distances, size_t& devices);
+
+    /// @brief Where the device's micros() falls on the host clock (see
+    /// ClockSync, it has to be CLOCK_REALTIME like now_ns()). Any thread, any
+    /// time; frames decoded from then on get a host_timestamp_ns and count
+    /// towards the send and total latency.
+    void set_clock(uint8_t id, const ClockMapping& mapping);
+
+    /// @brief Appends every datagram, telemetry or not, to log with its
+    /// kernel receive time and sender. Call before start(); log must stay
+    /// open until stop().
+    void set_recorder(RangeLogWriter* log) { recorder = log; }
+
+    /// @brief Binds the sockets. False (with errno set) if that fails.
+    bool open();
+
+    /// @brief Starts the worker threads. Returns immediately.
+    void start();
+
+    /// @brief Stops and joins the workers.
+    void stop();
+
+    /// @brief Copies the device's state. False if nothing arrived from it yet.
+    bool device(uint8_t id, DeviceState& out) const;
+
+    /// @brief Devices whose newest frame is older than stale_ms, of those seen.
+    size_t stale_devices(uint64_t now_ns, uint32_t stale_ms) const;
+    size_t seen_devices() const;
+
+    /// @brief Summed over the workers.
+    AggregatorStats stats() const;
+    /// @brief Since start(), summed over the workers.
+    AggregatorLatency latency() const;
+
+    /// @brief Host clock used for received_ns, CLOCK_REALTIME like the kernel
+    /// timestamps.
+    static uint64_t now_ns();
+
+private:
+    struct Worker;
+    struct Shard {
+        mutable std::mutex mutex;
+        DeviceState devices[256 / AGGREGATOR_SHARDS];
+        PositionTracker<NUM_ANCHORS> trackers[256 / AGGREGATOR_SHARDS];
+        ClockMapping clocks[256 / AGGREGATOR_SHARDS];
+    };
+
+    void run(Worker& worker);
+    void apply(Worker& worker, uint8_t id, const TelemetryFrame& frame);
+    void apply(const Worker& worker, uint8_t id, const TelemetryPosition& fix);
+    void apply(uint8_t id, const TraceReport& report);
+    void apply(const int* distances, size_t devices);
+    void heard(const Worker& worker, const TelemetryHeader& header);
+    void finish_datagram(Worker& worker);
+    DeviceState& slot(uint8_t id) { return shards[id % AGGREGATOR_SHARDS].devices[id / AGGREGATOR_SHARDS]; }
+
+    int port;
+    std::vector<std::unique_ptr<Worker>> workers;
+    Shard shards[AGGREGATOR_SHARDS];
+    std::atomic<bool> running;
+    std::atomic<bool> tracking;
+    RangeLogWriter* recorder;
+    std::mutex recorder_mutex; // The workers take turns, a batch at a time
+
+    std::mutex calibration_mutex;
+    bool calibration_ready;
+    size_t calibration_devices;
+    int calibration_matrix[CAL_MAX_DEVICES * CAL_MAX_DEVICES];
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "batch_solver.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_HAVE_AVX2 1
+// batch_solver_avx2.cpp
+void batch_solve_avx2(const BatchAnchorSet& anchors, const BatchLanes& lanes, size_t begin, size_t end);
+#else
+#define BATCH_HAVE_AVX2 0
+#endif
+
+// One tag per lane, the fallback and the reference for the AVX2 path
+struct ScalarOps {
+    typedef float V;
+    typedef bool M;
+    static const size_t WIDTH = 1;
+
+    static V set1(float v) { return v; }
+    static V load_ranges(const int32_t* p) { return (float)*p; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V sqrt(V a) { return sqrtf(a); }
+    static V abs(V a) { return fabsf(a); }
+    static V max(V a, V b) { return a > b ? a : b; }
+    static M gt(V a, V b) { return a > b; }
+    static M ge(V a, V b) { return a >= b; }
+    static M land(M a, M b) { return a && b; }
+    static bool any(M m) { return m; }
+    static V select(M m, V a, V b) { return m ? a : b; }
+    static void store(float* p, V v) { *p = v; }
+    static void store_count(uint8_t* p, V v) { *p = (uint8_t)v; }
+    static void store_mask(uint8_t* p, M m) { *p = m; }
+};
+
+
+////////////////
+// RANGE BATCH //
+////////////////
+
+void RangeBatch::resize(size_t tags) {
+    size_t old_padded = padded();
+    std::vector<int32_t> old;
+    old.swap(ranges);
+
+    count = tags;
+    ranges.assign(NUM_ANCHORS * padded(), 0);
+    size_t keep = old_padded < padded() ? old_padded : padded();
+    for (size_t a = 0; a < NUM_ANCHORS && keep; a++) {
+        memcpy(&ranges[a * padded()], &old[a * old_padded], keep * sizeof(int32_t));
+    }
+    // Lanes past the end must stay empty even if they held a tag before
+    for (size_t a = 0; a < NUM_ANCHORS; a++) {
+        for (size_t t = count; t < padded(); t++) ranges[a * padded() + t] = 0;
+    }
+}
+
+
+void RangeBatch::set(size_t tag, const int ranges_cm[NUM_ANCHORS]) {
+    size_t stride = padded();
+    for (size_t a = 0; a < NUM_ANCHORS; a++) ranges[a * stride + tag] = ranges_cm[a];
+}
+
+
+//////////////////
+// BATCH SOLVER //
+//////////////////
+
+BatchSolver::BatchSolver()
+    : requested(BATCH_SIMD_AUTO), has_avx2(false), lane_count(0), next_chunk(0), job(0), busy(0), stopping(false) {
+    memset(&anchors, 0, sizeof(anchors));
+    memset(&lanes, 0, sizeof(lanes));
+#if BATCH_HAVE_AVX2
+    has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+
+BatchSolver::~BatchSolver() { stop_pool(); }
+
+
+void BatchSolver::set_anchor(size_t i, const float position[2]) {
+    anchors.x[i] = position[0];
+    anchors.y[i] = position[1];
+    anchors.configured |= 1U << i;
+}
+
+
+void BatchSolver::clear_anchor(size_t i) { anchors.configured &= ~(1U << i); }
+
+
+void BatchSolver::set_simd(BatchSimd simd) { requested = simd; }
+
+
+BatchSimd BatchSolver::simd() const {
+    if (requested == BATCH_SIMD_SCALAR || !has_avx2) return BATCH_SIMD_SCALAR;
+    return BATCH_SIMD_AVX2;
+}
+
+
+void BatchSolver::set_threads(size_t threads) {
+    stop_pool();
+    stopping = false;
+    for (size_t i = 1; i < threads; i++) pool.emplace_back([this] { run_pool(); });
+}
+
+
+void BatchSolver::stop_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : pool) t.join();
+    pool.clear();
+}
+
+
+void BatchSolver::solve(const RangeBatch& batch, BatchFixes& out) {
+    size_t padded = batch.padded();
+    out.x.resize(padded);
+    out.y.resize(padded);
+    out.rms_residual.resize(padded);
+    out.anchors_used.resize(padded);
+    out.valid.resize(padded);
+
+    for (size_t a = 0; a < NUM_ANCHORS; a++) lanes.ranges[a] = batch.anchor(a);
+    lanes.x = out.x.data();
+    lanes.y = out.y.data();
+    lanes.rms_residual = out.rms_residual.data();
+    lanes.anchors_used = out.anchors_used.data();
+    lanes.valid = out.valid.data();
+    lane_count = padded;
+    next_chunk = 0;
+
+    // Small batches aren't worth waking anyone for
+    if (pool.empty() || padded <= BATCH_CHUNK) {
+        solve_range(0, padded);
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job++;
+            busy = pool.size();
+        }
+        wake.notify_all();
+
+        for (size_t c; (c = next_chunk.fetch_add(1)) * BATCH_CHUNK < lane_count;) {
+            size_t begin = c * BATCH_CHUNK;
+            solve_range(begin, begin + BATCH_CHUNK < lane_count ? begin + BATCH_CHUNK : lane_count);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return busy == 0; });
+    }
+
+    size_t count = batch.size();
+    out.x.resize(count);
+    out.y.resize(count);
+    out.rms_residual.resize(count);
+    out.anchors_used.resize(count);
+    out.valid.resize(count);
+}
+
+
+void BatchSolver::solve_range(size_t begin, size_t end) {
+#if BATCH_HAVE_AVX2
+    if (simd() == BATCH_SIMD_AVX2) {
+        batch_solve_avx2(anchors, lanes, begin, end);
+        return;
+    }
+#endif
+    batch_solve_lanes<ScalarOps>(anchors, lanes, begin, end);
+}
+
+
+void BatchSolver::run_pool() {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || job != seen; });
+            if (stopping) return;
+            seen = job;
+        }
+
+        // Chunks are handed out in order, so the last thread in finds none left
+        for (size_t c; (c = next_chunk.fetch_add(1)) * BATCH_CHUNK < lane_count;) {
+            size_t begin = c * BATCH_CHUNK;
+            solve_range(begin, begin + BATCH_CHUNK < lane_count ? begin + BATCH_CHUNK : lane_count);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0) finished.notify_one();
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef BATCH_SOLVER_H
+#define BATCH_SOLVER_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "batch_solver_kernel.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define BATCH_LANES 8 // Widest SIMD path (AVX2, 8 floats); batches are padded to it
+#define BATCH_CHUNK 256 // Tags per unit of work handed to a pool thread
+
+enum BatchSimd {
+    BATCH_SIMD_AUTO, // AVX2 if this CPU has it, else scalar
+    BATCH_SIMD_SCALAR,
+    BATCH_SIMD_AVX2,
+};
+
+/// @brief Ranges for a batch of tags, stored anchor-major (one contiguous
+/// array per anchor) so a solver lane reads consecutive tags.
+class RangeBatch {
+public:
+    RangeBatch() : count(0) {}
+
+    /// @brief Sets the number of tags; new and padding lanes read as "no ranges".
+    void resize(size_t tags);
+
+    /// @brief Copies one tag's ranges, as parse_range() produces them.
+    void set(size_t tag, const int ranges[NUM_ANCHORS]);
+
+    int32_t* anchor(size_t a) { return &ranges[a * padded()]; }
+    const int32_t* anchor(size_t a) const { return &ranges[a * padded()]; }
+    size_t size() const { return count; }
+    size_t padded() const { return (count + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES; }
+
+private:
+    size_t count;
+    std::vector<int32_t> ranges;
+};
+
+// Solver output, one entry per tag, same meaning as Multilateration::Result.
+struct BatchFixes {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> rms_residual;
+    std::vector<uint8_t> anchors_used;
+    std::vector<uint8_t> valid;
+};
+
+/// @brief 2D multilateration for many tags at once, against NUM_ANCHORS fixed
+/// anchors. Gives the same fixes as Multilateration<NUM_ANCHORS, 2> (to float
+/// rounding), but runs 8 tags per AVX2 instruction stream and, with
+/// set_threads(), splits large batches across cores.
+class BatchSolver {
+public:
+    BatchSolver();
+    ~BatchSolver();
+
+    void set_anchor(size_t i, const float position[2]);
+    void clear_anchor(size_t i);
+
+    /// @brief Threads to solve with, the caller's included. 1 (the default)
+    /// solves on the calling thread only.
+    void set_threads(size_t threads);
+
+    /// @brief Forces a code path, e.g. to compare them. AVX2 falls back to
+    /// scalar where the CPU or build doesn't have it.
+    void set_simd(BatchSimd simd);
+
+    /// @brief The path solve() will actually take.
+    BatchSimd simd() const;
+
+    /// @brief Solves every tag in the batch. out is resized to batch.size().
+    void solve(const RangeBatch& batch, BatchFixes& out);
+
+private:
+    void solve_range(size_t begin, size_t end);
+    void run_pool();
+    void stop_pool();
+
+    BatchAnchorSet anchors;
+    BatchSimd requested;
+    bool has_avx2;
+
+    // The batch being solved, for the pool threads
+    BatchLanes lanes;
+    size_t lane_count;
+    std::atomic<size_t> next_chunk;
+
+    std::vector<std::thread> pool;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t job; // Bumped per solve(), wakes the pool
+    size_t busy; // Pool threads still working on the current job
+    bool stopping;
+};
+
+#endif
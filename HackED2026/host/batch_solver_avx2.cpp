@@ -0,0 +1,53 @@
+// The AVX2 build of the batch kernel, picked at runtime by BatchSolver when
+// the CPU supports it. Only this file is compiled for AVX2 and FMA, so the
+// rest of the program still runs anywhere. Keep its includes to the C
+// headers and the kernel, see batch_solver_kernel.h.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC target("avx2,fma")
+
+#include <immintrin.h>
+
+#include "batch_solver_kernel.h"
+
+// Eight tags per lane
+struct Avx2Ops {
+    typedef __m256 V;
+    typedef __m256 M; // All-ones or all-zeros per lane
+    static const size_t WIDTH = 8;
+
+    static V set1(float v) { return _mm256_set1_ps(v); }
+    static V load_ranges(const int32_t* p) { return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)p)); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm256_div_ps(a, b); }
+    static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+    static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static M gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static M ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static M land(M a, M b) { return _mm256_and_ps(a, b); }
+    static bool any(M m) { return _mm256_movemask_ps(m) != 0; }
+    static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+
+    static void store_count(uint8_t* p, V v) {
+        alignas(32) int32_t counts[8];
+        _mm256_store_si256((__m256i*)counts, _mm256_cvtps_epi32(v));
+        for (int i = 0; i < 8; i++) p[i] = (uint8_t)counts[i];
+    }
+
+    static void store_mask(uint8_t* p, M m) {
+        int bits = _mm256_movemask_ps(m);
+        for (int i = 0; i < 8; i++) p[i] = (bits >> i) & 1;
+    }
+};
+
+
+void batch_solve_avx2(const BatchAnchorSet& anchors, const BatchLanes& lanes, size_t begin, size_t end) {
+    batch_solve_lanes<Avx2Ops>(anchors, lanes, begin, end);
+}
+
+#endif
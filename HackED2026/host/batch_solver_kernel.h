@@ -0,0 +1,180 @@
+#ifndef BATCH_SOLVER_KERNEL_H
+#define BATCH_SOLVER_KERNEL_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "multilateration.h"
+#include "uwb_config.h"
+
+// Shared by batch_solver.cpp and batch_solver_avx2.cpp. The AVX2 file is
+// compiled for a different target, so nothing here may pull in more than the
+// C headers: an inline function emitted there with AVX2 instructions could be
+// the copy the linker keeps for everyone.
+
+struct BatchAnchorSet {
+    float x[NUM_ANCHORS];
+    float y[NUM_ANCHORS];
+    uint32_t configured; // Bitmask, like Multilateration
+};
+
+// One batch in structure-of-arrays form: lane i of every array is tag i.
+struct BatchLanes {
+    const int32_t* ranges[NUM_ANCHORS]; // cm, <= 0 for missing
+    float* x;
+    float* y;
+    float* rms_residual;
+    uint8_t* anchors_used;
+    uint8_t* valid;
+};
+
+/// @brief Symmetric 2x2 solve, elimination with partial pivoting and the same
+/// conditioning test as Multilateration::solve_linear. False lanes: (nearly)
+/// collinear anchors.
+template <typename Ops>
+typename Ops::M solve2(typename Ops::V a00, typename Ops::V a01, typename Ops::V a11, typename Ops::V b0,
+                       typename Ops::V b1, typename Ops::V& x0, typename Ops::V& x1) {
+    typedef typename Ops::V V;
+    typedef typename Ops::M M;
+
+    V abs00 = Ops::abs(a00), abs01 = Ops::abs(a01);
+    V limit = Ops::mul(Ops::max(Ops::max(abs00, abs01), Ops::abs(a11)), Ops::set1(1e-5f));
+
+    // Row 1 (a01, a11) pivots when |a01| > |a00|
+    M swap = Ops::gt(abs01, abs00);
+    V p0 = Ops::select(swap, a01, a00), p1 = Ops::select(swap, a11, a01), pb = Ops::select(swap, b1, b0);
+    V q0 = Ops::select(swap, a00, a01), q1 = Ops::select(swap, a01, a11), qb = Ops::select(swap, b0, b1);
+
+    M ok = Ops::gt(Ops::abs(p0), limit);
+    V safe_p0 = Ops::select(ok, p0, Ops::set1(1.0f));
+    V f = Ops::div(q0, safe_p0);
+    V r1 = Ops::sub(q1, Ops::mul(f, p1));
+    V rb = Ops::sub(qb, Ops::mul(f, pb));
+    ok = Ops::land(ok, Ops::gt(Ops::abs(r1), limit));
+    V safe_r1 = Ops::select(ok, r1, Ops::set1(1.0f));
+
+    x1 = Ops::div(rb, safe_r1);
+    x0 = Ops::div(Ops::sub(pb, Ops::mul(p1, x1)), safe_p0);
+    x0 = Ops::select(ok, x0, Ops::set1(0.0f));
+    x1 = Ops::select(ok, x1, Ops::set1(0.0f));
+    return ok;
+}
+
+/// @brief Solves lanes [begin, end), a multiple of Ops::WIDTH apart, with the
+/// same arithmetic as Multilateration<NUM_ANCHORS, 2>: a linearized fit, then
+/// up to MULTILAT_MAX_ITERATIONS Gauss-Newton steps. Lanes run in lockstep
+/// under masks; a lane that converged or failed a step just stops moving.
+///
+/// Ops supplies the lane type V, its mask type M and the arithmetic on them,
+/// so the scalar fallback and the AVX2 path are the same code.
+template <typename Ops>
+void batch_solve_lanes(const BatchAnchorSet& anchors, const BatchLanes& lanes, size_t begin, size_t end) {
+    typedef typename Ops::V V;
+    typedef typename Ops::M M;
+
+    const V zero = Ops::set1(0.0f);
+    const V one = Ops::set1(1.0f);
+    const V tiny = Ops::set1(1e-6f);
+
+    for (size_t lane = begin; lane < end; lane += Ops::WIDTH) {
+        V r[NUM_ANCHORS];
+        V w[NUM_ANCHORS];
+        V used = zero;
+
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            if (!((anchors.configured >> a) & 1)) {
+                r[a] = w[a] = zero;
+                continue;
+            }
+            r[a] = Ops::load_ranges(lanes.ranges[a] + lane);
+            w[a] = Ops::select(Ops::gt(r[a], zero), one, zero);
+            used = Ops::add(used, w[a]);
+        }
+
+        M ok = Ops::ge(used, Ops::set1(3.0f));
+        V x = zero, y = zero;
+
+        if (Ops::any(ok)) {
+            // Linear guess: subtract the weighted mean equation, see Multilateration
+            V inv_wsum = Ops::div(one, Ops::max(used, one));
+            V mean_x = zero, mean_y = zero, mean_c = zero;
+            V c[NUM_ANCHORS];
+            for (int a = 0; a < NUM_ANCHORS; a++) {
+                V ax = Ops::set1(anchors.x[a]), ay = Ops::set1(anchors.y[a]);
+                c[a] = Ops::sub(Ops::set1(anchors.x[a] * anchors.x[a] + anchors.y[a] * anchors.y[a]),
+                                Ops::mul(r[a], r[a]));
+                mean_x = Ops::add(mean_x, Ops::mul(w[a], ax));
+                mean_y = Ops::add(mean_y, Ops::mul(w[a], ay));
+                mean_c = Ops::add(mean_c, Ops::mul(w[a], c[a]));
+            }
+            mean_x = Ops::mul(mean_x, inv_wsum);
+            mean_y = Ops::mul(mean_y, inv_wsum);
+            mean_c = Ops::mul(mean_c, inv_wsum);
+
+            V a00 = zero, a01 = zero, a11 = zero, b0 = zero, b1 = zero;
+            for (int a = 0; a < NUM_ANCHORS; a++) {
+                V row0 = Ops::mul(Ops::set1(2.0f), Ops::sub(Ops::set1(anchors.x[a]), mean_x));
+                V row1 = Ops::mul(Ops::set1(2.0f), Ops::sub(Ops::set1(anchors.y[a]), mean_y));
+                V b = Ops::sub(c[a], mean_c);
+                V w0 = Ops::mul(w[a], row0), w1 = Ops::mul(w[a], row1);
+                a00 = Ops::add(a00, Ops::mul(w0, row0));
+                a01 = Ops::add(a01, Ops::mul(w0, row1));
+                a11 = Ops::add(a11, Ops::mul(w1, row1));
+                b0 = Ops::add(b0, Ops::mul(w0, b));
+                b1 = Ops::add(b1, Ops::mul(w1, b));
+            }
+            ok = Ops::land(ok, solve2<Ops>(a00, a01, a11, b0, b1, x, y));
+
+            // Gauss-Newton on the true range equations
+            M active = ok;
+            for (int it = 0; it < MULTILAT_MAX_ITERATIONS && Ops::any(active); it++) {
+                V j00 = zero, j01 = zero, j11 = zero, f0 = zero, f1 = zero;
+                for (int a = 0; a < NUM_ANCHORS; a++) {
+                    V dx = Ops::sub(x, Ops::set1(anchors.x[a]));
+                    V dy = Ops::sub(y, Ops::set1(anchors.y[a]));
+                    V dist = Ops::sqrt(Ops::add(Ops::mul(dx, dx), Ops::mul(dy, dy)));
+                    // Sitting on an anchor, no direction
+                    V wa = Ops::select(Ops::ge(dist, tiny), w[a], zero);
+                    V inv = Ops::div(one, Ops::max(dist, tiny));
+                    V jx = Ops::mul(dx, inv), jy = Ops::mul(dy, inv);
+                    V f = Ops::mul(wa, Ops::sub(dist, r[a]));
+                    V wjx = Ops::mul(wa, jx);
+                    f0 = Ops::add(f0, Ops::mul(jx, f));
+                    f1 = Ops::add(f1, Ops::mul(jy, f));
+                    j00 = Ops::add(j00, Ops::mul(wjx, jx));
+                    j01 = Ops::add(j01, Ops::mul(wjx, jy));
+                    j11 = Ops::add(j11, Ops::mul(Ops::mul(wa, jy), jy));
+                }
+
+                V step_x, step_y;
+                M moved = Ops::land(active, solve2<Ops>(j00, j01, j11, f0, f1, step_x, step_y));
+                x = Ops::select(moved, Ops::sub(x, step_x), x);
+                y = Ops::select(moved, Ops::sub(y, step_y), y);
+                V step = Ops::sqrt(Ops::add(Ops::mul(step_x, step_x), Ops::mul(step_y, step_y)));
+                active = Ops::land(moved, Ops::ge(step, Ops::set1(MULTILAT_CONVERGED)));
+            }
+        }
+
+        V sum = zero;
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            V dx = Ops::sub(x, Ops::set1(anchors.x[a]));
+            V dy = Ops::sub(y, Ops::set1(anchors.y[a]));
+            V f = Ops::sub(Ops::sqrt(Ops::add(Ops::mul(dx, dx), Ops::mul(dy, dy))), r[a]);
+            sum = Ops::add(sum, Ops::mul(w[a], Ops::mul(f, f)));
+        }
+        V rms = Ops::sqrt(Ops::div(sum, Ops::max(used, one)));
+
+        // Failed lanes read like a failed Multilateration::solve()
+        Ops::store(lanes.x + lane, Ops::select(ok, x, zero));
+        Ops::store(lanes.y + lane, Ops::select(ok, y, zero));
+        Ops::store(lanes.rms_residual + lane, Ops::select(ok, rms, zero));
+        Ops::store_count(lanes.anchors_used + lane, used);
+        Ops::store_mask(lanes.valid + lane, ok);
+    }
+}
+
+#endif
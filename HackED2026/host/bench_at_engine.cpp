@@ -0,0 +1,103 @@
+// Times the boot-time AT command sequence (AT+GETVER?, set_role(), set_delay())
+// through the AT engine against a mock module, and compares it with the fixed
+// timeouts the old send_radio_data() always waited out.
+//
+// Build: pio run -e native_at_bench && .pio/build/native_at_bench/program
+
+#include <stdio.h>
+
+#include "at_engine.h"
+#include "host_clock.h"
+#include "mock_uart.h"
+
+struct Step {
+    const char* command;
+    uint32_t timeout_ms;
+};
+
+// Same commands and timeouts as init_setup() -> set_role() -> set_delay()
+static const Step BOOT_SEQUENCE[] = {
+    { "AT+GETVER?", 2000 },
+    { "AT?", 2000 },
+    { "AT+RESTORE", 5000 },
+    { "AT+SETCFG=3,0,1,1", 2000 },
+    { "AT+SETCAP=64,10,1", 2000 },
+    { "AT+SETRPT=1", 2000 },
+    { "AT+SAVE", 2000 },
+    { "AT+RESTART", 2000 },
+    { "AT+SETANT=16450", 2000 },
+    { "AT+SAVE", 2000 },
+    { "AT+RESTART", 2000 },
+};
+static const size_t STEP_COUNT = sizeof(BOOT_SEQUENCE) / sizeof(BOOT_SEQUENCE[0]);
+
+
+static void configure_module(MockUart& uart) {
+    // Reply latencies are rough figures for the DW3000 AT firmware; flash
+    // writes and resets are the slow ones.
+    uart.set_default("OK", 3000);
+    uart.on("AT+GETVER?", "getver software:1.1.8,hardware:1.0.0\r\nOK", 4000);
+    uart.on("AT+RESTORE", "OK", 150000);
+    uart.on("AT+SAVE", "OK", 40000);
+    uart.on("AT+RESTART", "OK", 250000);
+}
+
+
+static void print_result(const char* command, const AtResult& result, void*) {
+    static const char* names[] = { "PENDING", "OK", "ERROR", "TIMEOUT" };
+    printf("  %-20s %-8s %8.2f ms\n", command, names[result.status], result.latency_us / 1000.0);
+}
+
+
+int main() {
+    uint32_t legacy_ms = 0;
+    for (size_t i = 0; i < STEP_COUNT; i++) legacy_ms += BOOT_SEQUENCE[i].timeout_ms;
+
+    // Blocking, one command at a time, the way send_radio_data() uses it
+    {
+        MockUart uart;
+        configure_module(uart);
+        AtEngine engine(uart, host_micros);
+
+        printf("Sequential run():\n");
+        uint32_t start = host_micros();
+        for (size_t i = 0; i < STEP_COUNT; i++) {
+            AtResult result = engine.run(BOOT_SEQUENCE[i].command, BOOT_SEQUENCE[i].timeout_ms);
+            print_result(BOOT_SEQUENCE[i].command, result, nullptr);
+        }
+        uint32_t elapsed = host_micros() - start;
+
+        const AtStats& stats = engine.stats();
+        printf("  total %.1f ms (fixed timeouts: %u ms), %u ok / %u err / %u timeout\n",
+               elapsed / 1000.0, legacy_ms, stats.ok, stats.errors, stats.timeouts);
+        printf("  latency min %.2f ms, mean %.2f ms, max %.2f ms\n\n",
+               stats.min_latency_us / 1000.0,
+               stats.total_latency_us / 1000.0 / (stats.completed ? stats.completed : 1),
+               stats.max_latency_us / 1000.0);
+    }
+
+    // Fire-and-forget, everything queued up front and driven by poll()
+    {
+        MockUart uart;
+        configure_module(uart);
+        AtEngine engine(uart, host_micros);
+
+        printf("Queued submit() + poll():\n");
+        uint32_t start = host_micros();
+        for (size_t i = 0; i < STEP_COUNT; i++) {
+            engine.submit(BOOT_SEQUENCE[i].command, BOOT_SEQUENCE[i].timeout_ms, nullptr, print_result);
+        }
+
+        uint32_t polls = 0;
+        while (!engine.idle()) {
+            engine.poll();
+            polls++;
+        }
+        uint32_t elapsed = host_micros() - start;
+
+        printf("  total %.1f ms over %u polls, speedup %.0fx\n",
+               elapsed / 1000.0, polls, legacy_ms * 1000.0 / elapsed);
+    }
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+// Fixes per second against tag count for the batch solver (scalar, AVX2, and
+// AVX2 across a thread pool) next to solving each tag with Multilateration,
+// plus how far the batch fixes stray from Multilateration's.
+//
+//   bench_batch_solver [--threads N] [--max-tags N]
+//
+// Build: pio run -e native_batch_solver_bench && .pio/build/native_batch_solver_bench/program
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "batch_solver.h"
+#include "host_clock.h"
+#include "multilateration.h"
+
+static const double NOISE_CM = 5.0;
+static const double DROPOUT = 0.1;
+static const double MIN_SECONDS = 0.2; // Per measurement, repeating the batch
+
+// Same field as bench_multilateration, flattened to 2D
+static const float ANCHORS[NUM_ANCHORS][2] = {
+    { 0, 0 }, { 980, 0 }, { 1035, 719 }, { 0, 900 }, { 500, -50 }, { 1100, 350 }, { 480, 980 }, { -60, 450 },
+};
+
+typedef Multilateration<NUM_ANCHORS, 2> PositionSolver;
+
+
+static std::vector<int> make_ranges(size_t tags) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> area(50, 1000);
+    std::normal_distribution<float> noise(0, NOISE_CM);
+    std::uniform_real_distribution<float> coin(0, 1);
+
+    std::vector<int> ranges(tags * NUM_ANCHORS);
+    for (size_t t = 0; t < tags; t++) {
+        float x = area(rng), y = area(rng);
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            float dist = hypotf(x - ANCHORS[a][0], y - ANCHORS[a][1]);
+            ranges[t * NUM_ANCHORS + a] = coin(rng) < DROPOUT ? 0 : (int)lroundf(dist + noise(rng));
+        }
+    }
+    return ranges;
+}
+
+
+// Repeats fn until MIN_SECONDS have passed, returns fixes per second
+template <typename Fn>
+static double measure(size_t tags, Fn fn) {
+    size_t rounds = 0;
+    uint64_t start = host_nanos();
+    uint64_t elapsed;
+    do {
+        fn();
+        rounds++;
+        elapsed = host_nanos() - start;
+    } while (elapsed < MIN_SECONDS * 1e9);
+    return rounds * tags / (elapsed / 1e9);
+}
+
+
+int main(int argc, char** argv) {
+    size_t threads = std::thread::hardware_concurrency();
+    size_t max_tags = 65536;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--threads") == 0) threads = (size_t)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--max-tags") == 0) max_tags = (size_t)atoi(argv[i + 1]);
+    }
+    if (threads < 1) threads = 1;
+
+    PositionSolver reference;
+    BatchSolver scalar, simd, pooled;
+    for (int a = 0; a < NUM_ANCHORS; a++) {
+        reference.set_anchor(a, ANCHORS[a]);
+        scalar.set_anchor(a, ANCHORS[a]);
+        simd.set_anchor(a, ANCHORS[a]);
+        pooled.set_anchor(a, ANCHORS[a]);
+    }
+    scalar.set_simd(BATCH_SIMD_SCALAR);
+    pooled.set_threads(threads);
+
+    printf("%d anchors, %.0f cm noise, %.0f%% dropout, %s, %zu threads for the pool\n", NUM_ANCHORS, NOISE_CM,
+           DROPOUT * 100, simd.simd() == BATCH_SIMD_AVX2 ? "AVX2" : "no AVX2 (scalar only)", threads);
+    printf("%8s %14s %14s %14s %14s %10s %9s\n", "tags", "per-tag/s", "batch/s", "simd/s", "simd+pool/s",
+           "max diff", "mismatch");
+
+    for (size_t tags = 1; tags <= max_tags; tags *= 8) {
+        std::vector<int> ranges = make_ranges(tags);
+        RangeBatch batch;
+        batch.resize(tags);
+        for (size_t t = 0; t < tags; t++) batch.set(t, &ranges[t * NUM_ANCHORS]);
+
+        std::vector<PositionSolver::Result> expected(tags);
+        BatchFixes fixes;
+
+        double per_tag = measure(tags, [&] {
+            for (size_t t = 0; t < tags; t++) reference.solve(&ranges[t * NUM_ANCHORS], expected[t]);
+        });
+        double batched = measure(tags, [&] { scalar.solve(batch, fixes); });
+        double vectorized = measure(tags, [&] { simd.solve(batch, fixes); });
+        double pooled_rate = measure(tags, [&] { pooled.solve(batch, fixes); });
+
+        // Agreement of the pooled SIMD output (the fastest path) with Multilateration
+        double max_diff = 0;
+        size_t mismatched = 0;
+        for (size_t t = 0; t < tags; t++) {
+            if (expected[t].valid != (bool)fixes.valid[t]) {
+                mismatched++;
+                continue;
+            }
+            if (!expected[t].valid) continue;
+            double diff = hypot(fixes.x[t] - expected[t].position[0], fixes.y[t] - expected[t].position[1]);
+            if (diff > max_diff) max_diff = diff;
+        }
+
+        printf("%8zu %14.0f %14.0f %14.0f %14.0f %7.3f cm %9zu\n", tags, per_tag, batched, vectorized, pooled_rate,
+               max_diff, mismatched);
+    }
+    return 0;
+}
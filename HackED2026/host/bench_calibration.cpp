@@ -0,0 +1,238 @@
+// Simulated calibration of 4, 8 and 16 anchors, in virtual time. Each anchor
+// runs a CalibrationParticipant, the tag runs the CalibrationCoordinator, each
+// on its own MeshDispatcher, and a shared radio delivers every AT+DATA
+// broadcast to all other devices after a delay, losing some. An anchor switched to tag gets AT+RANGE frames with
+// noisy ranges to the anchors that are still anchors.
+//
+//   sequential  one pair per round, like the get_distance() loop did
+//   parallel    round-robin rounds of disjoint pairs
+//
+// The legacy column is what the old flow would have spent on fixed waits
+// alone: the 1000 ms AT+DATA wait and two full set_role() sequences per pair.
+//
+// Build: pio run -e native_calibration_bench && .pio/build/native_calibration_bench/program [loss]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "calibration.h"
+#include "mesh.h"
+#include "telemetry.h"
+
+static const uint32_t STEP_US = 1000;
+static const uint32_t RADIO_LATENCY_US = 20000; // AT+DATA waits for a TDMA slot
+static const uint32_t RADIO_JITTER_US = 10000;
+static const uint32_t ROLE_SWITCH_US = 6000; // Transient switch, see bench_role_switch
+static const uint32_t RANGE_PERIOD_US = 100000;
+static const double RANGE_NOISE_CM = 5.0;
+static const double RANGE_DROPOUT = 0.1;
+static const double FIELD_CM = 2000.0;
+static const uint32_t LEGACY_PAIR_MS = 1000 + 2 * 17000;
+static const uint32_t GIVE_UP_US = 600000000; // Virtual time limit per run
+static const uint8_t COORDINATOR_ID = 255;
+
+struct Delivery {
+    uint32_t due_us;
+    int sender;
+    int receiver; // -1: the coordinator
+    std::string text;
+};
+
+struct Sim;
+
+struct Node {
+    Sim* sim;
+    int id;
+    double x, y;
+    bool tag;
+    uint32_t ready_us;
+    uint32_t next_range_us;
+    MeshDispatcher* mesh;
+    CalibrationParticipant* participant;
+};
+
+struct Sim {
+    uint32_t now_us;
+    double loss;
+    std::mt19937 rng;
+    std::vector<Node> nodes;
+    std::vector<Delivery> air;
+    uint32_t messages;
+    uint32_t air_bytes; // AT+DATA payloads, each counted once
+
+    double uniform() { return std::uniform_real_distribution<double>(0, 1)(rng); }
+
+    void broadcast(int sender, const char* text) {
+        messages++;
+        air_bytes += strlen(text);
+        for (int r = -1; r < (int)nodes.size(); r++) {
+            if (r == sender || (r == -1 && sender == COORDINATOR_ID)) continue;
+            if (uniform() < loss) continue;
+            uint32_t delay = RADIO_LATENCY_US + (uint32_t)(uniform() * RADIO_JITTER_US);
+            air.push_back(Delivery{ now_us + delay, sender, r, text });
+        }
+    }
+};
+
+
+static void coordinator_send(const char* text, size_t, void* ctx) {
+    ((Sim*)ctx)->broadcast(COORDINATOR_ID, text);
+}
+
+
+static void participant_send(const char* text, size_t, void* ctx) {
+    Node* node = (Node*)ctx;
+    node->sim->broadcast(node->id, text);
+}
+
+
+static void participant_role(bool measuring, void* ctx) {
+    Node* node = (Node*)ctx;
+    node->tag = measuring;
+    node->ready_us = node->sim->now_us + ROLE_SWITCH_US;
+    node->next_range_us = node->ready_us + (uint32_t)(node->sim->uniform() * RANGE_PERIOD_US);
+}
+
+
+struct Outcome {
+    double seconds;
+    CalibrationStats stats;
+    uint32_t messages;
+    uint32_t air_bytes;
+    uint32_t lost; // Seen by the coordinator, from gaps in the seqs
+    double result_rtt_ms; // MESH_CAL_REQUEST to each MESH_CAL_RESULT, p50
+    double rms_error_cm;
+    bool host_ok;
+};
+
+static Outcome run(size_t devices, bool parallel, double loss, unsigned seed) {
+    Sim sim;
+    sim.now_us = 0;
+    sim.loss = loss;
+    sim.rng.seed(seed);
+    sim.messages = 0;
+    sim.air_bytes = 0;
+    sim.nodes.resize(devices);
+
+    std::vector<MeshDispatcher> meshes;
+    std::vector<CalibrationParticipant> participants;
+    meshes.reserve(devices);
+    participants.reserve(devices);
+    for (size_t i = 0; i < devices; i++) {
+        Node& node = sim.nodes[i];
+        node.sim = &sim;
+        node.id = (int)i;
+        node.x = sim.uniform() * FIELD_CM;
+        node.y = sim.uniform() * FIELD_CM;
+        node.tag = false;
+        meshes.emplace_back((uint8_t)i, participant_send, &node);
+        node.mesh = &meshes.back();
+        participants.emplace_back((uint8_t)i, *node.mesh, participant_role, &node);
+        node.participant = &participants.back();
+    }
+
+    MeshDispatcher coordinator_mesh(COORDINATOR_ID, coordinator_send, &sim);
+    CalibrationCoordinator coordinator(coordinator_mesh);
+    coordinator.start(devices, sim.now_us, parallel);
+    std::normal_distribution<double> noise(0, RANGE_NOISE_CM);
+
+    while (!coordinator.finished() && sim.now_us < GIVE_UP_US) {
+        sim.now_us += STEP_US;
+
+        // Radio
+        std::vector<Delivery> due;
+        for (size_t i = 0; i < sim.air.size();) {
+            if ((int32_t)(sim.now_us - sim.air[i].due_us) >= 0) {
+                due.push_back(sim.air[i]);
+                sim.air[i] = sim.air.back();
+                sim.air.pop_back();
+            } else {
+                i++;
+            }
+        }
+        for (const Delivery& d : due) {
+            MeshDispatcher& mesh = d.receiver < 0 ? coordinator_mesh : *sim.nodes[d.receiver].mesh;
+            mesh.feed(d.sender, d.text.c_str(), d.text.size(), sim.now_us);
+        }
+
+        // Ranging, for every device that is currently a tag
+        for (Node& node : sim.nodes) {
+            if (!node.tag || (int32_t)(sim.now_us - node.next_range_us) < 0) continue;
+            node.next_range_us += RANGE_PERIOD_US;
+
+            int ranges[CAL_MAX_DEVICES] = { 0 };
+            for (const Node& anchor : sim.nodes) {
+                if (anchor.tag || sim.uniform() < RANGE_DROPOUT) continue;
+                double d = hypot(node.x - anchor.x, node.y - anchor.y) + noise(sim.rng);
+                ranges[anchor.id] = d < 1 ? 1 : (int)lround(d);
+            }
+            node.participant->on_ranges(ranges, devices, sim.now_us);
+        }
+
+        for (Node& node : sim.nodes) node.participant->poll(sim.now_us);
+        coordinator.poll(sim.now_us);
+        if (coordinator.measured() && !coordinator.finished()) coordinator.finish(sim.now_us);
+    }
+
+    Outcome out;
+    out.seconds = coordinator.stats().elapsed_us / 1e6;
+    out.stats = coordinator.stats();
+    out.messages = sim.messages;
+    out.air_bytes = sim.air_bytes;
+    out.lost = coordinator_mesh.stats(MESH_CAL_RESULT).lost + coordinator_mesh.stats(MESH_CAL_ACK).lost;
+    out.result_rtt_ms = coordinator_mesh.stats(MESH_CAL_REQUEST).round_trip_us.percentile(0.5) / 1000.0;
+
+    double sum = 0;
+    size_t n = 0;
+    for (size_t a = 0; a < devices; a++) {
+        for (size_t b = a + 1; b < devices; b++) {
+            if (coordinator.distance(a, b) == CAL_NO_DISTANCE) continue;
+            double truth = hypot(sim.nodes[a].x - sim.nodes[b].x, sim.nodes[a].y - sim.nodes[b].y);
+            sum += (coordinator.distance(a, b) - truth) * (coordinator.distance(a, b) - truth);
+            n++;
+        }
+    }
+    out.rms_error_cm = n ? sqrt(sum / n) : 0;
+
+    // The matrix goes to the host as one telemetry packet; check it survives
+    uint8_t packet[TELEMETRY_CALIBRATION_MAX_PACKET];
+    size_t len = telemetry_encode_calibration(packet, COORDINATOR_ID, coordinator.distances(), devices);
+    int decoded[TELEMETRY_CALIBRATION_MAX_DEVICES * TELEMETRY_CALIBRATION_MAX_DEVICES];
+    out.host_ok = telemetry_decode_calibration(packet, len, decoded, TELEMETRY_CALIBRATION_MAX_DEVICES) == (int)devices;
+    for (size_t i = 0; out.host_ok && i < devices * devices; i++) {
+        if (decoded[i] != coordinator.distances()[i]) out.host_ok = false;
+    }
+
+    return out;
+}
+
+
+int main(int argc, char** argv) {
+    double loss = argc > 1 ? atof(argv[1]) : 0.05;
+    const size_t sizes[] = { 4, 8, 16 };
+
+    printf("radio loss %.0f%%, %u ms latency, %u ms per range frame, %d samples per pair\n", loss * 100,
+           RADIO_LATENCY_US / 1000, RANGE_PERIOD_US / 1000, CAL_SAMPLES);
+    printf("%7s %6s %-11s %9s %7s %8s %7s %9s %9s %6s %9s %9s %7s\n", "devices", "pairs", "mode", "wall_s",
+           "rounds", "retries", "failed", "messages", "air_bytes", "lost", "rtt_ms", "rms_cm", "host");
+
+    for (size_t devices : sizes) {
+        size_t pairs = devices * (devices - 1) / 2;
+        printf("%7zu %6zu %-11s %9.1f\n", devices, pairs, "legacy", pairs * LEGACY_PAIR_MS / 1000.0);
+
+        for (int parallel = 0; parallel <= 1; parallel++) {
+            Outcome o = run(devices, parallel, loss, 1234 + (unsigned)devices);
+            printf("%7zu %6zu %-11s %9.2f %7u %8u %7u %9u %9u %6u %9.1f %9.1f %7s\n", devices, pairs,
+                   parallel ? "parallel" : "sequential", o.seconds, o.stats.rounds, o.stats.retries,
+                   o.stats.failed_pairs, o.messages, o.air_bytes, o.lost, o.result_rtt_ms, o.rms_error_cm,
+                   o.host_ok ? "ok" : "BAD");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+// What keeping the OLED live costs, replaying the recorded module output in
+// host/data at the module's report rate:
+//
+//   sync     the old updateOLED(): redraw the whole frame and display() it
+//            on the calling task, on every range frame
+//   async    status_task(): status_render() every STATUS_INTERVAL_MS and
+//            push only the pages whose text changed
+//
+// I2C time is worked out from the bytes each way puts on the bus at
+// OLED_I2C_CLOCK, 9 clocks per byte; the render cost is measured.
+//
+//   bench_display [--rate HZ] [capture]
+//
+// Build: pio run -e native_display_bench && .pio/build/native_display_bench/program
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "host_clock.h"
+#include "range_parser.h"
+#include "status_display.h"
+
+static const char* DEFAULT_CAPTURE = "host/data/range_session.txt";
+static const double I2C_CLOCK = 400000; // OLED_I2C_CLOCK
+static const int I2C_CHUNK = 32; // OLED_I2C_CHUNK
+
+// Adafruit display(): one command transaction, then the 1 KB frame 31 bytes
+// per transaction, each with the address and a control byte
+static const int FULL_FRAME_BYTES = (2 + 5) + 1024 + (1024 + 30) / 31 * 2;
+// push_page(): six single-command transactions, then 128 bytes I2C_CHUNK at a time
+static const int PAGE_BYTES = 6 * 3 + 128 + 128 / I2C_CHUNK * 2;
+
+
+static double bus_ms(double bytes) { return bytes * 9 / I2C_CLOCK * 1000; }
+
+
+int main(int argc, char** argv) {
+    double rate_hz = 10;
+    const char* path = DEFAULT_CAPTURE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) rate_hz = atof(argv[++i]);
+        else path = argv[i];
+    }
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return 1;
+    }
+    std::vector<RangeFrame> frames;
+    RangeStreamParser parser;
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+        if (parser.feed((char)c) == LINE_RANGE) frames.push_back(parser.range());
+    }
+    fclose(f);
+    if (frames.empty()) {
+        fprintf(stderr, "No range frames in %s\n", path);
+        return 1;
+    }
+
+    StatusModel model;
+    memset(&model, 0, sizeof(model));
+    model.uwb_index = 3;
+    strcpy(model.version, "1.1.8");
+    const uint8_t ip[4] = { 10, 42, 0, 30 };
+    memcpy(model.ip, ip, sizeof(ip));
+    model.link_up = true;
+
+    StatusScreen screen;
+    StatusRates rates = {};
+    double seconds = frames.size() / rate_hz;
+    double interval_s = STATUS_INTERVAL_MS / 1000.0;
+    double next_render = 0;
+    uint32_t last_fixes = 0;
+    uint64_t render_ns = 0;
+    uint32_t renders = 0;
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        double now = i / rate_hz;
+        memcpy(model.ranges, frames[i].ranges, sizeof(model.ranges));
+        model.frames++;
+        model.fixes++;
+        if (now < next_render) continue;
+
+        next_render += interval_s;
+        rates.fixes_per_s += STATUS_RATE_SMOOTHING * ((model.fixes - last_fixes) / interval_s - rates.fixes_per_s);
+        last_fixes = model.fixes;
+
+        uint64_t start = host_nanos();
+        status_render(model, rates, screen);
+        screen.take_dirty();
+        render_ns += host_nanos() - start;
+        renders++;
+    }
+
+    // What read_frame() and send_position() add per frame
+    const int REPEAT = 10000;
+    uint64_t start = host_nanos();
+    for (int n = 0; n < REPEAT; n++) {
+        for (const RangeFrame& frame : frames) {
+            memcpy(model.ranges, frame.ranges, sizeof(model.ranges));
+            model.frames++;
+            model.fixes++;
+            __asm__ volatile("" : : "r"(&model) : "memory");
+        }
+    }
+    double hot_ns = (double)(host_nanos() - start) / REPEAT / frames.size();
+
+    double pages = screen.lines_pushed() - STATUS_LINES; // Less the first full draw
+    double pages_per_render = pages / (renders - 1);
+    double sync_ms = bus_ms(FULL_FRAME_BYTES);
+
+    printf("%zu frames at %.0f Hz (%.0f s), redraws every %d ms\n\n", frames.size(), rate_hz, seconds,
+           STATUS_INTERVAL_MS);
+    printf("%-6s %12s %14s %14s %16s\n", "", "redraws/s", "bus ms/redraw", "bus ms/s", "hot path/frame");
+    printf("%-6s %12.1f %14.2f %14.1f %13.2f ms\n", "sync", rate_hz, sync_ms, sync_ms * rate_hz, sync_ms);
+    printf("%-6s %12.1f %14.2f %14.1f %13.1f ns\n", "async", renders / seconds, bus_ms(pages_per_render * PAGE_BYTES),
+           bus_ms(pages * PAGE_BYTES) / seconds, hot_ns);
+    printf("\n%.2f of %d pages changed per redraw, status_render() %.0f ns\n", pages_per_render, STATUS_LINES,
+           (double)render_ns / renders);
+    return 0;
+}
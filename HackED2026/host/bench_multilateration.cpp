@@ -0,0 +1,82 @@
+// Throughput and accuracy of the on-device Multilateration solver, in 2D and
+// 3D, with NUM_ANCHORS anchors, noisy ranges and the odd dropped anchor.
+//
+// Build: pio run -e native_multilat_bench && .pio/build/native_multilat_bench/program
+
+#include <math.h>
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+#include "host_clock.h"
+#include "multilateration.h"
+#include "uwb_config.h"
+
+static const int FIXES = 200000;
+static const double NOISE_CM = 5.0;
+static const double DROPOUT = 0.1;
+
+template <size_t DIM>
+static void run(const char* name, const float anchors[NUM_ANCHORS][3]) {
+    Multilateration<NUM_ANCHORS, DIM> solver;
+    for (int i = 0; i < NUM_ANCHORS; i++) solver.set_anchor(i, anchors[i]);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> area(50, 1000);
+    std::normal_distribution<float> noise(0, NOISE_CM);
+    std::uniform_real_distribution<float> coin(0, 1);
+
+    // Pre-generate so the timed loop only measures the solver
+    std::vector<int> ranges(FIXES * NUM_ANCHORS);
+    std::vector<float> truth(FIXES * DIM);
+    for (int f = 0; f < FIXES; f++) {
+        for (size_t d = 0; d < DIM; d++) truth[f * DIM + d] = d < 2 ? area(rng) : area(rng) * 0.2f;
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            float dist2 = 0;
+            for (size_t d = 0; d < DIM; d++) {
+                float diff = truth[f * DIM + d] - anchors[a][d];
+                dist2 += diff * diff;
+            }
+            ranges[f * NUM_ANCHORS + a] = coin(rng) < DROPOUT ? 0 : (int)lroundf(sqrtf(dist2) + noise(rng));
+        }
+    }
+
+    typename Multilateration<NUM_ANCHORS, DIM>::Result result;
+    int valid = 0;
+    double error_sum = 0, iterations = 0;
+
+    uint64_t start = host_nanos();
+    for (int f = 0; f < FIXES; f++) {
+        if (!solver.solve(&ranges[f * NUM_ANCHORS], result)) continue;
+        valid++;
+        iterations += result.iterations;
+
+        double err2 = 0;
+        for (size_t d = 0; d < DIM; d++) {
+            double diff = result.position[d] - truth[f * DIM + d];
+            err2 += diff * diff;
+        }
+        error_sum += sqrt(err2);
+    }
+    double seconds = (host_nanos() - start) / 1e9;
+
+    printf("%-3s %8d fixes %8d valid %12.0f solves/sec %7.1f ns/solve  mean error %5.2f cm  %.2f GN iterations\n",
+           name, FIXES, valid, FIXES / seconds, seconds * 1e9 / FIXES, error_sum / (valid ? valid : 1),
+           iterations / (valid ? valid : 1));
+}
+
+
+int main() {
+    // The three anchors from frontend.py plus five more around the field, in cm.
+    // Heights vary so the 3D case is solvable.
+    static const float anchors[NUM_ANCHORS][3] = {
+        { 0, 0, 0 }, { 980, 0, 150 }, { 1035, 719, 40 }, { 0, 900, 120 },
+        { 500, -50, 80 }, { 1100, 350, 10 }, { 480, 980, 200 }, { -60, 450, 60 },
+    };
+
+    printf("%d anchors, %.0f cm noise, %.0f%% dropout\n", NUM_ANCHORS, NOISE_CM, DROPOUT * 100);
+    run<2>("2D", anchors);
+    run<3>("3D", anchors);
+    return 0;
+}
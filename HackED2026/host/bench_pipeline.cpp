@@ -0,0 +1,217 @@
+// Runs the range capture through the ingest/process stages the way the tag
+// would, against a simulated UART: bytes arrive at 115200 baud into a 256 byte
+// RX FIFO that drops whatever doesn't fit, and every telemetry flush blocks
+// like a slow WiFi endPacket().
+//
+//   serial    one thread reads, parses, filters and sends, like loop() does
+//   pipeline  ingest and process each get a thread, joined by the SPSC queue
+//
+// Build: pio run -e native_pipeline_bench && .pio/build/native_pipeline_bench/program [capture] [send_ms]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "host_clock.h"
+#include "pipeline.h"
+
+static const char* DEFAULT_CAPTURE = "host/data/range_session.txt";
+static const size_t UART_BYTES_PER_SEC = 115200 / 10; // 8N1
+static const size_t UART_RX_FIFO = 256;
+static const int DEFAULT_SEND_MS = 30;
+
+static int send_ms = DEFAULT_SEND_MS;
+
+
+/// @brief The UART peripheral: a thread clocks the capture into a bounded
+/// FIFO at line rate, counting bytes lost to overflow.
+class SimUart {
+public:
+    explicit SimUart(const std::string& data) : data(data), head(0), size(0), dropped(0), done(false) {}
+
+    void start() {
+        worker = std::thread([this] { clock_in(); });
+    }
+
+    void join() { worker.join(); }
+
+    size_t read(char* out, size_t max) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = size < max ? size : max;
+        for (size_t i = 0; i < n; i++) out[i] = fifo[(head + i) % UART_RX_FIFO];
+        head = (head + n) % UART_RX_FIFO;
+        size -= n;
+        return n;
+    }
+
+    bool finished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return done && size == 0;
+    }
+
+    size_t bytes_dropped() const { return dropped; }
+
+private:
+    void clock_in() {
+        // 1 ms worth of bytes at a time
+        const size_t per_tick = UART_BYTES_PER_SEC / 1000 + 1;
+        auto next = std::chrono::steady_clock::now();
+
+        for (size_t pos = 0; pos < data.size(); pos += per_tick) {
+            size_t end = pos + per_tick < data.size() ? pos + per_tick : data.size();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = pos; i < end; i++) {
+                    if (size == UART_RX_FIFO) {
+                        dropped++;
+                        continue;
+                    }
+                    fifo[(head + size) % UART_RX_FIFO] = data[i];
+                    size++;
+                }
+            }
+            next += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(next);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+
+    const std::string& data;
+    std::thread worker;
+    std::mutex mutex;
+    char fifo[UART_RX_FIFO];
+    size_t head, size, dropped;
+    bool done;
+};
+
+
+static void slow_send(const uint8_t*, size_t, void* ctx) {
+    (*(uint32_t*)ctx)++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(send_ms));
+}
+
+
+struct Result {
+    uint32_t parsed;
+    uint32_t processed;
+    uint32_t packets;
+    size_t uart_dropped;
+    size_t queue_overflows;
+    size_t queue_max_depth;
+    uint32_t mean_latency_us;
+    uint32_t max_latency_us;
+    double seconds;
+};
+
+static Result run(const std::string& capture, bool pipelined) {
+    SampleQueue queue;
+    IngestStage ingest(queue);
+    RangeFilter filter(STABILITY_THRESHOLD);
+    uint32_t packets = 0;
+    TelemetryBatcher telemetry(3, TELEMETRY_DEFAULT_BATCH, TELEMETRY_DEFAULT_DEADLINE_US, slow_send, &packets);
+    ProcessStage process(queue, filter, telemetry);
+    SimUart uart(capture);
+
+    char chunk[PIPELINE_READ_CHUNK];
+    uint64_t start = host_nanos();
+    uart.start();
+
+    if (pipelined) {
+        std::atomic<bool> ingest_done(false);
+
+        std::thread producer([&] {
+            while (!uart.finished()) {
+                size_t n = uart.read(chunk, sizeof(chunk));
+                if (n) ingest.ingest(chunk, n, host_micros());
+                else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ingest_done = true;
+        });
+        std::thread consumer([&] {
+            for (;;) {
+                bool last = ingest_done;
+                if (process.run_once(host_micros()) == 0) {
+                    if (last) break;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        });
+
+        producer.join();
+        consumer.join();
+    } else {
+        while (!uart.finished()) {
+            size_t n = uart.read(chunk, sizeof(chunk));
+            if (n) ingest.ingest(chunk, n, host_micros());
+            process.run_once(host_micros());
+            if (!n) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    uart.join();
+    telemetry.flush();
+
+    Result r;
+    r.parsed = ingest.frames_parsed();
+    r.processed = process.samples_processed();
+    r.packets = packets;
+    r.uart_dropped = uart.bytes_dropped();
+    r.queue_overflows = queue.overflows();
+    r.queue_max_depth = queue.max_depth();
+    r.mean_latency_us = process.mean_latency_us();
+    r.max_latency_us = process.max_latency_us();
+    r.seconds = (host_nanos() - start) / 1e9;
+    return r;
+}
+
+
+static std::string load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", path);
+        exit(1);
+    }
+    std::string data;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.append(chunk, n);
+    fclose(f);
+    return data;
+}
+
+
+int main(int argc, char** argv) {
+    std::string capture = load(argc > 1 ? argv[1] : DEFAULT_CAPTURE);
+    if (argc > 2) send_ms = atoi(argv[2]);
+
+    // Frames the capture holds, for comparison
+    SampleQueue scratch;
+    IngestStage reference(scratch);
+    RangeSample sink;
+    for (size_t pos = 0; pos < capture.size(); pos += PIPELINE_READ_CHUNK) {
+        size_t n = capture.size() - pos < PIPELINE_READ_CHUNK ? capture.size() - pos : PIPELINE_READ_CHUNK;
+        reference.ingest(capture.data() + pos, n, 0);
+        while (scratch.pop(sink)) {}
+    }
+
+    printf("capture: %zu bytes, %u range frames, %zu B/s UART, %zu B RX FIFO, %d ms per send\n",
+           capture.size(), reference.frames_parsed(), UART_BYTES_PER_SEC, UART_RX_FIFO, send_ms);
+    printf("%-9s %7s %9s %7s %9s %10s %7s %10s %10s %7s\n", "mode", "parsed", "processed", "packets",
+           "uart_drop", "q_overflow", "q_depth", "lat_mean", "lat_max", "secs");
+
+    const bool modes[] = { false, true };
+    for (bool pipelined : modes) {
+        Result r = run(capture, pipelined);
+        printf("%-9s %7u %9u %7u %9zu %10zu %7zu %8uus %8uus %7.2f\n", pipelined ? "pipeline" : "serial",
+               r.parsed, r.processed, r.packets, r.uart_dropped, r.queue_overflows, r.queue_max_depth,
+               r.mean_latency_us, r.max_latency_us, r.seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Compares the streaming RangeStreamParser with the old read_serial() ->
+// parse_range() / parse_rdata() path on a recorded stream of module output.
+//
+// The old path is reproduced with std::string standing in for Arduino String:
+// readStringUntil() grows a string byte by byte, parse_range() copies it into
+// buf[128], strncpy()s it into temp[128] and runs strtok(), and parse_rdata()
+// builds substrings.
+//
+// Build: pio run -e native_parser_bench && .pio/build/native_parser_bench/program [capture]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "host_clock.h"
+#include "range_parser.h"
+
+static const char* DEFAULT_CAPTURE = "host/data/range_session.txt";
+static const int ITERATIONS = 2000;
+
+
+static std::string trim(const std::string& s) {
+    size_t a = s.find_first_not_of(" \t\r\n");
+    size_t b = s.find_last_not_of(" \t\r\n");
+    return a == std::string::npos ? std::string() : s.substr(a, b - a + 1);
+}
+
+static bool legacy_parse_range(std::string message, int ranges[]) {
+    int i = 0;
+    char buf[128];
+    strncpy(buf, message.c_str(), sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+
+    char* start = strstr(buf, "range:(");
+    if (!start) return false;
+    start += 7;
+
+    char* end = strchr(start, ')');
+    if (!end) return false;
+
+    char temp[128];
+    size_t len = end - start;
+    strncpy(temp, start, len);
+    temp[len] = '\0';
+
+    char* token = strtok(temp, ",");
+    while (token && i < NUM_ANCHORS) {
+        ranges[i++] = atoi(token);
+        token = strtok(NULL, ",");
+    }
+    return true;
+}
+
+static bool legacy_parse_rdata(const std::string& line, std::string& sender, std::string& message) {
+    if (line.compare(0, 9, "AT+RDATA=") != 0) return false;
+    std::string data = trim(line.substr(9));
+
+    int comma_count = 0;
+    size_t last_pos = 0;
+    for (size_t i = 0; i < data.length(); i++) {
+        if (data[i] != ',') continue;
+        comma_count++;
+        if (comma_count == 1) sender = trim(data.substr(last_pos, i - last_pos));
+        if (comma_count == 4) {
+            message = trim(data.substr(i + 1));
+            break;
+        }
+        last_pos = i + 1;
+    }
+    return sender.length() > 0 && message.length() > 0;
+}
+
+
+static std::string load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", path);
+        exit(1);
+    }
+    std::string data;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.append(chunk, n);
+    fclose(f);
+    return data;
+}
+
+
+int main(int argc, char** argv) {
+    std::string capture = load(argc > 1 ? argv[1] : DEFAULT_CAPTURE);
+
+    // Old path
+    uint64_t legacy_lines = 0, legacy_frames = 0;
+    long legacy_checksum = 0;
+    uint64_t start = host_nanos();
+    for (int it = 0; it < ITERATIONS; it++) {
+        size_t pos = 0;
+        while (pos < capture.size()) {
+            std::string line;
+            while (pos < capture.size() && capture[pos] != '\n') line += capture[pos++];
+            pos++;
+            line = trim(line);
+            if (line.empty()) continue;
+            legacy_lines++;
+
+            int ranges[NUM_ANCHORS] = { 0 };
+            std::string sender, message;
+            if (legacy_parse_range(line, ranges)) {
+                legacy_frames++;
+                for (int i = 0; i < NUM_ANCHORS; i++) legacy_checksum += ranges[i];
+            } else if (legacy_parse_rdata(line, sender, message)) {
+                legacy_frames++;
+                legacy_checksum += atoi(sender.c_str()) + (long)message.size();
+            }
+        }
+    }
+    double legacy_s = (host_nanos() - start) / 1e9;
+
+    // Streaming parser, fed through its ring buffer in UART-sized chunks
+    RangeStreamParser parser;
+    uint64_t lines = 0, frames = 0;
+    long checksum = 0;
+    start = host_nanos();
+    for (int it = 0; it < ITERATIONS; it++) {
+        size_t pos = 0;
+        while (pos < capture.size()) {
+            pos += parser.write(capture.data() + pos, capture.size() - pos);
+
+            AtLineType type;
+            while ((type = parser.next()) != LINE_NONE) {
+                lines++;
+                if (type == LINE_RANGE) {
+                    frames++;
+                    for (int i = 0; i < NUM_ANCHORS; i++) checksum += parser.range().ranges[i];
+                } else if (type == LINE_RDATA) {
+                    frames++;
+                    checksum += parser.rdata().sender_id + parser.rdata().length;
+                }
+            }
+        }
+    }
+    double stream_s = (host_nanos() - start) / 1e9;
+
+    printf("capture: %zu bytes, %d passes\n", capture.size(), ITERATIONS);
+    printf("%-10s %10s %10s %14s %12s\n", "parser", "lines", "frames", "lines/sec", "checksum");
+    printf("%-10s %10llu %10llu %14.0f %12ld\n", "legacy", (unsigned long long)legacy_lines,
+           (unsigned long long)legacy_frames, legacy_lines / legacy_s, legacy_checksum);
+    printf("%-10s %10llu %10llu %14.0f %12ld\n", "streaming", (unsigned long long)lines,
+           (unsigned long long)frames, lines / stream_s, checksum);
+    printf("speedup %.1fx\n", legacy_s / stream_s);
+
+    if (checksum != legacy_checksum || frames != legacy_frames) {
+        printf("MISMATCH between parsers\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Times the anchor -> tag -> anchor switches the calibration flow does for
+// every pairwise measurement, against a mock module that goes quiet for a
+// while after AT+RESTART.
+//
+//   legacy     set_role() as it was: AT+RESTORE, the whole config, AT+SAVE and
+//              AT+RESTART every time, each behind its fixed timeout
+//   persist    ModuleConfigurator, changed settings + AT+SAVE/AT+RESTART
+//   transient  ModuleConfigurator, changed settings only
+//
+// Build: pio run -e native_role_switch_bench && .pio/build/native_role_switch_bench/program [switches]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "at_engine.h"
+#include "host_clock.h"
+#include "mock_uart.h"
+#include "module_config.h"
+
+static const int DEFAULT_SWITCHES = 10;
+
+struct Step {
+    const char* command;
+    uint32_t timeout_ms;
+};
+
+// set_role() before the configurator, the fixed wait it did per command
+static const Step LEGACY_SWITCH[] = {
+    { "AT?", 2000 },
+    { "AT+RESTORE", 5000 },
+    { "AT+SETCFG=3,%d,1,1", 2000 },
+    { "AT+SETCAP=64,10,1", 2000 },
+    { "AT+SETRPT=1", 2000 },
+    { "AT+SAVE", 2000 },
+    { "AT+RESTART", 2000 },
+};
+static const size_t LEGACY_STEPS = sizeof(LEGACY_SWITCH) / sizeof(LEGACY_SWITCH[0]);
+
+
+static void configure_module(MockUart& uart) {
+    // Same rough DW3000 figures as bench_at_engine.cpp, plus the reboot itself
+    uart.set_default("OK", 3000);
+    uart.on("AT+RESTORE", "OK", 150000);
+    uart.on("AT+SAVE", "OK", 40000);
+    uart.on("AT+RESTART", "OK", 20000);
+    uart.on_reset("AT+RESTART", 600000);
+}
+
+
+static ModuleConfig config_for(int role) {
+    ModuleConfig config = { 3, role, 1, 1, 64, 10, 1, 1, 16450 };
+    return config;
+}
+
+
+static void print_row(const char* name, int switches, double total_ms, double min_ms, double max_ms,
+                      uint32_t commands, uint32_t flash_writes) {
+    printf("%-10s %8d %12.1f %10.1f %10.1f %10.1f %9u %7u\n", name, switches, total_ms, total_ms / switches,
+           min_ms, max_ms, commands, flash_writes);
+}
+
+
+static void run_configurator(const char* name, ConfigMode mode, int switches) {
+    MockUart uart;
+    configure_module(uart);
+    AtEngine engine(uart, host_micros);
+    ModuleConfigurator configurator(engine, host_micros);
+
+    // Boot: cache unknown, so this is the full restore, not counted
+    configurator.apply(config_for(1), CONFIG_PERSIST);
+    configurator.reset_stats();
+    size_t written_before = uart.written.size();
+
+    for (int i = 0; i < switches; i++) {
+        if (!configurator.apply(config_for(i % 2 == 0 ? 0 : 1), mode)) printf("  %s: switch %d failed\n", name, i);
+    }
+
+    const ConfigStats& stats = configurator.stats();
+    print_row(name, switches, stats.total_us / 1000.0, stats.min_us / 1000.0, stats.max_us / 1000.0,
+              (uint32_t)(uart.written.size() - written_before), stats.flash_writes);
+}
+
+
+int main(int argc, char** argv) {
+    int switches = argc > 1 ? atoi(argv[1]) : DEFAULT_SWITCHES;
+    if (switches < 1) switches = 1;
+
+    printf("%-10s %8s %12s %10s %10s %10s %9s %7s\n", "mode", "switches", "total_ms", "mean_ms", "min_ms",
+           "max_ms", "commands", "flash");
+
+    // Legacy: every command waited out its full timeout
+    uint32_t legacy_ms = 0;
+    for (size_t i = 0; i < LEGACY_STEPS; i++) legacy_ms += LEGACY_SWITCH[i].timeout_ms;
+    print_row("legacy", switches, (double)legacy_ms * switches, legacy_ms, legacy_ms,
+              (uint32_t)(LEGACY_STEPS * switches), 2 * switches);
+
+    run_configurator("persist", CONFIG_PERSIST, switches);
+    run_configurator("transient", CONFIG_TRANSIENT, switches);
+    return 0;
+}
@@ -0,0 +1,196 @@
+// Tracking a walking tag four ways: Multilateration on every raw frame, on
+// RangeFilter's converged window means (what get_converged_ranges() gives),
+// on RangeQuality's filtered ranges and weights (get_weighted_ranges()), and
+// with PositionTracker. Ranges carry noise, dropouts and the odd
+// non-line-of-sight outlier. Reports how many frames got a fix, its error
+// against the true path, Gauss-Newton iterations per fix and the cost per
+// frame.
+//
+//   bench_tracker [--seconds S] [--rate HZ] [--speed CM_PER_S] [--outliers FRACTION]
+//
+// Build: pio run -e native_tracker_bench && .pio/build/native_tracker_bench/program
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "host_clock.h"
+#include "multilateration.h"
+#include "position_tracker.h"
+#include "range_filter.h"
+#include "range_quality.h"
+
+static const double NOISE_CM = 5.0;
+static const double DROPOUT = 0.1;
+
+// Same field as bench_multilateration, flattened to 2D
+static const float ANCHORS[NUM_ANCHORS][2] = {
+    { 0, 0 }, { 980, 0 }, { 1035, 719 }, { 0, 900 }, { 500, -50 }, { 1100, 350 }, { 480, 980 }, { -60, 450 },
+};
+
+struct Frame {
+    uint32_t timestamp_us;
+    float truth[2];
+    int ranges[NUM_ANCHORS];
+};
+
+struct Result {
+    const char* name;
+    size_t fixes;
+    std::vector<double> errors;
+    double ns_per_frame;
+    size_t iterations;
+};
+
+
+// A rescuer sweeping the field in lanes at constant speed, then retracing
+// the sweep back to the start
+static void walk(double t, double speed, float out[2]) {
+    const double lane_len = 800, lane_gap = 150, lanes = 5;
+    const double sweep = lanes * (lane_len + lane_gap) - lane_gap;
+    double s = fmod(t * speed, 2 * sweep);
+    if (s > sweep) s = 2 * sweep - s;
+    int lane = (int)(s / (lane_len + lane_gap));
+    double along = s - lane * (lane_len + lane_gap);
+
+    double x = along < lane_len ? along : lane_len;
+    double y = lane * lane_gap + (along < lane_len ? 0 : along - lane_len);
+    if (lane % 2) x = lane_len - x;
+    out[0] = (float)(150 + x);
+    out[1] = (float)(100 + y);
+}
+
+
+static std::vector<Frame> make_frames(double seconds, double rate, double speed, double outliers) {
+    std::mt19937 rng(7);
+    std::normal_distribution<float> noise(0, NOISE_CM);
+    std::uniform_real_distribution<float> coin(0, 1);
+    std::uniform_real_distribution<float> excess(80, 300); // NLOS ranges only ever read long
+
+    std::vector<Frame> frames((size_t)(seconds * rate));
+    for (size_t f = 0; f < frames.size(); f++) {
+        Frame& frame = frames[f];
+        double t = f / rate;
+        frame.timestamp_us = (uint32_t)(t * 1e6);
+        walk(t, speed, frame.truth);
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            float dist = hypotf(frame.truth[0] - ANCHORS[a][0], frame.truth[1] - ANCHORS[a][1]);
+            float range = dist + noise(rng) + (coin(rng) < outliers ? excess(rng) : 0);
+            frame.ranges[a] = coin(rng) < DROPOUT ? 0 : (int)lroundf(range);
+        }
+    }
+    return frames;
+}
+
+
+static void add_fix(Result& r, const Frame& frame, float x, float y, size_t iterations = 0) {
+    r.fixes++;
+    r.errors.push_back(hypot(x - frame.truth[0], y - frame.truth[1]));
+    r.iterations += iterations;
+}
+
+
+static void print(const Result& r, size_t frames) {
+    std::vector<double> e = r.errors;
+    std::sort(e.begin(), e.end());
+    double mean = 0;
+    for (double v : e) mean += v;
+    mean /= e.empty() ? 1 : e.size();
+    double p95 = e.empty() ? 0 : e[(size_t)(0.95 * (e.size() - 1))];
+    double worst = e.empty() ? 0 : e.back();
+
+    printf("%-10s %6.1f%% of frames  error mean %6.1f cm  p95 %6.1f cm  max %7.1f cm  %7.0f ns/frame", r.name,
+           100.0 * r.fixes / frames, mean, p95, worst, r.ns_per_frame);
+    if (r.iterations) printf("  %.2f it/fix", (double)r.iterations / r.fixes);
+    printf("\n");
+}
+
+
+int main(int argc, char** argv) {
+    double seconds = 120, rate = 20, speed = 120, outliers = 0.03;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seconds") == 0) seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--rate") == 0) rate = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--speed") == 0) speed = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--outliers") == 0) outliers = atof(argv[i + 1]);
+    }
+
+    std::vector<Frame> frames = make_frames(seconds, rate, speed, outliers);
+
+    Multilateration<NUM_ANCHORS, 2> solver;
+    PositionTracker<NUM_ANCHORS> tracker;
+    for (int a = 0; a < NUM_ANCHORS; a++) {
+        solver.set_anchor(a, ANCHORS[a]);
+        tracker.set_anchor(a, ANCHORS[a]);
+    }
+
+    Result raw = { "raw", 0, {}, 0, 0 };
+    Result windowed = { "windowed", 0, {}, 0, 0 };
+    Result weighted = { "weighted", 0, {}, 0, 0 };
+    Result tracked = { "tracked", 0, {}, 0, 0 };
+    Multilateration<NUM_ANCHORS, 2>::Result fix;
+
+    uint64_t start = host_nanos();
+    for (const Frame& frame : frames) {
+        if (solver.solve(frame.ranges, fix)) add_fix(raw, frame, fix.position[0], fix.position[1], fix.iterations);
+    }
+    raw.ns_per_frame = (double)(host_nanos() - start) / frames.size();
+
+    // Only anchors whose whole window has settled take part, like a tag
+    // waiting on get_converged_ranges()
+    RangeFilter filter;
+    start = host_nanos();
+    for (const Frame& frame : frames) {
+        filter.add(frame.ranges, frame.timestamp_us);
+        int ranges[NUM_ANCHORS];
+        uint32_t converged = filter.estimate(ranges);
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            if (!((converged >> a) & 1)) ranges[a] = 0;
+        }
+        if (solver.solve(ranges, fix)) add_fix(windowed, frame, fix.position[0], fix.position[1], fix.iterations);
+    }
+    windowed.ns_per_frame = (double)(host_nanos() - start) / frames.size();
+
+    RangeQuality quality;
+    start = host_nanos();
+    for (const Frame& frame : frames) {
+        int ranges[NUM_ANCHORS];
+        float weights[NUM_ANCHORS];
+        quality.filter(frame.ranges, nullptr, ranges, weights);
+        if (solver.solve(ranges, fix, weights)) {
+            quality.add_residuals(fix.residuals, weights);
+            add_fix(weighted, frame, fix.position[0], fix.position[1], fix.iterations);
+        }
+    }
+    weighted.ns_per_frame = (double)(host_nanos() - start) / frames.size();
+
+    TrackerEstimate estimate;
+    start = host_nanos();
+    for (const Frame& frame : frames) {
+        tracker.update(frame.ranges, frame.timestamp_us);
+        if (tracker.estimate(frame.timestamp_us, estimate)) {
+            add_fix(tracked, frame, estimate.position[0], estimate.position[1]);
+        }
+    }
+    tracked.ns_per_frame = (double)(host_nanos() - start) / frames.size();
+
+    printf("%zu frames at %.0f Hz, walking %.0f cm/s, %.0f cm noise, %.0f%% dropout, %.0f%% outliers\n",
+           frames.size(), rate, speed, NOISE_CM, DROPOUT * 100, outliers * 100);
+    print(raw, frames.size());
+    print(windowed, frames.size());
+    print(weighted, frames.size());
+    print(tracked, frames.size());
+
+    const TrackerStats& s = tracker.stats();
+    printf("tracker: %u ranges accepted, %u rejected by the gate, %u restarts\n", s.accepted, s.rejected,
+           s.restarts);
+    const RangeQualityStats& q = quality.stats();
+    printf("quality: %u ranges, %u outliers replaced, %u zeros held, %u dropouts\n", q.samples, q.outliers, q.held,
+           q.dropouts);
+    return 0;
+}
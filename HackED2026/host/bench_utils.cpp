@@ -0,0 +1,466 @@
+// Microbenchmarks for the per-frame and per-command helpers in utils.cpp,
+// run against the recorded module output in host/data. Every case reports
+// ns/op, heap allocations per op and bytes allocated per op; allocations are
+// counted by replacing the global operator new below.
+//
+// The String helpers utils.cpp used to have (config_cmd, cap_cmd,
+// parse_software_version, the parse_range/parse_rdata wrappers and
+// send_wifi_data's message) are reproduced with std::string standing in for
+// Arduino String, so their allocation counts are a lower bound: std::string
+// keeps up to 15 characters inline where the ESP32 String keeps 11. The
+// *_fixed cases are the FixedString/ConstString versions that replaced them.
+//
+//   bench_utils [--json] [--compare baseline.jsonl [--tolerance 0.25]] [capture]
+//
+// --json prints one JSON object per case, for keeping as a baseline.
+// --compare reruns the cases against such a baseline and exits non-zero if
+// any case allocates more than before, or got slower by more than the
+// tolerance (default 25%; timings are noisy, allocation counts are not).
+//
+// Build: pio run -e native_utils_bench && .pio/build/native_utils_bench/program --json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "at_engine.h"
+#include "fixed_string.h"
+#include "host_clock.h"
+#include "range_filter.h"
+#include "range_parser.h"
+#include "telemetry.h"
+#include "trace.h"
+
+static const char* DEFAULT_CAPTURE = "host/data/range_session.txt";
+static const uint64_t MIN_RUN_NS = 200000000; // Per case
+static const double DEFAULT_TOLERANCE = 0.25;
+
+
+///////////////////////
+// ALLOCATION COUNTS //
+///////////////////////
+
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+
+void* operator new(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+
+////////////////////////
+// FIRMWARE STAND-INS //
+////////////////////////
+
+// As utils.cpp had them, with std::string for String
+struct Device {
+    int uwb_index;
+    int current_role;
+};
+
+static std::string config_cmd(const Device& device) {
+    std::string temp = "AT+SETCFG=";
+    temp = temp + std::to_string(device.uwb_index);
+    temp = temp + "," + std::to_string(device.current_role);
+    temp = temp + ",1";
+    temp = temp + ",1";
+    return temp;
+}
+
+static std::string cap_cmd() {
+    std::string temp = "AT+SETCAP=";
+    temp = temp + std::to_string(UWB_TAG_COUNT);
+    temp = temp + ",10";
+    temp = temp + ",1";
+    return temp;
+}
+
+static std::string parse_software_version(std::string version) {
+    while (version.length() > 0 && version[0] == '\0') version.erase(0, 1);
+
+    size_t start = version.find("software:");
+    if (start == std::string::npos) return "";
+    start += strlen("software:");
+
+    return version.substr(start, version.find(',', start) - start);
+}
+
+static AtLineType parse_line(RangeStreamParser& parser, const std::string& line) {
+    AtLineType type = LINE_NONE;
+    for (size_t i = 0; i < line.length(); i++) type = parser.feed(line[i]);
+    if (type == LINE_NONE) type = parser.feed('\n');
+    return type;
+}
+
+static void parse_range(std::string message, int ranges[]) {
+    RangeStreamParser parser;
+    if (parse_line(parser, message) != LINE_RANGE) return;
+    memcpy(ranges, parser.range().ranges, parser.range().count * sizeof(int));
+}
+
+static bool parse_rdata(const std::string& line, int& sender, char* message) {
+    RangeStreamParser parser;
+    if (parse_line(parser, line) != LINE_RDATA) return false;
+    sender = parser.rdata().sender_id;
+    memcpy(message, parser.rdata().message, parser.rdata().length + 1);
+    return true;
+}
+
+// The text send_wifi_data() puts in a packet
+static std::string wifi_message(const Device& device, const std::string& message) {
+    return std::to_string(device.uwb_index) + ": " + message;
+}
+
+// As utils.cpp has them now
+typedef FixedString<AT_COMMAND_LEN> CommandString;
+typedef FixedString<24> VersionString;
+static constexpr auto AT_CAP_COMMAND = const_string("AT+SETCAP=") + const_decimal<UWB_TAG_COUNT>() +
+                                       const_string(",10,1");
+
+static CommandString config_cmd_fixed(const Device& device) {
+    CommandString temp("AT+SETCFG=");
+    temp += device.uwb_index;
+    temp += ',';
+    temp += device.current_role;
+    temp += ",1";
+    temp += ",1";
+    return temp;
+}
+
+static VersionString parse_software_version_fixed(const char* version) {
+    VersionString out;
+    const char* start = strstr(version, "software:");
+    if (!start) return out;
+    start += strlen("software:");
+    const char* end = strchr(start, ',');
+    out.append(start, end ? (size_t)(end - start) : strlen(start));
+    return out;
+}
+
+static void parse_range_fixed(const char* message, int ranges[]) {
+    RangeStreamParser parser;
+    AtLineType type = LINE_NONE;
+    for (const char* c = message; *c; c++) type = parser.feed(*c);
+    if (type == LINE_NONE) type = parser.feed('\n');
+    if (type != LINE_RANGE) return;
+    memcpy(ranges, parser.range().ranges, parser.range().count * sizeof(int));
+}
+
+
+////////////
+// HARNESS //
+////////////
+
+struct Result {
+    std::string name;
+    uint64_t ops;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+static volatile long sink;
+
+/// @brief Calls body() (which does ops_per_call operations) until MIN_RUN_NS
+/// has passed. The first call is a warm-up and isn't counted.
+template <typename Body>
+static Result measure(const char* name, uint64_t ops_per_call, Body body) {
+    sink += body();
+
+    uint64_t calls = 0;
+    uint64_t allocs = alloc_count, bytes = alloc_bytes;
+    uint64_t start = host_nanos(), elapsed = 0;
+    while (elapsed < MIN_RUN_NS) {
+        for (int i = 0; i < 16; i++) sink += body();
+        calls += 16;
+        elapsed = host_nanos() - start;
+    }
+
+    Result r;
+    r.name = name;
+    r.ops = calls * ops_per_call;
+    r.ns_per_op = (double)elapsed / r.ops;
+    r.allocs_per_op = (double)(alloc_count - allocs) / r.ops;
+    r.bytes_per_op = (double)(alloc_bytes - bytes) / r.ops;
+    return r;
+}
+
+
+static std::string load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", path);
+        exit(1);
+    }
+    std::string data;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.append(chunk, n);
+    fclose(f);
+    return data;
+}
+
+
+static std::vector<Result> run_all(const std::string& capture) {
+    std::vector<std::string> range_lines, rdata_lines;
+    std::string version_reply;
+    size_t pos = 0;
+    while (pos < capture.size()) {
+        size_t end = capture.find('\n', pos);
+        if (end == std::string::npos) end = capture.size();
+        std::string line = capture.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (line.compare(0, 9, "AT+RANGE=") == 0) range_lines.push_back(line);
+        else if (line.compare(0, 9, "AT+RDATA=") == 0) rdata_lines.push_back(line);
+        else if (line.compare(0, 7, "getver ") == 0) version_reply = std::string(1, '\0') + line; // As read after boot
+    }
+
+    // Ranges as the firmware has them after parsing, for the filter and telemetry cases
+    std::vector<RangeFrame> frames;
+    RangeStreamParser stream;
+    for (const std::string& line : range_lines) {
+        if (parse_line(stream, line) == LINE_RANGE) frames.push_back(stream.range());
+    }
+
+    std::vector<Result> results;
+    const Device device = { 3, 0 };
+
+    results.push_back(measure("parse_range", range_lines.size(), [&] {
+        long sum = 0;
+        for (const std::string& line : range_lines) {
+            int ranges[NUM_ANCHORS] = { 0 };
+            parse_range(line, ranges);
+            sum += ranges[0];
+        }
+        return sum;
+    }));
+
+    results.push_back(measure("parse_range_fixed", range_lines.size(), [&] {
+        long sum = 0;
+        for (const std::string& line : range_lines) {
+            int ranges[NUM_ANCHORS] = { 0 };
+            parse_range_fixed(line.c_str(), ranges);
+            sum += ranges[0];
+        }
+        return sum;
+    }));
+
+    results.push_back(measure("parse_rdata", rdata_lines.size(), [&] {
+        long sum = 0;
+        char message[96];
+        for (const std::string& line : rdata_lines) {
+            int sender = 0;
+            if (parse_rdata(line, sender, message)) sum += sender + message[0];
+        }
+        return sum;
+    }));
+
+    // What read_frame() and the pipeline do instead: no per-line String at all
+    results.push_back(measure("stream_parser_line", range_lines.size() + rdata_lines.size(), [&] {
+        RangeStreamParser parser;
+        long sum = 0;
+        size_t at = 0;
+        while (at < capture.size()) {
+            at += parser.write(capture.data() + at, capture.size() - at);
+            AtLineType type;
+            while ((type = parser.next()) != LINE_NONE) sum += type;
+        }
+        return sum;
+    }));
+
+    results.push_back(measure("parse_software_version", 1, [&] {
+        return (long)parse_software_version(version_reply).size();
+    }));
+
+    // at_engine drops the leading \0 before the text gets here
+    results.push_back(measure("parse_software_version_fixed", 1, [&] {
+        return (long)parse_software_version_fixed(version_reply.c_str() + 1).length();
+    }));
+
+    results.push_back(measure("config_cmd", 1, [&] { return (long)config_cmd(device).size(); }));
+    results.push_back(measure("config_cmd_fixed", 1, [&] { return (long)config_cmd_fixed(device).length(); }));
+    results.push_back(measure("cap_cmd", 1, [&] { return (long)cap_cmd().size(); }));
+    results.push_back(measure("cap_cmd_fixed", 1, [&] { return (long)strlen(AT_CAP_COMMAND.c_str()); }));
+
+    // ModuleConfigurator's way of building the same command
+    results.push_back(measure("config_cmd_snprintf", 1, [&] {
+        char command[AT_COMMAND_LEN];
+        return (long)snprintf(command, sizeof(command), "AT+SETCFG=%d,%d,%d,%d", device.uwb_index,
+                              device.current_role, 1, 1);
+    }));
+
+    // get_converged_ranges(): one add() and one estimate() per frame
+    RangeFilter filter(STABILITY_THRESHOLD);
+    uint32_t now_us = 0;
+    results.push_back(measure("converged_ranges", frames.size(), [&] {
+        long sum = 0;
+        int estimate[NUM_ANCHORS];
+        for (const RangeFrame& frame : frames) {
+            now_us += 100000;
+            filter.add(frame.ranges, now_us);
+            sum += filter.estimate(estimate);
+        }
+        return sum;
+    }));
+
+    results.push_back(measure("wifi_message", frames.size(), [&] {
+        long sum = 0;
+        for (const RangeFrame& frame : frames) {
+            sum += (long)wifi_message(device, std::to_string(frame.ranges[0])).size();
+        }
+        return sum;
+    }));
+
+    // send_wifi_data() now prints the pieces into the packet, this is the same text on the stack
+    results.push_back(measure("wifi_message_fixed", frames.size(), [&] {
+        long sum = 0;
+        for (const RangeFrame& frame : frames) {
+            FixedString<PARSER_LINE_LEN> message;
+            message += device.uwb_index;
+            message += ": ";
+            message += frame.ranges[0];
+            sum += (long)message.length();
+        }
+        return sum;
+    }));
+
+    // The binary UDP path: batched frames, flushed to a sink that does nothing
+    static size_t flushed;
+    TelemetryBatcher batcher(3, TELEMETRY_DEFAULT_BATCH, TELEMETRY_DEFAULT_DEADLINE_US,
+                             [](const uint8_t*, size_t len, void*) { flushed += len; }, nullptr);
+    results.push_back(measure("telemetry_frame", frames.size(), [&] {
+        for (const RangeFrame& frame : frames) {
+            now_us += 100000;
+            batcher.add(frame.ranges, now_us);
+        }
+        return (long)flushed;
+    }));
+
+    // What tracing adds to each stage: two cycle reads and a histogram insert
+    static Tracer tracer;
+    results.push_back(measure("trace_record", frames.size(), [&] {
+        for (size_t i = 0; i < frames.size(); i++) {
+            uint32_t start = trace_cycles();
+            tracer.record(TRACE_FILTER, trace_cycles() - start + frames[i].ranges[0]);
+        }
+        return (long)tracer.stage(TRACE_FILTER).count();
+    }));
+
+    return results;
+}
+
+
+/////////////
+// BASELINE //
+/////////////
+
+static void print_json(const std::vector<Result>& results) {
+    for (const Result& r : results) {
+        printf("{\"bench\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f}\n",
+               r.name.c_str(), (unsigned long long)r.ops, r.ns_per_op, r.allocs_per_op, r.bytes_per_op);
+    }
+}
+
+
+// Reads back what print_json() wrote; anything else on a line is ignored
+static std::vector<Result> load_baseline(const char* path) {
+    std::vector<Result> out;
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", path);
+        exit(1);
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        unsigned long long ops;
+        Result r;
+        if (sscanf(line, "{\"bench\":\"%63[^\"]\",\"ops\":%llu,\"ns_per_op\":%lf,\"allocs_per_op\":%lf,\"bytes_per_op\":%lf",
+                   name, &ops, &r.ns_per_op, &r.allocs_per_op, &r.bytes_per_op) != 5) {
+            continue;
+        }
+        r.name = name;
+        r.ops = ops;
+        out.push_back(r);
+    }
+    fclose(f);
+    return out;
+}
+
+
+static int compare(const std::vector<Result>& baseline, const std::vector<Result>& results, double tolerance) {
+    int regressions = 0;
+    printf("%-30s %12s %12s %8s %10s %10s  %s\n", "bench", "base_ns", "ns/op", "change", "base_alloc",
+           "allocs/op", "");
+
+    for (const Result& r : results) {
+        const Result* base = nullptr;
+        for (const Result& b : baseline) {
+            if (b.name == r.name) base = &b;
+        }
+        if (!base) {
+            printf("%-30s %12s %12.1f %8s %10s %10.2f  new\n", r.name.c_str(), "-", r.ns_per_op, "", "-",
+                   r.allocs_per_op);
+            continue;
+        }
+
+        double change = base->ns_per_op > 0 ? r.ns_per_op / base->ns_per_op - 1 : 0;
+        bool slower = change > tolerance;
+        bool more_allocs = r.allocs_per_op > base->allocs_per_op + 0.005;
+        regressions += slower || more_allocs;
+
+        printf("%-30s %12.1f %12.1f %+7.0f%% %10.2f %10.2f  %s\n", r.name.c_str(), base->ns_per_op, r.ns_per_op,
+               change * 100, base->allocs_per_op, r.allocs_per_op,
+               more_allocs ? "MORE ALLOCATIONS" : slower ? "SLOWER" : "");
+    }
+
+    printf("%d regression%s (tolerance %.0f%%)\n", regressions, regressions == 1 ? "" : "s", tolerance * 100);
+    return regressions ? 1 : 0;
+}
+
+
+int main(int argc, char** argv) {
+    bool json = false;
+    const char* baseline = nullptr;
+    const char* path = DEFAULT_CAPTURE;
+    double tolerance = DEFAULT_TOLERANCE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) json = true;
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) tolerance = atof(argv[++i]);
+        else path = argv[i];
+    }
+
+    std::vector<Result> results = run_all(load(path));
+
+    if (baseline) return compare(load_baseline(baseline), results, tolerance);
+
+    if (json) {
+        print_json(results);
+        return 0;
+    }
+
+    printf("%-30s %12s %10s %10s %12s\n", "bench", "ops", "ns/op", "allocs/op", "bytes/op");
+    for (const Result& r : results) {
+        printf("%-30s %12llu %10.1f %10.2f %12.1f\n", r.name.c_str(), (unsigned long long)r.ops, r.ns_per_op,
+               r.allocs_per_op, r.bytes_per_op);
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include "calibration_file.h"
+
+#include <stdio.h>
+
+
+bool calibration_file_load(const char* path, CalibrationCache& out) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+
+    uint8_t record[CAL_CACHE_MAX_LEN];
+    size_t len = fread(record, 1, sizeof(record), f);
+    fclose(f);
+    return calibration_cache_decode(record, len, out);
+}
+
+
+bool calibration_file_save(const char* path, const CalibrationCache& cache) {
+    uint8_t record[CAL_CACHE_MAX_LEN];
+    size_t len = calibration_cache_encode(cache, record, sizeof(record));
+    if (len == 0) return false;
+
+    char tmp[512];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return false;
+    FILE* f = fopen(tmp, "wb");
+    if (!f) return false;
+    bool ok = fwrite(record, 1, len, f) == len;
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef CALIBRATION_FILE_H
+#define CALIBRATION_FILE_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include "calibration_cache.h"
+
+// The laptop's copy of a calibration: one calibration_cache.h record, the
+// whole file. uwb_aggregator writes it when a tag sends its matrix,
+// uwb_control adds the antenna delays it sets, and uwb_aggregator and
+// frontend.py place the anchors from it on start instead of waiting for a
+// calibration.
+
+/// @return False if the file can't be read or isn't a record, see errno
+/// for the first.
+bool calibration_file_load(const char* path, CalibrationCache& out);
+
+/// @brief Writes the record next to path and renames it over, so a reader
+/// never sees half of one.
+/// @return False on a file error, see errno.
+bool calibration_file_save(const char* path, const CalibrationCache& cache);
+
+#endif
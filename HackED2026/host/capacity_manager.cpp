@@ -0,0 +1,151 @@
+#include "capacity_manager.h"
+
+#include <string.h>
+
+#include "host_clock.h"
+
+
+CapacityManager::CapacityManager(ControlClient& client, const TdmaPolicy& policy, int channel)
+    : client(client), tdma(policy, channel), phase(IDLE), replan(false), phase_start_ms(0), retry_after_ms(0),
+      waiting_retry(false) {
+    memset(&statistics, 0, sizeof(statistics));
+}
+
+
+bool CapacityManager::add(const char* host, uint16_t port, uint8_t id, bool anchor) {
+    int index = client.add_device(host, port, id);
+    if (index < 0) return false;
+
+    Device device = { (size_t)index, id, anchor, -1, -1, false, 0 };
+    devices.push_back(device);
+    return true;
+}
+
+
+bool CapacityManager::add_tag(const char* host, uint16_t port, uint8_t id) { return add(host, port, id, false); }
+
+
+bool CapacityManager::add_anchor(const char* host, uint16_t port, uint8_t id) { return add(host, port, id, true); }
+
+
+void CapacityManager::heard(uint8_t id, uint32_t now_ms) {
+    for (const Device& d : devices) {
+        if (d.id == id && !d.anchor) tdma.heard(id, now_ms);
+    }
+}
+
+
+void CapacityManager::restarted(uint8_t id) {
+    for (Device& d : devices) {
+        if (d.id != id) continue;
+        d.applied = -1;
+        replan = true;
+    }
+}
+
+
+int32_t CapacityManager::target_for(const Device& device) const {
+    if (device.anchor) return tdma_pack(tdma.capacity(), tdma.slot_ms(), TDMA_NO_SLOT);
+    uint8_t slot = tdma.slot(device.id);
+    // Not placed: gone quiet, or never heard. Left as it is.
+    return slot == TDMA_NO_SLOT ? -1 : tdma_pack(tdma.capacity(), tdma.slot_ms(), slot);
+}
+
+
+void CapacityManager::send_phase(uint8_t opcode, uint32_t now_ms) {
+    for (Device& d : devices) {
+        if (d.in_switch) d.command = client.queue(d.client_index, opcode, d.target);
+    }
+    phase_start_ms = now_ms;
+    // Out now rather than at the caller's next poll, so the burst is tight
+    client.poll(host_nanos());
+}
+
+
+bool CapacityManager::phase_done(bool& all_ok) {
+    all_ok = true;
+    for (const Device& d : devices) {
+        if (!d.in_switch) continue;
+        uint8_t status = client.device(d.client_index).commands[d.command].status;
+        if (status == CONTROL_PENDING) return false;
+        all_ok &= status == CONTROL_OK;
+    }
+    return true;
+}
+
+
+void CapacityManager::cancel_phase() {
+    for (const Device& d : devices) {
+        if (d.in_switch) client.cancel(d.client_index, d.command);
+    }
+}
+
+
+void CapacityManager::poll(uint32_t now_ms) {
+    client.poll(host_nanos());
+
+    if (phase == IDLE) {
+        bool changed = tdma.plan(now_ms);
+        if (waiting_retry && now_ms - retry_after_ms >= CAPACITY_RETRY_MS) waiting_retry = false;
+        if ((!changed && !replan) || waiting_retry) return;
+        replan = false;
+
+        bool any = false;
+        for (Device& d : devices) {
+            d.target = target_for(d);
+            d.in_switch = d.target >= 0 && d.target != d.applied;
+            any |= d.in_switch;
+        }
+        if (!any) return;
+
+        phase = STAGING;
+        send_phase(CONTROL_STAGE_TDMA, now_ms);
+        return;
+    }
+
+    bool all_ok;
+    bool done = phase_done(all_ok);
+    bool timed_out = !done && now_ms - phase_start_ms >= CAPACITY_SWITCH_TIMEOUT_MS;
+    if (!done && !timed_out) return;
+
+    if (phase == STAGING) {
+        if (done && all_ok) {
+            statistics.last_stage_ms = now_ms - phase_start_ms;
+            phase = COMMITTING;
+            send_phase(CONTROL_COMMIT_TDMA, now_ms);
+            return;
+        }
+        // Nobody switched. Staged layouts just sit on the boards until the next stage.
+        cancel_phase();
+        statistics.aborted++;
+        phase = IDLE;
+        replan = true;
+        waiting_retry = true;
+        retry_after_ms = now_ms;
+        return;
+    }
+
+    // Committing: whoever acked OK runs the new layout, the rest get it again
+    if (timed_out) cancel_phase();
+    statistics.last_commit_ms = now_ms - phase_start_ms;
+    if (statistics.last_commit_ms > statistics.max_commit_ms) statistics.max_commit_ms = statistics.last_commit_ms;
+    bool failed = false;
+    for (Device& d : devices) {
+        if (!d.in_switch) continue;
+        d.in_switch = false;
+        if (client.device(d.client_index).commands[d.command].status == CONTROL_OK) {
+            d.applied = d.target;
+            statistics.devices_switched++;
+        } else {
+            d.applied = -1;
+            failed = true;
+        }
+    }
+    if (failed) {
+        statistics.partial++;
+        replan = true;
+    } else {
+        statistics.switches++;
+    }
+    phase = IDLE;
+}
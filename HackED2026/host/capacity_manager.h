@@ -0,0 +1,98 @@
+#ifndef CAPACITY_MANAGER_H
+#define CAPACITY_MANAGER_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "control_client.h"
+#include "tdma.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define CAPACITY_SWITCH_TIMEOUT_MS 3000 // A phase not acked by then is abandoned
+#define CAPACITY_RETRY_MS 5000 // Wait after an abandoned switch before the next try
+
+struct CapacityStats {
+    uint32_t switches; // Committed everywhere it had to go
+    uint32_t aborted; // A board rejected or didn't ack the stage, nothing switched
+    uint32_t partial; // A commit failed or timed out, those boards get it again
+    uint32_t devices_switched; // Commits acked, over all switches
+    uint32_t last_stage_ms; // First stage sent to the last stage ack
+    uint32_t last_commit_ms; // First commit sent to the last commit ack: how long the boards disagree
+    uint32_t max_commit_ms;
+};
+
+/// @brief Keeps the modules' TDMA layout at what the TdmaPlanner wants, over
+/// the control channel. A change goes out in two phases: every board that
+/// has to change stages its new layout and checks it (a tag in pipeline mode
+/// rejects it, for one), and only once all of them have acked OK does the
+/// commit go out, in one burst. The boards therefore switch within one
+/// CONTROL_POLL_INTERVAL_MS or so of each other, and a layout some board
+/// can't take never reaches any of them.
+///
+/// Boards that don't have to change are left alone: a tag joining into a
+/// free slot only reconfigures that tag.
+class CapacityManager {
+public:
+    /// @param client Opened by the caller. The manager adds the devices.
+    explicit CapacityManager(ControlClient& client, const TdmaPolicy& policy = TdmaPolicy(), int channel = 1);
+
+    /// @return False if host doesn't parse.
+    bool add_tag(const char* host, uint16_t port, uint8_t id);
+    bool add_anchor(const char* host, uint16_t port, uint8_t id);
+
+    /// @brief Any telemetry from the device. Anchors are ignored.
+    void heard(uint8_t id, uint32_t now_ms);
+
+    /// @brief The device rebooted, e.g. it sent a TELEMETRY_BOOT: its
+    /// module is back on the boot layout and gets the current one again.
+    void restarted(uint8_t id);
+
+    /// @brief Plans, and moves a switch along. Never blocks; call every few
+    /// ms, the sooner after an ack the shorter the switch.
+    void poll(uint32_t now_ms);
+
+    bool switching() const { return phase != IDLE; }
+    const TdmaPlanner& planner() const { return tdma; }
+    const CapacityStats& stats() const { return statistics; }
+
+private:
+    enum Phase { IDLE, STAGING, COMMITTING };
+
+    struct Device {
+        size_t client_index;
+        uint8_t id;
+        bool anchor;
+        int32_t applied; // tdma_pack() of what the module runs, -1 if not known
+        int32_t target;
+        bool in_switch;
+        size_t command; // Index of the current phase's command in the client
+    };
+
+    bool add(const char* host, uint16_t port, uint8_t id, bool anchor);
+    int32_t target_for(const Device& device) const;
+    void send_phase(uint8_t opcode, uint32_t now_ms);
+    /// @return True once no command of the phase is pending.
+    bool phase_done(bool& all_ok);
+    void cancel_phase();
+
+    ControlClient& client;
+    TdmaPlanner tdma;
+    std::vector<Device> devices;
+    Phase phase;
+    bool replan; // A restart or failed commit left some board off the layout
+    uint32_t phase_start_ms;
+    uint32_t retry_after_ms;
+    bool waiting_retry;
+    CapacityStats statistics;
+};
+
+#endif
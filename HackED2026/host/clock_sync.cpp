@@ -0,0 +1,115 @@
+#include "clock_sync.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+
+uint64_t clock_sync_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+ClockSync::ClockSync() {
+    memset(&statistics, 0, sizeof(statistics));
+    reset();
+}
+
+
+void ClockSync::reset() {
+    count = 0;
+    next = 0;
+    last_device_us = 0;
+    memset(&current, 0, sizeof(current));
+    statistics.min_delay_ns = 0;
+    statistics.skew_ppm = 0;
+}
+
+
+void ClockSync::add(uint64_t origin_ns, uint32_t receive_us, uint32_t transmit_us, uint64_t arrival_ns) {
+    uint32_t held_us = transmit_us - receive_us;
+    int64_t round_trip_ns = (int64_t)(arrival_ns - origin_ns) - (int64_t)held_us * 1000;
+    if (arrival_ns < origin_ns || round_trip_ns < 0) {
+        statistics.rejected++;
+        return;
+    }
+
+    // micros() wraps every ~71 min; carry it on in 64 bits from the last sample
+    uint32_t mid_us = receive_us + held_us / 2;
+    uint64_t host_mid_ns = origin_ns / 2 + arrival_ns / 2;
+    uint64_t device_us = mid_us;
+    if (count > 0) {
+        device_us = last_device_us + (int32_t)(mid_us - (uint32_t)last_device_us);
+        // A reboot restarts micros(), and nothing from before carries over
+        uint64_t expected_ns = host_mid_ns;
+        current.to_host_ns(mid_us, expected_ns);
+        int64_t error_ns = (int64_t)(host_mid_ns - expected_ns);
+        if (device_us < last_device_us - std::min<uint64_t>(last_device_us, CLOCK_SYNC_RESTART_US) ||
+            llabs(error_ns) > (int64_t)CLOCK_SYNC_RESTART_US * 1000) {
+            statistics.restarts++;
+            reset();
+            device_us = mid_us;
+        }
+    }
+    last_device_us = device_us;
+
+    Sample& s = samples[next];
+    s.device_us = device_us;
+    s.offset_ns = (int64_t)host_mid_ns - (int64_t)device_us * 1000;
+    s.delay_ns = (uint32_t)std::min<int64_t>(round_trip_ns, UINT32_MAX);
+    next = (next + 1) % CLOCK_SYNC_SAMPLES;
+    if (count < CLOCK_SYNC_SAMPLES) count++;
+    statistics.samples++;
+
+    fit();
+}
+
+
+void ClockSync::fit() {
+    // The quickest exchanges, which waited least at the board
+    Sample best[CLOCK_SYNC_SAMPLES];
+    memcpy(best, samples, count * sizeof(Sample));
+    size_t used = std::min<size_t>(count, CLOCK_SYNC_BEST);
+    std::partial_sort(best, best + used, best + count,
+                      [](const Sample& a, const Sample& b) { return a.delay_ns < b.delay_ns; });
+    statistics.min_delay_ns = best[0].delay_ns;
+
+    // Around the newest sample, so the mapping is most exact for what arrives next
+    uint64_t ref_us = last_device_us;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    uint64_t first = best[0].device_us, last = best[0].device_us;
+    for (size_t i = 0; i < used; i++) {
+        double x = (double)(int64_t)(best[i].device_us - ref_us) / 1e6; // s
+        double y = (double)(best[i].offset_ns - best[0].offset_ns); // ns
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        first = std::min(first, best[i].device_us);
+        last = std::max(last, best[i].device_us);
+    }
+
+    // Too close together for a slope: the single quickest exchange
+    double slope = 0; // ns of offset per s of the board's clock
+    double at_ref = 0;
+    if (used >= 2 && last - first >= CLOCK_SYNC_MIN_SPAN_US) {
+        double denom = used * sxx - sx * sx;
+        if (denom > 0) slope = (used * sxy - sx * sy) / denom;
+        double limit = CLOCK_SYNC_MAX_SKEW_PPM * 1000;
+        slope = std::max(-limit, std::min(limit, slope));
+        at_ref = (sy - slope * sx) / used;
+    }
+
+    current.valid = true;
+    current.ref_device_us = (uint32_t)ref_us;
+    current.ref_host_ns = (uint64_t)((int64_t)ref_us * 1000 + best[0].offset_ns + (int64_t)llround(at_ref));
+    current.ns_per_us = 1000.0 + slope / 1e6;
+    current.uncertainty_ns = best[0].delay_ns / 2;
+    // A fast board's offset shrinks as its clock runs ahead
+    statistics.skew_ppm = -slope / 1000;
+}
@@ -0,0 +1,93 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define CLOCK_SYNC_SAMPLES 32 // Exchanges kept per board, the oldest replaced
+#define CLOCK_SYNC_BEST 8 // Of those, the fit uses the ones with the shortest round trip
+#define CLOCK_SYNC_MIN_SPAN_US 5000000 // Best samples must span this much before a skew is fitted
+#define CLOCK_SYNC_MAX_SKEW_PPM 500.0 // Beyond any crystal, a fit past it is noise
+#define CLOCK_SYNC_RESTART_US 1000000 // micros() this far behind the last sample: the board rebooted
+
+/// @brief Host clock the syncs are stamped with: CLOCK_REALTIME, like the
+/// kernel's SO_TIMESTAMPNS and Aggregator::now_ns().
+uint64_t clock_sync_now_ns();
+
+/// @brief A board's micros() on the host clock, as of the last fit. Small
+/// and copyable, so it can be handed to other threads.
+struct ClockMapping {
+    bool valid;
+    uint32_t ref_device_us;
+    uint64_t ref_host_ns;
+    double ns_per_us; // 1000 plus the board's skew
+    uint32_t uncertainty_ns; // Half the shortest round trip: the offset is within this
+
+    /// @param device_us Within ~35 min of the reference, either way.
+    /// @return False until the first sync reply.
+    bool to_host_ns(uint32_t device_us, uint64_t& host_ns) const {
+        if (!valid) return false;
+        int32_t elapsed = (int32_t)(device_us - ref_device_us);
+        host_ns = ref_host_ns + (int64_t)(elapsed * ns_per_us);
+        return true;
+    }
+};
+
+struct ClockSyncStats {
+    uint32_t samples;
+    uint32_t rejected; // Replies that took less time than the board says it held them
+    uint32_t restarts;
+    uint32_t min_delay_ns; // Shortest round trip, net of the board's hold time, in the window
+    double skew_ppm; // Board clock fast (+) or slow (-) against the host's
+};
+
+/// @brief NTP-style offset and skew for one board's micros(), from the
+/// timestamps of CONTROL_SYNC exchanges (see control.h).
+///
+/// The board only reads its socket every CONTROL_POLL_INTERVAL_MS, so most
+/// exchanges are lopsided: the request waits, the reply doesn't, and the
+/// offset they give is off by up to half the wait. The wait does show in the
+/// round trip, though, so only the CLOCK_SYNC_BEST quickest exchanges in the
+/// window are used. With a second or so between syncs that leaves the
+/// estimate within a fraction of a millisecond on a quiet WiFi link. A line
+/// through them gives the skew once they span CLOCK_SYNC_MIN_SPAN_US.
+class ClockSync {
+public:
+    ClockSync();
+
+    /// @brief One exchange: the request went out at origin_ns and the reply
+    /// came back at arrival_ns, host clock; the board read it at receive_us
+    /// and answered at transmit_us.
+    void add(uint64_t origin_ns, uint32_t receive_us, uint32_t transmit_us, uint64_t arrival_ns);
+
+    const ClockMapping& mapping() const { return current; }
+    const ClockSyncStats& stats() const { return statistics; }
+
+    void reset();
+
+private:
+    struct Sample {
+        uint64_t device_us; // Midpoint of receive and transmit, unwrapped
+        int64_t offset_ns; // Host midpoint minus device midpoint
+        uint32_t delay_ns;
+    };
+
+    void fit();
+
+    Sample samples[CLOCK_SYNC_SAMPLES];
+    size_t count;
+    size_t next;
+    uint64_t last_device_us; // Unwrapped micros() of the newest sample
+    ClockMapping current;
+    ClockSyncStats statistics;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "control_client.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "host_clock.h"
+
+
+ControlClient::ControlClient(uint16_t session)
+    : sock(-1), session(session), next_seq(1), retry_ns((uint64_t)CONTROL_CLIENT_RETRY_MS * 1000000) {
+    if (this->session == 0) this->session = (uint16_t)(host_nanos() >> 10) | 1;
+    memset(&statistics, 0, sizeof(statistics));
+}
+
+
+ControlClient::~ControlClient() {
+    if (sock >= 0) close(sock);
+}
+
+
+bool ControlClient::open() {
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return false;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = 0;
+    if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0) return false;
+    // Sync replies are timed by the kernel, not by when poll() gets to them
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    return fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) == 0;
+}
+
+
+int ControlClient::add_device(const char* host, uint16_t port, uint8_t device_id) {
+    ControlDevice device;
+    memset(&device.addr, 0, sizeof(device.addr));
+    device.addr.sin_family = AF_INET;
+    device.addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &device.addr.sin_addr) != 1) return -1;
+    device.device_id = device_id;
+
+    devices.push_back(device);
+    return (int)devices.size() - 1;
+}
+
+
+size_t ControlClient::queue(size_t device, uint8_t opcode, int32_t arg) {
+    ControlOutcome outcome;
+    memset(&outcome, 0, sizeof(outcome));
+    outcome.command.seq = next_seq++;
+    outcome.command.opcode = opcode;
+    outcome.command.arg = arg;
+    outcome.status = CONTROL_PENDING;
+    devices[device].commands.push_back(outcome);
+    return devices[device].commands.size() - 1;
+}
+
+
+void ControlClient::queue_all(uint8_t opcode, int32_t arg) {
+    for (size_t i = 0; i < devices.size(); i++) queue(i, opcode, arg);
+}
+
+
+void ControlClient::cancel(size_t device, size_t command) {
+    ControlOutcome& c = devices[device].commands[command];
+    if (c.status == CONTROL_PENDING) c.status = CONTROL_STALE;
+}
+
+
+void ControlClient::sync(size_t device) {
+    ControlDevice& d = devices[device];
+    uint8_t packet[CONTROL_HEADER_LEN + CONTROL_SYNC_LEN];
+    size_t len = control_encode_sync(packet, d.device_id, session, clock_sync_now_ns());
+    if (sendto(sock, packet, len, 0, (const sockaddr*)&d.addr, sizeof(d.addr)) == (ssize_t)len) statistics.syncs++;
+}
+
+
+void ControlClient::sync_all() {
+    for (size_t i = 0; i < devices.size(); i++) sync(i);
+}
+
+
+void ControlClient::send_due(ControlDevice& device, uint64_t now_ns) {
+    ControlCommand batch[CONTROL_MAX_COMMANDS];
+    uint8_t packet[CONTROL_MAX_PACKET];
+    size_t count = 0;
+
+    for (size_t i = 0; i <= device.commands.size(); i++) {
+        if (i < device.commands.size()) {
+            ControlOutcome& c = device.commands[i];
+            if (c.status != CONTROL_PENDING || (c.sends && now_ns - c.last_sent_ns < retry_ns)) continue;
+
+            if (c.sends) statistics.resends++;
+            else c.first_sent_ns = now_ns;
+            c.sends++;
+            c.last_sent_ns = now_ns;
+            batch[count++] = c.command;
+            if (count < CONTROL_MAX_COMMANDS) continue;
+        }
+        if (count == 0) continue;
+
+        size_t len = control_encode_commands(packet, device.device_id, session, batch, count);
+        if (sendto(sock, packet, len, 0, (const sockaddr*)&device.addr, sizeof(device.addr)) == (ssize_t)len) {
+            statistics.packets_sent++;
+        }
+        count = 0;
+    }
+}
+
+
+void ControlClient::receive(uint64_t now_ns) {
+    uint8_t buf[CONTROL_CLIENT_MAX_DATAGRAM];
+    uint8_t control[CMSG_SPACE(sizeof(timespec))];
+    ControlAck acks[CONTROL_MAX_ACKS];
+    sockaddr_in from;
+    iovec iov = { buf, sizeof(buf) };
+    msghdr msg;
+    ssize_t n;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if ((n = recvmsg(sock, &msg, 0)) <= 0) break;
+
+        ControlDevice* device = nullptr;
+        for (ControlDevice& d : devices) {
+            if (d.addr.sin_addr.s_addr == from.sin_addr.s_addr && d.addr.sin_port == from.sin_port) device = &d;
+        }
+
+        uint8_t device_id;
+        uint16_t reply_session;
+        ControlSyncReply sync_reply;
+        if (control_decode_sync_reply(buf, (size_t)n, device_id, reply_session, sync_reply)) {
+            if (!device || reply_session != session) continue;
+            uint64_t arrival_ns = clock_sync_now_ns();
+            for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+                if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SO_TIMESTAMPNS) continue;
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                arrival_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+            }
+            device->clock.add(sync_reply.origin, sync_reply.receive_us, sync_reply.transmit_us, arrival_ns);
+            statistics.sync_replies++;
+            continue;
+        }
+
+        int count = control_decode_acks(buf, (size_t)n, device_id, reply_session, acks, CONTROL_MAX_ACKS);
+        if (count < 0 || reply_session != session) {
+            statistics.stray_acks++;
+            continue;
+        }
+        if (!device) {
+            statistics.stray_acks += count;
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            statistics.acks++;
+            ControlOutcome* outcome = nullptr;
+            for (ControlOutcome& c : device->commands) {
+                if (c.command.seq == acks[i].seq) outcome = &c;
+            }
+            if (!outcome) {
+                statistics.stray_acks++;
+                continue;
+            }
+            // Acked again after a resend crossed the first ack: keep the first
+            if (outcome->status != CONTROL_PENDING) continue;
+            // Still pending, it goes out again after the retry interval
+            if (acks[i].status == CONTROL_BUSY) continue;
+
+            outcome->status = acks[i].status;
+            outcome->acked_ns = now_ns;
+        }
+    }
+}
+
+
+bool ControlClient::poll(uint64_t now_ns) {
+    receive(now_ns);
+    for (ControlDevice& device : devices) send_due(device, now_ns);
+
+    for (const ControlDevice& device : devices) {
+        for (const ControlOutcome& c : device.commands) {
+            if (c.status == CONTROL_PENDING) return true;
+        }
+    }
+    return false;
+}
+
+
+bool ControlClient::run(uint32_t timeout_ms, uint32_t retry_ms) {
+    set_retry_ms(retry_ms);
+    uint64_t start = host_nanos();
+    uint64_t timeout_ns = (uint64_t)timeout_ms * 1000000;
+
+    for (;;) {
+        uint64_t now = host_nanos();
+        if (!poll(now)) return true;
+        if (now - start >= timeout_ns) return false;
+
+        // Wake for an ack, or to resend
+        uint64_t wait_ns = retry_ns < timeout_ns - (now - start) ? retry_ns : timeout_ns - (now - start);
+        pollfd fd = { sock, POLLIN, 0 };
+        ::poll(&fd, 1, (int)(wait_ns / 1000000) + 1);
+    }
+}
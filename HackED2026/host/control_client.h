@@ -0,0 +1,112 @@
+#ifndef CONTROL_CLIENT_H
+#define CONTROL_CLIENT_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "clock_sync.h"
+#include "control.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define CONTROL_CLIENT_RETRY_MS 200 // Resend what hasn't been acked after this long
+#define CONTROL_CLIENT_MAX_DATAGRAM 2048
+
+// One command to one device, and what became of it.
+struct ControlOutcome {
+    ControlCommand command;
+    uint8_t status; // ControlStatus, CONTROL_PENDING until acked
+    uint32_t sends; // Packets it went out in
+    uint64_t first_sent_ns;
+    uint64_t last_sent_ns;
+    uint64_t acked_ns;
+};
+
+struct ControlDevice {
+    sockaddr_in addr;
+    uint8_t device_id; // Written into the packets, CONTROL_ANY_DEVICE for whichever board is there
+    std::vector<ControlOutcome> commands;
+    ClockSync clock; // From the replies to sync()
+};
+
+struct ControlClientStats {
+    uint64_t packets_sent;
+    uint64_t resends; // Commands sent again after CONTROL_CLIENT_RETRY_MS or a CONTROL_BUSY
+    uint64_t acks;
+    uint64_t stray_acks; // For another session, an unknown seq, or from no known device
+    uint64_t syncs;
+    uint64_t sync_replies;
+};
+
+/// @brief The laptop's end of the control protocol, see control.h. Talks to
+/// any number of boards from one non-blocking socket: every command gets a
+/// seq from one counter, each board gets its commands batched into one
+/// packet, and anything not acked is resent with the same seq until it is.
+class ControlClient {
+public:
+    /// @param session Should differ between runs, see control.h. 0 picks one
+    /// from the clock.
+    explicit ControlClient(uint16_t session = 0);
+    ~ControlClient();
+
+    /// @brief Opens the socket on an ephemeral port.
+    /// @return False on a socket error, see errno.
+    bool open();
+
+    /// @brief host is a dotted IPv4 address.
+    /// @return The device's index, or -1 if host doesn't parse.
+    int add_device(const char* host, uint16_t port, uint8_t device_id = CONTROL_ANY_DEVICE);
+
+    /// @brief Queues a command for one device.
+    /// @return Its index in the device's commands, where its outcome will be.
+    size_t queue(size_t device, uint8_t opcode, int32_t arg);
+    /// @brief Queues the command for every device, each with its own seq.
+    void queue_all(uint8_t opcode, int32_t arg);
+    /// @brief Stops resending a command that is still pending and marks it
+    /// CONTROL_STALE: the board may or may not have run it.
+    void cancel(size_t device, size_t command);
+
+    /// @brief Sends one clock sync to the device now, see ClockSync. Not
+    /// resent: a lost one is a sample fewer.
+    void sync(size_t device);
+    void sync_all();
+
+    /// @brief Sends what is due and reads every ack and sync reply waiting.
+    /// Never blocks.
+    /// @return True while some command isn't acked.
+    bool poll(uint64_t now_ns);
+
+    /// @brief Polls until every command is acked or timeout_ms has passed,
+    /// sleeping in poll(2) in between.
+    /// @return True if everything was acked.
+    bool run(uint32_t timeout_ms, uint32_t retry_ms = CONTROL_CLIENT_RETRY_MS);
+
+    void set_retry_ms(uint32_t ms) { retry_ns = (uint64_t)ms * 1000000; }
+
+    uint16_t session_id() const { return session; }
+    size_t device_count() const { return devices.size(); }
+    const ControlDevice& device(size_t i) const { return devices[i]; }
+    const ControlClientStats& stats() const { return statistics; }
+
+private:
+    void send_due(ControlDevice& device, uint64_t now_ns);
+    void receive(uint64_t now_ns);
+
+    int sock;
+    uint16_t session;
+    uint32_t next_seq;
+    uint64_t retry_ns;
+    std::vector<ControlDevice> devices;
+    ControlClientStats statistics;
+};
+
+#endif
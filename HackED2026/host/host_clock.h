@@ -0,0 +1,20 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdint.h>
+#include <chrono>
+
+/// @brief Stand-in for the Arduino micros() on the host. Wraps at 32 bits just
+/// like the board does, so the same unsigned subtraction works on both.
+inline uint32_t host_micros() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+inline uint64_t host_nanos() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
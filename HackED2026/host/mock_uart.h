@@ -0,0 +1,126 @@
+#ifndef MOCK_UART_H
+#define MOCK_UART_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "at_engine.h"
+#include "host_clock.h"
+
+/// @brief Host-side stand-in for SERIAL_AT. Answers commands from a table of
+/// canned replies after a configurable delay, the way the DW3000 AT firmware
+/// would, so the AT engine can be built and timed without a board.
+class MockUart : public AtPort {
+public:
+    struct Rule {
+        /// @brief Matched against the start of each command written.
+        std::string prefix;
+        /// @brief Sent back verbatim, lines separated by \r\n.
+        std::string reply;
+        uint32_t latency_us;
+    };
+
+    MockUart() : default_reply("OK"), default_latency_us(2000), busy_until_us(0) {}
+
+    /// @brief Replies to anything starting with `prefix`. Later rules win.
+    void on(const std::string& prefix, const std::string& reply, uint32_t latency_us) {
+        rules.push_back(Rule{ prefix, reply, latency_us });
+    }
+
+    /// @brief What unmatched commands get back.
+    void set_default(const std::string& reply, uint32_t latency_us) {
+        default_reply = reply;
+        default_latency_us = latency_us;
+    }
+
+    /// @brief Commands starting with `prefix` reset the module: after the reply
+    /// it ignores everything for `down_us`, like AT+RESTART does.
+    void on_reset(const std::string& prefix, uint32_t down_us) {
+        resets.push_back(Reset{ prefix, down_us });
+    }
+
+    /// @brief Queues a line the module sends on its own, e.g. an AT+RANGE report.
+    void inject(const std::string& line, uint32_t delay_us) {
+        schedule(line + "\r\n", delay_us);
+    }
+
+    int available() override {
+        release_due();
+        return (int)(rx.size() - rx_pos);
+    }
+
+    int read() override {
+        release_due();
+        if (rx_pos >= rx.size()) return -1;
+        return (unsigned char)rx[rx_pos++];
+    }
+
+    void write_line(const char* line) override {
+        written.push_back(line);
+
+        // Still rebooting, the command is lost
+        if ((int32_t)(host_micros() - busy_until_us) < 0) return;
+
+        const Rule* match = nullptr;
+        for (const Rule& rule : rules) {
+            if (std::string(line).compare(0, rule.prefix.size(), rule.prefix) == 0) match = &rule;
+        }
+
+        uint32_t latency = match ? match->latency_us : default_latency_us;
+        schedule((match ? match->reply : default_reply) + "\r\n", latency);
+
+        for (const Reset& reset : resets) {
+            if (std::string(line).compare(0, reset.prefix.size(), reset.prefix) == 0) {
+                busy_until_us = host_micros() + latency + reset.down_us;
+            }
+        }
+    }
+
+    /// @brief Every command written so far, in order.
+    std::vector<std::string> written;
+
+private:
+    struct Pending {
+        uint32_t due_us;
+        std::string bytes;
+    };
+
+    void schedule(const std::string& bytes, uint32_t delay_us) {
+        pending.push_back(Pending{ host_micros() + delay_us, bytes });
+    }
+
+    void release_due() {
+        uint32_t now = host_micros();
+        // Replies leave in order, like a real UART, even if a later one is due sooner
+        while (!pending.empty() && (int32_t)(now - pending.front().due_us) >= 0) {
+            rx += pending.front().bytes;
+            pending.pop_front();
+        }
+
+        if (rx_pos > 4096) {
+            rx.erase(0, rx_pos);
+            rx_pos = 0;
+        }
+    }
+
+    struct Reset {
+        std::string prefix;
+        uint32_t down_us;
+    };
+
+    std::vector<Rule> rules;
+    std::vector<Reset> resets;
+    std::string default_reply;
+    uint32_t default_latency_us;
+    uint32_t busy_until_us;
+    std::deque<Pending> pending;
+    std::string rx;
+    size_t rx_pos = 0;
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include "range_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+#include "wire_format.h"
+
+static size_t padded(size_t len) { return (len + 7) & ~(size_t)7; }
+
+static uint64_t realtime_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool write_all(int fd, const uint8_t* p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+
+////////////
+// WRITER //
+////////////
+
+RangeLogWriter::RangeLogWriter()
+    : fd(-1), used(0), offset(0), last_flush_ns(0), record_count(0), chunk_records(RANGE_LOG_CHUNK_RECORDS) {}
+
+
+RangeLogWriter::~RangeLogWriter() { close(); }
+
+
+bool RangeLogWriter::open(const char* path, uint32_t records_per_chunk) {
+    close();
+    fd = ::open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) return false;
+
+    chunk_records = records_per_chunk ? records_per_chunk : RANGE_LOG_CHUNK_RECORDS;
+    buffer.assign(RANGE_LOG_BUFFER, 0);
+    chunks.clear();
+    record_count = 0;
+    offset = 0;
+    last_flush_ns = realtime_ns();
+
+    uint8_t* h = buffer.data();
+    memset(h, 0, RANGE_LOG_HEADER_LEN);
+    put_u32(h, RANGE_LOG_MAGIC);
+    put_u16(h + 4, RANGE_LOG_VERSION);
+    put_u16(h + 6, RANGE_LOG_HEADER_LEN);
+    put_u64(h + 8, last_flush_ns);
+    put_u32(h + 16, chunk_records);
+    used = RANGE_LOG_HEADER_LEN;
+    return true;
+}
+
+
+bool RangeLogWriter::append(uint64_t received_ns, uint32_t source, const uint8_t* data, size_t len) {
+    if (fd < 0 || len > UINT16_MAX) return false;
+
+    size_t record_len = padded(RANGE_LOG_RECORD_LEN + len);
+    if (used + record_len > buffer.size()) {
+        if (!flush()) return false;
+        if (record_len > buffer.size()) buffer.resize(record_len);
+    }
+
+    if (record_count % chunk_records == 0) {
+        RangeLogChunk chunk = { offset + used, received_ns, 0 };
+        chunks.push_back(chunk);
+    }
+    chunks.back().records++;
+
+    TelemetryHeader header;
+    bool telemetry = telemetry_decode_header(data, len, header);
+
+    uint8_t* r = buffer.data() + used;
+    put_u64(r, received_ns);
+    put_u32(r + 8, source);
+    put_u16(r + 12, (uint16_t)len);
+    r[14] = telemetry ? header.device_id : 0;
+    r[15] = telemetry ? header.type : 0;
+    memcpy(r + RANGE_LOG_RECORD_LEN, data, len);
+    memset(r + RANGE_LOG_RECORD_LEN + len, 0, record_len - RANGE_LOG_RECORD_LEN - len);
+    used += record_len;
+    record_count++;
+
+    if (received_ns - last_flush_ns > RANGE_LOG_FLUSH_NS) return flush();
+    return true;
+}
+
+
+bool RangeLogWriter::flush() {
+    if (fd < 0) return false;
+    last_flush_ns = realtime_ns();
+    if (used == 0) return true;
+    if (!write_all(fd, buffer.data(), used)) return false;
+    offset += used;
+    used = 0;
+    return true;
+}
+
+
+bool RangeLogWriter::close() {
+    if (fd < 0) return true;
+    bool ok = flush();
+
+    // Index and footer go through the buffer too, it is empty now
+    size_t index_len = chunks.size() * RANGE_LOG_CHUNK_LEN + RANGE_LOG_FOOTER_LEN;
+    if (buffer.size() < index_len) buffer.resize(index_len);
+    uint8_t* p = buffer.data();
+    for (const RangeLogChunk& chunk : chunks) {
+        put_u64(p, chunk.offset);
+        put_u64(p + 8, chunk.first_ns);
+        put_u32(p + 16, chunk.records);
+        put_u32(p + 20, 0);
+        p += RANGE_LOG_CHUNK_LEN;
+    }
+    put_u64(p, offset);
+    put_u64(p + 8, record_count);
+    put_u32(p + 16, (uint32_t)chunks.size());
+    put_u32(p + 20, RANGE_LOG_INDEX_MAGIC);
+    ok = ok && write_all(fd, buffer.data(), index_len);
+
+    ok = ::close(fd) == 0 && ok;
+    fd = -1;
+    buffer.clear();
+    buffer.shrink_to_fit();
+    return ok;
+}
+
+
+////////////
+// READER //
+////////////
+
+RangeLogReader::RangeLogReader()
+    : data(nullptr), length(0), header_len(0), end(0), record_count(0), newest_ns(0), footer_found(false) {}
+
+
+RangeLogReader::~RangeLogReader() { close(); }
+
+
+bool RangeLogReader::open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < RANGE_LOG_HEADER_LEN) {
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    data = (const uint8_t*)map;
+    length = (size_t)st.st_size;
+    header_len = get_u16(data + 6);
+    if (get_u32(data) != RANGE_LOG_MAGIC || get_u16(data + 4) != RANGE_LOG_VERSION ||
+        header_len < RANGE_LOG_HEADER_LEN || header_len > length) {
+        close();
+        return false;
+    }
+
+    footer_found = load_index();
+    if (!footer_found) rebuild_index();
+    return true;
+}
+
+
+void RangeLogReader::close() {
+    if (data) munmap((void*)data, length);
+    data = nullptr;
+    length = 0;
+    index.clear();
+    record_count = 0;
+    newest_ns = 0;
+}
+
+
+uint64_t RangeLogReader::first_ns() const { return index.empty() ? 0 : index.front().first_ns; }
+
+
+bool RangeLogReader::load_index() {
+    if (length < header_len + RANGE_LOG_FOOTER_LEN) return false;
+    const uint8_t* footer = data + length - RANGE_LOG_FOOTER_LEN;
+    if (get_u32(footer + 20) != RANGE_LOG_INDEX_MAGIC) return false;
+
+    uint64_t index_offset = get_u64(footer);
+    uint32_t chunk_count = get_u32(footer + 16);
+    if (index_offset < header_len ||
+        index_offset + (uint64_t)chunk_count * RANGE_LOG_CHUNK_LEN + RANGE_LOG_FOOTER_LEN != length) {
+        return false;
+    }
+
+    index.resize(chunk_count);
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        const uint8_t* p = data + index_offset + c * RANGE_LOG_CHUNK_LEN;
+        index[c].offset = get_u64(p);
+        index[c].first_ns = get_u64(p + 8);
+        index[c].records = get_u32(p + 16);
+    }
+    end = index_offset;
+    record_count = get_u64(footer + 8);
+
+    // Only the last chunk needs walking to find the newest record
+    newest_ns = 0;
+    if (!index.empty()) {
+        uint64_t offset = index.back().offset;
+        RangeLogRecord record;
+        while (next(offset, record)) newest_ns = record.received_ns;
+    }
+    return true;
+}
+
+
+void RangeLogReader::rebuild_index() {
+    uint32_t chunk_records = get_u32(data + 16);
+    if (chunk_records == 0) chunk_records = RANGE_LOG_CHUNK_RECORDS;
+
+    index.clear();
+    record_count = 0;
+    end = length; // next() stops at the first record cut short
+    uint64_t offset = header_len;
+    uint64_t start = offset;
+    RangeLogRecord record;
+
+    while (next(offset, record)) {
+        if (record_count % chunk_records == 0) {
+            RangeLogChunk chunk = { start, record.received_ns, 0 };
+            index.push_back(chunk);
+        }
+        index.back().records++;
+        record_count++;
+        newest_ns = record.received_ns;
+        start = offset;
+    }
+    end = start;
+}
+
+
+uint64_t RangeLogReader::seek(uint64_t ns) const {
+    // Last chunk starting at or before ns, then walk forward within it
+    size_t lo = 0, hi = index.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index[mid].first_ns <= ns) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return header_len;
+
+    uint64_t offset = index[lo - 1].offset;
+    RangeLogRecord record;
+    for (uint64_t at = offset; next(at, record); offset = at) {
+        if (record.received_ns >= ns) break;
+    }
+    return offset;
+}
+
+
+bool RangeLogReader::next(uint64_t& offset, RangeLogRecord& out) const {
+    if (offset + RANGE_LOG_RECORD_LEN > end) return false;
+    const uint8_t* r = data + offset;
+    out.len = get_u16(r + 12);
+    size_t record_len = padded(RANGE_LOG_RECORD_LEN + out.len);
+    if (offset + record_len > end) return false;
+
+    out.received_ns = get_u64(r);
+    out.source = get_u32(r + 8);
+    out.device_id = r[14];
+    out.type = r[15];
+    out.data = r + RANGE_LOG_RECORD_LEN;
+    offset += record_len;
+    return true;
+}
@@ -0,0 +1,149 @@
+#ifndef RANGE_LOG_H
+#define RANGE_LOG_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// Append-only capture of every datagram that reached the host, for replaying
+// a field session offline. All fields little-endian, records 8-byte aligned:
+//
+//   header (32 bytes)
+//     u32 magic         RANGE_LOG_MAGIC
+//     u16 version       RANGE_LOG_VERSION
+//     u16 header_len    offset of the first record
+//     u64 created_ns    CLOCK_REALTIME
+//     u32 chunk_records records per index chunk
+//     u8  reserved[12]
+//   record (RANGE_LOG_RECORD_LEN + len bytes, padded to 8), repeated
+//     u64 received_ns   when the datagram arrived, CLOCK_REALTIME
+//     u32 source        sender's IPv4 address, host byte order
+//     u16 len           payload bytes
+//     u8  device_id     from the telemetry header, 0 when type is 0
+//     u8  type          TelemetryType, 0 if the payload isn't telemetry
+//     u8  payload[len]  the datagram as received
+//   chunk index, written by close()
+//     (u64 offset, u64 first_ns, u32 records, u32 reserved), one per chunk
+//   footer (24 bytes), the last bytes of the file
+//     u64 index_offset
+//     u64 records
+//     u32 chunk_count
+//     u32 magic         RANGE_LOG_INDEX_MAGIC
+//
+// A log whose recorder died has no index or footer. The reader rebuilds the
+// index by walking the records, and stops at a record cut short.
+
+#define RANGE_LOG_MAGIC 0x4C425755 // "UWBL"
+#define RANGE_LOG_INDEX_MAGIC 0x49425755 // "UWBI"
+#define RANGE_LOG_VERSION 1
+#define RANGE_LOG_HEADER_LEN 32
+#define RANGE_LOG_RECORD_LEN 16
+#define RANGE_LOG_CHUNK_LEN 24
+#define RANGE_LOG_FOOTER_LEN 24
+#define RANGE_LOG_CHUNK_RECORDS 4096
+#define RANGE_LOG_BUFFER (1 << 20) // Bytes buffered before a write()
+#define RANGE_LOG_FLUSH_NS 1000000000ULL // A quiet recorder still hits the disk this often
+
+struct RangeLogRecord {
+    uint64_t received_ns;
+    uint32_t source;
+    uint8_t device_id;
+    uint8_t type;
+    uint16_t len;
+    const uint8_t* data; // Into the reader's mapping, valid until close()
+};
+
+struct RangeLogChunk {
+    uint64_t offset;
+    uint64_t first_ns;
+    uint32_t records;
+};
+
+/// @brief Writes a log. Not thread-safe; the aggregator serializes its workers.
+class RangeLogWriter {
+public:
+    RangeLogWriter();
+    ~RangeLogWriter();
+
+    /// @brief Creates (or truncates) the log. False (with errno set) on failure.
+    bool open(const char* path, uint32_t chunk_records = RANGE_LOG_CHUNK_RECORDS);
+
+    /// @brief Records one datagram. Buffered; it reaches the file within
+    /// RANGE_LOG_BUFFER bytes or RANGE_LOG_FLUSH_NS.
+    bool append(uint64_t received_ns, uint32_t source, const uint8_t* data, size_t len);
+
+    bool flush();
+
+    /// @brief Flushes and writes the index and footer.
+    bool close();
+
+    bool is_open() const { return fd >= 0; }
+    uint64_t records() const { return record_count; }
+    uint64_t bytes() const { return offset + used; }
+
+private:
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t used;
+    uint64_t offset; // File offset of buffer[0]
+    uint64_t last_flush_ns;
+    uint64_t record_count;
+    uint32_t chunk_records;
+    std::vector<RangeLogChunk> chunks;
+};
+
+/// @brief Reads a log through a read-only mapping, records are never copied.
+/// Reading is const, so several threads can walk one log at once.
+class RangeLogReader {
+public:
+    RangeLogReader();
+    ~RangeLogReader();
+
+    /// @brief False if the file can't be mapped or isn't a log.
+    bool open(const char* path);
+    void close();
+
+    /// @brief False if the index had to be rebuilt, i.e. the recorder didn't
+    /// close the log.
+    bool indexed() const { return footer_found; }
+
+    uint64_t records() const { return record_count; }
+    const std::vector<RangeLogChunk>& chunks() const { return index; }
+    uint64_t first_ns() const;
+    uint64_t last_ns() const { return newest_ns; }
+
+    /// @brief Offset of the first record.
+    uint64_t begin() const { return header_len; }
+
+    /// @brief Offset of the first record received at or after ns, through
+    /// the chunk index.
+    uint64_t seek(uint64_t ns) const;
+
+    /// @brief Reads the record at offset and moves offset past it.
+    /// @return False at the end of the records.
+    bool next(uint64_t& offset, RangeLogRecord& out) const;
+
+private:
+    bool load_index();
+    void rebuild_index();
+
+    const uint8_t* data;
+    size_t length;
+    uint64_t header_len;
+    uint64_t end; // Offset just past the last record
+    uint64_t record_count;
+    uint64_t newest_ns;
+    bool footer_found;
+    std::vector<RangeLogChunk> index;
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include "sim_network.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#include "host_clock.h"
+
+static const char SIM_VERSION_REPLY[] = "getver software:1.1.8,hardware:1.0.0";
+
+static bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// Comma separated ints after the '='
+static std::vector<int> arguments(const std::string& command) {
+    std::vector<int> out;
+    size_t eq = command.find('=');
+    if (eq == std::string::npos) return out;
+
+    const char* p = command.c_str() + eq + 1;
+    while (*p) {
+        char* end;
+        long v = strtol(p, &end, 10);
+        if (end == p) break;
+        out.push_back((int)v);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return out;
+}
+
+
+////////////
+// MODULE //
+////////////
+
+SimModule::SimModule(SimNetwork& network, double x, double y, double z)
+    : x(x), y(y), z(z), network(network) {
+    flash = live;
+}
+
+
+SimModule::Config SimModule::config() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return live;
+}
+
+
+void SimModule::release_due(uint32_t now_us) {
+    // Output leaves in order, like a real UART, even if a later line is due sooner
+    while (!pending.empty() && (int32_t)(now_us - pending.front().due_us) >= 0) {
+        rx += pending.front().bytes;
+        bytes_out += pending.front().bytes.size();
+        pending.pop_front();
+    }
+
+    if (rx_pos > 4096) {
+        rx.erase(0, rx_pos);
+        rx_pos = 0;
+    }
+}
+
+
+int SimModule::available() {
+    int n;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release_due(host_micros());
+        n = (int)(rx.size() - rx_pos);
+    }
+    // The firmware spins on available(); let the other simulated boards run
+    if (n == 0) std::this_thread::yield();
+    return n;
+}
+
+
+int SimModule::read() {
+    std::lock_guard<std::mutex> lock(mutex);
+    release_due(host_micros());
+    if (rx_pos >= rx.size()) return -1;
+    return (unsigned char)rx[rx_pos++];
+}
+
+
+size_t SimModule::read(char* out, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex);
+    release_due(host_micros());
+    size_t n = rx.size() - rx_pos < len ? rx.size() - rx_pos : len;
+    memcpy(out, rx.data() + rx_pos, n);
+    rx_pos += n;
+    return n;
+}
+
+
+void SimModule::emit(const std::string& line, uint32_t delay_us) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(Pending{ host_micros() + delay_us, line + "\r\n" });
+}
+
+
+std::string SimModule::reply(const std::string& command, uint32_t& latency_us) {
+    const SimTiming& t = network.timing();
+    std::vector<int> args = arguments(command);
+    latency_us = t.reply_us;
+
+    if (command == "AT?" || command == "AT") return "OK";
+    if (command == "AT+GETVER?") return std::string(SIM_VERSION_REPLY) + "\r\nOK";
+
+    if (starts_with(command, "AT+SETCFG=") && args.size() >= 2) {
+        live.id = args[0];
+        live.role = args[1];
+        return "OK";
+    }
+    if (starts_with(command, "AT+SETCAP=") && args.size() >= 2) {
+        live.tag_capacity = args[0];
+        live.slot_ms = args[1];
+        return "OK";
+    }
+    if (starts_with(command, "AT+SETRPT=") && args.size() >= 1) {
+        live.report = args[0];
+        return "OK";
+    }
+    if (starts_with(command, "AT+SETANT=") && args.size() >= 1) {
+        live.antenna_delay = args[0];
+        return "OK";
+    }
+    if (command == "AT+GETANT?") return "getant:" + std::to_string(live.antenna_delay) + "\r\nOK";
+
+    if (command == "AT+SAVE") {
+        latency_us = t.save_us;
+        flash = live;
+        return "OK";
+    }
+    if (command == "AT+RESTORE") {
+        latency_us = t.restore_us;
+        live = flash = Config();
+        return "OK";
+    }
+    if (command == "AT+RESTART") {
+        latency_us = t.restart_us;
+        live = flash;
+        busy_until_us = host_micros() + t.restart_us + t.reboot_us;
+        return "OK";
+    }
+
+    return "ERR";
+}
+
+
+void SimModule::write_line(const char* text) {
+    std::string command(text);
+    std::string data;
+    bool send_data = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands++;
+
+        // Still rebooting, the command is lost
+        if ((int32_t)(host_micros() - busy_until_us) < 0) {
+            commands_ignored++;
+            return;
+        }
+
+        uint32_t latency = 0;
+        std::string out;
+
+        if (starts_with(command, "AT+DATA=")) {
+            // AT+DATA=<len>,<message>
+            size_t comma = command.find(',');
+            if (comma != std::string::npos) {
+                data = command.substr(comma + 1);
+                send_data = true;
+                data_sent++;
+            }
+            latency = network.timing().reply_us;
+            out = send_data ? "OK" : "ERR";
+        } else {
+            out = reply(command, latency);
+        }
+
+        pending.push_back(Pending{ host_micros() + latency, out + "\r\n" });
+    }
+
+    // Outside the lock, the network locks the other modules
+    if (send_data) network.broadcast(*this, data);
+}
+
+
+/////////////
+// NETWORK //
+/////////////
+
+SimNetwork::SimNetwork(const SimTiming& timing, const SimNoise& noise, uint32_t seed)
+    : time(timing), noise(noise), rng(seed) {
+    interval_us = time.range_period_us;
+}
+
+
+SimModule& SimNetwork::add_module(double x, double y, double z) {
+    std::lock_guard<std::mutex> lock(mutex);
+    modules.emplace_back(new SimModule(*this, x, y, z));
+    return *modules.back();
+}
+
+
+void SimNetwork::broadcast(SimModule& sender, const std::string& message) {
+    int sender_id = sender.config().id;
+    char line[160];
+    // AT+RDATA=<sender>,<rssi>,<x>,<len>,<message>
+    snprintf(line, sizeof(line), "AT+RDATA=%d,-72,0,%u,%s", sender_id, (unsigned)message.size(),
+             message.c_str());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    for (auto& m : modules) {
+        if (m.get() == &sender) continue;
+        if (uniform(rng) < noise.data_loss) continue;
+
+        uint32_t delay = time.data_latency_us + (uint32_t)(uniform(rng) * time.data_jitter_us);
+        m->emit(line, delay);
+        m->data_received++;
+    }
+}
+
+
+std::string SimNetwork::range_report(SimModule& tag, const SimModule::Config& tag_config) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> gauss(0, noise.range_sigma_cm);
+
+    int ranges[NUM_ANCHORS] = { 0 };
+    double rssi[NUM_ANCHORS] = { 0 };
+    unsigned mask = 0;
+
+    for (auto& m : modules) {
+        SimModule::Config c = m->config();
+        if (c.role != 1 || c.id < 0 || c.id >= NUM_ANCHORS) continue;
+        if (c.tag_capacity != tag_config.tag_capacity || c.slot_ms != tag_config.slot_ms) continue;
+        if (uniform(rng) < noise.range_dropout) continue;
+
+        double dx = tag.x - m->x, dy = tag.y - m->y, dz = tag.z - m->z;
+        double d = sqrt(dx * dx + dy * dy + dz * dz);
+        // Both ends' antenna delays add to the measured time of flight
+        double bias = (2 * SIM_TRUE_ANTENNA_DELAY - tag_config.antenna_delay - c.antenna_delay) *
+                      noise.cm_per_delay_unit / 2;
+        double r = d + bias + gauss(rng);
+
+        ranges[c.id] = r < 1 ? 1 : (int)lround(r);
+        rssi[c.id] = -60.0 - 20.0 * log10(1.0 + d / 100.0) + gauss(rng) * 0.2;
+        mask |= 1u << c.id;
+    }
+
+    char line[256];
+    int n = snprintf(line, sizeof(line), "AT+RANGE=tid:%d,mask:%02X,seq:%u,range:(", tag_config.id, mask,
+                     tag.range_seq++);
+    for (int a = 0; a < NUM_ANCHORS; a++) n += snprintf(line + n, sizeof(line) - n, a ? ",%d" : "%d", ranges[a]);
+    n += snprintf(line + n, sizeof(line) - n, "),rssi:(");
+    for (int a = 0; a < NUM_ANCHORS; a++) n += snprintf(line + n, sizeof(line) - n, a ? ",%.2f" : "%.2f", rssi[a]);
+    snprintf(line + n, sizeof(line) - n, ")");
+    return line;
+}
+
+
+void SimNetwork::step(uint32_t now_us) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    std::vector<SimModule::Config> configs;
+    for (auto& m : modules) configs.push_back(m->config());
+
+    size_t slotted = 0;
+    uint32_t slowest_us = 0;
+    uint64_t lost_to_collisions = 0;
+    for (size_t i = 0; i < modules.size(); i++) {
+        const SimModule::Config& c = configs[i];
+        if (c.role != 0 || !c.report) continue;
+        if (c.id < 0 || c.id >= c.tag_capacity) continue; // No slot in its own superframe
+
+        // Ranges only with anchors on the same schedule, and a slot another
+        // tag also thinks is its own gets neither through
+        bool anchor = false, shared = false;
+        for (size_t j = 0; j < modules.size(); j++) {
+            const SimModule::Config& o = configs[j];
+            bool same_schedule = o.tag_capacity == c.tag_capacity && o.slot_ms == c.slot_ms;
+            if (o.role == 1) anchor |= same_schedule;
+            else if (j != i && o.report && o.id == c.id) shared = true;
+        }
+        if (!anchor) continue;
+
+        uint32_t superframe_us = (uint32_t)(c.tag_capacity * c.slot_ms * 1000);
+        uint32_t period_us = superframe_us > time.range_period_us ? superframe_us : time.range_period_us;
+        if (!shared) {
+            slotted++;
+            if (period_us > slowest_us) slowest_us = period_us;
+        }
+
+        SimModule& m = *modules[i];
+        bool due;
+        {
+            std::lock_guard<std::mutex> module_lock(m.mutex);
+            if ((int32_t)(now_us - m.busy_until_us) < 0) continue;
+            if (!m.booted) {
+                // First report lands somewhere in the first superframe
+                m.booted = true;
+                m.next_range_us = now_us + (uint32_t)(uniform(rng) * period_us);
+            }
+            due = (int32_t)(now_us - m.next_range_us) >= 0;
+            if (due) {
+                m.next_range_us += period_us;
+                // Fell more than a superframe behind, e.g. after a reconfigure
+                if ((int32_t)(now_us - m.next_range_us) >= 0) m.next_range_us = now_us + period_us;
+            }
+        }
+        if (!due) continue;
+        if (shared) {
+            lost_to_collisions++;
+            continue;
+        }
+
+        m.emit(range_report(m, c), 0);
+        m.ranges_sent++;
+    }
+
+    active = slotted;
+    interval_us = slowest_us ? slowest_us : time.range_period_us;
+    collisions += lost_to_collisions;
+}
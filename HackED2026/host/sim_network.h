@@ -0,0 +1,161 @@
+#ifndef SIM_NETWORK_H
+#define SIM_NETWORK_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "at_engine.h"
+#include "uwb_config.h"
+
+/// @brief Everything about the simulated radio and AT firmware that a run may
+/// want to change. The defaults are rough figures for the DW3000 modules.
+struct SimTiming {
+    uint32_t reply_us = 2000; // Ordinary AT command round trip
+    uint32_t save_us = 40000; // AT+SAVE, a flash write
+    uint32_t restore_us = 150000; // AT+RESTORE
+    uint32_t restart_us = 20000; // AT+RESTART answers OK, then...
+    uint32_t reboot_us = 300000; // ...ignores everything for this long
+    /// @brief Shortest time between two AT+RANGE reports of one tag. The real
+    /// interval is at least the tag's superframe, see SimNetwork.
+    uint32_t range_period_us = 100000;
+    uint32_t data_latency_us = 15000; // AT+DATA waits for the next slot
+    uint32_t data_jitter_us = 10000;
+};
+
+/// @brief How far the simulated ranges are from the truth.
+struct SimNoise {
+    double range_sigma_cm = 5.0;
+    /// @brief Chance an anchor is missing from a report (0 range, mask bit clear).
+    double range_dropout = 0.05;
+    /// @brief Chance an AT+DATA broadcast never reaches a given module.
+    double data_loss = 0.0;
+    /// @brief Range bias per antenna delay unit away from SIM_TRUE_ANTENNA_DELAY.
+    /// A higher delay gives a shorter range, like on the real modules.
+    double cm_per_delay_unit = 0.469;
+};
+
+#define SIM_TRUE_ANTENNA_DELAY 16450
+#define SIM_DEFAULT_ANTENNA_DELAY 16384
+
+class SimNetwork;
+
+/// @brief One emulated UWB module. Implements AtPort, so an AtEngine (or the
+/// pipeline's IngestStage) can drive it exactly like SERIAL_AT. Understands the
+/// commands the firmware sends: AT?, AT+GETVER?, AT+SETCFG, AT+SETCAP,
+/// AT+SETRPT, AT+SETANT / AT+GETANT?, AT+SAVE, AT+RESTORE, AT+RESTART and
+/// AT+DATA. Thread-safe: the device thread reads, the network thread writes.
+class SimModule : public AtPort {
+public:
+    struct Config {
+        int id = 0;
+        int role = 0; // 0: tag, 1: anchor
+        int tag_capacity = UWB_TAG_COUNT;
+        int slot_ms = 10;
+        int report = 0;
+        int antenna_delay = SIM_DEFAULT_ANTENNA_DELAY;
+    };
+
+    SimModule(SimNetwork& network, double x, double y, double z = 0);
+
+    int available() override;
+    int read() override;
+    void write_line(const char* line) override;
+
+    /// @brief Reads up to len bytes at once, like HardwareSerial::read(buf, len).
+    size_t read(char* out, size_t len);
+
+    /// @brief The live config, i.e. what the firmware last set.
+    Config config();
+    double x, y, z;
+
+    // Counters, read after the run
+    uint64_t bytes_out = 0;
+    uint64_t ranges_sent = 0;
+    uint64_t data_sent = 0;
+    uint64_t data_received = 0;
+    uint64_t commands = 0;
+    uint64_t commands_ignored = 0; // Written while rebooting
+
+private:
+    friend class SimNetwork;
+
+    /// @brief Queues module output, released once due.
+    void emit(const std::string& line, uint32_t delay_us);
+    void release_due(uint32_t now_us);
+    std::string reply(const std::string& command, uint32_t& latency_us);
+
+    SimNetwork& network;
+    std::mutex mutex;
+    Config live;
+    Config flash;
+    uint32_t busy_until_us = 0;
+    bool booted = false;
+    uint32_t next_range_us = 0;
+    uint32_t range_seq = 0;
+
+    struct Pending {
+        uint32_t due_us;
+        std::string bytes;
+    };
+    std::deque<Pending> pending;
+    std::string rx;
+    size_t rx_pos = 0;
+};
+
+/// @brief The shared air: places modules, produces AT+RANGE reports for every
+/// tag with reporting on, and carries AT+DATA between modules as AT+RDATA.
+///
+/// TDMA is modelled like the AT firmware schedules it, see tdma.h: a tag's
+/// slot is its module id, and it reports once per superframe of its own
+/// AT+SETCAP capacity times slot_ms (or range_period_us, if that is longer).
+/// A tag whose id is at or past its capacity gets no slot, it only ranges
+/// with anchors whose AT+SETCAP matches its own, and two tags with one id
+/// collide and both lose the report.
+class SimNetwork {
+public:
+    SimNetwork(const SimTiming& timing, const SimNoise& noise, uint32_t seed = 1);
+
+    /// @brief Adds a module at (x, y, z) cm. Owned by the network.
+    SimModule& add_module(double x, double y, double z = 0);
+
+    /// @brief Produces due range reports and data. Call every millisecond or so.
+    void step(uint32_t now_us);
+
+    const SimTiming& timing() const { return time; }
+    size_t size() const { return modules.size(); }
+    SimModule& module(size_t i) { return *modules[i]; }
+
+    /// @brief Tags that have a slot of their own and anchors to range with.
+    size_t active_tags() const { return active; }
+    /// @brief Report interval of the slowest of them right now.
+    uint32_t range_interval_us() const { return interval_us; }
+    /// @brief Reports lost to two tags sharing a slot.
+    uint64_t slot_collisions() const { return collisions; }
+
+private:
+    friend class SimModule;
+
+    void broadcast(SimModule& sender, const std::string& message);
+    std::string range_report(SimModule& tag, const SimModule::Config& tag_config);
+
+    SimTiming time;
+    SimNoise noise;
+    std::mutex mutex;
+    std::mt19937 rng;
+    std::vector<std::unique_ptr<SimModule>> modules;
+    size_t active = 0;
+    uint32_t interval_us = 0;
+    uint64_t collisions = 0;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t REGION_LEN = sizeof(SnapshotHeader) + 2 * sizeof(SnapshotSlot);
+
+
+////////////
+// WRITER //
+////////////
+
+SnapshotWriter::SnapshotWriter() : header(nullptr), slots(nullptr), length(0) { name[0] = '\0'; }
+
+
+SnapshotWriter::~SnapshotWriter() {
+    if (header) munmap(header, length);
+}
+
+
+bool SnapshotWriter::open(const char* shm_name) {
+    snprintf(name, sizeof(name), "%s", shm_name);
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, REGION_LEN) < 0) {
+        close(fd);
+        return false;
+    }
+    void* region = mmap(nullptr, REGION_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) return false;
+
+    header = (SnapshotHeader*)region;
+    slots = (SnapshotSlot*)((uint8_t*)region + sizeof(SnapshotHeader));
+    length = REGION_LEN;
+
+    // Taking over from an earlier publisher: readers see magic 0 until the
+    // layout is written again, so they never trust a half-written header
+    __atomic_store_n(&header->magic, 0, __ATOMIC_RELEASE);
+    memset(region, 0, REGION_LEN);
+    header->version = SNAPSHOT_VERSION;
+    header->header_len = sizeof(SnapshotHeader);
+    header->slot_len = sizeof(SnapshotSlot);
+    header->device_len = sizeof(SnapshotDevice);
+    header->max_devices = SNAPSHOT_MAX_DEVICES;
+    header->max_anchors = NUM_ANCHORS;
+    header->publisher_pid = (uint32_t)getpid();
+    __atomic_store_n(&header->magic, SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+void SnapshotWriter::unlink() {
+    if (name[0]) shm_unlink(name);
+}
+
+
+SnapshotSlot& SnapshotWriter::begin() {
+    uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_RELAXED);
+    SnapshotSlot& slot = slots[(generation + 1) % 2];
+
+    // Odd from here until publish(), so a reader still on this slot from two
+    // generations back notices the overwrite
+    __atomic_store_n(&slot.seq, slot.seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return slot;
+}
+
+
+void SnapshotWriter::publish(uint64_t published_ns) {
+    uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_RELAXED);
+    SnapshotSlot& slot = slots[(generation + 1) % 2];
+
+    slot.published_ns = published_ns;
+    __atomic_store_n(&slot.seq, slot.seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->generation, generation + 1, __ATOMIC_RELEASE);
+}
+
+
+////////////
+// READER //
+////////////
+
+SnapshotReader::SnapshotReader() : header(nullptr), slots(nullptr), length(0) {}
+
+
+SnapshotReader::~SnapshotReader() {
+    if (header) munmap((void*)header, length);
+}
+
+
+bool SnapshotReader::open(const char* shm_name) {
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < REGION_LEN) {
+        close(fd);
+        return false;
+    }
+    void* region = mmap(nullptr, REGION_LEN, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) return false;
+
+    const SnapshotHeader* h = (const SnapshotHeader*)region;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION ||
+        h->slot_len != sizeof(SnapshotSlot) || h->device_len != sizeof(SnapshotDevice) ||
+        h->max_devices != SNAPSHOT_MAX_DEVICES || h->max_anchors != NUM_ANCHORS) {
+        munmap(region, REGION_LEN);
+        return false;
+    }
+
+    header = h;
+    slots = (const SnapshotSlot*)((const uint8_t*)region + h->header_len);
+    length = REGION_LEN;
+    return true;
+}
+
+
+uint64_t SnapshotReader::generation() const {
+    return header ? __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE) : 0;
+}
+
+
+bool SnapshotReader::read(SnapshotSlot& out) const {
+    if (!header) return false;
+
+    for (int attempt = 0; attempt < SNAPSHOT_READ_RETRIES; attempt++) {
+        uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+        if (generation == 0) return false;
+
+        const SnapshotSlot& slot = slots[generation % 2];
+        uint64_t before = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+
+        // Header fields first, then only the devices in use
+        memcpy(&out, &slot, offsetof(SnapshotSlot, devices));
+        uint32_t count = out.device_count <= SNAPSHOT_MAX_DEVICES ? out.device_count : SNAPSHOT_MAX_DEVICES;
+        memcpy(out.devices, slot.devices, count * sizeof(SnapshotDevice));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == before) {
+            out.seq = before;
+            out.device_count = count;
+            return true;
+        }
+    }
+    return false;
+}
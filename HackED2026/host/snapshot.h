@@ -0,0 +1,155 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uwb_config.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// Shared-memory layout, little-endian, every field naturally aligned. Mirrored
+// by host/snapshot_reader.py; bump SNAPSHOT_VERSION when it changes.
+//
+//   header (64 bytes)
+//     u32 magic             SNAPSHOT_MAGIC
+//     u16 version           SNAPSHOT_VERSION
+//     u16 header_len        offset of slot 0
+//     u32 slot_len          slot 1 follows slot 0
+//     u32 device_len        sizeof(SnapshotDevice)
+//     u32 max_devices
+//     u32 max_anchors
+//     u64 generation        publishes so far; the newest is in slot generation % 2
+//     u32 publisher_pid
+//   slot, twice
+//     u64 seq               seqlock: odd while the publisher is writing the slot
+//     u64 published_ns      CLOCK_REALTIME
+//     u32 device_count      entries used in devices[], sorted by id
+//     u32 anchor_count      anchors[] are indexed by anchor uwb_index
+//     SnapshotAnchor  anchors[max_anchors]
+//     SnapshotDevice  devices[max_devices]
+//
+// Readers never block the publisher: they read the newest slot in place and
+// keep what they read only if its seq was even and unchanged around the read.
+// With two slots the publisher is always writing the one readers aren't
+// using, so a retry only happens to a reader that takes longer than a whole
+// publish period.
+
+#define SNAPSHOT_MAGIC 0x53425755 // "UWBS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER_LEN 64
+#define SNAPSHOT_MAX_DEVICES 256
+#define SNAPSHOT_DEFAULT_NAME "/uwb_snapshot" // shm_open() name, /dev/shm/uwb_snapshot
+#define SNAPSHOT_READ_RETRIES 100
+
+enum SnapshotFlags {
+    SNAPSHOT_HAS_RANGES = 1,
+    SNAPSHOT_HAS_POSITION = 2,
+    SNAPSHOT_STALE = 4, // No frame for longer than the publisher's stale limit
+    SNAPSHOT_POSITION_FROM_TAG = 8, // Solved on the tag, not by the publisher
+    SNAPSHOT_TRACKED = 16, // From the publisher's PositionTracker; rms_residual is its innovation RMS
+};
+
+struct SnapshotAnchor {
+    float position[3]; // cm
+    uint32_t configured; // 0: not placed, ignore the position
+};
+
+struct SnapshotDevice {
+    uint8_t id; // uwb_index
+    uint8_t flags; // SnapshotFlags
+    uint8_t anchors_used;
+    uint8_t reserved;
+    uint32_t seq; // Of the newest frame
+    uint32_t timestamp_us; // Device clock
+    uint32_t age_us; // Since the newest frame arrived, at publish time
+    int32_t ranges[NUM_ANCHORS]; // cm, 0: anchor not heard
+    float position[3]; // cm
+    float rms_residual; // cm
+    uint64_t frames;
+    uint64_t lost;
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_len;
+    uint32_t slot_len;
+    uint32_t device_len;
+    uint32_t max_devices;
+    uint32_t max_anchors;
+    uint64_t generation;
+    uint32_t publisher_pid;
+    uint8_t reserved[SNAPSHOT_HEADER_LEN - 36];
+};
+
+struct SnapshotSlot {
+    uint64_t seq;
+    uint64_t published_ns;
+    uint32_t device_count;
+    uint32_t anchor_count;
+    SnapshotAnchor anchors[NUM_ANCHORS];
+    SnapshotDevice devices[SNAPSHOT_MAX_DEVICES];
+};
+
+static_assert(sizeof(SnapshotHeader) == SNAPSHOT_HEADER_LEN, "header layout");
+static_assert(sizeof(SnapshotAnchor) == 16, "anchor layout");
+static_assert(sizeof(SnapshotDevice) == 48 + 4 * NUM_ANCHORS, "device layout");
+static_assert(sizeof(SnapshotSlot) % 8 == 0, "slot alignment");
+
+/// @brief Creates (or takes over) the shared-memory region and publishes
+/// whole snapshots into it. One publisher per region.
+class SnapshotWriter {
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();
+
+    /// @brief False (with errno set) if the region can't be created.
+    bool open(const char* name = SNAPSHOT_DEFAULT_NAME);
+
+    /// @brief Removes the region; readers that have it mapped keep their view.
+    void unlink();
+
+    /// @brief The slot the next publish() writes. Fill it, then publish().
+    /// seq and published_ns are set by publish().
+    SnapshotSlot& begin();
+
+    /// @brief Makes the slot from begin() the newest one.
+    void publish(uint64_t published_ns);
+
+private:
+    SnapshotHeader* header;
+    SnapshotSlot* slots;
+    size_t length;
+    char name[64];
+};
+
+/// @brief Read side, for C++ consumers. Python has snapshot_reader.py.
+class SnapshotReader {
+public:
+    SnapshotReader();
+    ~SnapshotReader();
+
+    /// @brief False if there is no region yet or its layout doesn't match.
+    bool open(const char* name = SNAPSHOT_DEFAULT_NAME);
+
+    /// @brief Copies the newest consistent snapshot.
+    /// @return False if nothing was published yet, or every retry raced the
+    /// publisher.
+    bool read(SnapshotSlot& out) const;
+
+    uint64_t generation() const;
+
+private:
+    const SnapshotHeader* header;
+    const SnapshotSlot* slots;
+    size_t length;
+};
+
+#endif
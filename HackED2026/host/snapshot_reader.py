@@ -0,0 +1,154 @@
+"""Reads the shared-memory position snapshot published by uwb_aggregator --shm.
+
+See host/snapshot.h for the layout. Reading never blocks the publisher: the
+newest slot is copied and kept only if its seqlock counter was even and
+unchanged around the copy.
+
+    python3 host/snapshot_reader.py [--shm NAME] [--hz HZ] [--once]
+"""
+import argparse
+import mmap
+import os
+import struct
+import time
+
+
+class SnapshotReader():
+    MAGIC = 0x53425755
+    VERSION = 1
+    DEFAULT_NAME = "/uwb_snapshot"
+    RETRIES = 100
+
+    # Flags per device
+    HAS_RANGES = 1
+    HAS_POSITION = 2
+    STALE = 4
+    POSITION_FROM_TAG = 8
+    TRACKED = 16
+
+    HEADER = struct.Struct('<IHHIIIIQI')
+    SLOT = struct.Struct('<QQII')
+    ANCHOR = struct.Struct('<fffI')
+
+    def __init__(self, name=DEFAULT_NAME):
+        path = "/dev/shm/" + name.lstrip("/")
+        with open(path, "rb") as f:
+            self.map = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+
+        (magic, version, self.header_len, self.slot_len, self.device_len, self.max_devices,
+         self.max_anchors, _, self.publisher_pid) = self.HEADER.unpack_from(self.map)
+        if magic != self.MAGIC or version != self.VERSION:
+            raise ValueError(f"{path} is not a version {self.VERSION} UWB snapshot")
+
+        self.anchors_offset = self.SLOT.size
+        self.devices_offset = self.SLOT.size + self.max_anchors * self.ANCHOR.size
+        # id, flags, anchors_used, reserved, seq, timestamp_us, age_us, ranges,
+        # position, rms_residual, frames, lost
+        self.device = struct.Struct(f'<BBBBIII{self.max_anchors}i3ffQQ')
+        if self.device.size != self.device_len:
+            raise ValueError(f"{path} has {self.device_len} byte devices, expected {self.device.size}")
+
+    def close(self):
+        self.map.close()
+
+    def generation(self):
+        return struct.unpack_from('<Q', self.map, 24)[0]
+
+    def read(self):
+        """Returns the newest consistent snapshot, or None if nothing was
+        published yet or every retry raced the publisher.
+
+        Returns:
+            dict: published_ns, generation, anchors {index: (x, y, z)} and
+            devices {id: dict}.
+        """
+        for _ in range(self.RETRIES):
+            generation = self.generation()
+            if generation == 0:
+                return None
+
+            base = self.header_len + (generation % 2) * self.slot_len
+            before = struct.unpack_from('<Q', self.map, base)[0]
+            if before & 1:
+                continue
+
+            _, published_ns, device_count, anchor_count = self.SLOT.unpack_from(self.map, base)
+            device_count = min(device_count, self.max_devices)
+            data = self.map[base:base + self.devices_offset + device_count * self.device_len]
+
+            if struct.unpack_from('<Q', self.map, base)[0] != before:
+                continue
+            return self.decode(data, generation, published_ns, device_count, anchor_count)
+        return None
+
+    def decode(self, data, generation, published_ns, device_count, anchor_count):
+        anchors = {}
+        for a in range(min(anchor_count, self.max_anchors)):
+            x, y, z, configured = self.ANCHOR.unpack_from(data, self.anchors_offset + a * self.ANCHOR.size)
+            if configured:
+                anchors[a] = (x, y, z)
+
+        devices = {}
+        n = self.max_anchors
+        for i in range(device_count):
+            fields = self.device.unpack_from(data, self.devices_offset + i * self.device_len)
+            device_id, flags, anchors_used, _, seq, timestamp_us, age_us = fields[:7]
+            ranges = list(fields[7:7 + n])
+            position = fields[7 + n:10 + n]
+            rms_residual, frames, lost = fields[10 + n:]
+            devices[device_id] = {
+                "flags": flags,
+                "seq": seq,
+                "timestamp_us": timestamp_us,
+                "age_ms": age_us / 1000,
+                "stale": bool(flags & self.STALE),
+                "ranges": ranges if flags & self.HAS_RANGES else None,
+                "position": position if flags & self.HAS_POSITION else None,
+                "position_from_tag": bool(flags & self.POSITION_FROM_TAG),
+                "tracked": bool(flags & self.TRACKED),
+                "rms_residual": rms_residual,
+                "anchors_used": anchors_used,
+                "frames": frames,
+                "lost": lost,
+            }
+
+        return {"generation": generation, "published_ns": published_ns, "anchors": anchors, "devices": devices}
+
+
+def print_snapshot(snapshot):
+    delay_ms = (time.time_ns() - snapshot["published_ns"]) / 1e6
+    print(f"generation {snapshot['generation']}, published {delay_ms:.1f} ms ago, "
+          f"{len(snapshot['devices'])} devices")
+    for device_id, d in sorted(snapshot["devices"].items()):
+        if d["position"]:
+            x, y, _ = d["position"]
+            source = "tag" if d["position_from_tag"] else "track"
+            where = f"({x:8.1f}, {y:8.1f}) rms {d['rms_residual']:6.1f} from {source}"
+        else:
+            where = "no fix"
+        print(f"  {device_id:3d} seq {d['seq']:8d} age {d['age_ms']:7.1f} ms{' STALE' if d['stale'] else '      '} "
+              f"{where} ranges {d['ranges']}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shm", default=SnapshotReader.DEFAULT_NAME)
+    parser.add_argument("--hz", type=float, default=2)
+    parser.add_argument("--once", action="store_true")
+    args = parser.parse_args()
+
+    reader = SnapshotReader(args.shm)
+    print(f"{args.shm}: published by pid {reader.publisher_pid}, {reader.max_anchors} anchors, "
+          f"{reader.max_devices} devices")
+    try:
+        while True:
+            snapshot = reader.read()
+            if snapshot:
+                print_snapshot(snapshot)
+            if args.once:
+                break
+            time.sleep(1 / args.hz)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        reader.close()
@@ -0,0 +1,179 @@
+#include "telemetry_decoder.h"
+
+#include <string.h>
+
+
+TelemetryDecoder::TelemetryDecoder() : malformed_packets(0) {
+    memset(devices, 0, sizeof(devices));
+    memset(positions, 0, sizeof(positions));
+}
+
+
+int TelemetryDecoder::decode(const uint8_t* data, size_t len) {
+    TelemetryHeader header;
+    if (!telemetry_decode_header(data, len, header)) {
+        malformed_packets++;
+        return -1;
+    }
+    if (header.type == TELEMETRY_POSITION) return decode_positions(header, data, len);
+    if (header.type == TELEMETRY_CALIBRATION) return decode_calibration(header, data, len);
+    if (header.type == TELEMETRY_STATS) return decode_stats(header, data, len);
+    if (header.type == TELEMETRY_HEAP) return decode_heap(header, data, len);
+    if (header.type == TELEMETRY_BOOT) return decode_boot(header, data, len);
+
+    TelemetryFrame frames[256];
+    int count = telemetry_decode_frames(data, len, frames, 256);
+    if (count < 0) {
+        malformed_packets++;
+        return -1;
+    }
+
+    DeviceLinkStats& s = devices[header.device_id];
+    s.packets++;
+
+    int delivered = 0;
+    for (int i = 0; i < count; i++) {
+        if (!track(s, frames[i].seq)) continue;
+
+        s.frames++;
+        s.last_timestamp_us = frames[i].timestamp_us;
+        delivered++;
+        if (frame_handler) frame_handler(header, frames[i]);
+    }
+
+    return delivered;
+}
+
+
+int TelemetryDecoder::decode_positions(const TelemetryHeader& header, const uint8_t* data, size_t len) {
+    TelemetryPosition fixes[256];
+    int count = telemetry_decode_positions(data, len, fixes, 256);
+    if (count < 0) {
+        malformed_packets++;
+        return -1;
+    }
+
+    DeviceLinkStats& s = positions[header.device_id];
+    s.packets++;
+
+    int delivered = 0;
+    for (int i = 0; i < count; i++) {
+        if (!track(s, fixes[i].seq)) continue;
+
+        s.frames++;
+        s.last_timestamp_us = fixes[i].timestamp_us;
+        delivered++;
+        if (position_handler) position_handler(header, fixes[i]);
+    }
+
+    return delivered;
+}
+
+
+int TelemetryDecoder::decode_calibration(const TelemetryHeader& header, const uint8_t* data, size_t len) {
+    int distances[TELEMETRY_CALIBRATION_MAX_DEVICES * TELEMETRY_CALIBRATION_MAX_DEVICES];
+    int devices = telemetry_decode_calibration(data, len, distances, TELEMETRY_CALIBRATION_MAX_DEVICES);
+    if (devices < 0) {
+        malformed_packets++;
+        return -1;
+    }
+
+    if (calibration_handler) calibration_handler(header, distances, (size_t)devices);
+    return 1;
+}
+
+
+int TelemetryDecoder::decode_stats(const TelemetryHeader& header, const uint8_t* data, size_t len) {
+    static TraceReport report; // ~8 KB
+    if (!trace_decode_stats(data, len, report)) {
+        malformed_packets++;
+        return -1;
+    }
+
+    if (stats_handler) stats_handler(header, report);
+    return 1;
+}
+
+
+int TelemetryDecoder::decode_heap(const TelemetryHeader& header, const uint8_t* data, size_t len) {
+    HeapStats stats;
+    if (!heap_decode_stats(data, len, stats)) {
+        malformed_packets++;
+        return -1;
+    }
+
+    if (heap_handler) heap_handler(header, stats);
+    return 1;
+}
+
+
+int TelemetryDecoder::decode_boot(const TelemetryHeader& header, const uint8_t* data, size_t len) {
+    BootReport report;
+    if (!boot_decode_report(data, len, report)) {
+        malformed_packets++;
+        return -1;
+    }
+
+    if (boot_handler) boot_handler(header, report);
+    return 1;
+}
+
+
+bool TelemetryDecoder::track(DeviceLinkStats& s, uint32_t seq) {
+    if (!s.seen) {
+        s.seen = true;
+        s.highest_seq = seq;
+        s.window = 1;
+        return true;
+    }
+
+    if (seq > s.highest_seq) {
+        uint32_t gap = seq - s.highest_seq;
+        s.lost += gap - 1;
+        s.window = gap >= TELEMETRY_REORDER_WINDOW ? 0 : s.window << gap;
+        s.window |= 1;
+        s.highest_seq = seq;
+        return true;
+    }
+
+    uint32_t back = s.highest_seq - seq;
+
+    if (back >= TELEMETRY_RESTART_GAP) {
+        // The sender started counting from zero again
+        s.restarts++;
+        s.highest_seq = seq;
+        s.window = 1;
+        return true;
+    }
+
+    if (back < TELEMETRY_REORDER_WINDOW) {
+        uint64_t bit = 1ULL << back;
+        if (s.window & bit) {
+            s.duplicates++;
+            return false;
+        }
+        s.window |= bit;
+    }
+
+    // A frame we had written off as lost turned up late
+    s.reordered++;
+    if (s.lost > 0) s.lost--;
+    return true;
+}
+
+
+void TelemetryDecoder::print_stats(FILE* out) const {
+    for (int i = 0; i < 512; i++) {
+        int id = i % 256;
+        const DeviceLinkStats& s = i < 256 ? devices[id] : positions[id];
+        if (!s.seen) continue;
+
+        uint64_t expected = s.frames + s.lost;
+        fprintf(out, "device %3d %-9s: %8llu frames %7llu packets %6llu lost (%.2f%%) %6llu reordered %5llu dup %3llu restarts\n",
+                id, i < 256 ? "ranges" : "positions", (unsigned long long)s.frames, (unsigned long long)s.packets,
+                (unsigned long long)s.lost, expected ? 100.0 * s.lost / expected : 0.0,
+                (unsigned long long)s.reordered, (unsigned long long)s.duplicates,
+                (unsigned long long)s.restarts);
+    }
+    if (malformed_packets) fprintf(out, "malformed packets: %llu\n", (unsigned long long)malformed_packets);
+}
@@ -0,0 +1,92 @@
+#ifndef TELEMETRY_DECODER_H
+#define TELEMETRY_DECODER_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <functional>
+
+#include "boot.h"
+#include "heap_monitor.h"
+#include "telemetry.h"
+#include "trace.h"
+
+// How far back a late frame can be told apart from a duplicate
+#define TELEMETRY_REORDER_WINDOW 64
+// A sequence this far behind means the device rebooted, not reordering
+#define TELEMETRY_RESTART_GAP 4096
+
+// Link health for one device, derived from frame sequence numbers.
+struct DeviceLinkStats {
+    uint64_t packets;
+    uint64_t frames;
+    /// @brief Sequence gaps not (yet) filled by a late frame.
+    uint64_t lost;
+    /// @brief Frames that arrived after a higher sequence number.
+    uint64_t reordered;
+    uint64_t duplicates;
+    uint64_t restarts;
+    uint32_t highest_seq;
+    uint32_t last_timestamp_us;
+    uint64_t window; // Bit n set: highest_seq - n has been seen
+    bool seen;
+};
+
+/// @brief Host-side decoder for the binary telemetry packets. Hands every new
+/// frame to a callback and keeps loss / reordering counts per device.
+class TelemetryDecoder {
+public:
+    typedef std::function<void(const TelemetryHeader&, const TelemetryFrame&)> FrameHandler;
+    typedef std::function<void(const TelemetryHeader&, const TelemetryPosition&)> PositionHandler;
+    /// @brief distances is row-major, devices x devices.
+    typedef std::function<void(const TelemetryHeader&, const int* distances, size_t devices)> CalibrationHandler;
+    typedef std::function<void(const TelemetryHeader&, const TraceReport&)> StatsHandler;
+    typedef std::function<void(const TelemetryHeader&, const HeapStats&)> HeapHandler;
+    typedef std::function<void(const TelemetryHeader&, const BootReport&)> BootHandler;
+
+    TelemetryDecoder();
+
+    void on_frame(FrameHandler handler) { frame_handler = handler; }
+    void on_position(PositionHandler handler) { position_handler = handler; }
+    void on_calibration(CalibrationHandler handler) { calibration_handler = handler; }
+    void on_stats(StatsHandler handler) { stats_handler = handler; }
+    void on_heap(HeapHandler handler) { heap_handler = handler; }
+    void on_boot(BootHandler handler) { boot_handler = handler; }
+
+    /// @brief Decodes one datagram. Duplicated frames are not delivered.
+    /// @return Frames (or fixes) delivered, or -1 if this isn't a telemetry packet.
+    int decode(const uint8_t* data, size_t len);
+
+    /// @brief Range frames and position fixes are numbered separately.
+    const DeviceLinkStats& stats(uint8_t device_id, uint8_t type = TELEMETRY_RANGES) const {
+        return type == TELEMETRY_POSITION ? positions[device_id] : devices[device_id];
+    }
+    uint64_t malformed() const { return malformed_packets; }
+
+    /// @brief One line per device that has sent anything.
+    void print_stats(FILE* out) const;
+
+private:
+    bool track(DeviceLinkStats& s, uint32_t seq);
+    int decode_positions(const TelemetryHeader& header, const uint8_t* data, size_t len);
+    int decode_calibration(const TelemetryHeader& header, const uint8_t* data, size_t len);
+    int decode_stats(const TelemetryHeader& header, const uint8_t* data, size_t len);
+    int decode_heap(const TelemetryHeader& header, const uint8_t* data, size_t len);
+    int decode_boot(const TelemetryHeader& header, const uint8_t* data, size_t len);
+
+    DeviceLinkStats devices[256];
+    DeviceLinkStats positions[256];
+    uint64_t malformed_packets;
+    FrameHandler frame_handler;
+    PositionHandler position_handler;
+    CalibrationHandler calibration_handler;
+    StatsHandler stats_handler;
+    HeapHandler heap_handler;
+    BootHandler boot_handler;
+};
+
+#endif
@@ -0,0 +1,105 @@
+// Load generator for uwb_aggregator (or anything on TARGET_PORT): N fake tags,
+// each with its own socket like a real board, send range frames through the
+// firmware's own TelemetryBatcher at a fixed total rate.
+//
+//   telemetry_flood [--tags N] [--rate FRAMES_PER_S] [--batch N] [--seconds S] [--port P]
+//
+// Build: pio run -e native_telemetry_flood && .pio/build/native_telemetry_flood/program --tags 64 --rate 20000
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "host_clock.h"
+#include "telemetry.h"
+
+struct FakeTag {
+    int sock;
+    sockaddr_in target;
+    uint64_t packets;
+    uint64_t failed;
+    std::unique_ptr<TelemetryBatcher> batcher;
+};
+
+
+static void send_packet(const uint8_t* packet, size_t len, void* ctx) {
+    FakeTag* tag = (FakeTag*)ctx;
+    if (sendto(tag->sock, packet, len, 0, (const sockaddr*)&tag->target, sizeof(tag->target)) == (ssize_t)len) {
+        tag->packets++;
+    } else {
+        tag->failed++;
+    }
+}
+
+
+int main(int argc, char** argv) {
+    int tags = UWB_TAG_COUNT;
+    double rate = 10000;
+    int batch = 1;
+    double seconds = 5;
+    int port = TARGET_PORT;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--tags") == 0) tags = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--rate") == 0) rate = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--batch") == 0) batch = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--seconds") == 0) seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--port") == 0) port = atoi(argv[i + 1]);
+    }
+    if (tags < 1 || tags > 256 || rate <= 0 || batch < 1) {
+        fprintf(stderr, "usage: %s [--tags N] [--rate FRAMES_PER_S] [--batch N] [--seconds S] [--port P]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<FakeTag> fleet(tags);
+    for (int t = 0; t < tags; t++) {
+        FakeTag& tag = fleet[t];
+        tag.sock = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&tag.target, 0, sizeof(tag.target));
+        tag.target.sin_family = AF_INET;
+        tag.target.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        tag.target.sin_port = htons(port);
+        tag.packets = tag.failed = 0;
+        tag.batcher.reset(new TelemetryBatcher((uint8_t)t, (uint8_t)batch, TELEMETRY_DEFAULT_DEADLINE_US,
+                                               send_packet, &tag));
+    }
+
+    // Frames go out round-robin across the tags, paced in 1 ms steps
+    uint64_t frames = 0;
+    uint32_t start = host_micros();
+    while (true) {
+        uint32_t elapsed_us = host_micros() - start;
+        if (elapsed_us >= seconds * 1e6) break;
+
+        uint64_t due = (uint64_t)(rate * elapsed_us / 1e6);
+        for (; frames < due; frames++) {
+            FakeTag& tag = fleet[frames % tags];
+            int ranges[NUM_ANCHORS];
+            for (int a = 0; a < NUM_ANCHORS; a++) ranges[a] = 100 + (int)((frames / tags + a * 37) % 900);
+            tag.batcher->add(ranges, host_micros());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    uint64_t packets = 0, failed = 0;
+    for (FakeTag& tag : fleet) {
+        tag.batcher->flush();
+        packets += tag.packets;
+        failed += tag.failed;
+        close(tag.sock);
+    }
+
+    double elapsed = (host_micros() - start) / 1e6;
+    printf("%d tags: %llu frames in %llu datagrams over %.1f s (%.0f frames/s), %llu sends failed\n", tags,
+           (unsigned long long)frames, (unsigned long long)packets, elapsed, frames / elapsed,
+           (unsigned long long)failed);
+    return 0;
+}
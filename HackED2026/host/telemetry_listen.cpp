@@ -0,0 +1,80 @@
+// Listens on TARGET_PORT for binary telemetry from the tags, prints every
+// range frame and calibration matrix and, every few seconds, the per-device
+// loss/reordering counts.
+// Plain-text datagrams (send_wifi_data) are printed as they are.
+//
+// Build: pio run -e native_telemetry_listen && .pio/build/native_telemetry_listen/program [-q]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "host_clock.h"
+#include "telemetry_decoder.h"
+
+static const uint32_t STATS_PERIOD_US = 5000000;
+
+
+int main(int argc, char** argv) {
+    bool quiet = argc > 1 && strcmp(argv[1], "-q") == 0;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(TARGET_PORT);
+    if (sock < 0 || bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    // Wake up for the stats line even when nothing arrives
+    timeval tv = { 1, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    TelemetryDecoder decoder;
+    decoder.on_frame([quiet](const TelemetryHeader& header, const TelemetryFrame& frame) {
+        if (quiet) return;
+        printf("%d: seq %u t %u us ranges", header.device_id, frame.seq, frame.timestamp_us);
+        for (int a = 0; a < NUM_ANCHORS; a++) printf(" %d", frame.ranges[a]);
+        printf("\n");
+    });
+
+    decoder.on_position([quiet](const TelemetryHeader& header, const TelemetryPosition& fix) {
+        if (quiet) return;
+        printf("%d: seq %u t %u us position (%.1f, %.1f, %.1f) cm residual %.1f cm from %d anchors\n",
+               header.device_id, fix.seq, fix.timestamp_us, fix.position[0], fix.position[1],
+               fix.position[2], fix.rms_residual, fix.anchors_used);
+    });
+
+    // Rare and what calibration is waiting on, so shown even with -q
+    decoder.on_calibration([](const TelemetryHeader& header, const int* distances, size_t devices) {
+        printf("%d: calibration, %zu devices, cm\n", header.device_id, devices);
+        for (size_t row = 0; row < devices; row++) {
+            printf("  %2zu:", row);
+            for (size_t col = 0; col < devices; col++) printf(" %6d", distances[row * devices + col]);
+            printf("\n");
+        }
+    });
+
+    uint32_t last_stats = host_micros();
+    uint8_t buf[2048];
+
+    while (true) {
+        ssize_t n = recv(sock, buf, sizeof(buf), 0);
+
+        if (n > 0 && decoder.decode(buf, (size_t)n) < 0 && !quiet) {
+            printf("%.*s\n", (int)n, (const char*)buf);
+        }
+
+        if (host_micros() - last_stats >= STATS_PERIOD_US) {
+            decoder.print_stats(stdout);
+            fflush(stdout);
+            last_stats = host_micros();
+        }
+    }
+}
@@ -0,0 +1,150 @@
+// Listens for the TELEMETRY_STATS packets the boards send every
+// TRACE_EXPORT_INTERVAL_MS and prints p50 / p99 / max per stage and per AT
+// command for each device. The histograms are totals since boot, so every
+// table covers the device's whole uptime. The TELEMETRY_HEAP packets sent
+// alongside add a heap line: free bytes and their low-water mark, the largest
+// free block, fragmentation, and how fast free bytes drift per hour since the
+// first packet heard. A device's TELEMETRY_BOOT report, sent once after
+// power-on, is printed as it arrives. Other telemetry on the port is ignored.
+//
+//   trace_report [--port P] [--period S] [--once]
+//
+// --once prints the first table that has every device heard so far, then exits.
+//
+// Build: pio run -e native_trace_report && .pio/build/native_trace_report/program
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "host_clock.h"
+#include "telemetry_decoder.h"
+
+
+// First and latest heap packet per device, for the drift
+struct HeapHistory {
+    HeapStats first;
+    HeapStats latest;
+    bool seen;
+};
+
+
+static void print_heap(const HeapHistory& heap) {
+    const HeapStats& h = heap.latest;
+    printf("  heap: %u of %u bytes free (min %u), largest block %u (min %u), fragmentation %.1f%% (max %.1f%%)",
+           h.free, h.total, h.min_free, h.largest_block, h.min_largest_block, h.fragmentation / 10.0,
+           h.max_fragmentation / 10.0);
+
+    double hours = (h.uptime_ms - heap.first.uptime_ms) / 3.6e6;
+    if (hours > 0.01) printf(", %+.0f bytes/h", ((double)h.free - heap.first.free) / hours);
+    printf("\n");
+}
+
+
+static void print_boot(uint8_t device_id, const BootReport& report) {
+    printf("device %d booted, %u datagrams held until WiFi was up, %u dropped\n", device_id, report.buffered,
+           report.dropped);
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+        const BootPhaseTiming& p = report.phases[i];
+        if (!p.started) continue;
+        printf("  %-12s %7.3f s -> ", boot_phase_name(i), p.start_us / 1e6);
+        if (p.done) printf("%7.3f s  %7.3f s\n", p.end_us / 1e6, (p.end_us - p.start_us) / 1e6);
+        else printf("not done\n");
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+
+static void print_report(uint8_t device_id, const TraceReport& report) {
+    printf("device %d, up %.1f s, %u cycles/us\n", device_id, report.uptime_us / 1e6, report.cycles_per_us);
+    printf("  %-8s %-12s %10s %10s %10s %10s\n", "kind", "name", "count", "p50_us", "p99_us", "max_us");
+
+    for (size_t i = 0; i < report.count; i++) {
+        const TraceEntry& e = report.entries[i];
+        const LogHistogram& h = e.histogram;
+        printf("  %-8s %-12s %10u %10.2f %10.2f %10.2f\n", e.kind == TRACE_KIND_STAGE ? "stage" : "command",
+               e.name, h.count(), report.to_us(e, h.percentile(0.5)), report.to_us(e, h.percentile(0.99)),
+               report.to_us(e, h.max()));
+    }
+}
+
+
+int main(int argc, char** argv) {
+    int port = TARGET_PORT;
+    double period_s = TRACE_EXPORT_INTERVAL_MS / 1000.0;
+    bool once = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--period") == 0 && i + 1 < argc) period_s = atof(argv[++i]);
+        else if (strcmp(argv[i], "--once") == 0) once = true;
+        else {
+            fprintf(stderr, "usage: %s [--port P] [--period S] [--once]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (sock < 0 || bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    timeval tv = { 1, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Latest report per device
+    std::unique_ptr<TraceReport> latest[256];
+    static HeapHistory heaps[256];
+    bool updated = false;
+
+    TelemetryDecoder decoder;
+    decoder.on_stats([&](const TelemetryHeader& header, const TraceReport& report) {
+        if (!latest[header.device_id]) latest[header.device_id].reset(new TraceReport);
+        *latest[header.device_id] = report;
+        updated = true;
+    });
+    decoder.on_boot([&](const TelemetryHeader& header, const BootReport& report) {
+        print_boot(header.device_id, report);
+    });
+    decoder.on_heap([&](const TelemetryHeader& header, const HeapStats& stats) {
+        HeapHistory& heap = heaps[header.device_id];
+        // After a reboot the drift starts over
+        if (!heap.seen || stats.uptime_ms < heap.latest.uptime_ms) heap.first = stats;
+        heap.latest = stats;
+        heap.seen = true;
+    });
+
+    uint32_t last_print = host_micros();
+    uint8_t buf[2048];
+
+    while (true) {
+        ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        if (n > 0) decoder.decode(buf, (size_t)n);
+
+        if (!updated || host_micros() - last_print < period_s * 1e6) continue;
+
+        for (int id = 0; id < 256; id++) {
+            if (latest[id]) print_report((uint8_t)id, *latest[id]);
+            if (latest[id] && heaps[id].seen) print_heap(heaps[id]);
+        }
+        printf("\n");
+        fflush(stdout);
+        last_print = host_micros();
+        updated = false;
+
+        if (once) return 0;
+    }
+}
@@ -0,0 +1,527 @@
+// Ingestion daemon for the tags' telemetry on TARGET_PORT. Keeps only the
+// newest frame and fix per device (see aggregator.h) and prints, every few
+// seconds, throughput, kernel drops, socket queueing delay and how many
+// devices have gone stale. With -v, one line per device as well.
+//
+// With --shm, the newest state of every device is also published --publish-hz
+// times a second into a shared-memory snapshot (see snapshot.h) that any
+// number of local readers (frontend.py, snapshot_reader.py) map without
+// touching the sockets. Positions come from the tag's own fixes when it sends
+// them, otherwise from a PositionTracker per device, fed every frame against
+// the --anchor placements.
+//
+// With --record, every datagram is also appended to a range log (see
+// range_log.h) that uwb_replay plays back later.
+//
+// With --tdma-tag and --tdma-anchor, a CapacityManager (see capacity_manager.h)
+// keeps the modules' TDMA capacity at what the tags heard from need, over the
+// control channel. Every anchor and tag must be listed; a tag not listed may
+// end up sharing a slot.
+//
+// With --calibration, the anchors are placed from that calibration file (see
+// calibration_file.h) rather than the defaults, so a restart doesn't wait on
+// a calibration. Whenever a tag sends a distance matrix that has drifted
+// from the file's by more than CAL_DRIFT_CM, it is solved into positions,
+// saved over the file, and the anchors move there. --anchor wins over both.
+//
+// Those devices, and any given with --sync, get a clock sync every --sync-ms
+// (see clock_sync.h), so their frames can be placed on the host clock. The
+// report then breaks a frame's latency down: the module's UART line, batching
+// on the board, the board's send and WiFi, queueing here, and the solve.
+//
+//   uwb_aggregator [--port P] [--workers N] [--stale-ms MS] [--report S] [--seconds S] [-v]
+//                  [--shm NAME] [--publish-hz HZ] [--anchor INDEX,X,Y]... [--record LOG]
+//                  [--tdma-tag IP[:PORT]/ID]... [--tdma-anchor IP[:PORT]/ID]...
+//                  [--sync IP[:PORT]/ID]... [--sync-ms MS] [--calibration FILE]
+//
+// Load-test it with telemetry_flood.
+//
+// Build: pio run -e native_uwb_aggregator && .pio/build/native_uwb_aggregator/program -v
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aggregator.h"
+#include "calibration_file.h"
+#include "capacity_manager.h"
+#include "host_clock.h"
+#include "snapshot.h"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int) { interrupted = 1; }
+
+
+/// @brief IP[:PORT]/ID, as uwb_control takes it but with the ID required.
+static bool parse_device(const char* spec, char (&host)[64], uint16_t& port, uint8_t& id) {
+    size_t len = strcspn(spec, ":/");
+    if (len == 0 || len >= sizeof(host)) return false;
+    memcpy(host, spec, len);
+    host[len] = '\0';
+
+    const char* p = spec + len;
+    port = LOCAL_PORT;
+    if (*p == ':') {
+        long value = strtol(p + 1, (char**)&p, 10);
+        if (value <= 0 || value > 65535) return false;
+        port = (uint16_t)value;
+    }
+    if (*p != '/') return false;
+    long value = strtol(p + 1, (char**)&p, 10);
+    if (*p != '\0' || value < 0 || value >= CONTROL_ANY_DEVICE) return false;
+    id = (uint8_t)value;
+    return true;
+}
+
+
+static bool add_tdma_device(CapacityManager& manager, const char* spec, bool anchor, std::vector<uint8_t>& ids) {
+    char host[64];
+    uint16_t port;
+    uint8_t id;
+    if (!parse_device(spec, host, port, id)) return false;
+
+    bool ok = anchor ? manager.add_anchor(host, port, id) : manager.add_tag(host, port, id);
+    if (ok) ids.push_back(id);
+    return ok;
+}
+
+
+static bool add_sync_device(ControlClient& control, const char* spec) {
+    char host[64];
+    uint16_t port;
+    uint8_t id;
+    return parse_device(spec, host, port, id) && control.add_device(host, port, id) >= 0;
+}
+
+
+/// @brief p50/p99 in ms, or dashes with nothing recorded.
+static void print_latency(const char* name, const LogHistogram& h) {
+    if (h.count() == 0) {
+        printf(" %s -/-", name);
+        return;
+    }
+    printf(" %s %.1f/%.1f", name, h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3);
+}
+
+
+static void print_latencies(const Aggregator& aggregator, const ControlClient& control) {
+    AggregatorLatency l = aggregator.latency();
+
+    // The module's line comes from the boards' own stats, worst of them
+    uint32_t uart_p50 = 0, uart_p99 = 0;
+    for (int id = 0; id < 256; id++) {
+        DeviceState s;
+        if (!aggregator.device((uint8_t)id, s)) continue;
+        if (s.uart_line_p99_us > uart_p99) {
+            uart_p50 = s.uart_line_p50_us;
+            uart_p99 = s.uart_line_p99_us;
+        }
+    }
+
+    printf("          latency ms p50/p99: uart %.1f/%.1f", uart_p50 / 1e3, uart_p99 / 1e3);
+    print_latency("batch", l.batch);
+    print_latency("mcu->host", l.send);
+    print_latency("queue", l.queue);
+    print_latency("solve", l.solve);
+    print_latency("total", l.total);
+
+    size_t synced = 0;
+    uint32_t uncertainty_ns = 0;
+    for (size_t i = 0; i < control.device_count(); i++) {
+        const ClockMapping& m = control.device(i).clock.mapping();
+        if (!m.valid) continue;
+        synced++;
+        if (m.uncertainty_ns > uncertainty_ns) uncertainty_ns = m.uncertainty_ns;
+    }
+    printf(", %zu/%zu clocks synced to %.2f ms\n", synced, control.device_count(), uncertainty_ns / 1e6);
+}
+
+// Same placement as programs/tag.cpp's ANCHOR_POSITIONS, until --anchor says otherwise
+static const float DEFAULT_ANCHORS[][2] = { { 0, 0 }, { 980, 0 }, { 1035, 719 } };
+
+struct Publisher {
+    SnapshotWriter writer;
+    std::mutex mutex; // A calibration can move the anchors while publishing
+    float anchors[NUM_ANCHORS][2];
+    uint32_t configured; // Anchor bitmask
+    uint32_t stale_ms;
+};
+
+
+/// @brief The first NUM_ANCHORS devices of the calibration become the anchors.
+static void place_anchors(const CalibrationCache& cache, Publisher& p) {
+    std::lock_guard<std::mutex> lock(p.mutex);
+    p.configured = 0;
+    for (size_t a = 0; a < cache.devices && a < NUM_ANCHORS; a++) {
+        p.anchors[a][0] = cache.positions[a][0];
+        p.anchors[a][1] = cache.positions[a][1];
+        p.configured |= 1U << a;
+    }
+}
+
+
+/// @brief A tag's matrix against the file's.
+/// @return True if it drifted, and was solved and saved over the file.
+static bool update_calibration(const char* path, CalibrationCache& cache, bool& have_cache, const int* distances,
+                               size_t devices) {
+    size_t compared = 0;
+    int drift = have_cache ? calibration_drift_cm(cache, distances, devices, compared) : -1;
+    if (have_cache && calibration_cache_holds(cache, distances, devices)) {
+        printf("calibration: %zu devices within %d cm of %s over %zu pairs, kept\n", devices, drift, path, compared);
+        return false;
+    }
+
+    CalibrationCache fresh;
+    calibration_cache_init(fresh, distances, devices, (uint32_t)time(nullptr));
+    // The delays came from uwb_control, not the tag
+    if (have_cache && cache.devices == fresh.devices) {
+        memcpy(fresh.antenna_delays, cache.antenna_delays, sizeof(fresh.antenna_delays));
+    }
+    if (!calibration_cache_solve(fresh)) {
+        printf("calibration: %zu devices, can't place them from the distances measured\n", devices);
+        return false;
+    }
+    if (!calibration_file_save(path, fresh)) {
+        perror(path);
+        return false;
+    }
+
+    if (have_cache) printf("calibration: drifted %d cm over %zu pairs, saved to %s\n", drift, compared, path);
+    else printf("calibration: %zu devices, saved to %s\n", devices, path);
+    for (size_t i = 0; i < fresh.devices; i++) {
+        printf("  %zu at (%.1f, %.1f) cm\n", i, fresh.positions[i][0], fresh.positions[i][1]);
+    }
+    cache = fresh;
+    have_cache = true;
+    return true;
+}
+
+
+static void publish_snapshot(const Aggregator& aggregator, Publisher& p) {
+    SnapshotSlot& slot = p.writer.begin();
+    uint64_t now = Aggregator::now_ns();
+
+    slot.anchor_count = NUM_ANCHORS;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            SnapshotAnchor& anchor = slot.anchors[a];
+            anchor.configured = (p.configured >> a) & 1;
+            anchor.position[0] = p.anchors[a][0];
+            anchor.position[1] = p.anchors[a][1];
+            anchor.position[2] = 0;
+        }
+    }
+
+    uint32_t count = 0;
+    for (int id = 0; id < 256; id++) {
+        DeviceState s;
+        if (!aggregator.device((uint8_t)id, s)) continue;
+
+        SnapshotDevice& d = slot.devices[count++];
+        memset(&d, 0, sizeof(d));
+        d.id = (uint8_t)id;
+        d.seq = s.seq;
+        d.timestamp_us = s.timestamp_us;
+        d.frames = s.frames;
+        d.lost = s.lost;
+
+        uint64_t newest_ns = s.seen ? s.received_ns : s.position_received_ns;
+        if (s.has_position && s.position_received_ns > newest_ns) newest_ns = s.position_received_ns;
+        uint64_t age_ns = now > newest_ns ? now - newest_ns : 0;
+        d.age_us = age_ns / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(age_ns / 1000);
+        if (age_ns > (uint64_t)p.stale_ms * 1000000ULL) d.flags |= SNAPSHOT_STALE;
+
+        if (s.seen) {
+            d.flags |= SNAPSHOT_HAS_RANGES;
+            memcpy(d.ranges, s.ranges, sizeof(d.ranges));
+        }
+
+        if (s.has_position) {
+            d.flags |= SNAPSHOT_HAS_POSITION | SNAPSHOT_POSITION_FROM_TAG;
+            memcpy(d.position, s.position.position, sizeof(d.position));
+            d.rms_residual = s.position.rms_residual;
+            d.anchors_used = s.position.anchors_used;
+        } else if (s.has_track) {
+            d.flags |= SNAPSHOT_HAS_POSITION | SNAPSHOT_TRACKED;
+            d.position[0] = s.track.position[0];
+            d.position[1] = s.track.position[1];
+            d.rms_residual = s.track.innovation_rms;
+            d.anchors_used = s.track.anchors_used;
+        }
+    }
+    slot.device_count = count;
+    p.writer.publish(now);
+}
+
+
+static void print_devices(const Aggregator& aggregator, uint64_t now, uint32_t stale_ms) {
+    for (int id = 0; id < 256; id++) {
+        DeviceState s;
+        if (!aggregator.device((uint8_t)id, s)) continue;
+
+        double age_ms = (now - s.received_ns) / 1e6;
+        printf("  %3d seq %8u age %7.1f ms%s frames %8llu lost %5llu late %4llu dup %4llu restarts %2llu ranges",
+               id, s.seq, age_ms, age_ms > stale_ms ? " STALE" : "      ", (unsigned long long)s.frames,
+               (unsigned long long)s.lost, (unsigned long long)s.late, (unsigned long long)s.duplicates,
+               (unsigned long long)s.restarts);
+        for (int a = 0; a < NUM_ANCHORS; a++) printf(" %d", s.ranges[a]);
+        if (s.has_track) {
+            printf(" track (%.1f, %.1f) cm %.1f cm/s", s.track.position[0], s.track.position[1],
+                   hypotf(s.track.velocity[0], s.track.velocity[1]));
+        }
+        printf("\n");
+    }
+}
+
+
+int main(int argc, char** argv) {
+    int port = TARGET_PORT;
+    size_t workers = 1;
+    uint32_t stale_ms = AGGREGATOR_DEFAULT_STALE_MS;
+    double report_s = 5;
+    double seconds = 0;
+    bool verbose = false;
+    const char* shm_name = nullptr;
+    const char* record_path = nullptr;
+    const char* calibration_path = nullptr;
+    double publish_hz = 60;
+
+    std::unique_ptr<Publisher> publisher(new Publisher);
+    memset(publisher->anchors, 0, sizeof(publisher->anchors));
+    publisher->configured = 0;
+    for (size_t a = 0; a < sizeof(DEFAULT_ANCHORS) / sizeof(DEFAULT_ANCHORS[0]); a++) {
+        publisher->anchors[a][0] = DEFAULT_ANCHORS[a][0];
+        publisher->anchors[a][1] = DEFAULT_ANCHORS[a][1];
+        publisher->configured |= 1U << a;
+    }
+    bool custom_anchors = false;
+
+    ControlClient control;
+    CapacityManager tdma(control);
+    std::vector<uint8_t> tdma_ids;
+    uint32_t sync_ms = 1000;
+
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--port") == 0 && has_value) port = atoi(argv[++i]);
+        else if (strcmp(a, "--workers") == 0 && has_value) workers = (size_t)atoi(argv[++i]);
+        else if (strcmp(a, "--stale-ms") == 0 && has_value) stale_ms = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(a, "--report") == 0 && has_value) report_s = atof(argv[++i]);
+        else if (strcmp(a, "--seconds") == 0 && has_value) seconds = atof(argv[++i]);
+        else if (strcmp(a, "-v") == 0) verbose = true;
+        else if (strcmp(a, "--shm") == 0 && has_value) shm_name = argv[++i];
+        else if (strcmp(a, "--publish-hz") == 0 && has_value) publish_hz = atof(argv[++i]);
+        else if (strcmp(a, "--record") == 0 && has_value) record_path = argv[++i];
+        else if (strcmp(a, "--anchor") == 0 && has_value) {
+            int index;
+            float x, y;
+            if (sscanf(argv[++i], "%d,%f,%f", &index, &x, &y) != 3 || index < 0 || index >= NUM_ANCHORS) {
+                fprintf(stderr, "--anchor takes INDEX,X,Y with INDEX below %d\n", NUM_ANCHORS);
+                return 1;
+            }
+            // The first --anchor replaces the defaults rather than adding to them
+            if (!custom_anchors) publisher->configured = 0;
+            custom_anchors = true;
+            publisher->anchors[index][0] = x;
+            publisher->anchors[index][1] = y;
+            publisher->configured |= 1U << index;
+        } else if ((strcmp(a, "--tdma-tag") == 0 || strcmp(a, "--tdma-anchor") == 0) && has_value) {
+            if (!add_tdma_device(tdma, argv[++i], strcmp(a, "--tdma-anchor") == 0, tdma_ids)) {
+                fprintf(stderr, "%s takes IP[:PORT]/ID\n", a);
+                return 1;
+            }
+        } else if (strcmp(a, "--sync") == 0 && has_value) {
+            if (!add_sync_device(control, argv[++i])) {
+                fprintf(stderr, "--sync takes IP[:PORT]/ID\n");
+                return 1;
+            }
+        } else if (strcmp(a, "--sync-ms") == 0 && has_value) {
+            sync_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(a, "--calibration") == 0 && has_value) {
+            calibration_path = argv[++i];
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--port P] [--workers N] [--stale-ms MS] [--report S] [--seconds S] [-v]\n"
+                    "       [--shm NAME] [--publish-hz HZ] [--anchor INDEX,X,Y]... [--record LOG]\n"
+                    "       [--tdma-tag IP[:PORT]/ID]... [--tdma-anchor IP[:PORT]/ID]...\n"
+                    "       [--sync IP[:PORT]/ID]... [--sync-ms MS] [--calibration FILE]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (publish_hz <= 0) publish_hz = 60;
+
+    // Warm start: the anchors where the last calibration put them
+    CalibrationCache calibration;
+    bool have_calibration = calibration_path && calibration_file_load(calibration_path, calibration);
+    if (have_calibration && calibration.has_positions && !custom_anchors) {
+        place_anchors(calibration, *publisher);
+        time_t saved = (time_t)calibration.saved_unix;
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&saved));
+        printf("%u anchors from %s, calibrated %s\n", (unsigned)calibration.devices, calibration_path, when);
+    }
+    int calibration_matrix[CAL_MAX_DEVICES * CAL_MAX_DEVICES];
+    size_t calibration_devices;
+
+    // Outlives the aggregator, whose workers write to it
+    RangeLogWriter recording;
+    Aggregator aggregator(port, workers);
+    for (int a = 0; a < NUM_ANCHORS; a++) {
+        if ((publisher->configured >> a) & 1) aggregator.set_anchor(a, publisher->anchors[a]);
+    }
+    if (record_path) {
+        if (!recording.open(record_path)) {
+            perror(record_path);
+            return 1;
+        }
+        aggregator.set_recorder(&recording);
+    }
+    if (!aggregator.open()) {
+        perror("bind");
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    aggregator.start();
+    printf("listening on %d with %zu worker%s\n", port, workers, workers == 1 ? "" : "s");
+
+    std::atomic<bool> publishing(false);
+    std::thread publish_thread;
+    if (shm_name) {
+        Publisher& p = *publisher;
+        if (!p.writer.open(shm_name)) {
+            perror("shm_open");
+            aggregator.stop();
+            return 1;
+        }
+        p.stale_ms = stale_ms;
+
+        publishing = true;
+        publish_thread = std::thread([&aggregator, &p, &publishing, publish_hz] {
+            auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(1.0 / publish_hz));
+            auto next = std::chrono::steady_clock::now();
+            while (publishing) {
+                publish_snapshot(aggregator, p);
+                next += period;
+                std::this_thread::sleep_until(next);
+            }
+        });
+        printf("publishing snapshots to %s at %.0f Hz\n", shm_name, publish_hz);
+    }
+
+    bool tdma_on = !tdma_ids.empty();
+    bool control_on = control.device_count() > 0;
+    bool sync_on = control_on && sync_ms > 0;
+    if (control_on) {
+        if (!control.open()) {
+            perror("control socket");
+            aggregator.stop();
+            return 1;
+        }
+        if (tdma_on) printf("managing TDMA for %zu devices, session %u\n", tdma_ids.size(), control.session_id());
+        if (sync_on) printf("syncing %zu clocks every %u ms\n", control.device_count(), (unsigned)sync_ms);
+    }
+    // Per device, the newest heard_ns and booted_ns passed on to the manager
+    uint64_t tdma_heard[256] = { 0 };
+    uint64_t tdma_booted[256] = { 0 };
+
+    auto start = std::chrono::steady_clock::now();
+    auto last = start;
+    auto last_sync = start - std::chrono::milliseconds(sync_ms);
+    AggregatorStats prev;
+    memset(&prev, 0, sizeof(prev));
+
+    while (!interrupted) {
+        // The manager wants polling often enough that acks turn into the next phase quickly
+        // Sync replies too: a reply that waits here looks like a slow round trip
+        std::this_thread::sleep_for(std::chrono::milliseconds(control_on ? 10 : 100));
+        auto now = std::chrono::steady_clock::now();
+        if (sync_on && now - last_sync >= std::chrono::milliseconds(sync_ms)) {
+            control.sync_all();
+            last_sync = now;
+        }
+        if (tdma_on) {
+            uint32_t now_ms = (uint32_t)(host_nanos() / 1000000);
+            for (uint8_t id : tdma_ids) {
+                DeviceState s;
+                aggregator.device(id, s);
+                if (s.booted_ns != tdma_booted[id]) tdma.restarted(id);
+                if (s.heard_ns != tdma_heard[id]) tdma.heard(id, now_ms);
+                tdma_booted[id] = s.booted_ns;
+                tdma_heard[id] = s.heard_ns;
+            }
+            tdma.poll(now_ms);
+        } else if (control_on) {
+            control.poll(host_nanos());
+        }
+        for (size_t i = 0; i < control.device_count() && sync_on; i++) {
+            aggregator.set_clock(control.device(i).device_id, control.device(i).clock.mapping());
+        }
+        if (calibration_path && aggregator.take_calibration(calibration_matrix, calibration_devices) &&
+            update_calibration(calibration_path, calibration, have_calibration, calibration_matrix,
+                               calibration_devices) && !custom_anchors) {
+            place_anchors(calibration, *publisher);
+            for (int a = 0; a < NUM_ANCHORS; a++) {
+                if ((publisher->configured >> a) & 1) aggregator.set_anchor(a, publisher->anchors[a]);
+            }
+        }
+        double since_start = std::chrono::duration<double>(now - start).count();
+        double since_last = std::chrono::duration<double>(now - last).count();
+        bool done = seconds > 0 && since_start >= seconds;
+        if (since_last < report_s && !done) continue;
+
+        AggregatorStats s = aggregator.stats();
+        uint64_t datagrams = s.datagrams - prev.datagrams;
+        uint64_t calls = s.recv_calls - prev.recv_calls;
+        uint64_t wall_ns = Aggregator::now_ns();
+
+        printf("%7.1f s: %8.0f datagrams/s %8.0f frames/s %5.1f per recvmmsg, queue delay mean %.3f ms max %.3f ms, "
+               "%llu kernel drops, %llu malformed, %zu devices, %zu stale\n",
+               since_start, datagrams / since_last, (s.frames - prev.frames) / since_last,
+               calls ? (double)datagrams / calls : 0.0,
+               datagrams ? (s.queue_ns_total - prev.queue_ns_total) / 1e6 / datagrams : 0.0, s.queue_ns_max / 1e6,
+               (unsigned long long)s.kernel_drops, (unsigned long long)s.malformed, aggregator.seen_devices(),
+               aggregator.stale_devices(wall_ns, stale_ms));
+        if (verbose) print_devices(aggregator, wall_ns, stale_ms);
+        if (tdma_on) {
+            const CapacityStats& t = tdma.stats();
+            printf("          tdma: %u tags in %u x %u ms, %u switches, %u aborted, %u partial, last commit %u ms\n",
+                   (unsigned)tdma.planner().active(), tdma.planner().capacity(), tdma.planner().slot_ms(),
+                   (unsigned)t.switches, (unsigned)t.aborted, (unsigned)t.partial, (unsigned)t.last_commit_ms);
+        }
+        if (sync_on) print_latencies(aggregator, control);
+        fflush(stdout);
+
+        prev = s;
+        last = now;
+        if (done) break;
+    }
+
+    if (publish_thread.joinable()) {
+        publishing = false;
+        publish_thread.join();
+        publisher->writer.unlink();
+    }
+    aggregator.stop();
+    if (record_path) {
+        uint64_t records = recording.records();
+        if (!recording.close()) perror(record_path);
+        printf("recorded %llu datagrams to %s\n", (unsigned long long)records, record_path);
+    }
+    return 0;
+}
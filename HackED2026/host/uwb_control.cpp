@@ -0,0 +1,202 @@
+// Sends commands to the boards while they run, see control.h. Every command
+// goes to every --device, batched into one packet per board, and is resent
+// until the board acks it; a board applies each one once however many times
+// it arrives.
+//
+//   uwb_control --device IP[:PORT][/ID] [--device ...] [--timeout MS] [--retry MS]
+//               [--calibration FILE] COMMAND [ARG] [COMMAND [ARG] ...]
+//
+//   ping                 round trip only
+//   batch N              range frames per telemetry datagram (tags)
+//   deadline US          longest a frame waits for its batch (tags)
+//   delay D              antenna delay, saved to the module's flash
+//   role tag|anchor      the module's role; not in pipeline mode
+//   calibration-ok       tag_with_calibration saves its calibration and goes on
+//                        to tell the anchors
+//
+// PORT defaults to LOCAL_PORT, ID to any board at that address. Exits 1 if
+// any command wasn't acked OK.
+//
+// With --calibration, every delay acked by a device given with its ID is also
+// written into that calibration file (see calibration_file.h), if the file
+// has the device.
+//
+// Build: pio run -e native_uwb_control && .pio/build/native_uwb_control/program --device 10.42.0.30 batch 8
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "calibration_file.h"
+#include "control_client.h"
+#include "uwb_config.h"
+
+static const uint32_t DEFAULT_TIMEOUT_MS = 3000;
+
+
+/// @brief IP[:PORT][/ID]
+static bool add_device(ControlClient& client, const char* spec) {
+    char host[64];
+    int port = LOCAL_PORT;
+    int id = CONTROL_ANY_DEVICE;
+
+    size_t len = strcspn(spec, ":/");
+    if (len == 0 || len >= sizeof(host)) return false;
+    memcpy(host, spec, len);
+    host[len] = '\0';
+
+    const char* p = spec + len;
+    if (*p == ':') {
+        port = (int)strtol(p + 1, (char**)&p, 10);
+        if (port <= 0 || port > 65535) return false;
+    }
+    if (*p == '/') {
+        id = (int)strtol(p + 1, (char**)&p, 10);
+        if (id < 0 || id >= CONTROL_ANY_DEVICE) return false;
+    }
+    return *p == '\0' && client.add_device(host, (uint16_t)port, (uint8_t)id) >= 0;
+}
+
+
+/// @return Arguments used, 0 if argv[0] isn't a command.
+static int parse_command(int argc, char** argv, uint8_t& opcode, int32_t& arg) {
+    const char* name = argv[0];
+    arg = 0;
+
+    if (strcmp(name, "ping") == 0) opcode = CONTROL_PING;
+    else if (strcmp(name, "calibration-ok") == 0) {
+        // The tag stamps its cached calibration with it
+        opcode = CONTROL_CALIBRATION_OK;
+        arg = (int32_t)(uint32_t)time(nullptr);
+    }
+    else {
+        if (argc < 2) return 0;
+        if (strcmp(name, "batch") == 0) opcode = CONTROL_SET_BATCH;
+        else if (strcmp(name, "deadline") == 0) opcode = CONTROL_SET_DEADLINE;
+        else if (strcmp(name, "delay") == 0) opcode = CONTROL_SET_DELAY;
+        else if (strcmp(name, "role") == 0) {
+            opcode = CONTROL_SET_ROLE;
+            if (strcmp(argv[1], "tag") == 0) arg = 0;
+            else if (strcmp(argv[1], "anchor") == 0) arg = 1;
+            else return 0;
+            return 2;
+        }
+        else return 0;
+
+        char* end;
+        arg = (int32_t)strtol(argv[1], &end, 10);
+        return *end == '\0' ? 2 : 0;
+    }
+    return 1;
+}
+
+
+/// @brief Writes the delays the boards acked into the calibration file.
+static void save_delays(const ControlClient& client, const char* path) {
+    CalibrationCache cache;
+    if (!calibration_file_load(path, cache)) {
+        fprintf(stderr, "%s: no calibration to add the delays to\n", path);
+        return;
+    }
+
+    size_t saved = 0;
+    for (size_t d = 0; d < client.device_count(); d++) {
+        const ControlDevice& device = client.device(d);
+        if (device.device_id >= cache.devices) continue;
+        for (const ControlOutcome& c : device.commands) {
+            if (c.command.opcode != CONTROL_SET_DELAY || c.status != CONTROL_OK) continue;
+            cache.antenna_delays[device.device_id] = (uint16_t)c.command.arg;
+            saved++;
+        }
+    }
+    if (saved == 0) return;
+    if (calibration_file_save(path, cache)) printf("%zu antenna delays saved to %s\n", saved, path);
+    else perror(path);
+}
+
+
+static void usage(const char* program) {
+    fprintf(stderr, "usage: %s --device IP[:PORT][/ID] [--device ...] [--timeout MS] [--retry MS]\n"
+                    "          [--calibration FILE] COMMAND [ARG] ...\n"
+                    "commands: ping, batch N, deadline US, delay D, role tag|anchor, calibration-ok\n", program);
+}
+
+
+int main(int argc, char** argv) {
+    ControlClient client;
+    uint32_t timeout_ms = DEFAULT_TIMEOUT_MS;
+    uint32_t retry_ms = CONTROL_CLIENT_RETRY_MS;
+    size_t commands = 0;
+    const char* calibration_path = nullptr;
+
+    // Devices and options first, then the commands, which need every device known
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--device") == 0) {
+            if (!add_device(client, argv[i + 1])) {
+                fprintf(stderr, "Bad device %s\n", argv[i + 1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--timeout") == 0) timeout_ms = (uint32_t)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--retry") == 0) retry_ms = (uint32_t)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--calibration") == 0) calibration_path = argv[i + 1];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    while (i < argc) {
+        uint8_t opcode;
+        int32_t arg;
+        int used = parse_command(argc - i, argv + i, opcode, arg);
+        if (!used) {
+            fprintf(stderr, "Bad command %s\n", argv[i]);
+            usage(argv[0]);
+            return 1;
+        }
+        client.queue_all(opcode, arg);
+        commands++;
+        i += used;
+    }
+    if (client.device_count() == 0 || commands == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!client.open()) {
+        perror("socket");
+        return 1;
+    }
+    client.run(timeout_ms, retry_ms);
+
+    // One line per command per device
+    bool all_ok = true;
+    for (size_t d = 0; d < client.device_count(); d++) {
+        const ControlDevice& device = client.device(d);
+        char host[32];
+        snprintf(host, sizeof(host), "%s:%u", inet_ntoa(device.addr.sin_addr), ntohs(device.addr.sin_port));
+
+        for (const ControlOutcome& c : device.commands) {
+            all_ok &= c.status == CONTROL_OK;
+            printf("%-21s %-14s %6ld  %-8s", host, control_opcode_name(c.command.opcode), (long)c.command.arg,
+                   c.status == CONTROL_PENDING ? "timeout" : control_status_name(c.status));
+            if (c.status != CONTROL_PENDING) printf(" %7.1f ms", (c.acked_ns - c.first_sent_ns) / 1e6);
+            printf("  %u sent\n", c.sends);
+        }
+    }
+
+    if (calibration_path) save_delays(client, calibration_path);
+
+    const ControlClientStats& s = client.stats();
+    printf("session %04x: %llu packets, %llu resends, %llu acks, %llu stray\n", client.session_id(),
+           (unsigned long long)s.packets_sent, (unsigned long long)s.resends, (unsigned long long)s.acks,
+           (unsigned long long)s.stray_acks);
+    return all_ok ? 0 : 1;
+}
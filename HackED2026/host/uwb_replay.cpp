@@ -0,0 +1,254 @@
+// Plays back a range log recorded by uwb_aggregator --record. By default
+// the datagrams go through the same decoder and solver as live data, in
+// process and as fast as the log can be read, to measure solver and filter
+// changes offline on recorded field data. --speed 1 keeps the recorded
+// timing instead, and --send re-transmits the datagrams over UDP to a
+// running aggregator (or frontend.py).
+//
+//   uwb_replay LOG [--speed X] [--send PORT] [--solver none|raw|weighted|tracker] [--anchor INDEX,X,Y]...
+//                  [--from S] [--to S] [--passes N] [-v]
+//
+// weighted solves each frame after a RangeQuality filter per device, the
+// way tag.cpp does with WEIGHT_RANGES. --speed 0 (the default) doesn't wait at all. --from/--to are seconds into
+// the log and use its chunk index. --passes repeats the replay, each pass
+// with fresh decoder and solver state, for steadier timings on short logs.
+//
+// Build: pio run -e native_uwb_replay && .pio/build/native_uwb_replay/program session.uwblog
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "host_clock.h"
+#include "multilateration.h"
+#include "position_tracker.h"
+#include "range_log.h"
+#include "range_quality.h"
+#include "telemetry_decoder.h"
+
+enum SolverMode { SOLVER_NONE, SOLVER_RAW, SOLVER_WEIGHTED, SOLVER_TRACKER };
+
+// Same placement as programs/tag.cpp's ANCHOR_POSITIONS, until --anchor says otherwise
+static const float DEFAULT_ANCHORS[][2] = { { 0, 0 }, { 980, 0 }, { 1035, 719 } };
+
+struct Replay {
+    SolverMode mode;
+    Multilateration<NUM_ANCHORS, 2> solver;
+    PositionTracker<NUM_ANCHORS> trackers[256];
+    RangeQuality quality[256];
+    uint64_t fixes[256];
+    uint64_t frames[256];
+    float last[256][2];
+};
+
+struct PassResult {
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t fixes;
+    uint64_t not_telemetry;
+    double seconds;
+};
+
+
+static PassResult run_pass(const RangeLogReader& log, uint64_t from, uint64_t to, double speed, int sock,
+                           const sockaddr_in* target, Replay& replay) {
+    TelemetryDecoder decoder;
+    memset(replay.fixes, 0, sizeof(replay.fixes));
+    memset(replay.frames, 0, sizeof(replay.frames));
+    for (auto& tracker : replay.trackers) tracker.reset();
+    for (auto& quality : replay.quality) quality.reset();
+
+    Multilateration<NUM_ANCHORS, 2>::Result fix;
+    TrackerEstimate estimate;
+    int ranges[NUM_ANCHORS];
+    float weights[NUM_ANCHORS];
+    decoder.on_frame([&](const TelemetryHeader& header, const TelemetryFrame& frame) {
+        uint8_t id = header.device_id;
+        replay.frames[id]++;
+        bool solved = false;
+        if (replay.mode == SOLVER_RAW) {
+            solved = replay.solver.solve(frame.ranges, fix);
+        } else if (replay.mode == SOLVER_WEIGHTED) {
+            // Telemetry frames don't carry the RSSI
+            replay.quality[id].filter(frame.ranges, nullptr, ranges, weights);
+            solved = replay.solver.solve(ranges, fix, weights);
+            if (solved) replay.quality[id].add_residuals(fix.residuals, weights);
+        }
+
+        if (solved) {
+            replay.fixes[id]++;
+            replay.last[id][0] = fix.position[0];
+            replay.last[id][1] = fix.position[1];
+        } else if (replay.mode == SOLVER_TRACKER) {
+            replay.trackers[id].update(frame.ranges, frame.timestamp_us);
+            if (replay.trackers[id].estimate(frame.timestamp_us, estimate)) {
+                replay.fixes[id]++;
+                replay.last[id][0] = estimate.position[0];
+                replay.last[id][1] = estimate.position[1];
+            }
+        }
+    });
+
+    PassResult result;
+    memset(&result, 0, sizeof(result));
+    uint64_t offset = log.seek(from);
+    RangeLogRecord record;
+    uint64_t first_ns = 0;
+    auto wall_start = std::chrono::steady_clock::now();
+    uint64_t start = host_nanos();
+
+    while (log.next(offset, record)) {
+        if (record.received_ns > to) break;
+        if (result.records == 0) first_ns = record.received_ns;
+
+        if (speed > 0) {
+            auto due = wall_start + std::chrono::nanoseconds((uint64_t)((record.received_ns - first_ns) / speed));
+            std::this_thread::sleep_until(due);
+        }
+
+        if (sock >= 0) {
+            sendto(sock, record.data, record.len, 0, (const sockaddr*)target, sizeof(*target));
+        } else if (decoder.decode(record.data, record.len) < 0) {
+            result.not_telemetry++;
+        }
+        result.records++;
+        result.bytes += record.len;
+    }
+
+    result.seconds = (host_nanos() - start) / 1e9;
+    for (int id = 0; id < 256; id++) {
+        result.frames += replay.frames[id];
+        result.fixes += replay.fixes[id];
+    }
+    return result;
+}
+
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    double speed = 0;
+    int send_port = 0;
+    double from_s = 0, to_s = -1;
+    int passes = 1;
+    bool verbose = false;
+    SolverMode mode = SOLVER_TRACKER;
+
+    std::unique_ptr<Replay> replay(new Replay);
+    float anchors[NUM_ANCHORS][2] = {};
+    uint32_t configured = 0;
+    for (size_t a = 0; a < sizeof(DEFAULT_ANCHORS) / sizeof(DEFAULT_ANCHORS[0]); a++) {
+        anchors[a][0] = DEFAULT_ANCHORS[a][0];
+        anchors[a][1] = DEFAULT_ANCHORS[a][1];
+        configured |= 1U << a;
+    }
+    bool custom_anchors = false;
+    bool usage = false;
+
+    for (int i = 1; i < argc && !usage; i++) {
+        const char* a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(a, "--speed") == 0 && has_value) speed = atof(argv[++i]);
+        else if (strcmp(a, "--send") == 0 && has_value) send_port = atoi(argv[++i]);
+        else if (strcmp(a, "--from") == 0 && has_value) from_s = atof(argv[++i]);
+        else if (strcmp(a, "--to") == 0 && has_value) to_s = atof(argv[++i]);
+        else if (strcmp(a, "--passes") == 0 && has_value) passes = atoi(argv[++i]);
+        else if (strcmp(a, "-v") == 0) verbose = true;
+        else if (strcmp(a, "--solver") == 0 && has_value) {
+            const char* m = argv[++i];
+            if (strcmp(m, "none") == 0) mode = SOLVER_NONE;
+            else if (strcmp(m, "raw") == 0) mode = SOLVER_RAW;
+            else if (strcmp(m, "weighted") == 0) mode = SOLVER_WEIGHTED;
+            else if (strcmp(m, "tracker") == 0) mode = SOLVER_TRACKER;
+            else usage = true;
+        } else if (strcmp(a, "--anchor") == 0 && has_value) {
+            int index;
+            float x, y;
+            if (sscanf(argv[++i], "%d,%f,%f", &index, &x, &y) != 3 || index < 0 || index >= NUM_ANCHORS) {
+                fprintf(stderr, "--anchor takes INDEX,X,Y with INDEX below %d\n", NUM_ANCHORS);
+                return 1;
+            }
+            if (!custom_anchors) configured = 0;
+            custom_anchors = true;
+            anchors[index][0] = x;
+            anchors[index][1] = y;
+            configured |= 1U << index;
+        } else if (a[0] != '-' && !path) {
+            path = a;
+        } else {
+            usage = true;
+        }
+    }
+    if (usage || !path || passes < 1) {
+        fprintf(stderr,
+                "usage: %s LOG [--speed X] [--send PORT] [--solver none|raw|weighted|tracker] [--anchor INDEX,X,Y]...\n"
+                "       [--from S] [--to S] [--passes N] [-v]\n",
+                argv[0]);
+        return 1;
+    }
+
+    RangeLogReader log;
+    if (!log.open(path)) {
+        fprintf(stderr, "%s: not a range log\n", path);
+        return 1;
+    }
+    double span = (log.last_ns() - log.first_ns()) / 1e9;
+    printf("%s: %llu records over %.1f s in %zu chunks%s\n", path, (unsigned long long)log.records(), span,
+           log.chunks().size(), log.indexed() ? "" : " (not closed cleanly, index rebuilt)");
+
+    replay->mode = mode;
+    for (int a = 0; a < NUM_ANCHORS; a++) {
+        if (!((configured >> a) & 1)) continue;
+        replay->solver.set_anchor(a, anchors[a]);
+        for (auto& tracker : replay->trackers) tracker.set_anchor(a, anchors[a]);
+    }
+
+    int sock = -1;
+    sockaddr_in target;
+    memset(&target, 0, sizeof(target));
+    if (send_port) {
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        target.sin_family = AF_INET;
+        target.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        target.sin_port = htons(send_port);
+    }
+
+    uint64_t from = log.first_ns() + (uint64_t)(from_s * 1e9);
+    uint64_t to = to_s < 0 ? UINT64_MAX : log.first_ns() + (uint64_t)(to_s * 1e9);
+    static const char* MODE_NAMES[] = { "none", "raw", "weighted", "tracker" };
+
+    for (int pass = 0; pass < passes; pass++) {
+        PassResult r = run_pass(log, from, to, speed, sock, &target, *replay);
+        if (sock >= 0) {
+            printf("sent %llu datagrams to port %d in %.3f s\n", (unsigned long long)r.records, send_port,
+                   r.seconds);
+            continue;
+        }
+        printf("%llu records (%.1f MB), %llu frames, %llu fixes (%s), %llu not telemetry in %.3f s: "
+               "%.2f M records/s, %.2f M frames/s\n",
+               (unsigned long long)r.records, r.bytes / 1e6, (unsigned long long)r.frames,
+               (unsigned long long)r.fixes, MODE_NAMES[mode], (unsigned long long)r.not_telemetry, r.seconds,
+               r.records / r.seconds / 1e6, r.frames / r.seconds / 1e6);
+    }
+
+    if (verbose && sock < 0) {
+        for (int id = 0; id < 256; id++) {
+            if (!replay->frames[id]) continue;
+            printf("  %3d frames %8llu fixes %8llu", id, (unsigned long long)replay->frames[id],
+                   (unsigned long long)replay->fixes[id]);
+            if (replay->fixes[id]) printf(" last (%.1f, %.1f) cm", replay->last[id][0], replay->last[id][1]);
+            printf("\n");
+        }
+    }
+
+    if (sock >= 0) close(sock);
+    return 0;
+}
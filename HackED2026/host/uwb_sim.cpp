@@ -0,0 +1,633 @@
+// Runs N simulated tags and anchors against the firmware's portable logic.
+// Each simulated board gets its own thread, a SimModule on its "UART" and the
+// same code the ESP32 runs: ModuleConfigurator boots the module, tags feed
+// IngestStage -> ProcessStage -> TelemetryBatcher and send the packets over a
+// real UDP socket to 127.0.0.1, anchors exchange heartbeats as mesh frames
+// (see mesh.h) over AT+DATA through the AtEngine. With --listen the telemetry is received and decoded here too,
+// for end-to-end latency and loss.
+//
+//   uwb_sim [--tags N] [--anchors N] [--seconds S] [--port P] [--listen]
+//           [--period-ms MS] [--data-ms MS] [--loss P] [--dropout P] [--seed N]
+//           [--control-port BASE] [--control-loss P] [--adaptive]
+//
+// Without --listen, run telemetry_listen (or frontend.py) on the same port.
+// With --control-port each board takes commands on 127.0.0.1:BASE+uwb_index,
+// for uwb_control; --control-loss drops that share of commands and acks.
+// --adaptive (needs --control-port, implies --listen) runs a CapacityManager
+// here on the telemetry, and reports the tags' update rate across its switch.
+//
+// Build: pio run -e native_uwb_sim && .pio/build/native_uwb_sim/program --tags 24 --listen
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "at_engine.h"
+#include "capacity_manager.h"
+#include "control.h"
+#include "control_client.h"
+#include "host_clock.h"
+#include "mesh.h"
+#include "module_config.h"
+#include "pipeline.h"
+#include "sim_network.h"
+#include "telemetry_decoder.h"
+#include "wire_format.h"
+
+static const double FIELD_CM = 2000.0;
+
+struct Options {
+    int tags = 8;
+    int anchors = 4;
+    double seconds = 10;
+    int port = TARGET_PORT;
+    bool listen = false;
+    int period_ms = 100;
+    int data_ms = 1000;
+    double loss = 0;
+    double dropout = 0.05;
+    unsigned seed = 1;
+    int control_port = 0; // 0: no control sockets
+    double control_loss = 0;
+    bool adaptive = false;
+};
+
+static std::atomic<bool> running(true);
+static std::atomic<bool> listening(true); // Stops after the boards' last flush
+
+
+/// @brief Stands in for WiFiUDP: every board sends to the same local port.
+class UdpSink {
+public:
+    explicit UdpSink(int port) : sock(socket(AF_INET, SOCK_DGRAM, 0)) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+    }
+    ~UdpSink() { close(sock); }
+
+    void send(const uint8_t* data, size_t len) {
+        if (sendto(sock, data, len, 0, (const sockaddr*)&addr, sizeof(addr)) == (ssize_t)len) {
+            packets++;
+            bytes += len;
+        }
+    }
+
+    std::atomic<uint64_t> packets{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+
+private:
+    int sock;
+    sockaddr_in addr;
+};
+
+
+static double percentile(std::vector<uint32_t>& v, double p) {
+    if (v.empty()) return 0;
+    size_t i = (size_t)(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+
+/// @brief One simulated board.
+struct SimDevice {
+    SimDevice(SimModule& module, int id, bool anchor, UdpSink& udp)
+        : id(id), anchor(anchor), module(module), udp(udp), engine(module, host_micros),
+          config(engine, host_micros), ingest(queue), filter(STABILITY_THRESHOLD),
+          telemetry((uint8_t)id, TELEMETRY_DEFAULT_BATCH, TELEMETRY_DEFAULT_DEADLINE_US, flush, this),
+          process(queue, filter, telemetry), control((uint8_t)id), control_rng(id), mesh((uint8_t)id, send_mesh, this) {
+        engine.set_tracer(&tracer);
+        ingest.set_tracer(&tracer);
+        process.set_tracer(&tracer);
+        mesh.on(MESH_HEARTBEAT, on_heartbeat, this);
+    }
+
+    static void flush(const uint8_t* packet, size_t len, void* ctx) {
+        ((SimDevice*)ctx)->udp.send(packet, len);
+    }
+
+    // Lines the anchor's engine isn't waiting for: AT+RDATA from the others
+    static void on_line(const char* line, size_t len, void* ctx) {
+        SimDevice* self = (SimDevice*)ctx;
+        for (size_t i = 0; i < len; i++) self->rdata_parser.feed(line[i]);
+        if (self->rdata_parser.feed('\n') != LINE_RDATA) return;
+
+        const RDataFrame& r = self->rdata_parser.rdata();
+        self->mesh.feed(r.sender_id, r.message, r.length, host_micros());
+    }
+
+    static void send_mesh(const char* text, size_t len, void* ctx) {
+        char command[AT_COMMAND_LEN];
+        snprintf(command, sizeof(command), "AT+DATA=%u,%s", (unsigned)len, text);
+        ((SimDevice*)ctx)->engine.submit(command, 1000);
+    }
+
+    // All the boards share host_micros(), so the sender's stamp gives the one-way latency
+    static void on_heartbeat(const MeshMessage& message, void* ctx) {
+        if (message.length < 4) return;
+        ((SimDevice*)ctx)->data_latency_us.push_back(message.received_us - get_u32(message.payload));
+    }
+
+    ~SimDevice() {
+        if (control_sock >= 0) close(control_sock);
+    }
+
+    bool open_control(int port) {
+        control_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        return control_sock >= 0 && bind(control_sock, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+               fcntl(control_sock, F_SETFL, O_NONBLOCK) == 0;
+    }
+
+    // handle_control() as far as a simulated board goes. Both pipeline
+    // stages run on this thread, like tag.cpp's loop() without USE_PIPELINE,
+    // so tags can take a TDMA layout; the range lines that arrive while
+    // module_config is busy are lost, as they would be there.
+    uint8_t handle_control(const ControlCommand& command) {
+        switch (command.opcode) {
+        case CONTROL_PING:
+            return CONTROL_OK;
+        case CONTROL_SET_BATCH:
+            if (anchor) return CONTROL_REJECTED;
+            if (command.arg < 1 || command.arg > TELEMETRY_MAX_FRAMES) return CONTROL_INVALID;
+            telemetry.set_batch((uint8_t)command.arg, telemetry.deadline());
+            return CONTROL_OK;
+        case CONTROL_SET_DEADLINE:
+            if (anchor) return CONTROL_REJECTED;
+            if (command.arg < 0) return CONTROL_INVALID;
+            telemetry.set_batch(telemetry.batch_size(), (uint32_t)command.arg);
+            return CONTROL_OK;
+        case CONTROL_SET_DELAY: {
+            ModuleConfig target;
+            if (!anchor || !config.cached(target)) return CONTROL_REJECTED;
+            if (command.arg < 0 || command.arg > UINT16_MAX) return CONTROL_INVALID;
+            target.antenna_delay = command.arg;
+            return config.apply(target, CONFIG_PERSIST) ? CONTROL_OK : CONTROL_FAILED;
+        }
+        case CONTROL_SET_ROLE:
+            return CONTROL_REJECTED; // The sim's threads are either tag or anchor
+        case CONTROL_STAGE_TDMA: {
+            uint8_t capacity, slot_ms, slot;
+            tdma_unpack(command.arg, capacity, slot_ms, slot);
+            if (capacity == 0 || capacity > UWB_TAG_COUNT || slot_ms < TDMA_MIN_SLOT_MS_6M8) return CONTROL_INVALID;
+            if (anchor ? slot != TDMA_NO_SLOT : slot >= capacity) return CONTROL_INVALID;
+            tdma_staged = command.arg;
+            return CONTROL_OK;
+        }
+        case CONTROL_COMMIT_TDMA: {
+            ModuleConfig target;
+            if (command.arg != tdma_staged || !config.cached(target)) return CONTROL_REJECTED;
+            uint8_t capacity, slot_ms, slot;
+            tdma_unpack(command.arg, capacity, slot_ms, slot);
+            tdma_staged = -1;
+            target.tag_capacity = capacity;
+            target.slot_ms = slot_ms;
+            if (!anchor) target.id = slot;
+            return config.apply(target, CONFIG_TRANSIENT) ? CONTROL_OK : CONTROL_FAILED;
+        }
+        default:
+            return CONTROL_UNKNOWN;
+        }
+    }
+
+    // poll_control(), with an ordinary socket for WiFiUDP
+    void poll_control(const Options& opt) {
+        uint32_t now_ms = host_micros() / 1000;
+        if (control_sock < 0 || now_ms - last_control_ms < CONTROL_POLL_INTERVAL_MS) return;
+        last_control_ms = now_ms;
+
+        uint8_t packet[CONTROL_MAX_PACKET];
+        std::uniform_real_distribution<double> uniform(0, 1);
+        for (int i = 0; i < CONTROL_PACKETS_PER_POLL; i++) {
+            sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = recvfrom(control_sock, packet, sizeof(packet), 0, (sockaddr*)&from, &from_len);
+            if (n <= 0) break;
+            if (uniform(control_rng) < opt.control_loss) continue;
+
+            uint32_t received_us = host_micros();
+            uint8_t reply[CONTROL_HEADER_LEN + CONTROL_SYNC_REPLY_LEN];
+            size_t reply_len = control.answer_sync(packet, (size_t)n, received_us, host_micros(), reply);
+            if (reply_len) {
+                sendto(control_sock, reply, reply_len, 0, (const sockaddr*)&from, from_len);
+                continue;
+            }
+            if (!control.receive(packet, (size_t)n)) continue;
+
+            ControlCommand command;
+            while (control.next(command)) {
+                control.complete(command, handle_control(command));
+                control_applied++;
+            }
+
+            size_t len = control.encode_acks(packet);
+            if (len && uniform(control_rng) >= opt.control_loss) {
+                sendto(control_sock, packet, len, 0, (const sockaddr*)&from, from_len);
+            }
+        }
+    }
+
+    void run(const Options& opt) {
+        uint32_t start = host_micros();
+
+        // Same settings as module_config_for() on the board
+        ModuleConfig target = { id, anchor ? 1 : 0, 1, 1, UWB_TAG_COUNT, 10, 1, 1, -1 };
+        booted = config.apply(target, CONFIG_PERSIST);
+        boot_us = host_micros() - start;
+
+        if (anchor) {
+            engine.set_unsolicited_handler(on_line, this);
+            uint32_t next_data = host_micros() + (uint32_t)(id * 37 % 100) * 1000;
+
+            while (running) {
+                if (opt.data_ms > 0 && (int32_t)(host_micros() - next_data) >= 0) {
+                    uint8_t heartbeat[4];
+                    put_u32(heartbeat, host_micros());
+                    mesh.send(MESH_HEARTBEAT, heartbeat, sizeof(heartbeat), host_micros());
+                    next_data += opt.data_ms * 1000;
+                }
+                engine.poll();
+                poll_control(opt);
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+            return;
+        }
+
+        // Tag: the pipeline, both stages on this thread like loop() would
+        char buf[PIPELINE_READ_CHUNK];
+        uint32_t last_stats_ms = host_micros() / 1000;
+        while (running) {
+            if (host_micros() / 1000 - last_stats_ms >= TRACE_EXPORT_INTERVAL_MS) {
+                uint8_t packet[TRACE_MAX_PACKET];
+                udp.send(packet, trace_encode_stats(packet, sizeof(packet), (uint8_t)id, tracer, host_micros()));
+                last_stats_ms = host_micros() / 1000;
+            }
+
+            poll_control(opt);
+
+            size_t n = module.read(buf, sizeof(buf));
+            if (n) ingest.ingest(buf, n, host_micros());
+            if (process.run_once(host_micros()) == 0 && n == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        telemetry.flush();
+    }
+
+    int id;
+    bool anchor;
+    SimModule& module;
+    UdpSink& udp;
+    AtEngine engine;
+    ModuleConfigurator config;
+
+    SampleQueue queue;
+    IngestStage ingest;
+    RangeFilter filter;
+    TelemetryBatcher telemetry;
+    ProcessStage process;
+    Tracer tracer; // Stats go out with the telemetry, see trace_report
+
+    ControlChannel control;
+    int control_sock = -1;
+    uint32_t last_control_ms = 0;
+    uint64_t control_applied = 0; // Commands run, resends excluded
+    int32_t tdma_staged = -1;
+    std::mt19937 control_rng;
+
+    RangeStreamParser rdata_parser;
+    MeshDispatcher mesh;
+    std::vector<uint32_t> data_latency_us;
+    bool booted = false;
+    uint32_t boot_us = 0;
+};
+
+
+/// @brief The laptop side, in process: decodes the telemetry and keeps the
+/// latency from each frame's timestamp to its arrival.
+struct Receiver {
+    explicit Receiver(int port) {
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        ok = sock >= 0 && bind(sock, (sockaddr*)&addr, sizeof(addr)) == 0;
+
+        timeval tv = { 0, 100000 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int size = 4 << 20;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+        decoder.on_frame([this](const TelemetryHeader& header, const TelemetryFrame& frame) {
+            uint32_t now = host_micros();
+            latency_us.push_back(now - frame.timestamp_us);
+            std::lock_guard<std::mutex> lock(arrivals_mutex);
+            arrivals_ms[header.device_id].push_back(now / 1000);
+        });
+        for (auto& h : heard_ms) h = 0;
+    }
+    ~Receiver() { close(sock); }
+
+    void run() {
+        uint8_t buf[2048];
+        while (listening) {
+            ssize_t n = recv(sock, buf, sizeof(buf), 0);
+            if (n <= 0) continue;
+            // Stats count too: a tag without a slot still sends those
+            TelemetryHeader header;
+            if (telemetry_decode_header(buf, (size_t)n, header)) heard_ms[header.device_id] = host_micros() / 1000;
+            decoder.decode(buf, (size_t)n);
+        }
+        // Whatever is still in the socket buffer
+        ssize_t n;
+        while ((n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT)) > 0) decoder.decode(buf, (size_t)n);
+    }
+
+    int sock;
+    bool ok;
+    TelemetryDecoder decoder;
+    std::vector<uint32_t> latency_us;
+
+    // For --adaptive
+    std::atomic<uint32_t> heard_ms[TDMA_MAX_DEVICES]; // 0: never
+    std::mutex arrivals_mutex;
+    std::vector<uint32_t> arrivals_ms[TDMA_MAX_DEVICES]; // Frames, by device
+};
+
+
+/// @brief Frames per second each of the tags got between from_ms and to_ms.
+static double tag_rate(Receiver& receiver, const std::vector<int>& tags, uint32_t from_ms, uint32_t to_ms) {
+    if (tags.empty() || to_ms <= from_ms) return 0;
+    std::lock_guard<std::mutex> lock(receiver.arrivals_mutex);
+    size_t frames = 0;
+    for (int id : tags) {
+        for (uint32_t t : receiver.arrivals_ms[id]) frames += t >= from_ms && t < to_ms;
+    }
+    return frames * 1000.0 / (to_ms - from_ms) / tags.size();
+}
+
+
+/// @brief Longest any of the tags went without a frame between from_ms and to_ms.
+static uint32_t tag_max_gap_ms(Receiver& receiver, const std::vector<int>& tags, uint32_t from_ms, uint32_t to_ms) {
+    std::lock_guard<std::mutex> lock(receiver.arrivals_mutex);
+    uint32_t gap = 0;
+    for (int id : tags) {
+        uint32_t last = from_ms;
+        for (uint32_t t : receiver.arrivals_ms[id]) {
+            if (t < from_ms || t >= to_ms) continue;
+            gap = std::max(gap, t - last);
+            last = t;
+        }
+        gap = std::max(gap, to_ms - last);
+    }
+    return gap;
+}
+
+
+static bool parse_options(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(a, "--listen") == 0) {
+            opt.listen = true;
+            continue;
+        }
+        if (strcmp(a, "--adaptive") == 0) {
+            opt.adaptive = opt.listen = true;
+            continue;
+        }
+        if (!v) return false;
+        i++;
+
+        if (strcmp(a, "--tags") == 0) opt.tags = atoi(v);
+        else if (strcmp(a, "--anchors") == 0) opt.anchors = atoi(v);
+        else if (strcmp(a, "--seconds") == 0) opt.seconds = atof(v);
+        else if (strcmp(a, "--port") == 0) opt.port = atoi(v);
+        else if (strcmp(a, "--period-ms") == 0) opt.period_ms = atoi(v);
+        else if (strcmp(a, "--data-ms") == 0) opt.data_ms = atoi(v);
+        else if (strcmp(a, "--loss") == 0) opt.loss = atof(v);
+        else if (strcmp(a, "--dropout") == 0) opt.dropout = atof(v);
+        else if (strcmp(a, "--seed") == 0) opt.seed = (unsigned)atoi(v);
+        else if (strcmp(a, "--control-port") == 0) opt.control_port = atoi(v);
+        else if (strcmp(a, "--control-loss") == 0) opt.control_loss = atof(v);
+        else return false;
+    }
+
+    if (opt.anchors > NUM_ANCHORS) opt.anchors = NUM_ANCHORS; // Only NUM_ANCHORS fit in a report
+    return opt.tags >= 0 && opt.anchors >= 0 && (!opt.adaptive || opt.control_port);
+}
+
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        fprintf(stderr, "usage: %s [--tags N] [--anchors N] [--seconds S] [--port P] [--listen]\n"
+                        "          [--period-ms MS] [--data-ms MS] [--loss P] [--dropout P] [--seed N]\n"
+                        "          [--control-port BASE] [--control-loss P] [--adaptive]\n", argv[0]);
+        return 1;
+    }
+
+    SimTiming timing;
+    timing.range_period_us = opt.period_ms * 1000;
+    SimNoise noise;
+    noise.data_loss = opt.loss;
+    noise.range_dropout = opt.dropout;
+    SimNetwork network(timing, noise, opt.seed);
+
+    std::unique_ptr<Receiver> receiver;
+    if (opt.listen) {
+        receiver.reset(new Receiver(opt.port));
+        if (!receiver->ok) {
+            perror("bind");
+            return 1;
+        }
+    }
+
+    // Anchors around the edge of the field, tags scattered inside it
+    UdpSink udp(opt.port);
+    std::mt19937 rng(opt.seed);
+    std::uniform_real_distribution<double> uniform(0, FIELD_CM);
+    std::vector<std::unique_ptr<SimDevice>> devices;
+
+    for (int a = 0; a < opt.anchors; a++) {
+        double angle = 2 * M_PI * a / (opt.anchors ? opt.anchors : 1);
+        SimModule& m = network.add_module(FIELD_CM / 2 * (1 + cos(angle)), FIELD_CM / 2 * (1 + sin(angle)), 200);
+        devices.emplace_back(new SimDevice(m, a, true, udp));
+    }
+    for (int t = 0; t < opt.tags; t++) {
+        SimModule& m = network.add_module(uniform(rng), uniform(rng), 100);
+        devices.emplace_back(new SimDevice(m, NUM_ANCHORS + t, false, udp));
+    }
+
+    for (auto& d : devices) {
+        if (opt.control_port && !d->open_control(opt.control_port + d->id)) {
+            perror("control bind");
+            return 1;
+        }
+    }
+
+    printf("%d anchors, %d tags, %.0f s, UDP to 127.0.0.1:%d%s\n", opt.anchors, opt.tags, opt.seconds, opt.port,
+           opt.listen ? " (listening)" : "");
+    if (opt.control_port) {
+        printf("commands on 127.0.0.1:%d+uwb_index, anchors from 0, tags from %d\n", opt.control_port, NUM_ANCHORS);
+    }
+
+    std::thread air([&] {
+        while (running) {
+            network.step(host_micros());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    std::thread listener;
+    if (receiver) listener = std::thread([&] { receiver->run(); });
+
+    // The laptop's capacity manager, fed by what the receiver hears
+    ControlClient client;
+    std::unique_ptr<CapacityManager> manager;
+    std::vector<int> tag_ids;
+    if (opt.adaptive) {
+        if (!client.open()) {
+            perror("control socket");
+            return 1;
+        }
+        manager.reset(new CapacityManager(client));
+        for (auto& d : devices) {
+            uint16_t port = (uint16_t)(opt.control_port + d->id);
+            if (d->anchor) manager->add_anchor("127.0.0.1", port, (uint8_t)d->id);
+            else manager->add_tag("127.0.0.1", port, (uint8_t)d->id);
+            if (!d->anchor) tag_ids.push_back(d->id);
+        }
+    }
+    uint32_t switch_start_ms = 0, switch_end_ms = 0; // The first switch
+
+    std::vector<std::thread> boards;
+    for (auto& d : devices) boards.emplace_back([&opt, &d] { d->run(opt); });
+
+    uint32_t start = host_micros();
+    while (host_micros() - start < opt.seconds * 1e6) {
+        if (!manager) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            continue;
+        }
+        uint32_t now_ms = host_micros() / 1000;
+        for (int id : tag_ids) {
+            uint32_t heard = receiver->heard_ms[id];
+            if (heard) manager->heard((uint8_t)id, heard);
+        }
+        manager->poll(now_ms);
+        if (!switch_start_ms && manager->switching()) switch_start_ms = now_ms;
+        if (switch_start_ms && !switch_end_ms && !manager->switching()) switch_end_ms = now_ms;
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    running = false;
+
+    for (auto& b : boards) b.join();
+    air.join();
+    listening = false;
+    if (listener.joinable()) listener.join();
+    double elapsed = (host_micros() - start) / 1e6;
+
+    // Report
+    uint64_t ranges = 0, parsed = 0, overflows = 0, boot_failures = 0;
+    uint64_t control_packets = 0, control_applied = 0, control_duplicates = 0, control_syncs = 0;
+    uint64_t heartbeats_sent = 0, heartbeats_lost = 0;
+    uint32_t boot_max = 0;
+    uint64_t boot_total = 0;
+    std::vector<uint32_t> data_latency;
+    for (size_t i = 0; i < devices.size(); i++) {
+        SimDevice& d = *devices[i];
+        ranges += d.module.ranges_sent;
+        parsed += d.ingest.frames_parsed();
+        overflows += d.queue.overflows();
+        boot_failures += !d.booted;
+        control_packets += d.control.stats().packets;
+        control_applied += d.control_applied;
+        control_duplicates += d.control.stats().duplicates;
+        control_syncs += d.control.stats().syncs;
+        boot_total += d.boot_us;
+        boot_max = std::max(boot_max, d.boot_us);
+        data_latency.insert(data_latency.end(), d.data_latency_us.begin(), d.data_latency_us.end());
+        heartbeats_sent += d.mesh.stats(MESH_HEARTBEAT).sent;
+        heartbeats_lost += d.mesh.stats(MESH_HEARTBEAT).lost;
+    }
+
+    printf("boot       mean %.0f ms, max %.0f ms, %llu failed\n", boot_total / 1000.0 / devices.size(),
+           boot_max / 1000.0, (unsigned long long)boot_failures);
+    printf("air        %zu tags in slots, %.0f ms per report, %llu AT+RANGE (%.0f/s), %llu lost to shared slots\n",
+           network.active_tags(), network.range_interval_us() / 1000.0, (unsigned long long)ranges, ranges / elapsed,
+           (unsigned long long)network.slot_collisions());
+    printf("firmware   %llu frames parsed, %llu queue overflows, %llu packets / %llu bytes sent (%.0f/s)\n",
+           (unsigned long long)parsed, (unsigned long long)overflows, (unsigned long long)udp.packets.load(),
+           (unsigned long long)udp.bytes.load(), udp.packets / elapsed);
+    printf("mesh       %llu heartbeats sent, %zu received, %llu seen lost, latency p50 %.1f ms, p99 %.1f ms\n",
+           (unsigned long long)heartbeats_sent, data_latency.size(), (unsigned long long)heartbeats_lost,
+           percentile(data_latency, 0.5) / 1000.0, percentile(data_latency, 0.99) / 1000.0);
+
+    if (opt.control_port) {
+        printf("control    %llu packets, %llu commands run, %llu resends answered from the window, %llu clock syncs\n",
+               (unsigned long long)control_packets, (unsigned long long)control_applied,
+               (unsigned long long)control_duplicates, (unsigned long long)control_syncs);
+    }
+
+    if (manager) {
+        const CapacityStats& s = manager->stats();
+        const TdmaPlanner& plan = manager->planner();
+        printf("tdma       capacity %u x %u ms = %u ms superframe, %llu switches (%llu aborted, %llu partial), "
+               "stage %u ms, commit %u ms\n",
+               plan.capacity(), plan.slot_ms(), (unsigned)plan.superframe_ms(), (unsigned long long)s.switches,
+               (unsigned long long)s.aborted, (unsigned long long)s.partial, (unsigned)s.last_stage_ms,
+               (unsigned)s.last_commit_ms);
+        uint32_t start_ms = start / 1000;
+        uint32_t end_ms = start_ms + (uint32_t)(elapsed * 1000);
+        if (switch_end_ms) {
+            // Before: from the first frames in to the switch. After: a second on.
+            uint32_t before_from = start_ms + 1000;
+            uint32_t after_from = switch_end_ms + 1000;
+            printf("           per tag %.1f Hz before, %.1f Hz after, switch took %u ms, longest gap %u ms around "
+                   "it (%u ms before it)\n",
+                   tag_rate(*receiver, tag_ids, before_from, switch_start_ms),
+                   tag_rate(*receiver, tag_ids, after_from, end_ms), switch_end_ms - switch_start_ms,
+                   tag_max_gap_ms(*receiver, tag_ids, switch_start_ms > 1000 ? switch_start_ms - 1000 : 0,
+                                  switch_end_ms + 1000),
+                   tag_max_gap_ms(*receiver, tag_ids, before_from, switch_start_ms));
+        }
+    }
+
+    if (receiver) {
+        uint64_t frames = 0, lost = 0;
+        for (auto& d : devices) {
+            const DeviceLinkStats& s = receiver->decoder.stats((uint8_t)d->id);
+            frames += s.frames;
+            lost += s.lost;
+        }
+        std::vector<uint32_t>& lat = receiver->latency_us;
+        printf("host       %llu frames, %llu lost, parse->host latency p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+               (unsigned long long)frames, (unsigned long long)lost, percentile(lat, 0.5) / 1000.0,
+               percentile(lat, 0.99) / 1000.0, lat.empty() ? 0.0 : *std::max_element(lat.begin(), lat.end()) / 1000.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include "at_engine.h"
+
+#include <string.h>
+
+// Lines the module sends on its own, not as a reply to a command.
+static const char* const UNSOLICITED_PREFIXES[] = { "AT+RANGE", "AT+RDATA" };
+
+static bool starts_with(const char* text, size_t len, const char* prefix) {
+    size_t n = strlen(prefix);
+    return len >= n && memcmp(text, prefix, n) == 0;
+}
+
+static bool ends_with(const char* text, size_t len, const char* suffix) {
+    size_t n = strlen(suffix);
+    return len >= n && memcmp(text + len - n, suffix, n) == 0;
+}
+
+
+AtEngine::AtEngine(AtPort& port, AtClock clock)
+    : port(port), clock(clock), head(0), count(0), next_id(0), in_flight(false),
+      sent_at_us(0), last_status(AT_PENDING), line_len(0), response_len(0), unsolicited(nullptr),
+      unsolicited_ctx(nullptr), take_line(nullptr), give_line(nullptr), share_ctx(nullptr),
+      tracer(nullptr) {
+    response[0] = '\0';
+    reset_stats();
+}
+
+
+void AtEngine::reset_stats() {
+    memset(&statistics, 0, sizeof(statistics));
+    statistics.min_latency_us = UINT32_MAX;
+}
+
+
+void AtEngine::set_unsolicited_handler(AtLineHandler handler, void* ctx) {
+    unsolicited = handler;
+    unsolicited_ctx = ctx;
+}
+
+
+void AtEngine::set_line_share(AtTakeLineFn take, AtGiveLineFn give, void* ctx) {
+    take_line = take;
+    give_line = give;
+    share_ctx = ctx;
+}
+
+
+int AtEngine::submit(const char* command, uint32_t timeout_ms, const char* expect,
+                     AtCallback callback, void* ctx) {
+    if (count == AT_QUEUE_DEPTH) {
+        statistics.dropped++;
+        return -1;
+    }
+
+    AtCommand& slot = queue[(head + count) % AT_QUEUE_DEPTH];
+    strncpy(slot.text, command, AT_COMMAND_LEN - 1);
+    slot.text[AT_COMMAND_LEN - 1] = '\0';
+    slot.expect = expect;
+    slot.timeout_us = timeout_ms * 1000UL;
+    slot.callback = callback;
+    slot.ctx = ctx;
+    slot.id = next_id++;
+    count++;
+
+    return slot.id;
+}
+
+
+void AtEngine::poll() {
+    if (!in_flight && count > 0) start_head();
+
+    while (port.available()) {
+        int c = port.read();
+        if (c < 0) break;
+
+        // The module emits a few null bytes when it comes out of reset
+        if (c == '\0') continue;
+
+        if (c == '\n') {
+            handle_line();
+            line_len = 0;
+            // A reply may have freed the head, so get the next one on the wire
+            if (!in_flight && count > 0) start_head();
+            continue;
+        }
+
+        // Overlong lines are truncated rather than split
+        if (line_len < AT_LINE_LEN - 1) line[line_len++] = (char)c;
+    }
+
+    if (in_flight && (uint32_t)(clock() - sent_at_us) >= queue[head].timeout_us) {
+        finish(AT_TIMEOUT);
+        if (count > 0) start_head();
+    }
+}
+
+
+AtResult AtEngine::run(const char* command, uint32_t timeout_ms, const char* expect) {
+    // The rest of whatever line the other reader is on comes to us now
+    if (take_line && line_len == 0) line_len = take_line(line, AT_LINE_LEN - 1, share_ctx);
+
+    // Let anything already queued go first so the response buffer is ours
+    while (!idle()) poll();
+
+    AtResult result = { 0, AT_PENDING, 0, response, 0 };
+    int id = submit(command, timeout_ms, expect);
+    if (id >= 0) {
+        while (!idle()) poll();
+    }
+
+    if (give_line && line_len > 0) {
+        give_line(line, line_len, share_ctx);
+        line_len = 0;
+    }
+    if (id < 0) return result;
+
+    result.id = (uint16_t)id;
+    result.status = last_status;
+    result.latency_us = statistics.last_latency_us;
+    result.response_len = response_len;
+    return result;
+}
+
+
+void AtEngine::start_head() {
+    response_len = 0;
+    response[0] = '\0';
+
+    port.write_line(queue[head].text);
+    sent_at_us = clock();
+    in_flight = true;
+}
+
+
+void AtEngine::handle_line() {
+    // Strip the \r and any padding the module adds
+    while (line_len > 0 && (line[line_len - 1] == '\r' || line[line_len - 1] == ' ')) line_len--;
+    line[line_len] = '\0';
+
+    if (line_len == 0) return;
+
+    bool is_unsolicited = false;
+    for (size_t i = 0; i < sizeof(UNSOLICITED_PREFIXES) / sizeof(UNSOLICITED_PREFIXES[0]); i++) {
+        if (starts_with(line, line_len, UNSOLICITED_PREFIXES[i])) is_unsolicited = true;
+    }
+
+    if (!in_flight) {
+        if (unsolicited) unsolicited(line, line_len, unsolicited_ctx);
+        return;
+    }
+
+    const char* expect = queue[head].expect;
+    if (expect && starts_with(line, line_len, expect)) {
+        append_response(line, line_len);
+        finish(AT_OK);
+        return;
+    }
+
+    if (is_unsolicited && unsolicited) {
+        unsolicited(line, line_len, unsolicited_ctx);
+        return;
+    }
+
+    append_response(line, line_len);
+
+    if (starts_with(line, line_len, AT_TERMINATOR_OK) || ends_with(line, line_len, AT_TERMINATOR_OK)) {
+        finish(AT_OK);
+    } else if (starts_with(line, line_len, AT_TERMINATOR_ERR) || strstr(line, "ERROR")) {
+        finish(AT_ERROR);
+    }
+}
+
+
+void AtEngine::append_response(const char* text, size_t len) {
+    if (response_len > 0 && response_len < AT_RESPONSE_LEN - 1) response[response_len++] = '\n';
+
+    size_t room = AT_RESPONSE_LEN - 1 - response_len;
+    if (len > room) len = room;
+
+    memcpy(response + response_len, text, len);
+    response_len += len;
+    response[response_len] = '\0';
+}
+
+
+void AtEngine::finish(AtStatus status) {
+    AtCommand& cmd = queue[head];
+    uint32_t latency = (uint32_t)(clock() - sent_at_us);
+
+    statistics.completed++;
+    if (status == AT_OK) statistics.ok++;
+    if (status == AT_ERROR) statistics.errors++;
+    if (status == AT_TIMEOUT) statistics.timeouts++;
+    statistics.last_latency_us = latency;
+    if (latency < statistics.min_latency_us) statistics.min_latency_us = latency;
+    if (latency > statistics.max_latency_us) statistics.max_latency_us = latency;
+    statistics.total_latency_us += latency;
+    last_status = status;
+    if (tracer) tracer->record_command(cmd.text, latency);
+
+    AtResult result = { cmd.id, status, latency, response, response_len };
+
+    // Pop before the callback so it is free to queue a follow-up command. The
+    // text is copied out since that command may land in the freed slot.
+    AtCallback callback = cmd.callback;
+    void* ctx = cmd.ctx;
+    char text[AT_COMMAND_LEN];
+    if (callback) memcpy(text, cmd.text, AT_COMMAND_LEN);
+    head = (head + 1) % AT_QUEUE_DEPTH;
+    count--;
+    in_flight = false;
+
+    if (callback) callback(text, result, ctx);
+}
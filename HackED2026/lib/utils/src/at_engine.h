@@ -0,0 +1,159 @@
+#ifndef AT_ENGINE_H
+#define AT_ENGINE_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define AT_QUEUE_DEPTH 16 // Commands that can be waiting at once
+#define AT_COMMAND_LEN 96 // Longest command, including the null terminator
+#define AT_LINE_LEN 160 // Longest single reply line we keep
+#define AT_RESPONSE_LEN 384 // Everything a command gets back, all lines joined
+
+// The AT firmware answers every command with one of these.
+#define AT_TERMINATOR_OK "OK"
+#define AT_TERMINATOR_ERR "ERR"
+
+/// @brief Microsecond clock. micros() on the board, steady_clock on the host.
+typedef uint32_t (*AtClock)();
+
+enum AtStatus { AT_PENDING = 0, AT_OK = 1, AT_ERROR = 2, AT_TIMEOUT = 3 };
+
+/// @brief Byte-level link to the UWB module. SERIAL_AT on the board, a mock on
+/// the host, so the engine never touches hardware directly.
+class AtPort {
+public:
+    virtual ~AtPort() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    /// @brief Sends one command, the port appends the line ending.
+    virtual void write_line(const char* line) = 0;
+};
+
+struct AtResult {
+    /// @brief Queue-assigned id, matches the value returned by submit().
+    uint16_t id;
+    AtStatus status;
+    /// @brief Time from the command hitting the wire to its terminator.
+    uint32_t latency_us;
+    /// @brief All reply lines, newline separated. Only valid inside the
+    /// callback, or until the next command completes.
+    const char* response;
+    size_t response_len;
+};
+
+typedef void (*AtCallback)(const char* command, const AtResult& result, void* ctx);
+typedef void (*AtLineHandler)(const char* line, size_t len, void* ctx);
+/// @brief Copies the other reader's half-read line into out (at most len
+/// bytes) and forgets it. @return Its length.
+typedef size_t (*AtTakeLineFn)(char* out, size_t len, void* ctx);
+/// @brief The engine's half-read line, for the other reader to continue.
+typedef void (*AtGiveLineFn)(const char* text, size_t len, void* ctx);
+
+struct AtStats {
+    uint32_t completed;
+    uint32_t ok;
+    uint32_t errors;
+    uint32_t timeouts;
+    uint32_t dropped; // submit() calls rejected because the queue was full
+    uint32_t last_latency_us;
+    uint32_t min_latency_us;
+    uint32_t max_latency_us;
+    uint64_t total_latency_us;
+};
+
+/// @brief Queues AT commands and completes each one as soon as its terminator
+/// (OK, ERR or an expected reply prefix) arrives, instead of waiting out the
+/// whole timeout.
+class AtEngine {
+public:
+    AtEngine(AtPort& port, AtClock clock);
+
+    /// @brief Queues a command.
+    /// @param command The AT command, without a line ending.
+    /// @param timeout_ms Upper bound on the wait for a terminator.
+    /// @param expect Optional reply prefix that also completes the command.
+    /// @param callback Optional completion callback, called from poll().
+    /// @param ctx Passed back to the callback.
+    /// @return The command id, or -1 if the queue is full.
+    int submit(const char* command, uint32_t timeout_ms, const char* expect = nullptr,
+               AtCallback callback = nullptr, void* ctx = nullptr);
+
+    /// @brief Drains the port, matches replies and starts the next command.
+    /// Never blocks.
+    void poll();
+
+    /// @brief Blocking helper: queues a command and polls until it completes.
+    AtResult run(const char* command, uint32_t timeout_ms, const char* expect = nullptr);
+
+    /// @brief Receives AT+RANGE / AT+RDATA lines that are not a reply to the
+    /// command in flight. Without a handler they are folded into the response.
+    void set_unsolicited_handler(AtLineHandler handler, void* ctx);
+
+    /// @brief For a port something else reads as well, between commands. A
+    /// line is never split between the two: run() takes the other reader's
+    /// half-read line before it reads and gives its own back when it returns.
+    void set_line_share(AtTakeLineFn take, AtGiveLineFn give, void* ctx);
+
+    /// @brief Optional: every completed command's latency goes into the
+    /// tracer's histogram for its name. Null turns it off.
+    void set_tracer(Tracer* command_tracer) { tracer = command_tracer; }
+
+    bool idle() const { return count == 0; }
+    size_t pending() const { return count; }
+    const AtStats& stats() const { return statistics; }
+    void reset_stats();
+
+private:
+    struct AtCommand {
+        char text[AT_COMMAND_LEN];
+        const char* expect;
+        uint32_t timeout_us;
+        AtCallback callback;
+        void* ctx;
+        uint16_t id;
+    };
+
+    void start_head();
+    void handle_line();
+    void finish(AtStatus status);
+    void append_response(const char* text, size_t len);
+
+    AtPort& port;
+    AtClock clock;
+
+    AtCommand queue[AT_QUEUE_DEPTH];
+    size_t head;
+    size_t count;
+    uint16_t next_id;
+
+    // State of the command at the head of the queue
+    bool in_flight;
+    uint32_t sent_at_us;
+    AtStatus last_status;
+
+    char line[AT_LINE_LEN];
+    size_t line_len;
+    char response[AT_RESPONSE_LEN];
+    size_t response_len;
+
+    AtLineHandler unsolicited;
+    void* unsolicited_ctx;
+    AtTakeLineFn take_line;
+    AtGiveLineFn give_line;
+    void* share_ctx;
+
+    AtStats statistics;
+    Tracer* tracer;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "boot.h"
+
+#include "telemetry.h"
+#include "wire_format.h"
+
+static const char* const PHASE_NAMES[BOOT_PHASE_COUNT] = {
+    "wifi", "oled", "module_ready", "version", "role", "first_range", "first_send",
+};
+
+
+const char* boot_phase_name(uint8_t phase) {
+    return phase < BOOT_PHASE_COUNT ? PHASE_NAMES[phase] : "?";
+}
+
+
+size_t boot_encode_report(uint8_t* out, uint8_t device_id, const BootTimer& timer, uint16_t buffered,
+                          uint16_t dropped) {
+    put_u16(out, TELEMETRY_MAGIC);
+    out[2] = TELEMETRY_VERSION;
+    out[3] = TELEMETRY_BOOT;
+    out[4] = device_id;
+    out[5] = 0;
+    out[6] = 0;
+    out[7] = 0;
+    put_u16(out + TELEMETRY_HEADER_LEN, buffered);
+    put_u16(out + TELEMETRY_HEADER_LEN + 2, dropped);
+    size_t len = TELEMETRY_HEADER_LEN + 4;
+
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+        const BootPhaseTiming& p = timer.phase(i);
+        if (!p.started) continue;
+
+        uint8_t* f = out + len;
+        f[0] = i;
+        f[1] = p.done;
+        f[2] = 0;
+        f[3] = 0;
+        put_u32(f + 4, p.start_us);
+        put_u32(f + 8, p.end_us);
+        len += BOOT_PHASE_LEN;
+        out[5]++;
+    }
+
+    return len;
+}
+
+
+bool boot_decode_report(const uint8_t* data, size_t len, BootReport& report) {
+    TelemetryHeader header;
+    if (!telemetry_decode_header(data, len, header) || header.type != TELEMETRY_BOOT) return false;
+    if (len < TELEMETRY_HEADER_LEN + 4 + (size_t)header.frame_count * BOOT_PHASE_LEN) return false;
+
+    const uint8_t* p = data + TELEMETRY_HEADER_LEN;
+    memset(&report, 0, sizeof(report));
+    report.buffered = get_u16(p);
+    report.dropped = get_u16(p + 2);
+    p += 4;
+
+    for (size_t i = 0; i < header.frame_count; i++, p += BOOT_PHASE_LEN) {
+        if (p[0] >= BOOT_PHASE_COUNT) continue;
+        BootPhaseTiming& t = report.phases[p[0]];
+        t.started = true;
+        t.done = p[1] != 0;
+        t.start_us = get_u32(p + 4);
+        t.end_us = get_u32(p + 8);
+    }
+
+    return true;
+}
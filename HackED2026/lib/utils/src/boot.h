@@ -0,0 +1,147 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define BOOT_BUFFER_BYTES 8192 // Datagrams held until WiFi is up, the oldest go first
+#define BOOT_OLED_POWER_UP_MS 100 // The SSD1306 takes commands this long after power-on
+#define BOOT_REPORT_WAIT_MS 10000 // Longest the boot report waits on the first range once WiFi is up
+#define BOOT_PHASE_LEN 12 // Bytes per phase in a TELEMETRY_BOOT packet
+
+// Startup steps, in roughly the order they finish. WiFi associates in the
+// background from the start, so BOOT_WIFI overlaps all the others.
+enum BootPhase {
+    BOOT_WIFI = 0, // WiFi.begin() to associated
+    BOOT_OLED, // Wire and display.begin()
+    BOOT_MODULE_READY, // Reset released to the module answering AT
+    BOOT_VERSION, // AT+GETVER?
+    BOOT_ROLE, // set_role(), the module's whole config
+    BOOT_FIRST_RANGE, // Role set to the first AT+RANGE frame
+    BOOT_FIRST_SEND, // Link up to the buffered datagrams sent
+    BOOT_PHASE_COUNT
+};
+
+/// @brief Name for printing, "?" if out of range.
+const char* boot_phase_name(uint8_t phase);
+
+struct BootPhaseTiming {
+    uint32_t start_us; // micros() since reset
+    uint32_t end_us;
+    bool started;
+    bool done;
+};
+
+/// @brief Start and end of each BootPhase. Phases may overlap.
+class BootTimer {
+public:
+    BootTimer() { memset(phases, 0, sizeof(phases)); }
+
+    void begin(BootPhase phase, uint32_t now_us) {
+        phases[phase].start_us = now_us;
+        phases[phase].started = true;
+    }
+
+    /// @brief Does nothing the second time, so it can sit on a hot path.
+    void end(BootPhase phase, uint32_t now_us) {
+        BootPhaseTiming& p = phases[phase];
+        if (p.done) return;
+        if (!p.started) begin(phase, now_us);
+        p.end_us = now_us;
+        p.done = true;
+    }
+
+    bool done(BootPhase phase) const { return phases[phase].done; }
+    const BootPhaseTiming& phase(uint8_t phase) const { return phases[phase]; }
+    uint32_t duration_us(BootPhase phase) const { return phases[phase].end_us - phases[phase].start_us; }
+
+private:
+    BootPhaseTiming phases[BOOT_PHASE_COUNT];
+};
+
+/// @brief Datagrams that can't go out yet, kept whole in one flat buffer.
+/// When it fills up the oldest are dropped, the newest matter more once the
+/// link is back.
+template <size_t BYTES>
+class DatagramBuffer {
+public:
+    DatagramBuffer() : used(0), held(0), lost(0) {}
+
+    /// @return False if the datagram can never fit.
+    bool push(const uint8_t* data, size_t len) {
+        if (len + 2 > BYTES || len > UINT16_MAX) {
+            lost++;
+            return false;
+        }
+        while (used + 2 + len > BYTES) drop_oldest();
+
+        buffer[used] = (uint8_t)len;
+        buffer[used + 1] = (uint8_t)(len >> 8);
+        memcpy(buffer + used + 2, data, len);
+        used += 2 + len;
+        held++;
+        return true;
+    }
+
+    /// @brief Hands every datagram, oldest first, to send(data, len) and empties the buffer.
+    /// @return Datagrams sent.
+    template <typename Send>
+    size_t drain(Send send) {
+        size_t sent = 0;
+        for (size_t at = 0; at < used; sent++) {
+            size_t len = buffer[at] | (size_t)buffer[at + 1] << 8;
+            send(buffer + at + 2, len);
+            at += 2 + len;
+        }
+        used = 0;
+        held = 0;
+        return sent;
+    }
+
+    size_t count() const { return held; }
+    size_t bytes() const { return used; }
+    /// @brief Datagrams dropped since boot to make room, or too big to keep.
+    uint32_t dropped() const { return lost; }
+
+private:
+    void drop_oldest() {
+        size_t len = 2 + (buffer[0] | (size_t)buffer[1] << 8);
+        memmove(buffer, buffer + len, used - len);
+        used -= len;
+        held--;
+        lost++;
+    }
+
+    uint8_t buffer[BYTES];
+    size_t used;
+    size_t held;
+    uint32_t lost;
+};
+
+struct BootReport {
+    uint16_t buffered; // Datagrams held until the link came up
+    uint16_t dropped; // Lost to a full buffer
+    BootPhaseTiming phases[BOOT_PHASE_COUNT]; // By BootPhase, not started if the packet lacks it
+};
+
+/// @brief Writes a TELEMETRY_BOOT packet, see telemetry.h.
+/// @param out At least TELEMETRY_HEADER_LEN + 4 + BOOT_PHASE_COUNT * BOOT_PHASE_LEN bytes.
+/// @return The packet length.
+size_t boot_encode_report(uint8_t* out, uint8_t device_id, const BootTimer& timer, uint16_t buffered,
+                          uint16_t dropped);
+
+/// @brief Decodes a TELEMETRY_BOOT packet. Phases this build doesn't know
+/// are skipped.
+/// @return False if the packet is malformed.
+bool boot_decode_report(const uint8_t* data, size_t len, BootReport& report);
+
+#endif
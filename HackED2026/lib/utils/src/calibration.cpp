@@ -0,0 +1,392 @@
+#include "calibration.h"
+
+#include <string.h>
+
+#include "wire_format.h"
+
+// A pair is two ids in one byte
+static_assert(CAL_MAX_DEVICES <= 16, "Calibration pairs don't fit in a byte");
+static_assert(1 + CAL_MAX_PAIRS <= MESH_MAX_PAYLOAD, "A calibration request doesn't fit in a mesh frame");
+
+
+static void coordinator_message(const MeshMessage& message, void* ctx) {
+    ((CalibrationCoordinator*)ctx)->on_message(message);
+}
+
+
+static void participant_message(const MeshMessage& message, void* ctx) {
+    ((CalibrationParticipant*)ctx)->on_message(message);
+}
+
+
+size_t calibration_round_count(size_t devices) {
+    if (devices < 2) return 0;
+    return devices % 2 == 0 ? devices - 1 : devices;
+}
+
+
+size_t calibration_round_pairs(size_t devices, size_t round, CalPair* out) {
+    if (devices < 2 || devices > CAL_MAX_DEVICES) return 0;
+
+    // Odd counts get a phantom device; whoever is paired with it sits the round out
+    size_t n = devices % 2 == 0 ? devices : devices + 1;
+    size_t ring = n - 1;
+    size_t count = 0;
+
+    // Device n-1 stays put while the others rotate around it
+    for (size_t k = 0; k < n / 2; k++) {
+        size_t x = k == 0 ? n - 1 : (round + k) % ring;
+        size_t y = (round + ring - k) % ring;
+        if (x >= devices || y >= devices) continue;
+
+        // Alternate who measures so the role switches are spread out
+        bool swap = (round + k) % 2 == 1;
+        out[count].a = (uint8_t)(swap ? y : x);
+        out[count].b = (uint8_t)(swap ? x : y);
+        count++;
+    }
+
+    return count;
+}
+
+
+uint8_t calibration_mesh_type(CalMessageType type) {
+    switch (type) {
+    case CAL_MSG_REQUEST: return MESH_CAL_REQUEST;
+    case CAL_MSG_RESULT: return MESH_CAL_RESULT;
+    case CAL_MSG_DONE: return MESH_CAL_DONE;
+    case CAL_MSG_ACK: return MESH_CAL_ACK;
+    default: return 0;
+    }
+}
+
+
+static uint8_t pack_pair(const CalPair& pair) { return (uint8_t)(pair.a << 4 | pair.b); }
+
+
+static CalPair unpack_pair(uint8_t packed) { return CalPair{ (uint8_t)(packed >> 4), (uint8_t)(packed & 0x0F) }; }
+
+
+int calibration_encode(const CalMessage& message, uint8_t* out, size_t len) {
+    switch (message.type) {
+    case CAL_MSG_REQUEST:
+        if (len < 1 + (size_t)message.pair_count) return -1;
+        out[0] = message.round;
+        for (size_t i = 0; i < message.pair_count; i++) out[1 + i] = pack_pair(message.pairs[i]);
+        return 1 + message.pair_count;
+    case CAL_MSG_RESULT:
+        if (len < 4 || message.distance < 0 || message.distance > UINT16_MAX) return -1;
+        out[0] = message.round;
+        out[1] = pack_pair(message.pairs[0]);
+        put_u16(out + 2, (uint16_t)message.distance);
+        return 4;
+    case CAL_MSG_DONE:
+    case CAL_MSG_ACK:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+
+bool calibration_decode(const MeshMessage& message, CalMessage& out) {
+    memset(&out, 0, sizeof(out));
+    const uint8_t* p = message.payload;
+
+    switch (message.type) {
+    case MESH_CAL_REQUEST:
+        if (message.length < 1 || message.length > 1 + CAL_MAX_PAIRS) return false;
+        out.type = CAL_MSG_REQUEST;
+        out.round = p[0];
+        out.pair_count = (uint8_t)(message.length - 1);
+        for (size_t i = 0; i < out.pair_count; i++) out.pairs[i] = unpack_pair(p[1 + i]);
+        return true;
+    case MESH_CAL_RESULT:
+        if (message.length != 4) return false;
+        out.type = CAL_MSG_RESULT;
+        out.round = p[0];
+        out.pair_count = 1;
+        out.pairs[0] = unpack_pair(p[1]);
+        out.distance = get_u16(p + 2);
+        return true;
+    case MESH_CAL_DONE:
+        out.type = CAL_MSG_DONE;
+        return true;
+    case MESH_CAL_ACK:
+        out.type = CAL_MSG_ACK;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/////////////////
+// COORDINATOR //
+/////////////////
+
+CalibrationCoordinator::CalibrationCoordinator(MeshDispatcher& mesh)
+    : mesh(mesh), phase(PHASE_IDLE), device_count(0), parallel(true), round_limit(0), round(0), retries(0),
+      started_us(0), deadline_us(0), pair_count(0), pending(0), acked(0) {
+    memset(&statistics, 0, sizeof(statistics));
+    mesh.on(MESH_CAL_RESULT, coordinator_message, this);
+    mesh.on(MESH_CAL_ACK, coordinator_message, this);
+}
+
+
+void CalibrationCoordinator::start(size_t devices, uint32_t now_us, bool all_at_once) {
+    device_count = devices > CAL_MAX_DEVICES ? CAL_MAX_DEVICES : devices;
+    parallel = all_at_once;
+    round_limit = 0;
+    for (size_t a = 0; a < device_count; a++) {
+        for (size_t b = 0; b < device_count; b++) matrix[a * device_count + b] = a == b ? 0 : CAL_NO_DISTANCE;
+    }
+
+    memset(&statistics, 0, sizeof(statistics));
+    started_us = now_us;
+    round = 0;
+    phase = PHASE_MEASURING;
+    start_round(now_us);
+}
+
+
+void CalibrationCoordinator::check(size_t devices, uint32_t now_us, size_t rounds) {
+    start(devices, now_us, true);
+    // start() already sent the first round, the limit only stops the ones after it
+    round_limit = rounds ? rounds : 1;
+}
+
+
+void CalibrationCoordinator::start_round(uint32_t now_us) {
+    size_t rounds = parallel ? calibration_round_count(device_count) : device_count * (device_count - 1) / 2;
+    if (round_limit && rounds > round_limit) rounds = round_limit;
+    if (round >= rounds) {
+        phase = PHASE_MEASURED;
+        statistics.elapsed_us = now_us - started_us;
+        return;
+    }
+
+    if (parallel) {
+        pair_count = calibration_round_pairs(device_count, round, pairs);
+    } else {
+        // Pairs in order, (0,1), (0,2) ... (1,2) ...
+        size_t index = round;
+        size_t a = 0;
+        while (index >= device_count - 1 - a) index -= device_count - 1 - a++;
+        pairs[0].a = (uint8_t)a;
+        pairs[0].b = (uint8_t)(a + 1 + index);
+        pair_count = 1;
+    }
+    pending = (1UL << pair_count) - 1;
+    retries = 0;
+    statistics.rounds++;
+
+    send_request(now_us);
+    deadline_us = now_us + CAL_ROUND_TIMEOUT_US;
+}
+
+
+void CalibrationCoordinator::send_request(uint32_t now_us) {
+    CalMessage message;
+    message.type = CAL_MSG_REQUEST;
+    message.round = round;
+    message.pair_count = 0;
+
+    // Only what is still missing, so finished measurers aren't disturbed
+    for (size_t i = 0; i < pair_count; i++) {
+        if (pending & (1UL << i)) message.pairs[message.pair_count++] = pairs[i];
+    }
+
+    send(message, now_us);
+}
+
+
+void CalibrationCoordinator::send_done(uint32_t now_us) {
+    CalMessage message;
+    message.type = CAL_MSG_DONE;
+    send(message, now_us);
+}
+
+
+void CalibrationCoordinator::send(const CalMessage& message, uint32_t now_us) {
+    uint8_t payload[MESH_MAX_PAYLOAD] = { 0 };
+    int len = calibration_encode(message, payload, sizeof(payload));
+    if (len < 0) return;
+
+    statistics.messages_sent++;
+    mesh.send(calibration_mesh_type(message.type), payload, (size_t)len, now_us);
+}
+
+
+void CalibrationCoordinator::on_message(const MeshMessage& frame) {
+    CalMessage message;
+    if (!calibration_decode(frame, message)) return;
+    int sender = frame.sender;
+
+    if (message.type == CAL_MSG_ACK && phase == PHASE_FINISHING) {
+        if (sender < 0 || (size_t)sender >= device_count) return;
+        acked |= 1UL << sender;
+        if (acked == (1UL << device_count) - 1) phase = PHASE_COMPLETE;
+        return;
+    }
+
+    if (message.type != CAL_MSG_RESULT || message.distance < 0) return;
+
+    const CalPair& pair = message.pairs[0];
+    if (pair.a >= device_count || pair.b >= device_count) return;
+
+    // A late result for a pair given up on earlier still counts
+    if (distance(pair.a, pair.b) == CAL_NO_DISTANCE) {
+        matrix[pair.a * device_count + pair.b] = message.distance;
+        matrix[pair.b * device_count + pair.a] = message.distance;
+    }
+
+    if (phase != PHASE_MEASURING || message.round != round) return;
+
+    for (size_t i = 0; i < pair_count; i++) {
+        if (pairs[i].a == pair.a && pairs[i].b == pair.b) pending &= ~(1UL << i);
+    }
+
+    if (pending == 0) {
+        round++;
+        start_round(frame.received_us);
+    }
+}
+
+
+void CalibrationCoordinator::poll(uint32_t now_us) {
+    if (phase != PHASE_MEASURING && phase != PHASE_FINISHING) return;
+    if ((int32_t)(now_us - deadline_us) < 0) return;
+
+    if (retries < CAL_MAX_RETRIES) {
+        retries++;
+        statistics.retries++;
+        if (phase == PHASE_MEASURING) send_request(now_us);
+        else send_done(now_us);
+        deadline_us = now_us + CAL_ROUND_TIMEOUT_US;
+        return;
+    }
+
+    if (phase == PHASE_FINISHING) {
+        for (size_t d = 0; d < device_count; d++) {
+            if (!(acked & (1UL << d))) statistics.missing_acks++;
+        }
+        phase = PHASE_COMPLETE;
+        return;
+    }
+
+    for (size_t i = 0; i < pair_count; i++) {
+        if (pending & (1UL << i)) statistics.failed_pairs++;
+    }
+    round++;
+    start_round(now_us);
+}
+
+
+void CalibrationCoordinator::finish(uint32_t now_us) {
+    if (phase != PHASE_MEASURED) return;
+
+    phase = PHASE_FINISHING;
+    acked = 0;
+    retries = 0;
+    send_done(now_us);
+    deadline_us = now_us + CAL_ROUND_TIMEOUT_US;
+}
+
+
+/////////////////
+// PARTICIPANT //
+/////////////////
+
+CalibrationParticipant::CalibrationParticipant(uint8_t id, MeshDispatcher& mesh, RoleFn role, void* ctx)
+    : id(id), mesh(mesh), role_fn(role), ctx(ctx), active(false), finished(false), round(0), peer(0),
+      deadline_us(0), sample_count(0), have_result(false) {
+    memset(&request, 0, sizeof(request));
+    memset(&last_result, 0, sizeof(last_result));
+    mesh.on(MESH_CAL_REQUEST, participant_message, this);
+    mesh.on(MESH_CAL_DONE, participant_message, this);
+}
+
+
+void CalibrationParticipant::on_message(const MeshMessage& frame) {
+    CalMessage message;
+    if (!calibration_decode(frame, message)) return;
+    uint32_t now_us = frame.received_us;
+
+    if (message.type == CAL_MSG_DONE) {
+        if (active) stop(CAL_NO_DISTANCE, now_us);
+        finished = true;
+        mesh.reply(frame.ref(), MESH_CAL_ACK, nullptr, 0, now_us);
+        return;
+    }
+
+    if (message.type != CAL_MSG_REQUEST) return;
+
+    for (size_t i = 0; i < message.pair_count; i++) {
+        const CalPair& pair = message.pairs[i];
+        if (pair.b != id) continue;
+
+        request = frame.ref();
+
+        // Asked again for something already sent: the result got lost
+        if (have_result && last_result.round == message.round && last_result.pairs[0].a == pair.a) {
+            send_result(now_us);
+            return;
+        }
+
+        if (active && round == message.round && peer == pair.a) return; // Already on it
+
+        if (!active) role_fn(true, ctx);
+        active = true;
+        round = message.round;
+        peer = pair.a;
+        sample_count = 0;
+        deadline_us = now_us + CAL_MEASURE_TIMEOUT_US;
+        return;
+    }
+}
+
+
+void CalibrationParticipant::on_ranges(const int* ranges, size_t count, uint32_t now_us) {
+    if (!active || peer >= count || ranges[peer] <= 0) return;
+
+    samples[sample_count++] = ranges[peer];
+    if (sample_count < CAL_SAMPLES) return;
+
+    // Median, so one multipath outlier doesn't skew the result
+    for (size_t i = 1; i < sample_count; i++) {
+        int v = samples[i];
+        size_t j = i;
+        for (; j > 0 && samples[j - 1] > v; j--) samples[j] = samples[j - 1];
+        samples[j] = v;
+    }
+    stop(samples[sample_count / 2], now_us);
+}
+
+
+void CalibrationParticipant::poll(uint32_t now_us) {
+    if (active && (int32_t)(now_us - deadline_us) >= 0) stop(CAL_NO_DISTANCE, now_us);
+}
+
+
+void CalibrationParticipant::stop(int distance, uint32_t now_us) {
+    active = false;
+    role_fn(false, ctx);
+    if (distance < 0) return;
+
+    last_result.type = CAL_MSG_RESULT;
+    last_result.round = round;
+    last_result.pair_count = 1;
+    last_result.pairs[0].a = peer;
+    last_result.pairs[0].b = id;
+    last_result.distance = distance;
+    have_result = true;
+    send_result(now_us);
+}
+
+
+void CalibrationParticipant::send_result(uint32_t now_us) {
+    uint8_t payload[MESH_MAX_PAYLOAD] = { 0 };
+    int len = calibration_encode(last_result, payload, sizeof(payload));
+    if (len >= 0) mesh.reply(request, MESH_CAL_RESULT, payload, (size_t)len, now_us);
+}
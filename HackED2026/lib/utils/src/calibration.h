@@ -0,0 +1,206 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mesh.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define CAL_MAX_DEVICES 16
+#define CAL_MAX_PAIRS (CAL_MAX_DEVICES / 2) // Disjoint pairs in one round
+
+#define CAL_SAMPLES 5 // Ranges per pair, the median is reported
+#define CAL_ROUND_TIMEOUT_US 1500000 // Wait for a round's results before re-asking
+#define CAL_MEASURE_TIMEOUT_US 1200000 // A measurer gives up and goes back to anchor
+#define CAL_MAX_RETRIES 3 // Re-asks per round (and for the ACKs) before moving on
+#define CAL_CHECK_ROUNDS 1 // Rounds a check() measures: n/2 fresh pairs with 4 anchors
+
+#define CAL_NO_DISTANCE -1
+
+// Messages, as mesh frames (see mesh.h). A pair is one byte, a << 4 | b.
+//
+//   MESH_CAL_REQUEST   coordinator: measure these pairs. The b side turns tag
+//                      and ranges to anchor a.
+//     u8  round
+//     u8  pair, per pair
+//   MESH_CAL_RESULT    measurer, replying to the request: the result. Nothing
+//                      is sent if it got no ranges; the round timeout re-asks.
+//     u8  round
+//     u8  pair
+//     u16 cm
+//   MESH_CAL_DONE      coordinator: calibration is over
+//   MESH_CAL_ACK       every device, replying to MESH_CAL_DONE
+
+struct CalPair {
+    uint8_t a; // Stays anchor
+    uint8_t b; // Switches to tag and measures
+};
+
+enum CalMessageType { CAL_MSG_NONE = 0, CAL_MSG_REQUEST, CAL_MSG_RESULT, CAL_MSG_DONE, CAL_MSG_ACK };
+
+struct CalMessage {
+    CalMessageType type;
+    uint8_t round;
+    uint8_t pair_count;
+    CalPair pairs[CAL_MAX_PAIRS]; // REQUEST: all of them, RESULT: the one measured
+    int distance; // RESULT
+};
+
+/// @brief Rounds needed to measure every pair once: n - 1 for even n, n for odd.
+size_t calibration_round_count(size_t devices);
+
+/// @brief The pairs measured in one round. Round-robin (circle method), so
+/// no device is in two pairs of the same round and every pair comes up once
+/// over calibration_round_count() rounds.
+/// @param out At least CAL_MAX_PAIRS.
+/// @return The number of pairs.
+size_t calibration_round_pairs(size_t devices, size_t round, CalPair* out);
+
+/// @brief The mesh type a message goes out as.
+uint8_t calibration_mesh_type(CalMessageType type);
+
+/// @return The payload length, -1 if it didn't fit.
+int calibration_encode(const CalMessage& message, uint8_t* out, size_t len);
+
+/// @return False if the frame isn't a calibration message.
+bool calibration_decode(const MeshMessage& message, CalMessage& out);
+
+struct CalibrationStats {
+    uint32_t rounds;
+    uint32_t retries; // Requests re-sent for missing results or ACKs
+    uint32_t failed_pairs; // Given up on after CAL_MAX_RETRIES
+    uint32_t messages_sent;
+    uint32_t missing_acks;
+    uint32_t elapsed_us; // start() until every result was in
+};
+
+/// @brief Runs calibration from the device that isn't being calibrated (the
+/// tag). Asks for one round of disjoint pairs at a time and moves on as soon
+/// as every result is in, re-asking only for the pairs still missing when the
+/// round times out. Never blocks: it gets the results from the mesh as
+/// they are fed in, and times out in poll().
+class CalibrationCoordinator {
+public:
+    /// @brief Registers for the results and ACKs with the mesh, so it must
+    /// stay where it is.
+    explicit CalibrationCoordinator(MeshDispatcher& mesh);
+
+    /// @brief Starts measuring devices 0..devices-1.
+    /// @param all_at_once False measures one pair per round, e.g. to rule out
+    /// tags interfering with each other.
+    void start(size_t devices, uint32_t now_us, bool all_at_once = true);
+
+    /// @brief Measures only the first few rounds of pairs, to see whether a
+    /// cached calibration still holds (see calibration_cache.h). The pairs
+    /// not measured stay CAL_NO_DISTANCE.
+    void check(size_t devices, uint32_t now_us, size_t rounds = CAL_CHECK_ROUNDS);
+
+    /// @brief A result or an ACK, from the mesh. Anything not for this
+    /// calibration is ignored.
+    void on_message(const MeshMessage& message);
+
+    /// @brief Handles timeouts. Call often.
+    void poll(uint32_t now_us);
+
+    /// @brief Tells the devices calibration is over, once measured() is true.
+    /// finished() turns true when all of them have acknowledged, or the last
+    /// retry ran out.
+    void finish(uint32_t now_us);
+
+    bool measured() const { return phase == PHASE_MEASURED || phase == PHASE_FINISHING || phase == PHASE_COMPLETE; }
+    bool finished() const { return phase == PHASE_COMPLETE; }
+
+    size_t devices() const { return device_count; }
+    /// @brief cm, CAL_NO_DISTANCE if it couldn't be measured. Symmetric.
+    int distance(size_t a, size_t b) const { return matrix[a * device_count + b]; }
+    /// @brief Row-major, devices() x devices(), for telemetry_encode_calibration().
+    const int* distances() const { return matrix; }
+    const CalibrationStats& stats() const { return statistics; }
+
+private:
+    enum Phase { PHASE_IDLE, PHASE_MEASURING, PHASE_MEASURED, PHASE_FINISHING, PHASE_COMPLETE };
+
+    void start_round(uint32_t now_us);
+    void send_request(uint32_t now_us);
+    void send_done(uint32_t now_us);
+    void send(const CalMessage& message, uint32_t now_us);
+
+    MeshDispatcher& mesh;
+
+    Phase phase;
+    size_t device_count;
+    bool parallel;
+    size_t round_limit; // 0 for every round
+    uint8_t round;
+    uint8_t retries;
+    uint32_t started_us;
+    uint32_t deadline_us;
+
+    CalPair pairs[CAL_MAX_PAIRS];
+    size_t pair_count;
+    uint32_t pending; // Bit i: pairs[i] has no result yet
+    uint32_t acked;
+
+    int matrix[CAL_MAX_DEVICES * CAL_MAX_DEVICES]; // devices() x devices()
+    CalibrationStats statistics;
+};
+
+/// @brief Runs calibration on a device being calibrated (an anchor). When a
+/// request names it as the b side of a pair it switches to tag through the
+/// role callback, takes CAL_SAMPLES ranges to the a side, switches back and
+/// reports the median. Never blocks: requests come from the mesh, feed it
+/// every AT+RANGE and call poll().
+class CalibrationParticipant {
+public:
+    /// @brief measuring: true to become a tag, false to go back to anchor.
+    typedef void (*RoleFn)(bool measuring, void* ctx);
+
+    /// @brief Registers for the requests with the mesh, so it must stay
+    /// where it is.
+    CalibrationParticipant(uint8_t id, MeshDispatcher& mesh, RoleFn role, void* ctx);
+
+    /// @brief A request or MESH_CAL_DONE, from the mesh.
+    void on_message(const MeshMessage& message);
+
+    /// @brief Feed every AT+RANGE frame, indexed by anchor id.
+    void on_ranges(const int* ranges, size_t count, uint32_t now_us);
+
+    /// @brief Gives up a measurement that is taking too long.
+    void poll(uint32_t now_us);
+
+    bool measuring() const { return active; }
+    /// @brief MESH_CAL_DONE has been received and acknowledged.
+    bool done() const { return finished; }
+
+private:
+    void stop(int distance, uint32_t now_us);
+    void send_result(uint32_t now_us);
+
+    uint8_t id;
+    MeshDispatcher& mesh;
+    RoleFn role_fn;
+    void* ctx;
+
+    bool active;
+    bool finished;
+    uint8_t round;
+    uint8_t peer;
+    MeshRef request; // The newest one naming this device, what the result answers
+    uint32_t deadline_us;
+    int samples[CAL_SAMPLES];
+    size_t sample_count;
+
+    // The last result, re-sent if the coordinator asks again (it was lost)
+    bool have_result;
+    CalMessage last_result;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "calibration_cache.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "multilateration.h"
+#include "wire_format.h"
+
+
+// Bitwise, the record is written once a calibration and read once a boot
+static uint32_t crc32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+
+void calibration_cache_init(CalibrationCache& cache, const int* distances, size_t devices, uint32_t saved_unix) {
+    memset(&cache, 0, sizeof(cache));
+    cache.devices = (uint8_t)(devices > CAL_MAX_DEVICES ? CAL_MAX_DEVICES : devices);
+    cache.saved_unix = saved_unix;
+    for (size_t a = 0; a < cache.devices; a++) {
+        for (size_t b = 0; b < cache.devices; b++) {
+            int d = distances[a * devices + b];
+            cache.distances[a * cache.devices + b] = (int16_t)(d > INT16_MAX ? INT16_MAX : d);
+        }
+    }
+}
+
+
+size_t calibration_cache_encode(const CalibrationCache& cache, uint8_t* out, size_t len) {
+    size_t n = cache.devices;
+    size_t need = CAL_CACHE_HEADER_LEN + n * n * 2 + n * 2 + (cache.has_positions ? n * 8 : 0) + 4;
+    if (n > CAL_MAX_DEVICES || need > len) return 0;
+
+    put_u16(out, CAL_CACHE_MAGIC);
+    out[2] = CAL_CACHE_VERSION;
+    out[3] = (uint8_t)n;
+    put_u32(out + 4, cache.saved_unix);
+    out[8] = cache.has_positions ? CAL_CACHE_POSITIONS : 0;
+
+    uint8_t* p = out + CAL_CACHE_HEADER_LEN;
+    for (size_t i = 0; i < n * n; i++, p += 2) put_i16(p, cache.distances[i]);
+    for (size_t i = 0; i < n; i++, p += 2) put_u16(p, cache.antenna_delays[i]);
+    if (cache.has_positions) {
+        for (size_t i = 0; i < n; i++) {
+            for (size_t d = 0; d < 2; d++, p += 4) put_u32(p, (uint32_t)(int32_t)lroundf(cache.positions[i][d] * 10));
+        }
+    }
+    put_u32(p, crc32(out, (size_t)(p - out)));
+    return need;
+}
+
+
+bool calibration_cache_decode(const uint8_t* data, size_t len, CalibrationCache& out) {
+    if (len < CAL_CACHE_HEADER_LEN + 4) return false;
+    if (get_u16(data) != CAL_CACHE_MAGIC || data[2] != CAL_CACHE_VERSION) return false;
+
+    size_t n = data[3];
+    bool positions = data[8] & CAL_CACHE_POSITIONS;
+    size_t body = CAL_CACHE_HEADER_LEN + n * n * 2 + n * 2 + (positions ? n * 8 : 0);
+    if (n > CAL_MAX_DEVICES || len < body + 4) return false;
+    if (get_u32(data + body) != crc32(data, body)) return false;
+
+    memset(&out, 0, sizeof(out));
+    out.devices = (uint8_t)n;
+    out.saved_unix = get_u32(data + 4);
+    out.has_positions = positions;
+
+    const uint8_t* p = data + CAL_CACHE_HEADER_LEN;
+    for (size_t i = 0; i < n * n; i++, p += 2) out.distances[i] = get_i16(p);
+    for (size_t i = 0; i < n; i++, p += 2) out.antenna_delays[i] = get_u16(p);
+    if (positions) {
+        for (size_t i = 0; i < n; i++) {
+            for (size_t d = 0; d < 2; d++, p += 4) out.positions[i][d] = (int32_t)get_u32(p) / 10.0f;
+        }
+    }
+    return true;
+}
+
+
+int calibration_drift_cm(const CalibrationCache& cache, const int* fresh, size_t devices, size_t& compared) {
+    compared = 0;
+    if (devices != cache.devices) return -1;
+
+    int drift = -1;
+    for (size_t a = 0; a < devices; a++) {
+        for (size_t b = a + 1; b < devices; b++) {
+            int cached = cache.distances[a * devices + b];
+            int now = fresh[a * devices + b];
+            if (cached == CAL_NO_DISTANCE || now == CAL_NO_DISTANCE) continue;
+
+            compared++;
+            int diff = now > cached ? now - cached : cached - now;
+            if (diff > drift) drift = diff;
+        }
+    }
+    return drift;
+}
+
+
+bool calibration_cache_holds(const CalibrationCache& cache, const int* fresh, size_t devices) {
+    size_t compared;
+    int drift = calibration_drift_cm(cache, fresh, devices, compared);
+    return compared >= CAL_CHECK_MIN_PAIRS && drift <= CAL_DRIFT_CM;
+}
+
+
+// Either direction of a pair, whichever was measured. -1 if neither was.
+static float pair_distance(const CalibrationCache& cache, size_t a, size_t b) {
+    int d = cache.distances[a * cache.devices + b];
+    if (d == CAL_NO_DISTANCE) d = cache.distances[b * cache.devices + a];
+    return d > 0 ? (float)d : -1;
+}
+
+
+bool calibration_cache_solve(CalibrationCache& cache) {
+    size_t n = cache.devices;
+    cache.has_positions = false;
+    memset(cache.positions, 0, sizeof(cache.positions));
+    if (n < 3) return false;
+
+    // The first three fix the frame: law of cosines for device 2
+    float d01 = pair_distance(cache, 0, 1);
+    float d02 = pair_distance(cache, 0, 2);
+    float d12 = pair_distance(cache, 1, 2);
+    if (d01 <= 0 || d02 <= 0 || d12 <= 0) return false;
+    cache.positions[1][0] = d01;
+    float x2 = (d01 * d01 + d02 * d02 - d12 * d12) / (2 * d01);
+    cache.positions[2][0] = x2;
+    cache.positions[2][1] = sqrtf(fmaxf(0, d02 * d02 - x2 * x2));
+
+    Multilateration<CAL_MAX_DEVICES, 2> solver;
+    for (size_t i = 0; i < 3; i++) solver.set_anchor(i, cache.positions[i]);
+
+    for (size_t i = 3; i < n; i++) {
+        int ranges[CAL_MAX_DEVICES] = { 0 };
+        for (size_t j = 0; j < i; j++) ranges[j] = (int)pair_distance(cache, i, j);
+
+        Multilateration<CAL_MAX_DEVICES, 2>::Result fix;
+        if (!solver.solve(ranges, fix)) return false;
+        cache.positions[i][0] = fix.position[0];
+        cache.positions[i][1] = fix.position[1];
+        solver.set_anchor(i, cache.positions[i]);
+    }
+
+    cache.has_positions = true;
+    return true;
+}
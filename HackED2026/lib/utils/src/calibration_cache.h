@@ -0,0 +1,81 @@
+#ifndef CALIBRATION_CACHE_H
+#define CALIBRATION_CACHE_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "calibration.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// What a calibration found, kept so the next boot only has to check it
+// rather than measure every pair again. The same record is a blob in the
+// tag's NVS and the laptop's calibration file (uwb_aggregator --calibration,
+// uwb_control --calibration, frontend.py --calibration):
+//
+//   u16 magic        CAL_CACHE_MAGIC
+//   u8  version      CAL_CACHE_VERSION
+//   u8  devices      n
+//   u32 saved_unix   the laptop's clock when it accepted it, 0 if unknown
+//   u8  flags        CAL_CACHE_POSITIONS
+//   i16 cm[n * n]    row-major, CAL_NO_DISTANCE where a pair wasn't measured
+//   u16 delay[n]     antenna delays, 0 where not known
+//   with CAL_CACHE_POSITIONS, per device:
+//     i32 x, y       mm
+//   u32 crc          CRC-32 (zlib's) of everything before it
+//
+// 85 bytes for 4 anchors with positions.
+
+#define CAL_CACHE_MAGIC 0x4B43 // "CK"
+#define CAL_CACHE_VERSION 1
+#define CAL_CACHE_POSITIONS 0x01
+#define CAL_CACHE_HEADER_LEN 9
+#define CAL_CACHE_MAX_LEN (CAL_CACHE_HEADER_LEN + CAL_MAX_DEVICES * (2 * CAL_MAX_DEVICES + 2 + 8) + 4)
+
+#define CAL_DRIFT_CM 30 // A fresh range this far off the cached one means a device moved
+#define CAL_CHECK_MIN_PAIRS 2 // Fewer fresh pairs than this can't vouch for the cache
+
+struct CalibrationCache {
+    uint8_t devices;
+    uint32_t saved_unix;
+    bool has_positions;
+    int16_t distances[CAL_MAX_DEVICES * CAL_MAX_DEVICES]; // devices x devices, cm
+    uint16_t antenna_delays[CAL_MAX_DEVICES];
+    float positions[CAL_MAX_DEVICES][2]; // cm, with has_positions
+};
+
+/// @brief A cache of a coordinator's matrix, with no delays or positions yet.
+void calibration_cache_init(CalibrationCache& cache, const int* distances, size_t devices, uint32_t saved_unix);
+
+/// @return The record's length, 0 if it doesn't fit in len.
+size_t calibration_cache_encode(const CalibrationCache& cache, uint8_t* out, size_t len);
+
+/// @return False if the record is cut short, of another version, or fails its CRC.
+bool calibration_cache_decode(const uint8_t* data, size_t len, CalibrationCache& out);
+
+/// @brief How far fresh ranges are from the cached ones.
+/// @param fresh Row-major, devices x devices, CAL_NO_DISTANCE where not
+/// measured, e.g. CalibrationCoordinator::distances() after a check().
+/// @param compared Set to the pairs measured in both.
+/// @return The largest difference in cm, -1 if no pair was measured in both
+/// or the device counts differ.
+int calibration_drift_cm(const CalibrationCache& cache, const int* fresh, size_t devices, size_t& compared);
+
+/// @brief Whether a check() says the cache still holds: enough pairs
+/// compared and none drifted past CAL_DRIFT_CM.
+bool calibration_cache_holds(const CalibrationCache& cache, const int* fresh, size_t devices);
+
+/// @brief Places every device from the distances alone: device 0 at the
+/// origin, 1 along +x, 2 on the +y side, the rest by multilateration against
+/// the ones already placed. Sets has_positions.
+/// @return False if 0-1, 0-2 or 1-2 is missing, or a later device couldn't
+/// be placed.
+bool calibration_cache_solve(CalibrationCache& cache);
+
+#endif
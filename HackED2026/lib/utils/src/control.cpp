@@ -0,0 +1,242 @@
+#include "control.h"
+
+#include <string.h>
+
+#include "wire_format.h"
+
+static const char* const OPCODE_NAMES[] = {
+    "?", "ping", "batch", "deadline", "delay", "role", "calibration_ok", "stage_tdma", "commit_tdma",
+};
+
+static const char* const STATUS_NAMES[] = {
+    "pending", "ok", "unknown", "invalid", "rejected", "failed", "busy", "stale",
+};
+
+
+const char* control_opcode_name(uint8_t opcode) {
+    return opcode < sizeof(OPCODE_NAMES) / sizeof(OPCODE_NAMES[0]) ? OPCODE_NAMES[opcode] : "?";
+}
+
+
+const char* control_status_name(uint8_t status) {
+    return status < sizeof(STATUS_NAMES) / sizeof(STATUS_NAMES[0]) ? STATUS_NAMES[status] : "?";
+}
+
+
+static void put_header(uint8_t* out, uint8_t type, uint8_t device_id, uint8_t count, uint16_t session) {
+    put_u16(out, CONTROL_MAGIC);
+    out[2] = CONTROL_VERSION;
+    out[3] = type;
+    out[4] = device_id;
+    out[5] = count;
+    put_u16(out + 6, session);
+}
+
+
+/// @return The entry count, or -1 if data isn't a whole packet of the given type.
+static int check_header(const uint8_t* data, size_t len, uint8_t type, size_t entry_len) {
+    if (len < CONTROL_HEADER_LEN) return -1;
+    if (get_u16(data) != CONTROL_MAGIC || data[2] != CONTROL_VERSION || data[3] != type) return -1;
+    if (len < CONTROL_HEADER_LEN + (size_t)data[5] * entry_len) return -1;
+    return data[5];
+}
+
+
+size_t control_encode_commands(uint8_t* out, uint8_t device_id, uint16_t session, const ControlCommand* commands,
+                               size_t count) {
+    if (count > CONTROL_MAX_COMMANDS) return 0;
+
+    put_header(out, CONTROL_COMMANDS, device_id, (uint8_t)count, session);
+    uint8_t* p = out + CONTROL_HEADER_LEN;
+    for (size_t i = 0; i < count; i++, p += CONTROL_COMMAND_LEN) {
+        put_u32(p, commands[i].seq);
+        p[4] = commands[i].opcode;
+        p[5] = 0;
+        p[6] = 0;
+        p[7] = 0;
+        put_u32(p + 8, (uint32_t)commands[i].arg);
+    }
+    return p - out;
+}
+
+
+int control_decode_acks(const uint8_t* data, size_t len, uint8_t& device_id, uint16_t& session, ControlAck* acks,
+                        size_t max_acks) {
+    int count = check_header(data, len, CONTROL_ACKS, CONTROL_ACK_LEN);
+    if (count < 0) return -1;
+
+    device_id = data[4];
+    session = get_u16(data + 6);
+    const uint8_t* p = data + CONTROL_HEADER_LEN;
+    size_t n = 0;
+    for (; n < (size_t)count && n < max_acks; n++, p += CONTROL_ACK_LEN) {
+        acks[n].seq = get_u32(p);
+        acks[n].opcode = p[4];
+        acks[n].status = p[5];
+    }
+    return (int)n;
+}
+
+
+size_t control_encode_sync(uint8_t* out, uint8_t device_id, uint16_t session, uint64_t origin) {
+    put_header(out, CONTROL_SYNC, device_id, 0, session);
+    put_u64(out + CONTROL_HEADER_LEN, origin);
+    return CONTROL_HEADER_LEN + CONTROL_SYNC_LEN;
+}
+
+
+bool control_decode_sync_reply(const uint8_t* data, size_t len, uint8_t& device_id, uint16_t& session,
+                               ControlSyncReply& reply) {
+    if (check_header(data, len, CONTROL_SYNC_REPLY, 0) < 0 || len < CONTROL_HEADER_LEN + CONTROL_SYNC_REPLY_LEN) {
+        return false;
+    }
+
+    device_id = data[4];
+    session = get_u16(data + 6);
+    const uint8_t* p = data + CONTROL_HEADER_LEN;
+    reply.origin = get_u64(p);
+    reply.receive_us = get_u32(p + 8);
+    reply.transmit_us = get_u32(p + 12);
+    return true;
+}
+
+
+ControlChannel::ControlChannel(uint8_t device_id)
+    : device_id(device_id), session(0), has_session(false), highest_seq(0), window_seen(0), queue_head(0),
+      queue_count(0), ack_count(0) {
+    memset(window_status, 0, sizeof(window_status));
+    memset(window_opcode, 0, sizeof(window_opcode));
+    memset(&statistics, 0, sizeof(statistics));
+}
+
+
+bool ControlChannel::receive(const uint8_t* data, size_t len) {
+    int count = check_header(data, len, CONTROL_COMMANDS, CONTROL_COMMAND_LEN);
+    if (count < 0 || (data[4] != device_id && data[4] != CONTROL_ANY_DEVICE)) {
+        statistics.malformed++;
+        return false;
+    }
+    statistics.packets++;
+
+    uint16_t packet_session = get_u16(data + 6);
+    if (!has_session || packet_session != session) {
+        // A new client: nothing it sends can be a resend of the old one's,
+        // and the old one isn't waiting on acks any more
+        session = packet_session;
+        has_session = true;
+        window_seen = 0;
+        queue_count = 0;
+        ack_count = 0;
+    }
+
+    const uint8_t* p = data + CONTROL_HEADER_LEN;
+    for (int i = 0; i < count; i++, p += CONTROL_COMMAND_LEN) {
+        ControlCommand command;
+        command.seq = get_u32(p);
+        command.opcode = p[4];
+        command.arg = (int32_t)get_u32(p + 8);
+        size_t slot = command.seq % CONTROL_WINDOW;
+
+        bool ahead = window_seen == 0 || command.seq > highest_seq;
+        if (!ahead) {
+            uint32_t back = highest_seq - command.seq;
+            if (back >= CONTROL_WINDOW) {
+                ack(command.seq, command.opcode, CONTROL_STALE);
+                continue;
+            }
+            if (window_seen & (1ULL << back)) {
+                // Already run: the same answer again. Still queued: the ack is on its way.
+                statistics.duplicates++;
+                if (window_status[slot] != CONTROL_PENDING) ack(command.seq, window_opcode[slot], window_status[slot]);
+                continue;
+            }
+        }
+
+        if (queue_count == CONTROL_QUEUE_LEN) {
+            // Not marked as seen, so the resend is taken as new
+            statistics.busy++;
+            ack(command.seq, command.opcode, CONTROL_BUSY);
+            continue;
+        }
+
+        if (ahead) {
+            uint32_t shift = window_seen == 0 ? CONTROL_WINDOW : command.seq - highest_seq;
+            window_seen = shift >= CONTROL_WINDOW ? 1 : (window_seen << shift) | 1;
+            highest_seq = command.seq;
+        } else {
+            window_seen |= 1ULL << (highest_seq - command.seq);
+        }
+        window_status[slot] = CONTROL_PENDING;
+        window_opcode[slot] = command.opcode;
+
+        queue[(queue_head + queue_count) % CONTROL_QUEUE_LEN] = command;
+        queue_count++;
+        statistics.commands++;
+    }
+
+    return true;
+}
+
+
+size_t ControlChannel::answer_sync(const uint8_t* data, size_t len, uint32_t receive_us, uint32_t transmit_us,
+                                   uint8_t* out) {
+    if (check_header(data, len, CONTROL_SYNC, 0) < 0 || len < CONTROL_HEADER_LEN + CONTROL_SYNC_LEN) return 0;
+    if (data[4] != device_id && data[4] != CONTROL_ANY_DEVICE) return 0;
+    statistics.syncs++;
+
+    // The sender's session, whatever the window is on
+    put_header(out, CONTROL_SYNC_REPLY, device_id, 0, get_u16(data + 6));
+    uint8_t* p = out + CONTROL_HEADER_LEN;
+    put_u64(p, get_u64(data + CONTROL_HEADER_LEN));
+    put_u32(p + 8, receive_us);
+    put_u32(p + 12, transmit_us);
+    return CONTROL_HEADER_LEN + CONTROL_SYNC_REPLY_LEN;
+}
+
+
+bool ControlChannel::next(ControlCommand& command) {
+    if (queue_count == 0) return false;
+
+    command = queue[queue_head];
+    queue_head = (queue_head + 1) % CONTROL_QUEUE_LEN;
+    queue_count--;
+    return true;
+}
+
+
+void ControlChannel::complete(const ControlCommand& command, uint8_t status) {
+    uint32_t back = highest_seq - command.seq;
+    if (window_seen != 0 && command.seq <= highest_seq && back < CONTROL_WINDOW && (window_seen & (1ULL << back))) {
+        window_status[command.seq % CONTROL_WINDOW] = status;
+    }
+    ack(command.seq, command.opcode, status);
+}
+
+
+size_t ControlChannel::encode_acks(uint8_t* out) {
+    if (ack_count == 0) return 0;
+
+    put_header(out, CONTROL_ACKS, device_id, (uint8_t)ack_count, session);
+    uint8_t* p = out + CONTROL_HEADER_LEN;
+    for (size_t i = 0; i < ack_count; i++, p += CONTROL_ACK_LEN) {
+        put_u32(p, acks[i].seq);
+        p[4] = acks[i].opcode;
+        p[5] = acks[i].status;
+        p[6] = 0;
+        p[7] = 0;
+    }
+    ack_count = 0;
+    return p - out;
+}
+
+
+void ControlChannel::ack(uint32_t seq, uint8_t opcode, uint8_t status) {
+    if (ack_count == CONTROL_MAX_ACKS) {
+        statistics.acks_dropped++;
+        return;
+    }
+    acks[ack_count].seq = seq;
+    acks[ack_count].opcode = opcode;
+    acks[ack_count].status = status;
+    ack_count++;
+}
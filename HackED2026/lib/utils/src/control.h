@@ -0,0 +1,213 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// Commands from the laptop to a board's LOCAL_PORT, and their acks back to
+// wherever the commands came from. All fields little-endian:
+//
+//   header (8 bytes)
+//     u16 magic         CONTROL_MAGIC
+//     u8  version       CONTROL_VERSION
+//     u8  type          ControlType
+//     u8  device_id     commands: the board addressed, CONTROL_ANY_DEVICE for
+//                       whichever gets it; acks: the board answering
+//     u8  count         entries that follow
+//     u16 session       picked by the sender of the commands, echoed in acks
+//   command (12 bytes), count times
+//     u32 seq           per session, each command once; resent with the same seq
+//     u8  opcode        ControlOpcode
+//     u8  reserved[3]
+//     i32 arg
+//   ack (8 bytes), count times
+//     u32 seq
+//     u8  opcode
+//     u8  status        ControlStatus
+//     u16 reserved
+//   sync, count 0 (8 bytes)
+//     u64 origin        the sender's clock when it sent this, echoed back
+//   sync reply, count 0 (16 bytes)
+//     u64 origin
+//     u32 receive_us    the board's micros() when it read the sync
+//     u32 transmit_us   and as it wrote the reply
+//
+// A board applies each seq at most once. A command resent after it was
+// applied gets the same ack again, one resent while it is still queued gets
+// none until it's done. A new session starts the board's window over.
+//
+// Syncs are NTP's four timestamps: origin and the reply's arrival on the
+// sender's clock, receive_us and transmit_us on the board's, so the sender
+// can work out the board's clock offset (see clock_sync.h on the laptop).
+// They are answered straight away, outside the command window, and never
+// resent: a lost one is just a sample fewer.
+
+#define CONTROL_MAGIC 0x4353 // "SC"
+#define CONTROL_VERSION 1
+#define CONTROL_HEADER_LEN 8
+#define CONTROL_COMMAND_LEN 12
+#define CONTROL_ACK_LEN 8
+#define CONTROL_SYNC_LEN 8
+#define CONTROL_SYNC_REPLY_LEN 16
+#define CONTROL_ANY_DEVICE 0xFF
+#define CONTROL_MAX_COMMANDS 32 // Per packet
+#define CONTROL_MAX_PACKET (CONTROL_HEADER_LEN + CONTROL_MAX_COMMANDS * CONTROL_COMMAND_LEN)
+
+#define CONTROL_QUEUE_LEN CONTROL_MAX_COMMANDS // Commands received but not yet run, a whole packet
+#define CONTROL_WINDOW 64 // How far back a resent seq is still recognised
+#define CONTROL_MAX_ACKS 32 // Acks waiting to be sent
+#define CONTROL_POLL_INTERVAL_MS 20 // A receive is a socket call, not worth making every loop
+#define CONTROL_PACKETS_PER_POLL 4 // Most datagrams read per poll, the rest wait for the next one
+
+enum ControlType { CONTROL_COMMANDS = 1, CONTROL_ACKS = 2, CONTROL_SYNC = 3, CONTROL_SYNC_REPLY = 4 };
+
+enum ControlOpcode {
+    CONTROL_PING = 1, // Nothing, acked as it comes
+    CONTROL_SET_BATCH = 2, // arg: range frames per telemetry datagram
+    CONTROL_SET_DEADLINE = 3, // arg: us a frame may wait for its batch
+    CONTROL_SET_DELAY = 4, // arg: antenna delay, saved to the module's flash
+    CONTROL_SET_ROLE = 5, // arg: DeviceRole, 0 tag, 1 anchor
+    CONTROL_CALIBRATION_OK = 6, // The laptop has placed every device, arg: its unix time, see tag_with_calibration
+    CONTROL_STAGE_TDMA = 7, // arg: tdma_pack() layout, checked and held until the commit
+    CONTROL_COMMIT_TDMA = 8, // arg: the staged layout, which the module then switches to
+};
+
+enum ControlStatus {
+    CONTROL_PENDING = 0, // Not acked yet, never on the wire
+    CONTROL_OK = 1,
+    CONTROL_UNKNOWN = 2, // Opcode this board doesn't handle
+    CONTROL_INVALID = 3, // Argument out of range
+    CONTROL_REJECTED = 4, // Can't be done in the board's current mode
+    CONTROL_FAILED = 5, // Tried, the module said no
+    CONTROL_BUSY = 6, // Queue full, send it again later
+    CONTROL_STALE = 7, // Older than the window, may or may not have been applied
+};
+
+struct ControlCommand {
+    uint32_t seq;
+    uint8_t opcode;
+    int32_t arg;
+};
+
+struct ControlAck {
+    uint32_t seq;
+    uint8_t opcode;
+    uint8_t status;
+};
+
+struct ControlSyncReply {
+    uint64_t origin;
+    uint32_t receive_us;
+    uint32_t transmit_us;
+};
+
+struct ControlStats {
+    uint32_t packets;
+    uint32_t syncs; // Answered, not counted in packets
+    uint32_t commands; // New ones, queued to run
+    uint32_t duplicates; // Resent ones that were recognised
+    uint32_t busy; // Turned away with a full queue
+    uint32_t malformed; // Packets that weren't commands for this board
+    uint32_t acks_dropped; // Acks that didn't fit before the next send
+};
+
+/// @brief Name for printing, "?" if unknown.
+const char* control_opcode_name(uint8_t opcode);
+const char* control_status_name(uint8_t status);
+
+/// @brief Encodes a command packet.
+/// @param out At least CONTROL_HEADER_LEN + count * CONTROL_COMMAND_LEN bytes.
+/// @return The packet length, 0 if count is over CONTROL_MAX_COMMANDS.
+size_t control_encode_commands(uint8_t* out, uint8_t device_id, uint16_t session, const ControlCommand* commands,
+                               size_t count);
+
+/// @brief Decodes an ack packet.
+/// @return The number of acks written, or -1 if the packet is malformed.
+int control_decode_acks(const uint8_t* data, size_t len, uint8_t& device_id, uint16_t& session, ControlAck* acks,
+                        size_t max_acks);
+
+/// @brief Encodes a sync.
+/// @param out At least CONTROL_HEADER_LEN + CONTROL_SYNC_LEN bytes.
+/// @return The packet length.
+size_t control_encode_sync(uint8_t* out, uint8_t device_id, uint16_t session, uint64_t origin);
+
+/// @brief Decodes a sync reply.
+/// @return False if the packet isn't one.
+bool control_decode_sync_reply(const uint8_t* data, size_t len, uint8_t& device_id, uint16_t& session,
+                               ControlSyncReply& reply);
+
+/// @brief The board's end of the control protocol, with no I/O of its own:
+/// feed it received packets with receive(), run what next() hands out, report
+/// each result with complete(), and send what encode_acks() writes. The
+/// board's loop decides when, so nothing in here blocks or allocates.
+class ControlChannel {
+public:
+    /// @param device_id Which commands are for this board, besides those to
+    /// CONTROL_ANY_DEVICE. Written into the acks.
+    explicit ControlChannel(uint8_t device_id = CONTROL_ANY_DEVICE);
+
+    /// @brief For boards whose id is only known at run time.
+    void set_device_id(uint8_t id) { device_id = id; }
+
+    /// @brief Takes one datagram. New commands are queued, resent ones are
+    /// answered from the window.
+    /// @return False if it wasn't a command packet for this board.
+    bool receive(const uint8_t* data, size_t len);
+
+    /// @brief Answers a sync, see the packet layout. Check every datagram
+    /// with this before receive(), and send the reply at once.
+    /// @param receive_us micros() when the datagram was read.
+    /// @param transmit_us micros() now, as the reply goes out.
+    /// @param out At least CONTROL_HEADER_LEN + CONTROL_SYNC_REPLY_LEN bytes.
+    /// @return The reply's length, 0 if data isn't a sync for this board.
+    size_t answer_sync(const uint8_t* data, size_t len, uint32_t receive_us, uint32_t transmit_us, uint8_t* out);
+
+    /// @brief The oldest queued command.
+    /// @return False if there is none.
+    bool next(ControlCommand& command);
+
+    /// @brief Records the result of a command from next() and queues its ack.
+    void complete(const ControlCommand& command, uint8_t status);
+
+    /// @brief Writes the queued acks into one packet and clears them.
+    /// @param out At least CONTROL_HEADER_LEN + CONTROL_MAX_ACKS * CONTROL_ACK_LEN bytes.
+    /// @return The packet length, 0 if there is nothing to ack.
+    size_t encode_acks(uint8_t* out);
+
+    size_t queued() const { return queue_count; }
+    size_t acks_waiting() const { return ack_count; }
+    const ControlStats& stats() const { return statistics; }
+
+private:
+    void ack(uint32_t seq, uint8_t opcode, uint8_t status);
+
+    uint8_t device_id;
+    uint16_t session;
+    bool has_session;
+
+    // Seqs seen this session: highest and the CONTROL_WINDOW before it, with
+    // the status each was acked with (CONTROL_PENDING while queued)
+    uint32_t highest_seq;
+    uint8_t window_status[CONTROL_WINDOW];
+    uint8_t window_opcode[CONTROL_WINDOW];
+    uint64_t window_seen; // Bit n: highest_seq - n was received
+
+    ControlCommand queue[CONTROL_QUEUE_LEN];
+    size_t queue_head;
+    size_t queue_count;
+
+    ControlAck acks[CONTROL_MAX_ACKS];
+    size_t ack_count;
+
+    ControlStats statistics;
+};
+
+#endif
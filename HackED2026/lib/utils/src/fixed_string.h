@@ -0,0 +1,164 @@
+#ifndef FIXED_STRING_H
+#define FIXED_STRING_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/// @brief Text in a fixed buffer of N bytes, terminator included, for building
+/// commands and messages on the stack. Unlike Arduino String nothing is ever
+/// allocated, so long runs can't fragment the heap. Appends that don't fit
+/// are cut off and truncated() says so; the text is always terminated.
+template <size_t N>
+class FixedString {
+public:
+    FixedString() : len(0), overflow(false) { text[0] = '\0'; }
+    FixedString(const char* s) : FixedString() { append(s); }
+
+    FixedString& append(const char* s) { return append(s, strlen(s)); }
+
+    FixedString& append(const char* s, size_t n) {
+        if (n > N - 1 - len) {
+            n = N - 1 - len;
+            overflow = true;
+        }
+        memcpy(text + len, s, n);
+        len += n;
+        text[len] = '\0';
+        return *this;
+    }
+
+    FixedString& append(char c) { return append(&c, 1); }
+
+    FixedString& append(long v) {
+        // Digits come out backwards, the magnitude is negated so LONG_MIN fits
+        char digits[24];
+        size_t n = 0;
+        bool negative = v < 0;
+        if (!negative) v = -v;
+        do {
+            digits[sizeof(digits) - 1 - n++] = (char)('0' - v % 10);
+            v /= 10;
+        } while (v);
+        if (negative) digits[sizeof(digits) - 1 - n++] = '-';
+        return append(digits + sizeof(digits) - n, n);
+    }
+
+    FixedString& append(unsigned long v) {
+        char digits[24];
+        size_t n = 0;
+        do {
+            digits[sizeof(digits) - 1 - n++] = (char)('0' + v % 10);
+            v /= 10;
+        } while (v);
+        return append(digits + sizeof(digits) - n, n);
+    }
+
+    FixedString& append(int v) { return append((long)v); }
+    FixedString& append(unsigned v) { return append((unsigned long)v); }
+
+    /// @brief printf-style append.
+    FixedString& appendf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text + len, N - len, format, args);
+        va_end(args);
+
+        if (n < 0) {
+            text[len] = '\0';
+        } else if ((size_t)n > N - 1 - len) {
+            len = N - 1;
+            overflow = true;
+        } else {
+            len += (size_t)n;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    FixedString& operator+=(T v) { return append(v); }
+
+    void clear() {
+        len = 0;
+        overflow = false;
+        text[0] = '\0';
+    }
+
+    /// @brief Strips spaces, tabs and line endings off both ends.
+    void trim() {
+        size_t start = 0;
+        while (start < len && is_space(text[start])) start++;
+        while (len > start && is_space(text[len - 1])) len--;
+        len -= start;
+        memmove(text, text + start, len);
+        text[len] = '\0';
+    }
+
+    const char* c_str() const { return text; }
+    size_t length() const { return len; }
+    static constexpr size_t capacity() { return N - 1; }
+    /// @brief True if something appended didn't fit.
+    bool truncated() const { return overflow; }
+
+private:
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    char text[N];
+    size_t len;
+    bool overflow;
+};
+
+/// @brief Text fixed at compile time, N bytes with the terminator. Built from
+/// const_string() and const_decimal() joined with +, so a command whose parts
+/// are all constexpr ends up in flash with no code run to build it:
+///
+///   constexpr auto CAP = const_string("AT+SETCAP=") + const_decimal<UWB_TAG_COUNT>() + const_string(",10,1");
+template <size_t N>
+struct ConstString {
+    char text[N];
+
+    constexpr const char* c_str() const { return text; }
+    static constexpr size_t length() { return N - 1; }
+};
+
+template <size_t N>
+constexpr ConstString<N> const_string(const char (&s)[N]) {
+    ConstString<N> out{};
+    for (size_t i = 0; i < N; i++) out.text[i] = s[i];
+    return out;
+}
+
+/// @brief Characters in the decimal form of v, sign included.
+constexpr size_t const_decimal_length(long v) {
+    size_t n = v < 0 ? 2 : 1;
+    for (v /= 10; v; v /= 10) n++;
+    return n;
+}
+
+template <long V>
+constexpr ConstString<const_decimal_length(V) + 1> const_decimal() {
+    ConstString<const_decimal_length(V) + 1> out{};
+    long v = V < 0 ? V : -V;
+    size_t i = const_decimal_length(V);
+    do {
+        out.text[--i] = (char)('0' - v % 10);
+        v /= 10;
+    } while (v);
+    if (V < 0) out.text[0] = '-';
+    return out;
+}
+
+template <size_t A, size_t B>
+constexpr ConstString<A + B - 1> operator+(const ConstString<A>& a, const ConstString<B>& b) {
+    ConstString<A + B - 1> out{};
+    for (size_t i = 0; i < A - 1; i++) out.text[i] = a.text[i];
+    for (size_t i = 0; i < B; i++) out.text[A - 1 + i] = b.text[i];
+    return out;
+}
+
+#endif
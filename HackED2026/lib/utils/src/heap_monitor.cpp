@@ -0,0 +1,47 @@
+#include "heap_monitor.h"
+
+#include "telemetry.h"
+#include "wire_format.h"
+
+
+size_t heap_encode_stats(uint8_t* out, uint8_t device_id, const HeapStats& stats) {
+    put_u16(out, TELEMETRY_MAGIC);
+    out[2] = TELEMETRY_VERSION;
+    out[3] = TELEMETRY_HEAP;
+    out[4] = device_id;
+    out[5] = 1;
+    out[6] = 0;
+    out[7] = 0;
+
+    uint8_t* p = out + TELEMETRY_HEADER_LEN;
+    put_u32(p, stats.uptime_ms);
+    put_u32(p + 4, stats.total);
+    put_u32(p + 8, stats.free);
+    put_u32(p + 12, stats.min_free);
+    put_u32(p + 16, stats.largest_block);
+    put_u32(p + 20, stats.min_largest_block);
+    put_u16(p + 24, stats.fragmentation);
+    put_u16(p + 26, stats.max_fragmentation);
+    put_u32(p + 28, stats.samples);
+
+    return TELEMETRY_HEADER_LEN + TELEMETRY_HEAP_LEN;
+}
+
+
+bool heap_decode_stats(const uint8_t* data, size_t len, HeapStats& stats) {
+    TelemetryHeader header;
+    if (!telemetry_decode_header(data, len, header) || header.type != TELEMETRY_HEAP) return false;
+    if (header.frame_count != 1) return false;
+
+    const uint8_t* p = data + TELEMETRY_HEADER_LEN;
+    stats.uptime_ms = get_u32(p);
+    stats.total = get_u32(p + 4);
+    stats.free = get_u32(p + 8);
+    stats.min_free = get_u32(p + 12);
+    stats.largest_block = get_u32(p + 16);
+    stats.min_largest_block = get_u32(p + 20);
+    stats.fragmentation = get_u16(p + 24);
+    stats.max_fragmentation = get_u16(p + 26);
+    stats.samples = get_u32(p + 28);
+    return true;
+}
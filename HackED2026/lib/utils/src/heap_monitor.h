@@ -0,0 +1,70 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct HeapStats {
+    uint32_t uptime_ms; // At the latest sample
+    uint32_t total; // Bytes the heap manages
+    uint32_t free;
+    uint32_t min_free; // Lowest free seen since boot
+    uint32_t largest_block; // Largest single allocation that would succeed
+    uint32_t min_largest_block;
+    /// @brief Permille of the free bytes that aren't in the largest block:
+    /// 0 when free memory is one block, near 1000 when it is in crumbs.
+    uint16_t fragmentation;
+    uint16_t max_fragmentation;
+    uint32_t samples;
+};
+
+/// @brief Folds periodic heap readings into since-boot extremes. Free bytes
+/// that drift down over hours are a leak; a largest block that shrinks while
+/// free stays put is fragmentation, and sooner or later an allocation that
+/// should fit won't. Doesn't read the heap itself, so it runs on the host too;
+/// on the ESP32 feed it heap_caps_get_free_size() and friends.
+class HeapMonitor {
+public:
+    HeapMonitor() { reset(); }
+
+    void reset() {
+        statistics = HeapStats();
+        statistics.min_free = UINT32_MAX;
+        statistics.min_largest_block = UINT32_MAX;
+    }
+
+    void sample(uint32_t free_bytes, uint32_t largest_block, uint32_t total, uint32_t now_ms) {
+        HeapStats& s = statistics;
+        s.uptime_ms = now_ms;
+        s.total = total;
+        s.free = free_bytes;
+        s.largest_block = largest_block;
+        if (free_bytes < s.min_free) s.min_free = free_bytes;
+        if (largest_block < s.min_largest_block) s.min_largest_block = largest_block;
+
+        uint64_t in_largest = free_bytes ? (uint64_t)largest_block * 1000 / free_bytes : 1000;
+        s.fragmentation = in_largest >= 1000 ? 0 : (uint16_t)(1000 - in_largest);
+        if (s.fragmentation > s.max_fragmentation) s.max_fragmentation = s.fragmentation;
+        s.samples++;
+    }
+
+    const HeapStats& stats() const { return statistics; }
+
+private:
+    HeapStats statistics;
+};
+
+/// @brief Writes a TELEMETRY_HEAP packet, see telemetry.h.
+/// @param out At least TELEMETRY_HEADER_LEN + TELEMETRY_HEAP_LEN bytes.
+/// @return The packet length.
+size_t heap_encode_stats(uint8_t* out, uint8_t device_id, const HeapStats& stats);
+
+/// @brief Decodes a TELEMETRY_HEAP packet.
+/// @return False if the packet is malformed.
+bool heap_decode_stats(const uint8_t* data, size_t len, HeapStats& stats);
+
+#endif
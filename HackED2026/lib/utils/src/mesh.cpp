@@ -0,0 +1,234 @@
+#include "mesh.h"
+
+#include <string.h>
+
+#include "at_engine.h"
+#include "range_parser.h"
+
+// "AT+DATA=<len>," with a two-digit length, and the text, must make one command
+static_assert(sizeof("AT+DATA=99,") - 1 + MESH_MAX_TEXT <= AT_COMMAND_LEN, "A mesh frame doesn't fit in AT+DATA");
+static_assert(MESH_MAX_TEXT <= RDATA_MESSAGE_LEN, "A mesh frame doesn't fit in an AT+RDATA message");
+
+static const char* const TYPE_NAMES[] = {
+    "?", "heartbeat", "cal_request", "cal_result", "cal_done", "cal_ack",
+};
+
+static const char BASE64URL[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+
+const char* mesh_type_name(uint8_t type) {
+    return type < sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]) ? TYPE_NAMES[type] : "?";
+}
+
+
+static int base64url_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-') return 62;
+    if (c == '_') return 63;
+    return -1;
+}
+
+
+size_t mesh_encode(uint8_t type, uint8_t seq, const MeshRef* answers, const uint8_t* payload, size_t payload_len,
+                   char* out, size_t len) {
+    uint8_t frame[MESH_MAX_FRAME];
+    size_t header_len = MESH_HEADER_LEN + (answers ? MESH_REPLY_LEN : 0);
+    if (header_len + payload_len > MESH_MAX_FRAME) return 0;
+
+    frame[0] = (uint8_t)(type | (answers ? MESH_REPLY : 0));
+    frame[1] = seq;
+    if (answers) {
+        frame[2] = answers->sender;
+        frame[3] = answers->type;
+        frame[4] = answers->seq;
+    }
+    if (payload_len) memcpy(frame + header_len, payload, payload_len);
+    size_t frame_len = header_len + payload_len;
+
+    size_t text_len = 1 + (frame_len * 4 + 2) / 3;
+    if (text_len + 1 > len) return 0;
+
+    char* p = out;
+    *p++ = MESH_MARKER;
+    for (size_t i = 0; i < frame_len; i += 3) {
+        uint32_t bits = (uint32_t)frame[i] << 16;
+        if (i + 1 < frame_len) bits |= (uint32_t)frame[i + 1] << 8;
+        if (i + 2 < frame_len) bits |= frame[i + 2];
+
+        // Two characters for one byte left, three for two
+        size_t chars = frame_len - i >= 3 ? 4 : frame_len - i + 1;
+        for (size_t c = 0; c < chars; c++) *p++ = BASE64URL[(bits >> (18 - 6 * c)) & 0x3F];
+    }
+    *p = '\0';
+    return text_len;
+}
+
+
+bool mesh_decode(const char* text, size_t len, uint8_t* frame, MeshMessage& out) {
+    if (len < 1 || text[0] != MESH_MARKER) return false;
+    text++;
+    len--;
+
+    // A lone character left over is never a whole byte
+    if (len % 4 == 1 || len > (MESH_MAX_FRAME * 4 + 2) / 3) return false;
+    size_t frame_len = 0;
+    uint32_t bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        int v = base64url_value(text[i]);
+        if (v < 0) return false;
+        bits = (bits << 6) | (uint32_t)v;
+        if (i % 4 == 3 || i == len - 1) {
+            size_t chars = i % 4 + 1;
+            bits <<= 6 * (4 - chars);
+            for (size_t b = 0; b < chars - 1; b++) frame[frame_len++] = (uint8_t)(bits >> (16 - 8 * b));
+            bits = 0;
+        }
+    }
+
+    if (frame_len < MESH_HEADER_LEN) return false;
+    out.type = frame[0] & ~MESH_REPLY;
+    out.seq = frame[1];
+    out.is_reply = frame[0] & MESH_REPLY;
+    if (out.type >= MESH_TYPE_COUNT) return false;
+
+    size_t header_len = MESH_HEADER_LEN;
+    memset(&out.answers, 0, sizeof(out.answers));
+    if (out.is_reply) {
+        if (frame_len < MESH_HEADER_LEN + MESH_REPLY_LEN) return false;
+        out.answers.sender = frame[2];
+        out.answers.type = frame[3];
+        out.answers.seq = frame[4];
+        header_len += MESH_REPLY_LEN;
+    }
+    out.payload = frame + header_len;
+    out.length = frame_len - header_len;
+    return true;
+}
+
+
+MeshDispatcher::MeshDispatcher(uint8_t id, MeshSendFn send, void* ctx)
+    : self(id), send_fn(send), send_ctx(ctx), peer_count(0) {
+    memset(handlers, 0, sizeof(handlers));
+    memset(next_seq, 0, sizeof(next_seq));
+    memset(pending, 0, sizeof(pending));
+    memset(peers, 0, sizeof(peers));
+    memset(&statistics, 0, sizeof(statistics));
+    for (MeshTypeStats& s : type_stats) {
+        s.sent = s.received = s.lost = s.duplicates = s.unhandled = 0;
+        s.round_trip_us.clear();
+    }
+}
+
+
+void MeshDispatcher::on(uint8_t type, MeshHandler handler, void* ctx) {
+    if (type >= MESH_TYPE_COUNT) return;
+    handlers[type].fn = handler;
+    handlers[type].ctx = ctx;
+}
+
+
+uint8_t MeshDispatcher::send(uint8_t type, const uint8_t* payload, size_t len, uint32_t now_us) {
+    return transmit(type, nullptr, payload, len, now_us);
+}
+
+
+uint8_t MeshDispatcher::reply(const MeshRef& to, uint8_t type, const uint8_t* payload, size_t len, uint32_t now_us) {
+    return transmit(type, &to, payload, len, now_us);
+}
+
+
+uint8_t MeshDispatcher::transmit(uint8_t type, const MeshRef* answers, const uint8_t* payload, size_t len,
+                                 uint32_t now_us) {
+    type %= MESH_TYPE_COUNT;
+    uint8_t seq = next_seq[type];
+
+    char text[MESH_MAX_TEXT];
+    size_t text_len = mesh_encode(type, seq, answers, payload, len, text, sizeof(text));
+    if (text_len == 0) {
+        statistics.oversized++;
+        return seq;
+    }
+    next_seq[type]++;
+
+    // Oldest slot out, replies to it are no longer timed
+    Pending* slot = &pending[type][0];
+    for (Pending& p : pending[type]) {
+        if (!p.used) {
+            slot = &p;
+            break;
+        }
+        if ((int32_t)(p.sent_us - slot->sent_us) < 0) slot = &p;
+    }
+    slot->used = true;
+    slot->seq = seq;
+    slot->sent_us = now_us;
+
+    type_stats[type].sent++;
+    send_fn(text, text_len, send_ctx);
+    return seq;
+}
+
+
+bool MeshDispatcher::feed(int sender, const char* text, size_t len, uint32_t now_us) {
+    if (len < 1 || text[0] != MESH_MARKER) return false;
+
+    uint8_t frame[MESH_MAX_FRAME];
+    MeshMessage message;
+    if (!mesh_decode(text, len, frame, message)) {
+        statistics.malformed++;
+        return true;
+    }
+    message.sender = sender;
+    message.received_us = now_us;
+
+    MeshTypeStats& s = type_stats[message.type];
+    s.received++;
+    follow(sender, message.type, message.seq);
+    if (message.is_reply && message.answers.sender == self) time_reply(message.answers, now_us);
+
+    const Handler& h = handlers[message.type];
+    if (h.fn) h.fn(message, h.ctx);
+    else s.unhandled++;
+    return true;
+}
+
+
+void MeshDispatcher::follow(int sender, uint8_t type, uint8_t seq) {
+    Peer* peer = nullptr;
+    for (size_t i = 0; i < peer_count && !peer; i++) {
+        if (peers[i].sender == sender) peer = &peers[i];
+    }
+    if (!peer) {
+        if (peer_count == MESH_MAX_PEERS) {
+            statistics.unfollowed++;
+            return;
+        }
+        peer = &peers[peer_count++];
+        peer->sender = sender;
+        peer->seen = 0;
+    }
+
+    uint8_t bit = (uint8_t)(1 << type);
+    if (peer->seen & bit) {
+        uint8_t gap = (uint8_t)(seq - peer->last_seq[type]);
+        // Far behind is a reboot or a reordering, not half the seqs lost
+        if (gap == 0) type_stats[type].duplicates++;
+        else if (gap < 128) type_stats[type].lost += gap - 1;
+    }
+    peer->seen |= bit;
+    peer->last_seq[type] = seq;
+}
+
+
+void MeshDispatcher::time_reply(const MeshRef& answers, uint32_t now_us) {
+    if (answers.type >= MESH_TYPE_COUNT) return;
+
+    for (const Pending& p : pending[answers.type]) {
+        if (p.used && p.seq == answers.seq) {
+            type_stats[answers.type].round_trip_us.record(now_us - p.sent_us);
+            return;
+        }
+    }
+}
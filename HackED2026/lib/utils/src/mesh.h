@@ -0,0 +1,170 @@
+#ifndef MESH_H
+#define MESH_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// Messages between boards, broadcast over the radio with AT+DATA and received
+// as AT+RDATA. The module's sender id says who it is from. A frame:
+//
+//   u8  type       MeshType, | MESH_REPLY if the frame answers another
+//   u8  seq        the sender's count of frames of this type, wraps
+//   with MESH_REPLY (3 bytes), the frame answered:
+//     u8  to       its sender
+//     u8  type
+//     u8  seq
+//   payload        up to MESH_MAX_PAYLOAD, its layout set by the type
+//
+// AT+DATA takes a line of text, so on the air the frame is '!' followed by
+// base64url without padding: no commas, no line ends, and the length is
+// worked out rather than counted by hand. Text without the '!' isn't a mesh
+// frame and is left to whoever wants it.
+//
+// A gap in one sender's seqs of one type counts as that many frames lost. A
+// reply to one of our own frames gives that type's round trip.
+
+#define MESH_MARKER '!'
+#define MESH_REPLY 0x80
+#define MESH_HEADER_LEN 2
+#define MESH_REPLY_LEN 3
+#define MESH_MAX_FRAME 60 // Before base64, so "AT+DATA=<len>,<text>" fits AT_COMMAND_LEN
+#define MESH_MAX_PAYLOAD (MESH_MAX_FRAME - MESH_HEADER_LEN - MESH_REPLY_LEN)
+#define MESH_MAX_TEXT (1 + (MESH_MAX_FRAME * 4 + 2) / 3 + 1) // Marker, base64 and the null terminator
+#define MESH_MAX_PEERS 16 // Senders whose seqs are followed for loss, the first ones heard
+#define MESH_PENDING 4 // Own frames per type a reply is still timed against
+
+enum MeshType {
+    MESH_HEARTBEAT = 1, // u32 the sender's micros()
+    MESH_CAL_REQUEST = 2, // See calibration.h
+    MESH_CAL_RESULT = 3,
+    MESH_CAL_DONE = 4,
+    MESH_CAL_ACK = 5,
+    MESH_TYPE_COUNT = 8 // Types are below this
+};
+
+/// @brief A frame answered, or about to be.
+struct MeshRef {
+    uint8_t sender;
+    uint8_t type;
+    uint8_t seq;
+};
+
+/// @brief One frame as received.
+struct MeshMessage {
+    int sender; // From AT+RDATA
+    uint8_t type; // MeshType, without MESH_REPLY
+    uint8_t seq;
+    bool is_reply;
+    MeshRef answers; // With is_reply
+    const uint8_t* payload;
+    size_t length;
+    uint32_t received_us;
+
+    /// @brief What a reply to this frame refers to.
+    MeshRef ref() const { return MeshRef{ (uint8_t)sender, type, seq }; }
+};
+
+struct MeshTypeStats {
+    uint32_t sent;
+    uint32_t received;
+    uint32_t lost; // Gaps in the seqs of the senders followed
+    uint32_t duplicates; // A sender's last seq again
+    uint32_t unhandled; // Received with no handler registered
+    LogHistogram round_trip_us; // Sending a frame of this type to each reply to it
+};
+
+struct MeshStats {
+    uint32_t malformed; // Had the marker, but not a frame
+    uint32_t oversized; // Not sent: the payload doesn't fit
+    uint32_t unfollowed; // Frames from senders past MESH_MAX_PEERS, not checked for loss
+};
+
+const char* mesh_type_name(uint8_t type);
+
+/// @return The text's length, without the terminator, or 0 if the frame
+/// doesn't fit in MESH_MAX_FRAME or len.
+size_t mesh_encode(uint8_t type, uint8_t seq, const MeshRef* answers, const uint8_t* payload, size_t payload_len,
+                   char* out, size_t len);
+
+/// @brief The frame in an AT+RDATA message. payload points into frame, which
+/// must hold MESH_MAX_FRAME bytes.
+/// @return False if the text isn't a mesh frame.
+bool mesh_decode(const char* text, size_t len, uint8_t* frame, MeshMessage& out);
+
+/// @brief Sends the text with AT+DATA. Blocking is fine, it's the caller's
+/// loop.
+typedef void (*MeshSendFn)(const char* text, size_t len, void* ctx);
+typedef void (*MeshHandler)(const MeshMessage& message, void* ctx);
+
+/// @brief Routes every received frame to the handler registered for its
+/// type, as it is fed, and numbers and encodes what is sent. One handler per
+/// type; whoever registers last gets it.
+class MeshDispatcher {
+public:
+    /// @param id This board's module id, what the others see as the sender.
+    MeshDispatcher(uint8_t id, MeshSendFn send, void* ctx);
+
+    void set_id(uint8_t id) { self = id; }
+    uint8_t id() const { return self; }
+
+    void on(uint8_t type, MeshHandler handler, void* ctx);
+
+    /// @return The frame's seq.
+    uint8_t send(uint8_t type, const uint8_t* payload, size_t len, uint32_t now_us);
+    /// @brief Sends a frame that answers another, from MeshMessage::ref().
+    uint8_t reply(const MeshRef& to, uint8_t type, const uint8_t* payload, size_t len, uint32_t now_us);
+
+    /// @brief Feed every AT+RDATA.
+    /// @return False if the message isn't a mesh frame.
+    bool feed(int sender, const char* text, size_t len, uint32_t now_us);
+
+    const MeshTypeStats& stats(uint8_t type) const { return type_stats[type % MESH_TYPE_COUNT]; }
+    const MeshStats& stats() const { return statistics; }
+
+private:
+    struct Handler {
+        MeshHandler fn;
+        void* ctx;
+    };
+
+    struct Peer {
+        int sender;
+        uint8_t seen; // Bit per type
+        uint8_t last_seq[MESH_TYPE_COUNT];
+    };
+
+    struct Pending {
+        bool used;
+        uint8_t seq;
+        uint32_t sent_us;
+    };
+
+    uint8_t transmit(uint8_t type, const MeshRef* answers, const uint8_t* payload, size_t len, uint32_t now_us);
+    void follow(int sender, uint8_t type, uint8_t seq);
+    void time_reply(const MeshRef& answers, uint32_t now_us);
+
+    uint8_t self;
+    MeshSendFn send_fn;
+    void* send_ctx;
+
+    Handler handlers[MESH_TYPE_COUNT];
+    uint8_t next_seq[MESH_TYPE_COUNT];
+    Pending pending[MESH_TYPE_COUNT][MESH_PENDING];
+    Peer peers[MESH_MAX_PEERS];
+    size_t peer_count;
+
+    MeshTypeStats type_stats[MESH_TYPE_COUNT];
+    MeshStats statistics;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "module_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+ModuleConfigurator::ModuleConfigurator(AtEngine& engine, AtClock clock)
+    : engine(engine), clock(clock), valid(false), dirty(false), failed(0) {
+    memset(&current, 0, sizeof(current));
+    reset_stats();
+}
+
+
+void ModuleConfigurator::reset_stats() {
+    memset(&statistics, 0, sizeof(statistics));
+    statistics.min_us = UINT32_MAX;
+}
+
+
+bool ModuleConfigurator::cached(ModuleConfig& out) const {
+    if (!valid) return false;
+    out = current;
+    return true;
+}
+
+
+void ModuleConfigurator::on_result(const char*, const AtResult& result, void* ctx) {
+    if (result.status != AT_OK) ((ModuleConfigurator*)ctx)->failed++;
+}
+
+
+void ModuleConfigurator::send(const char* command, uint32_t timeout_ms) {
+    if (engine.submit(command, timeout_ms, nullptr, on_result, this) < 0) failed++;
+}
+
+
+bool ModuleConfigurator::wait_ready(uint32_t timeout_ms) {
+    uint32_t start = clock();
+
+    do {
+        if (engine.run("AT?", MODULE_READY_POLL_MS).status == AT_OK) return true;
+    } while ((uint32_t)(clock() - start) < timeout_ms * 1000UL);
+
+    return false;
+}
+
+
+bool ModuleConfigurator::apply(const ModuleConfig& target, ConfigMode mode) {
+    uint32_t start = clock();
+    bool full = !valid;
+    bool restart = false;
+    char command[AT_COMMAND_LEN];
+
+    failed = 0;
+    statistics.applies++;
+
+    if (full) {
+        // Module state unknown, start from the defaults
+        statistics.full_applies++;
+        send("AT+RESTORE", MODULE_RESTORE_TIMEOUT_MS);
+        statistics.flash_writes++;
+    }
+
+    bool cfg_changed = full || target.id != current.id || target.role != current.role ||
+                       target.channel != current.channel || target.range_filter != current.range_filter;
+    bool cap_changed = full || target.tag_capacity != current.tag_capacity ||
+                       target.slot_ms != current.slot_ms || target.ext_mode != current.ext_mode;
+    bool rpt_changed = full || target.report != current.report;
+    bool ant_changed = target.antenna_delay >= 0 && (full || target.antenna_delay != current.antenna_delay);
+    size_t changes = 0;
+
+    if (cfg_changed) {
+        snprintf(command, sizeof(command), "AT+SETCFG=%d,%d,%d,%d", target.id, target.role,
+                 target.channel, target.range_filter);
+        send(command, MODULE_COMMAND_TIMEOUT_MS);
+        changes++;
+    }
+    if (cap_changed) {
+        snprintf(command, sizeof(command), "AT+SETCAP=%d,%d,%d", target.tag_capacity, target.slot_ms,
+                 target.ext_mode);
+        send(command, MODULE_COMMAND_TIMEOUT_MS);
+        changes++;
+    }
+    if (rpt_changed) {
+        snprintf(command, sizeof(command), "AT+SETRPT=%d", target.report);
+        send(command, MODULE_COMMAND_TIMEOUT_MS);
+        changes++;
+    }
+    if (ant_changed) {
+        snprintf(command, sizeof(command), "AT+SETANT=%d", target.antenna_delay);
+        send(command, MODULE_COMMAND_TIMEOUT_MS);
+        changes++;
+    }
+    statistics.commands += changes;
+
+    if (full || (mode == CONFIG_PERSIST && (changes > 0 || dirty))) {
+        send("AT+SAVE", MODULE_COMMAND_TIMEOUT_MS);
+        send("AT+RESTART", MODULE_COMMAND_TIMEOUT_MS); // Reload the config saved in flash memory
+        statistics.flash_writes++;
+        restart = true;
+    }
+
+    // Everything is queued up front, the engine sends each as the last is answered
+    while (!engine.idle()) engine.poll();
+
+    // A restart answers OK before it goes down, so wait until it is back. A live
+    // change just gets one probe to confirm the module took it.
+    bool ready = true;
+    if (restart) ready = wait_ready(MODULE_READY_TIMEOUT_MS);
+    else if (changes > 0) ready = wait_ready(MODULE_READY_POLL_MS);
+
+    bool ok = failed == 0 && ready;
+    if (ok) {
+        ModuleConfig previous = current;
+        current = target;
+        // A restore reset the delay to the default, otherwise the module still has the old one
+        if (target.antenna_delay < 0) current.antenna_delay = full ? -1 : previous.antenna_delay;
+        valid = true;
+        dirty = restart ? false : (dirty || changes > 0);
+    } else {
+        // Some commands may have landed and some not, so trust nothing
+        valid = false;
+        statistics.failures++;
+    }
+
+    uint32_t elapsed = (uint32_t)(clock() - start);
+    statistics.last_us = elapsed;
+    if (elapsed < statistics.min_us) statistics.min_us = elapsed;
+    if (elapsed > statistics.max_us) statistics.max_us = elapsed;
+    statistics.total_us += elapsed;
+
+    return ok;
+}
@@ -0,0 +1,109 @@
+#ifndef MODULE_CONFIG_H
+#define MODULE_CONFIG_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "at_engine.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define MODULE_COMMAND_TIMEOUT_MS 2000
+#define MODULE_RESTORE_TIMEOUT_MS 5000
+#define MODULE_READY_POLL_MS 50 // Each AT? probe while waiting for the module
+#define MODULE_READY_TIMEOUT_MS 3000 // Longest a restart may take to answer again
+
+/// @brief Everything set_role() / set_delay() write to the module. Fields map
+/// one to one onto AT+SETCFG, AT+SETCAP, AT+SETRPT and AT+SETANT.
+struct ModuleConfig {
+    // AT+SETCFG
+    int id;
+    int role; // 0: tag, 1: anchor
+    int channel; // 0: 850k, 1: 6.8M
+    int range_filter;
+    // AT+SETCAP
+    int tag_capacity;
+    int slot_ms;
+    int ext_mode;
+    // AT+SETRPT
+    int report;
+    /// @brief AT+SETANT value, -1 to leave whatever the module has.
+    int antenna_delay;
+};
+
+enum ConfigMode {
+    /// @brief Only send what changed and leave flash alone. For role switches
+    /// that are undone a moment later, like a calibration measurement.
+    CONFIG_TRANSIENT = 0,
+    /// @brief Also AT+SAVE and AT+RESTART, so the config survives a power cycle.
+    CONFIG_PERSIST = 1,
+};
+
+struct ConfigStats {
+    uint32_t applies;
+    uint32_t full_applies; // Went through AT+RESTORE because the cache was unknown
+    uint32_t commands; // Setting commands sent, not counting readiness probes
+    uint32_t flash_writes; // AT+SAVE / AT+RESTORE
+    uint32_t failures;
+    uint32_t last_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+/// @brief Keeps a copy of what the module was last configured with and, on a
+/// change, sends only the commands whose settings differ. The AT firmware
+/// applies AT+SETCFG / SETCAP / SETRPT / SETANT straight away; AT+SAVE only
+/// matters for the next boot, so transient changes skip it and the reset that
+/// follows. Instead of sleeping after a reset the module is probed with AT?
+/// until it answers.
+///
+/// The cache starts out unknown, and is dropped again if any command fails,
+/// in which case the next apply() does the full AT+RESTORE sequence.
+class ModuleConfigurator {
+public:
+    ModuleConfigurator(AtEngine& engine, AtClock clock);
+
+    /// @brief Brings the module to `target`. Blocks until every command has
+    /// been answered; the time that took is in stats().last_us.
+    /// @return False if a command failed or the module didn't come back.
+    bool apply(const ModuleConfig& target, ConfigMode mode);
+
+    /// @brief Probes with AT? until the module answers OK.
+    /// @return False if it didn't within timeout_ms.
+    bool wait_ready(uint32_t timeout_ms);
+
+    /// @brief Forget the cached config, e.g. after the module was reset
+    /// outside of this class.
+    void invalidate() { valid = false; }
+
+    /// @brief The config the module is known to have.
+    /// @return False while it is unknown.
+    bool cached(ModuleConfig& out) const;
+
+    /// @brief True if a transient change hasn't been saved to flash yet.
+    bool unsaved() const { return dirty; }
+
+    const ConfigStats& stats() const { return statistics; }
+    void reset_stats();
+
+private:
+    void send(const char* command, uint32_t timeout_ms);
+    static void on_result(const char* command, const AtResult& result, void* ctx);
+
+    AtEngine& engine;
+    AtClock clock;
+    ModuleConfig current;
+    bool valid;
+    bool dirty;
+    uint32_t failed;
+    ConfigStats statistics;
+};
+
+#endif
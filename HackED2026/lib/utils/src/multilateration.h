@@ -0,0 +1,236 @@
+#ifndef MULTILATERATION_H
+#define MULTILATERATION_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define MULTILAT_MAX_ITERATIONS 5 // Gauss-Newton refinements after the linear guess
+#define MULTILAT_CONVERGED 0.01f // Stop refining once a step is smaller than this (cm)
+
+/// @brief Solves a DIM-dimensional position from ranges to up to ANCHORS fixed
+/// anchors. A linearized least-squares fit gives the starting point, then a
+/// few Gauss-Newton steps on the true range equations refine it. Everything
+/// lives on the stack, so it is safe to call per frame on the tag.
+///
+/// Units are whatever the anchors and ranges are given in; the module reports
+/// cm. A range of 0 or less means the anchor wasn't heard and it is skipped.
+template <size_t ANCHORS, size_t DIM, typename T = float>
+class Multilateration {
+public:
+    struct Result {
+        T position[DIM];
+        /// @brief RMS of |position - anchor| - range over the anchors used.
+        T rms_residual;
+        /// @brief |position - anchor| - range per anchor, 0 for anchors not used.
+        T residuals[ANCHORS];
+        uint8_t anchors_used;
+        uint8_t iterations;
+        bool valid;
+    };
+
+    Multilateration() : configured(0) {
+        for (size_t i = 0; i < ANCHORS; i++) {
+            for (size_t d = 0; d < DIM; d++) anchors[i][d] = 0;
+        }
+    }
+
+    /// @brief Sets where anchor i is. Anchors never set are ignored.
+    void set_anchor(size_t i, const T position[DIM]) {
+        for (size_t d = 0; d < DIM; d++) anchors[i][d] = position[d];
+        configured |= 1UL << i;
+    }
+
+    void clear_anchor(size_t i) { configured &= ~(1UL << i); }
+
+    /// @brief Solves one fix.
+    /// @param ranges One per anchor, <= 0 for missing.
+    /// @param out Filled even on failure, with valid = false.
+    /// @param weights Optional per-anchor confidence, 0 drops the anchor.
+    /// @return out.valid: at least DIM + 1 anchors and a well-conditioned geometry.
+    bool solve(const int ranges[ANCHORS], Result& out, const T* weights = nullptr) const {
+        T r[ANCHORS];
+        T w[ANCHORS];
+        size_t used = 0;
+
+        for (size_t i = 0; i < ANCHORS; i++) {
+            bool ok = (configured & (1UL << i)) && ranges[i] > 0 && (!weights || weights[i] > 0);
+            r[i] = (T)ranges[i];
+            w[i] = ok ? (weights ? weights[i] : (T)1) : (T)0;
+            if (ok) used++;
+        }
+
+        out.anchors_used = (uint8_t)used;
+        out.iterations = 0;
+        out.valid = false;
+        out.rms_residual = 0;
+        for (size_t d = 0; d < DIM; d++) out.position[d] = 0;
+        for (size_t i = 0; i < ANCHORS; i++) out.residuals[i] = 0;
+
+        if (used < DIM + 1) return false;
+        if (!linear_guess(r, w, out.position)) return false;
+
+        for (size_t it = 0; it < MULTILAT_MAX_ITERATIONS; it++) {
+            out.iterations = (uint8_t)(it + 1);
+            T step = 0;
+            if (!gauss_newton_step(r, w, out.position, step)) break;
+            if (step < (T)MULTILAT_CONVERGED) break;
+        }
+
+        out.rms_residual = rms(r, w, out.position, out.residuals);
+        out.valid = true;
+        return true;
+    }
+
+private:
+    // Subtracting the weighted mean of the squared-range equations
+    // |x - a_i|^2 = r_i^2 turns them linear in x:
+    //   2 (a_i - a_m) . x = (|a_i|^2 - r_i^2) - mean(|a|^2 - r^2)
+    bool linear_guess(const T r[ANCHORS], const T w[ANCHORS], T x[DIM]) const {
+        T wsum = 0;
+        T mean_anchor[DIM] = {};
+        T mean_c = 0;
+
+        for (size_t i = 0; i < ANCHORS; i++) {
+            if (w[i] <= 0) continue;
+            T c = -r[i] * r[i];
+            for (size_t d = 0; d < DIM; d++) {
+                mean_anchor[d] += w[i] * anchors[i][d];
+                c += anchors[i][d] * anchors[i][d];
+            }
+            mean_c += w[i] * c;
+            wsum += w[i];
+        }
+        for (size_t d = 0; d < DIM; d++) mean_anchor[d] /= wsum;
+        mean_c /= wsum;
+
+        T ata[DIM][DIM] = {};
+        T atb[DIM] = {};
+
+        for (size_t i = 0; i < ANCHORS; i++) {
+            if (w[i] <= 0) continue;
+            T row[DIM];
+            T c = -r[i] * r[i];
+            for (size_t d = 0; d < DIM; d++) {
+                row[d] = 2 * (anchors[i][d] - mean_anchor[d]);
+                c += anchors[i][d] * anchors[i][d];
+            }
+            T b = c - mean_c;
+
+            for (size_t p = 0; p < DIM; p++) {
+                atb[p] += w[i] * row[p] * b;
+                for (size_t q = 0; q < DIM; q++) ata[p][q] += w[i] * row[p] * row[q];
+            }
+        }
+
+        return solve_linear(ata, atb, x);
+    }
+
+    // Minimizes sum w_i (|x - a_i| - r_i)^2 around x
+    bool gauss_newton_step(const T r[ANCHORS], const T w[ANCHORS], T x[DIM], T& step) const {
+        T jtj[DIM][DIM] = {};
+        T jtf[DIM] = {};
+
+        for (size_t i = 0; i < ANCHORS; i++) {
+            if (w[i] <= 0) continue;
+
+            T diff[DIM];
+            T dist2 = 0;
+            for (size_t d = 0; d < DIM; d++) {
+                diff[d] = x[d] - anchors[i][d];
+                dist2 += diff[d] * diff[d];
+            }
+            T dist = sqrt(dist2);
+            if (dist < (T)1e-6) continue; // Sitting on an anchor, no direction
+
+            T f = dist - r[i];
+            for (size_t p = 0; p < DIM; p++) {
+                T jp = diff[p] / dist;
+                jtf[p] += w[i] * jp * f;
+                for (size_t q = 0; q < DIM; q++) jtj[p][q] += w[i] * jp * diff[q] / dist;
+            }
+        }
+
+        T dx[DIM];
+        if (!solve_linear(jtj, jtf, dx)) return false;
+
+        step = 0;
+        for (size_t d = 0; d < DIM; d++) {
+            x[d] -= dx[d];
+            step += dx[d] * dx[d];
+        }
+        step = sqrt(step);
+        return true;
+    }
+
+    T rms(const T r[ANCHORS], const T w[ANCHORS], const T x[DIM], T residuals[ANCHORS]) const {
+        T sum = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < ANCHORS; i++) {
+            if (w[i] <= 0) continue;
+            T dist2 = 0;
+            for (size_t d = 0; d < DIM; d++) dist2 += (x[d] - anchors[i][d]) * (x[d] - anchors[i][d]);
+            T f = sqrt(dist2) - r[i];
+            residuals[i] = f;
+            sum += f * f;
+            n++;
+        }
+        return n ? sqrt(sum / n) : 0;
+    }
+
+    // Gaussian elimination with partial pivoting on a DIM x DIM system
+    static bool solve_linear(T a[DIM][DIM], T b[DIM], T x[DIM]) {
+        T scale = 0;
+        for (size_t p = 0; p < DIM; p++) {
+            for (size_t q = 0; q < DIM; q++) {
+                if (fabs(a[p][q]) > scale) scale = fabs(a[p][q]);
+            }
+        }
+
+        for (size_t col = 0; col < DIM; col++) {
+            size_t pivot = col;
+            for (size_t row = col + 1; row < DIM; row++) {
+                if (fabs(a[row][col]) > fabs(a[pivot][col])) pivot = row;
+            }
+            // Anchors (nearly) collinear in 2D or coplanar in 3D
+            if (!(fabs(a[pivot][col]) > scale * (T)1e-5)) return false;
+
+            if (pivot != col) {
+                for (size_t k = 0; k < DIM; k++) {
+                    T t = a[col][k];
+                    a[col][k] = a[pivot][k];
+                    a[pivot][k] = t;
+                }
+                T t = b[col];
+                b[col] = b[pivot];
+                b[pivot] = t;
+            }
+
+            for (size_t row = col + 1; row < DIM; row++) {
+                T f = a[row][col] / a[col][col];
+                for (size_t k = col; k < DIM; k++) a[row][k] -= f * a[col][k];
+                b[row] -= f * b[col];
+            }
+        }
+
+        for (size_t i = DIM; i-- > 0;) {
+            T s = b[i];
+            for (size_t k = i + 1; k < DIM; k++) s -= a[i][k] * x[k];
+            x[i] = s / a[i][i];
+        }
+        return true;
+    }
+
+    T anchors[ANCHORS][DIM];
+    uint32_t configured;
+};
+
+#endif
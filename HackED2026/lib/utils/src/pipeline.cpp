@@ -0,0 +1,64 @@
+#include "pipeline.h"
+
+
+size_t IngestStage::ingest(const char* data, size_t len, uint32_t now_us) {
+    size_t queued = 0;
+    uint32_t start = trace_cycles();
+    // A line carried over from the last chunk keeps the time it started
+    if (!stream.in_line()) line_start_us = now_us;
+
+    while (len > 0) {
+        size_t consumed = 0;
+        AtLineType type = stream.feed(data, len, consumed);
+        data += consumed;
+        len -= consumed;
+        if (type == LINE_NONE) continue;
+
+        uint32_t started = line_start_us;
+        line_start_us = now_us; // The next line starts in this chunk at the earliest
+        if (type != LINE_RANGE) continue;
+        frames++;
+        if (tracer) tracer->record(TRACE_UART_LINE, (now_us - started) * trace_cycles_per_us());
+
+        RangeSample sample;
+        sample.frame = stream.range();
+        sample.timestamp_us = started;
+        if (out.push(sample)) queued++;
+    }
+
+    if (tracer) tracer->record(TRACE_UART_READ, trace_cycles() - start);
+    return queued;
+}
+
+
+size_t ProcessStage::run_once(uint32_t now_us) {
+    size_t count = 0;
+    RangeSample sample;
+
+    while (in.pop(sample)) {
+        uint32_t start = trace_cycles();
+
+        // The sample may have landed after the caller read the clock
+        uint32_t waited = (int32_t)(now_us - sample.timestamp_us) > 0 ? now_us - sample.timestamp_us : 0;
+        latency_total_us += waited;
+        if (waited > latency_max_us) latency_max_us = waited;
+
+        filter.add(sample.frame.ranges, sample.timestamp_us);
+        uint32_t filtered = trace_cycles();
+        telemetry.add(sample.frame.ranges, sample.timestamp_us);
+        uint32_t sent = trace_cycles();
+        if (hook) hook(sample, filter, hook_ctx);
+
+        if (tracer) {
+            tracer->record(TRACE_FILTER, filtered - start);
+            tracer->record(TRACE_TELEMETRY, sent - filtered);
+            tracer->record(TRACE_FRAME, trace_cycles() - start);
+        }
+
+        processed++;
+        count++;
+    }
+
+    telemetry.poll(now_us);
+    return count;
+}
@@ -0,0 +1,103 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "range_filter.h"
+#include "range_parser.h"
+#include "spsc_queue.h"
+#include "telemetry.h"
+#include "trace.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define PIPELINE_QUEUE_DEPTH 32 // Range samples between the two stages
+#define PIPELINE_READ_CHUNK 64 // Bytes pulled off the UART per read
+
+// One parsed AT+RANGE report on its way from the UART to the network.
+struct RangeSample {
+    RangeFrame frame;
+    /// @brief micros() when the line's first byte was read.
+    uint32_t timestamp_us;
+};
+
+typedef SpscQueue<RangeSample, PIPELINE_QUEUE_DEPTH> SampleQueue;
+
+/// @brief First stage: bytes in, parsed range samples out. Only touches the
+/// parser and the producer side of the queue, so it can own a core to itself
+/// and keep the UART drained whatever the network is doing.
+class IngestStage {
+public:
+    explicit IngestStage(SampleQueue& out) : out(out), frames(0), line_start_us(0), tracer(nullptr) {}
+
+    /// @brief Optional, times every chunk as TRACE_UART_READ and every range
+    /// line, first chunk to last, as TRACE_UART_LINE.
+    void set_tracer(Tracer* stage_tracer) { tracer = stage_tracer; }
+
+    /// @brief Parses a chunk of UART bytes and queues every range frame in it.
+    /// A frame is stamped with the now_us of the chunk its line started in.
+    /// @return Frames queued; frames that didn't fit show in out.overflows().
+    size_t ingest(const char* data, size_t len, uint32_t now_us);
+
+    uint32_t frames_parsed() const { return frames; }
+    const RangeStreamParser& parser() const { return stream; }
+
+private:
+    SampleQueue& out;
+    RangeStreamParser stream;
+    uint32_t frames;
+    uint32_t line_start_us;
+    Tracer* tracer;
+};
+
+/// @brief Second stage: drains the queue, runs the convergence filter and
+/// hands the frames to the telemetry batcher, whose flush does the slow
+/// network send. A hook lets the caller update the OLED etc. per frame.
+class ProcessStage {
+public:
+    typedef void (*FrameHook)(const RangeSample& sample, const RangeFilter& filter, void* ctx);
+
+    ProcessStage(SampleQueue& in, RangeFilter& filter, TelemetryBatcher& telemetry)
+        : in(in), filter(filter), telemetry(telemetry), hook(nullptr), hook_ctx(nullptr),
+          processed(0), latency_total_us(0), latency_max_us(0), tracer(nullptr) {}
+
+    void set_hook(FrameHook frame_hook, void* ctx) {
+        hook = frame_hook;
+        hook_ctx = ctx;
+    }
+
+    /// @brief Optional, times TRACE_FILTER, TRACE_TELEMETRY and TRACE_FRAME
+    /// (the whole sample, hook included).
+    void set_tracer(Tracer* stage_tracer) { tracer = stage_tracer; }
+
+    /// @brief Processes everything queued, then lets a partial telemetry batch
+    /// go out if it is past its deadline.
+    /// @return Samples processed.
+    size_t run_once(uint32_t now_us);
+
+    uint32_t samples_processed() const { return processed; }
+    /// @brief Queue wait, from the newline being read to processing.
+    uint32_t mean_latency_us() const { return processed ? (uint32_t)(latency_total_us / processed) : 0; }
+    uint32_t max_latency_us() const { return latency_max_us; }
+
+private:
+    SampleQueue& in;
+    RangeFilter& filter;
+    TelemetryBatcher& telemetry;
+    FrameHook hook;
+    void* hook_ctx;
+
+    uint32_t processed;
+    uint64_t latency_total_us;
+    uint32_t latency_max_us;
+    Tracer* tracer;
+};
+
+#endif
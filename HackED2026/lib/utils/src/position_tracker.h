@@ -0,0 +1,285 @@
+#ifndef POSITION_TRACKER_H
+#define POSITION_TRACKER_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "multilateration.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define TRACKER_ACCEL_NOISE 150.0f // cm/s^2, how sharply a walking person changes velocity
+#define TRACKER_RANGE_SIGMA 10.0f // cm, ranging noise of the module
+#define TRACKER_GATE 3.0f // Ranges further than this many sigmas from the prediction are rejected
+#define TRACKER_MAX_REJECTS 6 // Rejections in a row before the track is restarted from a fresh fix
+#define TRACKER_MAX_GAP_US 2000000 // No range for this long also restarts the track
+#define TRACKER_SEED_WINDOW_US 500000 // Ranges this close together may seed a track
+#define TRACKER_SEED_VELOCITY_SIGMA 100.0f // cm/s, a new track could already be moving
+#define TRACKER_INNOVATION_SMOOTHING 0.1f // Weight of each new innovation in innovation_rms
+
+// The tracker's view of a tag at one instant.
+struct TrackerEstimate {
+    float position[2]; // cm
+    float velocity[2]; // cm/s
+    /// @brief cm, square root of the position covariance's trace.
+    float position_sigma;
+    /// @brief cm, smoothed RMS of the accepted range innovations.
+    float innovation_rms;
+    /// @brief Ranges accepted by the latest update.
+    uint8_t anchors_used;
+    uint32_t timestamp_us;
+};
+
+struct TrackerStats {
+    uint32_t accepted;
+    uint32_t rejected; // Failed the innovation gate
+    uint32_t restarts; // Tracks dropped for rejections or gaps and seeded again
+};
+
+/// @brief Constant-velocity extended Kalman filter for one tag, in 2D. Every
+/// range is its own measurement, folded in the moment it arrives at its own
+/// timestamp, so a new estimate is available per range report. There is no
+/// window to fill first, unlike RangeFilter.
+///
+/// A range whose innovation is more than TRACKER_GATE sigmas off is rejected
+/// instead of being allowed to drag the track. If ranges keep disagreeing, the
+/// tag really has moved away from the prediction, and the track is re-seeded
+/// from a Multilateration fix over the latest ranges.
+///
+/// Timestamps are micros() on the device that measured the ranges, wrapping
+/// is fine. All state is inline, so the tracker costs no heap.
+template <size_t ANCHORS>
+class PositionTracker {
+public:
+    PositionTracker() : configured(0) { reset(); }
+
+    /// @brief Sets where anchor i is. Ranges to anchors never set are ignored.
+    void set_anchor(size_t i, const float position[2]) {
+        anchors[i][0] = position[0];
+        anchors[i][1] = position[1];
+        seed_solver.set_anchor(i, position);
+        configured |= 1UL << i;
+    }
+
+    /// @brief Drops the track and everything heard so far. Anchors are kept.
+    void reset() {
+        active = false;
+        rejects_in_row = 0;
+        last_us = 0;
+        innovation_ms = 0;
+        anchors_used = 0;
+        for (size_t a = 0; a < ANCHORS; a++) {
+            latest_range[a] = 0;
+            latest_us[a] = 0;
+        }
+        statistics.accepted = statistics.rejected = statistics.restarts = 0;
+    }
+
+    /// @brief Folds in one range.
+    /// @param range cm, 0 or less for an anchor not heard.
+    /// @return True if the range was accepted, or seeded a new track.
+    bool update(size_t a, int range, uint32_t now_us) {
+        if (!remember(a, range, now_us)) return false;
+        if (active && !advance(now_us)) active = false;
+
+        anchors_used = 0;
+        if (!active) return seed(now_us);
+
+        uint32_t restarts = statistics.restarts;
+        bool accepted = correct(a, (float)range);
+        if (statistics.restarts != restarts) return active; // Re-seeded instead
+        anchors_used = accepted;
+        return accepted;
+    }
+
+    /// @brief Folds in a whole frame, e.g. RangeFrame::ranges, one range at a time.
+    /// @return Ranges accepted.
+    size_t update(const int ranges[ANCHORS], uint32_t now_us) {
+        size_t heard = 0;
+        for (size_t a = 0; a < ANCHORS; a++) heard += remember(a, ranges[a], now_us);
+        if (!heard) return 0;
+        if (active && !advance(now_us)) active = false;
+
+        anchors_used = 0;
+        if (!active) return seed(now_us) ? anchors_used : 0;
+
+        uint32_t restarts = statistics.restarts;
+        size_t accepted = 0;
+        for (size_t a = 0; a < ANCHORS; a++) {
+            if (ranges[a] <= 0 || !((configured >> a) & 1)) continue;
+            if (correct(a, (float)ranges[a])) accepted++;
+            // Too many rejections re-seeded the track from this very frame,
+            // the rest of it is already in the fix
+            if (statistics.restarts != restarts) return active ? anchors_used : 0;
+        }
+        anchors_used = (uint8_t)accepted;
+        return accepted;
+    }
+
+    /// @brief False until enough anchors have been heard to seed a track, and
+    /// again for a moment after the track is lost.
+    bool tracking() const { return active; }
+
+    /// @brief The track, extrapolated to now_us without changing it.
+    /// @return False if there is no track.
+    bool estimate(uint32_t now_us, TrackerEstimate& out) const {
+        if (!active) return false;
+
+        int32_t delta = (int32_t)(now_us - last_us);
+        float dt = delta > 0 ? delta * 1e-6f : 0;
+        out.position[0] = state[0] + dt * state[2];
+        out.position[1] = state[1] + dt * state[3];
+        out.velocity[0] = state[2];
+        out.velocity[1] = state[3];
+        // The extrapolation's added uncertainty is left out, it is small over a frame
+        out.position_sigma = sqrtf(cov[0][0] + cov[1][1]);
+        out.innovation_rms = sqrtf(innovation_ms);
+        out.anchors_used = anchors_used;
+        out.timestamp_us = delta > 0 ? now_us : last_us;
+        return true;
+    }
+
+    const TrackerStats& stats() const { return statistics; }
+
+private:
+    bool remember(size_t a, int range, uint32_t now_us) {
+        if (range <= 0 || !((configured >> a) & 1)) return false;
+        latest_range[a] = range;
+        latest_us[a] = now_us;
+        return true;
+    }
+
+    // Seeds a track from a Multilateration fix over the ranges heard within
+    // TRACKER_SEED_WINDOW_US of now. Starts at rest, with a wide velocity prior.
+    bool seed(uint32_t now_us) {
+        int ranges[ANCHORS];
+        for (size_t a = 0; a < ANCHORS; a++) {
+            bool recent = latest_range[a] > 0 && (uint32_t)(now_us - latest_us[a]) <= TRACKER_SEED_WINDOW_US;
+            ranges[a] = recent ? latest_range[a] : 0;
+        }
+
+        typename Multilateration<ANCHORS, 2>::Result fix;
+        if (!seed_solver.solve(ranges, fix)) return false;
+
+        float sigma = fix.rms_residual > TRACKER_RANGE_SIGMA ? fix.rms_residual : TRACKER_RANGE_SIGMA;
+        state[0] = fix.position[0];
+        state[1] = fix.position[1];
+        state[2] = state[3] = 0;
+        for (size_t i = 0; i < 4; i++) {
+            for (size_t j = 0; j < 4; j++) cov[i][j] = 0;
+        }
+        cov[0][0] = cov[1][1] = sigma * sigma;
+        cov[2][2] = cov[3][3] = TRACKER_SEED_VELOCITY_SIGMA * TRACKER_SEED_VELOCITY_SIGMA;
+
+        active = true;
+        rejects_in_row = 0;
+        last_us = now_us;
+        innovation_ms = fix.rms_residual * fix.rms_residual;
+        anchors_used = fix.anchors_used;
+        return true;
+    }
+
+    // Predicts the track forward to now_us. Ranges a little out of order are
+    // applied at the track's time; a long gap, or a clock that jumped back
+    // (a device reboot), drops the track.
+    bool advance(uint32_t now_us) {
+        int32_t delta = (int32_t)(now_us - last_us);
+        if (delta > TRACKER_MAX_GAP_US || delta < -TRACKER_MAX_GAP_US) {
+            statistics.restarts++;
+            return false;
+        }
+        if (delta <= 0) return true;
+
+        float dt = delta * 1e-6f;
+        state[0] += dt * state[2];
+        state[1] += dt * state[3];
+
+        // P = F P F^T, F adds dt * velocity to position
+        for (size_t i = 0; i < 4; i++) {
+            cov[0][i] += dt * cov[2][i];
+            cov[1][i] += dt * cov[3][i];
+        }
+        for (size_t i = 0; i < 4; i++) {
+            cov[i][0] += dt * cov[i][2];
+            cov[i][1] += dt * cov[i][3];
+        }
+
+        // + Q for white acceleration noise, per axis
+        float q = TRACKER_ACCEL_NOISE * TRACKER_ACCEL_NOISE;
+        float dt2 = dt * dt;
+        for (size_t d = 0; d < 2; d++) {
+            cov[d][d] += q * dt2 * dt / 3;
+            cov[d][d + 2] += q * dt2 / 2;
+            cov[d + 2][d] += q * dt2 / 2;
+            cov[d + 2][d + 2] += q * dt;
+        }
+
+        last_us = now_us;
+        return true;
+    }
+
+    // Range update against anchor a, gated on the innovation
+    bool correct(size_t a, float range) {
+        float dx = state[0] - anchors[a][0];
+        float dy = state[1] - anchors[a][1];
+        float predicted = sqrtf(dx * dx + dy * dy);
+        if (predicted < 1e-3f) return false; // On top of the anchor, no direction
+
+        // H = [dx, dy, 0, 0] / predicted
+        float h[2] = { dx / predicted, dy / predicted };
+        float ph[4]; // P H^T
+        for (size_t i = 0; i < 4; i++) ph[i] = cov[i][0] * h[0] + cov[i][1] * h[1];
+        float s = h[0] * ph[0] + h[1] * ph[1] + TRACKER_RANGE_SIGMA * TRACKER_RANGE_SIGMA;
+
+        float innovation = range - predicted;
+        if (innovation * innovation > TRACKER_GATE * TRACKER_GATE * s) {
+            statistics.rejected++;
+            if (++rejects_in_row >= TRACKER_MAX_REJECTS) {
+                statistics.restarts++;
+                active = false;
+                seed(last_us);
+            }
+            return false;
+        }
+
+        // x += K v, P -= K H P with K = P H^T / S, kept symmetric
+        for (size_t i = 0; i < 4; i++) state[i] += ph[i] / s * innovation;
+        for (size_t i = 0; i < 4; i++) {
+            for (size_t j = i; j < 4; j++) {
+                cov[i][j] -= ph[i] * ph[j] / s;
+                cov[j][i] = cov[i][j];
+            }
+        }
+
+        statistics.accepted++;
+        rejects_in_row = 0;
+        innovation_ms += TRACKER_INNOVATION_SMOOTHING * (innovation * innovation - innovation_ms);
+        return true;
+    }
+
+    float anchors[ANCHORS][2];
+    uint32_t configured;
+    Multilateration<ANCHORS, 2> seed_solver;
+
+    // Newest range per anchor, for seeding
+    int latest_range[ANCHORS];
+    uint32_t latest_us[ANCHORS];
+
+    bool active;
+    float state[4]; // x, y, vx, vy
+    float cov[4][4];
+    uint32_t last_us;
+    uint8_t rejects_in_row;
+    float innovation_ms; // Smoothed mean square
+    uint8_t anchors_used;
+    TrackerStats statistics;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef RANGE_FILTER_H
+#define RANGE_FILTER_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uwb_config.h"
+
+/// @brief Sliding-window convergence check, kept separately for each anchor.
+/// An anchor has converged once its last WINDOW ranges sit within `threshold`
+/// of each other. Every sample costs O(1): the window sum is kept running and
+/// the min/max come off monotonic deques instead of a rescan.
+///
+/// Ranges of 0 or less are how the module reports an anchor it can't hear, so
+/// they are not treated as samples.
+template <size_t WINDOW, size_t ANCHORS>
+class ConvergenceFilter {
+public:
+    explicit ConvergenceFilter(int threshold = STABILITY_THRESHOLD) : threshold(threshold) {
+        reset();
+    }
+
+    void reset() {
+        for (size_t a = 0; a < ANCHORS; a++) reset(a);
+    }
+
+    void reset(size_t a) {
+        AnchorWindow& w = anchors[a];
+        w.count = 0;
+        w.sum = 0;
+        w.max_head = w.max_size = 0;
+        w.min_head = w.min_size = 0;
+        w.last_sample_us = 0;
+        w.converged_since_us = 0;
+        w.converged = false;
+    }
+
+    /// @brief Adds one frame, e.g. RangeFrame::ranges.
+    void add(const int ranges[ANCHORS], uint32_t now_us) {
+        for (size_t a = 0; a < ANCHORS; a++) add(a, ranges[a], now_us);
+    }
+
+    /// @brief Adds one range for one anchor.
+    void add(size_t a, int range, uint32_t now_us) {
+        if (range <= 0) return;
+
+        AnchorWindow& w = anchors[a];
+        uint32_t n = w.count;
+        size_t slot = n % WINDOW;
+
+        if (n >= WINDOW) w.sum -= w.samples[slot];
+        w.samples[slot] = range;
+        w.sum += range;
+
+        // Drop whatever slides out of the window, which also leaves room to push
+        while (w.max_size > 0 && w.max_idx[w.max_head] + WINDOW <= n) pop_front(w.max_head, w.max_size);
+        while (w.min_size > 0 && w.min_idx[w.min_head] + WINDOW <= n) pop_front(w.min_head, w.min_size);
+
+        // Back of the max deque only keeps values that could still be the max
+        while (w.max_size > 0 && w.max_val[back(w.max_head, w.max_size)] <= range) w.max_size--;
+        w.max_idx[back(w.max_head, w.max_size + 1)] = n;
+        w.max_val[back(w.max_head, w.max_size + 1)] = range;
+        w.max_size++;
+
+        while (w.min_size > 0 && w.min_val[back(w.min_head, w.min_size)] >= range) w.min_size--;
+        w.min_idx[back(w.min_head, w.min_size + 1)] = n;
+        w.min_val[back(w.min_head, w.min_size + 1)] = range;
+        w.min_size++;
+
+        w.count = n + 1;
+        w.last_sample_us = now_us;
+
+        bool stable = w.count >= WINDOW && spread(a) <= threshold;
+        if (stable && !w.converged) w.converged_since_us = now_us;
+        w.converged = stable;
+    }
+
+    /// @brief True once the anchor's full window is within the threshold.
+    bool converged(size_t a) const { return anchors[a].converged; }
+
+    /// @brief Bit a set when anchor a has converged.
+    uint32_t converged_mask() const {
+        uint32_t mask = 0;
+        for (size_t a = 0; a < ANCHORS; a++) {
+            if (anchors[a].converged) mask |= 1UL << a;
+        }
+        return mask;
+    }
+
+    bool all_converged() const { return converged_mask() == (ANCHORS >= 32 ? 0xFFFFFFFFUL : (1UL << ANCHORS) - 1); }
+
+    /// @brief Samples seen so far, capped at the window size.
+    size_t filled(size_t a) const { return anchors[a].count < WINDOW ? anchors[a].count : WINDOW; }
+
+    /// @brief Mean of the samples currently in the window, 0 if there are none.
+    int mean(size_t a) const {
+        size_t n = filled(a);
+        return n ? (int)(anchors[a].sum / (long)n) : 0;
+    }
+
+    /// @brief Max - min over the current window.
+    int spread(size_t a) const {
+        const AnchorWindow& w = anchors[a];
+        if (w.count == 0) return 0;
+        return w.max_val[w.max_head] - w.min_val[w.min_head];
+    }
+
+    /// @brief Time since the anchor last reported a range, i.e. how stale it is.
+    uint32_t age_us(size_t a, uint32_t now_us) const {
+        return anchors[a].count ? (uint32_t)(now_us - anchors[a].last_sample_us) : UINT32_MAX;
+    }
+
+    /// @brief How long the anchor has been converged, 0 if it isn't.
+    uint32_t converged_for_us(size_t a, uint32_t now_us) const {
+        return anchors[a].converged ? (uint32_t)(now_us - anchors[a].converged_since_us) : 0;
+    }
+
+    /// @brief Best estimate available right now: the window mean for converged
+    /// anchors, the latest raw range for the rest, 0 for anchors never heard.
+    /// @return converged_mask(), so callers can tell which values are settled.
+    uint32_t estimate(int out[ANCHORS]) const {
+        for (size_t a = 0; a < ANCHORS; a++) {
+            const AnchorWindow& w = anchors[a];
+            if (w.converged) out[a] = mean(a);
+            else if (w.count) out[a] = w.samples[(w.count - 1) % WINDOW];
+            else out[a] = 0;
+        }
+        return converged_mask();
+    }
+
+    void set_threshold(int value) { threshold = value; }
+
+private:
+    struct AnchorWindow {
+        int samples[WINDOW];
+        long sum;
+        uint32_t count; // Samples ever added, doubles as the next sample index
+
+        // Monotonic deques over the window, stored as rings of WINDOW slots
+        uint32_t max_idx[WINDOW];
+        int max_val[WINDOW];
+        size_t max_head, max_size;
+        uint32_t min_idx[WINDOW];
+        int min_val[WINDOW];
+        size_t min_head, min_size;
+
+        uint32_t last_sample_us;
+        uint32_t converged_since_us;
+        bool converged;
+    };
+
+    /// @brief Slot of the size-th element from the head.
+    static size_t back(size_t head, size_t size) { return (head + size - 1) % WINDOW; }
+
+    static void pop_front(size_t& head, size_t& size) {
+        head = (head + 1) % WINDOW;
+        size--;
+    }
+
+    AnchorWindow anchors[ANCHORS];
+    int threshold;
+};
+
+// Per-anchor convergence over the last BUFF_SIZE ranges
+typedef ConvergenceFilter<BUFF_SIZE, NUM_ANCHORS> RangeFilter;
+
+#endif
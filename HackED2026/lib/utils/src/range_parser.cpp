@@ -0,0 +1,396 @@
+#include "range_parser.h"
+
+#include <string.h>
+
+static const char RANGE_PREFIX[] = "AT+RANGE=";
+static const char RDATA_PREFIX[] = "AT+RDATA=";
+static const uint8_t PREFIX_LEN = sizeof(RANGE_PREFIX) - 1; // Both are the same length
+
+// Keeps a runaway digit string from overflowing the int
+static const int MAX_NUMBER = 100000000;
+
+// The lists decoded out of an AT+RANGE line
+static const uint8_t LIST_RANGE = 1;
+static const uint8_t LIST_RSSI = 2;
+static const uint8_t LIST_ALL = LIST_RANGE | LIST_RSSI;
+
+
+RangeStreamParser::RangeStreamParser() {
+    reset();
+}
+
+
+void RangeStreamParser::reset() {
+    ring_head = 0;
+    ring_count = 0;
+    line_count = 0;
+    overflow_count = 0;
+    start_line();
+}
+
+
+void RangeStreamParser::start_line() {
+    state = PREFIX;
+    prefix_pos = 0;
+    maybe_range = true;
+    maybe_rdata = true;
+
+    key_len = 0;
+    value = 0;
+    negative = false;
+    has_digits = false;
+    in_fraction = false;
+    paren_depth = 0;
+    lists_closed = 0;
+    list = 0;
+    target = nullptr;
+
+    rdata_field = 0;
+    has_sender = false;
+
+    range_frame.tag_id = -1;
+    range_frame.seq = -1;
+    memset(range_frame.ranges, 0, sizeof(range_frame.ranges));
+    range_frame.count = 0;
+    memset(range_frame.rssi, 0, sizeof(range_frame.rssi));
+    range_frame.rssi_count = 0;
+
+    rdata_frame.sender_id = -1;
+    rdata_frame.message[0] = '\0';
+    rdata_frame.length = 0;
+
+    line_len = 0;
+    line_buf[0] = '\0';
+    line_done = false;
+    truncated = false;
+}
+
+
+size_t RangeStreamParser::write(const char* data, size_t len) {
+    size_t written = 0;
+    // At most two copies: up to the end of the ring, then from its start
+    while (written < len && ring_count < PARSER_RING_SIZE) {
+        size_t tail = (ring_head + ring_count) % PARSER_RING_SIZE;
+        size_t run = tail >= ring_head ? PARSER_RING_SIZE - tail : ring_head - tail;
+        if (run > len - written) run = len - written;
+
+        memcpy(ring + tail, data + written, run);
+        written += run;
+        ring_count += run;
+    }
+    return written;
+}
+
+
+AtLineType RangeStreamParser::next() {
+    while (ring_count > 0) {
+        // Hand over the longest run that doesn't wrap around the ring
+        size_t run = PARSER_RING_SIZE - ring_head;
+        if (run > ring_count) run = ring_count;
+
+        size_t consumed = 0;
+        AtLineType type = feed(ring + ring_head, run, consumed);
+        ring_head = (ring_head + consumed) % PARSER_RING_SIZE;
+        ring_count -= consumed;
+
+        if (type != LINE_NONE) return type;
+    }
+    return LINE_NONE;
+}
+
+
+AtLineType RangeStreamParser::feed(const char* data, size_t len, size_t& consumed) {
+    size_t i = 0;
+    while (i < len) {
+        if (line_done) start_line();
+
+        // Whole prefix in hand: one compare instead of nine state steps
+        if (state == PREFIX && prefix_pos == 0 && len - i >= PREFIX_LEN) {
+            if (memcmp(data + i, RANGE_PREFIX, PREFIX_LEN) == 0) state = RANGE_KEY;
+            else if (memcmp(data + i, RDATA_PREFIX, PREFIX_LEN) == 0) state = RDATA_FIELDS;
+
+            if (state != PREFIX) {
+                append_raw(data + i, PREFIX_LEN);
+                prefix_pos = PREFIX_LEN;
+                i += PREFIX_LEN;
+                continue;
+            }
+        }
+
+        // Whole list in hand: parse it in one tight loop
+        if (state == RANGE_LIST && !has_digits && !negative) {
+            const char* close = (const char*)memchr(data + i, ')', len - i);
+            if (close && !memchr(data + i, '\n', close - (data + i))) {
+                size_t stop = (size_t)(close - data) + 1;
+                append_raw(data + i, stop - i);
+                parse_list(data + i, close);
+                i = stop;
+                continue;
+            }
+        }
+
+        // Nothing left to decode on this line, so only the raw copy matters
+        if (state == OTHER || (state == RANGE_SKIP && lists_closed == LIST_ALL)) {
+            const char* newline = (const char*)memchr(data + i, '\n', len - i);
+            size_t stop = newline ? (size_t)(newline - data) : len;
+            append_raw(data + i, stop - i);
+            i = stop;
+            if (!newline) break;
+        }
+
+        AtLineType type = feed(data[i++]);
+        if (type != LINE_NONE) {
+            consumed = i;
+            return type;
+        }
+    }
+
+    consumed = i;
+    return LINE_NONE;
+}
+
+
+void RangeStreamParser::append_raw(const char* data, size_t len) {
+    size_t room = PARSER_LINE_LEN - 1 - line_len;
+    if (len > room) {
+        len = room;
+        mark_truncated();
+    }
+    memcpy(line_buf + line_len, data, len);
+    line_len += len;
+}
+
+
+AtLineType RangeStreamParser::feed(char c) {
+    if (line_done) start_line();
+
+    if (c == '\n') return finish_line();
+    if (c == '\r') return LINE_NONE;
+    // The module emits a few null bytes when it comes out of reset
+    if (c == '\0' && line_len == 0) return LINE_NONE;
+
+    if (line_len < PARSER_LINE_LEN - 1) line_buf[line_len++] = c;
+    else mark_truncated();
+
+    switch (state) {
+    case PREFIX:
+        if (c != RANGE_PREFIX[prefix_pos]) maybe_range = false;
+        if (c != RDATA_PREFIX[prefix_pos]) maybe_rdata = false;
+
+        if (!maybe_range && !maybe_rdata) {
+            state = OTHER;
+        } else if (++prefix_pos == PREFIX_LEN) {
+            state = maybe_range ? RANGE_KEY : RDATA_FIELDS;
+        }
+        break;
+
+    case RANGE_KEY:
+    case RANGE_NUMBER:
+    case RANGE_LIST:
+    case RANGE_SKIP:
+        range_byte(c);
+        break;
+
+    case RDATA_FIELDS:
+    case RDATA_MESSAGE:
+        rdata_byte(c);
+        break;
+
+    case OTHER:
+        break;
+    }
+
+    return LINE_NONE;
+}
+
+
+void RangeStreamParser::mark_truncated() {
+    // Only count each line once
+    if (!truncated) overflow_count++;
+    truncated = true;
+}
+
+
+AtLineType RangeStreamParser::finish_line() {
+    // The bulk path copies the \r that feed() would have dropped
+    if (line_len > 0 && line_buf[line_len - 1] == '\r') line_len--;
+    line_buf[line_len] = '\0';
+    line_done = true;
+
+    if (line_len == 0) return LINE_NONE;
+    line_count++;
+
+    switch (state) {
+    case RANGE_NUMBER:
+        if (target) *target = take_number();
+        // Fall through
+    case RANGE_KEY:
+    case RANGE_SKIP:
+    case RANGE_LIST:
+        // Like the old parse_range(), a list without its ")" is not trusted
+        return (lists_closed & LIST_RANGE) ? LINE_RANGE : LINE_OTHER;
+
+    case RDATA_MESSAGE:
+        // Trim trailing whitespace, leading whitespace was never stored
+        while (rdata_frame.length > 0 &&
+               (rdata_frame.message[rdata_frame.length - 1] == ' ' ||
+                rdata_frame.message[rdata_frame.length - 1] == '\t')) {
+            rdata_frame.length--;
+        }
+        rdata_frame.message[rdata_frame.length] = '\0';
+        return (has_sender && rdata_frame.length > 0) ? LINE_RDATA : LINE_OTHER;
+
+    default:
+        return LINE_OTHER;
+    }
+}
+
+
+void RangeStreamParser::number_byte(char c) {
+    if (c >= '0' && c <= '9') {
+        // Like atoi(), anything after the decimal point is dropped
+        if (!in_fraction && value < MAX_NUMBER) value = value * 10 + (c - '0');
+        has_digits = true;
+    } else if (c == '-' && !has_digits) {
+        negative = true;
+    } else if (c == '.') {
+        in_fraction = true;
+    }
+}
+
+
+int RangeStreamParser::take_number() {
+    int result = negative ? -value : value;
+    value = 0;
+    negative = false;
+    has_digits = false;
+    in_fraction = false;
+    return result;
+}
+
+
+void RangeStreamParser::parse_list(const char* p, const char* close) {
+    if (*p == '(') p++;
+    int* out = list == LIST_RANGE ? range_frame.ranges : range_frame.rssi;
+    uint8_t& count = list == LIST_RANGE ? range_frame.count : range_frame.rssi_count;
+    uint8_t n = count;
+
+    // A number at a time rather than a switch per byte, the per-byte branches
+    // mispredict on every digit/punctuation change. Every loop stops at the
+    // closing ')', so none can run past the list.
+    while (p <= close) {
+        while (*p == ' ') p++;
+        bool minus = *p == '-';
+        if (minus) p++;
+
+        int v = 0;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            if (v < MAX_NUMBER) v = v * 10 + (*p - '0');
+        }
+        // Like atoi(), the fraction and anything else before the separator is dropped
+        while (*p != ',' && *p != ')') p++;
+
+        if (n < NUM_ANCHORS) out[n++] = minus ? -v : v;
+        p++;
+    }
+
+    count = n;
+    close_list();
+}
+
+
+void RangeStreamParser::list_value(int v) {
+    if (list == LIST_RANGE) {
+        if (range_frame.count < NUM_ANCHORS) range_frame.ranges[range_frame.count++] = v;
+    } else if (range_frame.rssi_count < NUM_ANCHORS) {
+        range_frame.rssi[range_frame.rssi_count++] = v;
+    }
+}
+
+
+void RangeStreamParser::close_list() {
+    lists_closed |= list;
+    paren_depth = 0;
+    state = RANGE_SKIP;
+}
+
+
+void RangeStreamParser::range_byte(char c) {
+    switch (state) {
+    case RANGE_KEY:
+        if (c == ':') {
+            if (key_len == 5 && memcmp(key, "range", 5) == 0) {
+                list = LIST_RANGE;
+                state = RANGE_LIST;
+            } else if (key_len == 4 && memcmp(key, "rssi", 4) == 0) {
+                list = LIST_RSSI;
+                state = RANGE_LIST;
+            } else if (key_len == 3 && memcmp(key, "tid", 3) == 0) {
+                target = &range_frame.tag_id;
+                state = RANGE_NUMBER;
+            } else if (key_len == 3 && memcmp(key, "seq", 3) == 0) {
+                target = &range_frame.seq;
+                state = RANGE_NUMBER;
+            } else {
+                paren_depth = 0;
+                state = RANGE_SKIP;
+            }
+            key_len = 0;
+        } else if (c == ',') {
+            key_len = 0;
+        } else if (c != ' ') {
+            // Keys longer than the buffer can't match anything we want
+            if (key_len < sizeof(key)) key[key_len++] = c;
+        }
+        break;
+
+    case RANGE_NUMBER:
+        if (c == ',') {
+            *target = take_number();
+            state = RANGE_KEY;
+        } else {
+            number_byte(c);
+        }
+        break;
+
+    case RANGE_LIST:
+        if (c == '(') break;
+
+        if (c == ',' || c == ')') {
+            list_value(take_number());
+            if (c == ')') close_list();
+        } else {
+            number_byte(c);
+        }
+        break;
+
+    case RANGE_SKIP:
+        if (c == '(') paren_depth++;
+        else if (c == ')' && paren_depth > 0) paren_depth--;
+        else if (c == ',' && paren_depth == 0) state = RANGE_KEY;
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+void RangeStreamParser::rdata_byte(char c) {
+    if (state == RDATA_FIELDS) {
+        if (c == ',') {
+            if (rdata_field == 0 && has_sender) rdata_frame.sender_id = take_number();
+            if (++rdata_field == 4) state = RDATA_MESSAGE;
+        } else if (rdata_field == 0 && c != ' ') {
+            number_byte(c);
+            has_sender = has_digits;
+        }
+        return;
+    }
+
+    // RDATA_MESSAGE: commas from here on are part of the payload
+    if (rdata_frame.length == 0 && (c == ' ' || c == '\t')) return;
+
+    if (rdata_frame.length < RDATA_MESSAGE_LEN - 1) rdata_frame.message[rdata_frame.length++] = c;
+    else mark_truncated();
+}
@@ -0,0 +1,148 @@
+#ifndef RANGE_PARSER_H
+#define RANGE_PARSER_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uwb_config.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define PARSER_RING_SIZE 256 // Bytes buffered between the UART and the parser
+#define PARSER_LINE_LEN 160 // Raw copy of the current line, for non-range lines
+#define RDATA_MESSAGE_LEN 96 // Longest AT+RDATA payload we keep
+
+enum AtLineType { LINE_NONE = 0, LINE_RANGE, LINE_RDATA, LINE_OTHER };
+
+// One AT+RANGE report, e.g.
+// AT+RANGE=tid:3,mask:07,seq:41,range:(152,98,301,0,0,0,0,0),rssi:(...)
+struct RangeFrame {
+    int tag_id;
+    int seq;
+    int ranges[NUM_ANCHORS];
+    /// @brief How many values were inside range:(...).
+    uint8_t count;
+    /// @brief dBm per anchor from rssi:(...), fraction dropped. 0 for anchors
+    /// the module has no reading for, and for all of them if the line had no
+    /// rssi list.
+    int rssi[NUM_ANCHORS];
+    uint8_t rssi_count;
+};
+
+// One AT+RDATA message: AT+RDATA=<sender>,<x>,<x>,<len>,<message>
+struct RDataFrame {
+    int sender_id;
+    char message[RDATA_MESSAGE_LEN];
+    uint8_t length;
+};
+
+/// @brief Byte-at-a-time parser for the module's output. Fields are decoded
+/// as the bytes arrive, so a frame is ready the moment its newline is seen,
+/// and nothing is copied or allocated on the way.
+class RangeStreamParser {
+public:
+    RangeStreamParser();
+
+    /// @brief Consumes one byte.
+    /// @return The type of line that just finished, or LINE_NONE mid-line.
+    AtLineType feed(char c);
+
+    /// @brief Consumes bytes until a line completes or the data runs out. The
+    /// tail of a line that holds nothing we decode is skipped with memchr().
+    /// @param consumed Set to how many bytes were used.
+    AtLineType feed(const char* data, size_t len, size_t& consumed);
+
+    /// @brief Buffers bytes, e.g. straight out of the UART driver.
+    /// @return How many fit; the rest should be written again later.
+    size_t write(const char* data, size_t len);
+
+    /// @brief Runs buffered bytes through feed() until a line completes.
+    AtLineType next();
+
+    // The accessors below describe the line feed()/next() just finished. They
+    // are decoded in place, so they only hold until the next byte is fed.
+
+    /// @brief The AT+RANGE frame that just completed.
+    const RangeFrame& range() const { return range_frame; }
+    /// @brief The AT+RDATA frame that just completed.
+    const RDataFrame& rdata() const { return rdata_frame; }
+    /// @brief Raw text of the line, truncated to PARSER_LINE_LEN.
+    const char* line() const { return line_buf; }
+    size_t line_length() const { return line_len; }
+    /// @brief True once a line's first byte is in and until its newline,
+    /// for timing a line from the byte that started it.
+    bool in_line() const { return !line_done && line_len > 0; }
+
+    uint32_t lines() const { return line_count; }
+    /// @brief Lines that were longer than the buffers and got truncated.
+    uint32_t overflows() const { return overflow_count; }
+
+    void reset();
+
+private:
+    enum State {
+        PREFIX, // Matching AT+RANGE= / AT+RDATA=
+        RANGE_KEY, // Reading a key up to ':'
+        RANGE_NUMBER, // A single number, e.g. tid:3
+        RANGE_LIST, // Inside range:( ... ) or rssi:( ... )
+        RANGE_SKIP, // Skipping a value we don't use
+        RDATA_FIELDS, // The four header fields of AT+RDATA
+        RDATA_MESSAGE, // Everything after the fourth comma
+        OTHER // Anything else, kept only as raw text
+    };
+
+    AtLineType finish_line();
+    void start_line();
+    void range_byte(char c);
+    void rdata_byte(char c);
+    void number_byte(char c);
+    int take_number();
+    void mark_truncated();
+    void append_raw(const char* data, size_t len);
+    void parse_list(const char* p, const char* close);
+    void list_value(int v);
+    void close_list();
+
+    State state;
+    uint8_t prefix_pos;
+    bool maybe_range;
+    bool maybe_rdata;
+
+    // Key/number scratch for the AT+RANGE fields
+    char key[8];
+    uint8_t key_len;
+    int value;
+    bool negative;
+    bool has_digits;
+    bool in_fraction;
+    uint8_t paren_depth;
+    uint8_t lists_closed; // LIST_* bits
+    uint8_t list; // The LIST_* being read
+    int* target; // Where the number being read ends up
+
+    uint8_t rdata_field;
+    bool has_sender;
+
+    RangeFrame range_frame;
+    RDataFrame rdata_frame;
+
+    char line_buf[PARSER_LINE_LEN];
+    size_t line_len;
+    bool line_done; // The next byte starts a new line
+    bool truncated;
+
+    char ring[PARSER_RING_SIZE];
+    size_t ring_head;
+    size_t ring_count;
+
+    uint32_t line_count;
+    uint32_t overflow_count;
+};
+
+#endif
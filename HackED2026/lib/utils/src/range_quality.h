@@ -0,0 +1,212 @@
+#ifndef RANGE_QUALITY_H
+#define RANGE_QUALITY_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uwb_config.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define QUALITY_WINDOW 7 // Ranges per anchor in the Hampel window
+#define QUALITY_MIN_SAMPLES 3 // Ranges needed before the window judges anything
+#define QUALITY_HAMPEL_K 3.0f // Ranges further than this many scaled MADs from the median are outliers
+#define QUALITY_MIN_SIGMA 8.0f // cm, keeps a window of near-identical ranges from flagging ordinary noise
+#define QUALITY_DROPOUT_FRAMES 3 // Zeros in a row before an anchor counts as dropped out
+#define QUALITY_HELD_WEIGHT 0.5f // Weight of the median held over a shorter gap
+#define QUALITY_REPLACED_WEIGHT 0.3f // Weight of the median standing in for an outlier
+#define QUALITY_RESIDUAL_SCALE 15.0f // cm, a residual RMS this big halves an anchor's weight
+#define QUALITY_RESIDUAL_SMOOTHING 0.2f // Weight of each new fix in the residual RMS
+#define QUALITY_RSSI_GOOD -85 // dBm, no penalty at or above
+#define QUALITY_RSSI_FLOOR -100 // dBm, at or below this the weight bottoms out
+#define QUALITY_RSSI_MIN_WEIGHT 0.25f
+
+struct RangeQualityStats {
+    uint32_t samples; // Non-zero ranges seen
+    uint32_t outliers; // Replaced by the window median
+    uint32_t held; // Zeros bridged with the window median
+    uint32_t dropouts; // Anchors that went silent for QUALITY_DROPOUT_FRAMES
+};
+
+/// @brief Robust pre-filter between the parser and the solver, kept for each
+/// anchor separately:
+///
+/// - A Hampel window: a range further than QUALITY_HAMPEL_K scaled MADs from
+///   the median of the last WINDOW ranges is a multipath spike, and the median
+///   stands in for it. A real jump in range is accepted once it fills half
+///   the window.
+/// - Dropout detection: a 0 from the module is bridged with the median for a
+///   frame or two, after QUALITY_DROPOUT_FRAMES the anchor counts as gone and
+///   its window starts over when it comes back.
+/// - A quality score from the solver's residuals for the anchor (see
+///   add_residuals()) and from its RSSI, when the module reports one.
+///
+/// Every anchor comes out with a weight for Multilateration::solve(), 0 for
+/// anchors that shouldn't be used at all. Frames are counted, not timed, as
+/// the module reports every anchor in every frame. All state is inline.
+template <size_t WINDOW, size_t ANCHORS>
+class RangeQualityFilter {
+public:
+    RangeQualityFilter() { reset(); }
+
+    void reset() {
+        for (size_t a = 0; a < ANCHORS; a++) reset(a);
+        statistics.samples = statistics.outliers = statistics.held = statistics.dropouts = 0;
+    }
+
+    void reset(size_t a) {
+        AnchorState& s = anchors[a];
+        s.count = 0;
+        s.zeros_in_row = 0;
+        s.dropped = false;
+        s.residual_ms = 0;
+        s.median = 0;
+    }
+
+    /// @brief Filters one frame, e.g. RangeFrame::ranges.
+    /// @param rssi Optional, dBm per anchor with 0 for unknown, e.g. RangeFrame::rssi.
+    /// @param out Ranges to solve with, 0 where the weight is 0.
+    /// @param weights Per-anchor weight in [0, 1].
+    /// @return Anchors with a non-zero weight.
+    size_t filter(const int ranges[ANCHORS], const int* rssi, int out[ANCHORS], float weights[ANCHORS]) {
+        size_t usable = 0;
+        for (size_t a = 0; a < ANCHORS; a++) {
+            float w = filter(a, ranges[a], out[a]);
+            if (w > 0) {
+                w *= residual_weight(a) * rssi_weight(rssi ? rssi[a] : 0);
+                usable++;
+            }
+            weights[a] = w;
+        }
+        return usable;
+    }
+
+    /// @brief Folds in the residuals of a fix solved from filter()'s output,
+    /// e.g. Multilateration::Result::residuals. Anchors that keep disagreeing
+    /// with the rest lose weight. Anchors with a weight of 0 are skipped.
+    void add_residuals(const float residuals[ANCHORS], const float weights[ANCHORS]) {
+        for (size_t a = 0; a < ANCHORS; a++) {
+            if (weights[a] <= 0) continue;
+            AnchorState& s = anchors[a];
+            s.residual_ms += QUALITY_RESIDUAL_SMOOTHING * (residuals[a] * residuals[a] - s.residual_ms);
+        }
+    }
+
+    /// @brief cm, the smoothed residual RMS of anchor a.
+    float residual_rms(size_t a) const { return sqrtf(anchors[a].residual_ms); }
+
+    /// @brief True while anchor a is silent past QUALITY_DROPOUT_FRAMES.
+    bool dropped_out(size_t a) const { return anchors[a].dropped; }
+
+    /// @brief Bit a set for every anchor that dropped out.
+    uint32_t dropout_mask() const {
+        uint32_t mask = 0;
+        for (size_t a = 0; a < ANCHORS; a++) {
+            if (anchors[a].dropped) mask |= 1UL << a;
+        }
+        return mask;
+    }
+
+    const RangeQualityStats& stats() const { return statistics; }
+
+private:
+    struct AnchorState {
+        int samples[WINDOW];
+        uint32_t count; // Ranges ever added, doubles as the next slot
+        uint8_t zeros_in_row;
+        bool dropped;
+        float residual_ms;
+        int median; // Of the window after the latest range
+    };
+
+    /// @return The Hampel/dropout part of the weight.
+    float filter(size_t a, int range, int& out) {
+        AnchorState& s = anchors[a];
+
+        if (range <= 0) {
+            if (s.zeros_in_row < 255) s.zeros_in_row++;
+            if (s.zeros_in_row >= QUALITY_DROPOUT_FRAMES) {
+                if (!s.dropped) statistics.dropouts++;
+                s.dropped = true;
+                s.count = 0;
+                s.residual_ms = 0;
+            } else if (s.count >= QUALITY_MIN_SAMPLES) {
+                statistics.held++;
+                out = s.median;
+                return QUALITY_HELD_WEIGHT;
+            }
+            out = 0;
+            return 0;
+        }
+
+        s.zeros_in_row = 0;
+        s.dropped = false;
+        s.samples[s.count % WINDOW] = range;
+        s.count++;
+        statistics.samples++;
+        out = range;
+
+        size_t n = s.count < WINDOW ? s.count : WINDOW;
+        if (n < QUALITY_MIN_SAMPLES) {
+            s.median = range;
+            return 1;
+        }
+
+        int sorted[WINDOW];
+        for (size_t i = 0; i < n; i++) sorted[i] = s.samples[i];
+        s.median = median(sorted, n);
+
+        int deviation[WINDOW];
+        for (size_t i = 0; i < n; i++) deviation[i] = abs_int(sorted[i] - s.median);
+        // 1.4826 MAD estimates the standard deviation of Gaussian noise
+        float sigma = 1.4826f * median(deviation, n);
+        if (sigma < QUALITY_MIN_SIGMA) sigma = QUALITY_MIN_SIGMA;
+
+        if (abs_int(range - s.median) > QUALITY_HAMPEL_K * sigma) {
+            statistics.outliers++;
+            out = s.median;
+            return QUALITY_REPLACED_WEIGHT;
+        }
+        return 1;
+    }
+
+    float residual_weight(size_t a) const {
+        float ratio2 = anchors[a].residual_ms / (QUALITY_RESIDUAL_SCALE * QUALITY_RESIDUAL_SCALE);
+        return 1 / (1 + ratio2);
+    }
+
+    static float rssi_weight(int rssi) {
+        if (rssi == 0 || rssi >= QUALITY_RSSI_GOOD) return 1;
+        if (rssi <= QUALITY_RSSI_FLOOR) return QUALITY_RSSI_MIN_WEIGHT;
+        float t = (float)(QUALITY_RSSI_GOOD - rssi) / (QUALITY_RSSI_GOOD - QUALITY_RSSI_FLOOR);
+        return 1 - t * (1 - QUALITY_RSSI_MIN_WEIGHT);
+    }
+
+    static int abs_int(int v) { return v < 0 ? -v : v; }
+
+    /// @brief Sorts v in place, insertion sort is the quickest at this size.
+    static int median(int v[], size_t n) {
+        for (size_t i = 1; i < n; i++) {
+            int x = v[i];
+            size_t j = i;
+            for (; j > 0 && v[j - 1] > x; j--) v[j] = v[j - 1];
+            v[j] = x;
+        }
+        return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    }
+
+    AnchorState anchors[ANCHORS];
+    RangeQualityStats statistics;
+};
+
+// Per-anchor Hampel window over the last QUALITY_WINDOW ranges
+typedef RangeQualityFilter<QUALITY_WINDOW, NUM_ANCHORS> RangeQuality;
+
+#endif
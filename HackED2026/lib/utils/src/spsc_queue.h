@@ -0,0 +1,77 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+/// @brief Lock-free single-producer/single-consumer ring. One task pushes,
+/// one task pops, and neither ever blocks or takes a lock. A push onto a full
+/// queue fails and is counted rather than overwriting unread items.
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0), overflow_count(0), high_water(0) {}
+
+    /// @brief Producer side.
+    /// @return False if the queue was full; the item is dropped.
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t used = h - tail.load(std::memory_order_acquire);
+
+        if (used == N) {
+            overflow_count.store(overflow_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        slots[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+
+        if (used + 1 > high_water.load(std::memory_order_relaxed)) {
+            high_water.store((uint32_t)(used + 1), std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /// @brief Consumer side.
+    /// @return False if there was nothing to pop.
+    bool pop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+
+        item = slots[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Approximate when called from a third task.
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+    static size_t capacity() { return N; }
+
+    /// @brief Pushes that failed because the consumer fell behind.
+    uint32_t overflows() const { return overflow_count.load(std::memory_order_relaxed); }
+    /// @brief Most items ever waiting at once.
+    uint32_t max_depth() const { return high_water.load(std::memory_order_relaxed); }
+
+private:
+    T slots[N];
+    // Producer and consumer indices on separate cache lines so the two cores
+    // don't fight over one line on every push/pop
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<uint32_t> overflow_count;
+    std::atomic<uint32_t> high_water;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "status_display.h"
+
+#include "fixed_string.h"
+
+static_assert(STATUS_RANGE_LINE + (NUM_ANCHORS + 1) / 2 < STATUS_LINES, "The anchors don't fit on the screen");
+
+typedef FixedString<STATUS_COLUMNS + 1> StatusLine;
+
+
+static void append_range(StatusLine& line, int anchor, int range) {
+    if (range > 0) line.appendf("A%d %5d", anchor, range);
+    else line.appendf("A%d    --", anchor);
+}
+
+
+void status_render(const StatusModel& model, const StatusRates& rates, StatusScreen& screen) {
+    StatusLine line;
+
+    line.appendf("SnowScape  #%d %s", model.uwb_index, model.role == 0 ? "TAG" : model.role == 1 ? "ANCHOR" : "-");
+    screen.set_line(0, line.c_str());
+
+    line.clear();
+    line.append("SW ");
+    line.append(model.version, strnlen(model.version, STATUS_VERSION_LEN));
+    screen.set_line(1, line.c_str());
+
+    line.clear();
+    line.appendf("IP %u.%u.%u.%u %s", model.ip[0], model.ip[1], model.ip[2], model.ip[3],
+                 model.link_up ? "UP" : "WAIT");
+    screen.set_line(2, line.c_str());
+
+    for (int a = 0; a < NUM_ANCHORS; a += 2) {
+        line.clear();
+        append_range(line, a, model.ranges[a]);
+        if (a + 1 < NUM_ANCHORS) {
+            line.append("  ");
+            append_range(line, a + 1, model.ranges[a + 1]);
+        }
+        screen.set_line(STATUS_RANGE_LINE + a / 2, line.c_str());
+    }
+
+    line.clear();
+    if (model.fixes) line.appendf("%.1f fix/s", rates.fixes_per_s);
+    else line.appendf("%.1f rng/s", rates.frames_per_s);
+    line.appendf("  %lu lost", (unsigned long)model.dropped);
+    screen.set_line(STATUS_LINES - 1, line.c_str());
+}
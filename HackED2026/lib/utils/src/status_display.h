@@ -0,0 +1,107 @@
+#ifndef STATUS_DISPLAY_H
+#define STATUS_DISPLAY_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "uwb_config.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+#define STATUS_LINES 8 // 8-pixel text rows on the 64-pixel panel, one SSD1306 page each
+#define STATUS_COLUMNS 21 // 6-pixel characters across 128 pixels
+#define STATUS_VERSION_LEN 16 // Of the module's software version shown, including the null terminator
+#define STATUS_INTERVAL_MS 200 // Fastest the display redraws, 5 frames/s
+#define STATUS_RATE_SMOOTHING 0.3f // Weight of each interval in the shown rates
+#define STATUS_RANGE_LINE 3 // First of the NUM_ANCHORS / 2 range lines
+
+/// @brief What the status screen shows. The hot path writes single aligned
+/// words and never waits on the display; the renderer copies the whole thing,
+/// so a field it catches mid-update is at worst one frame stale.
+struct StatusModel {
+    int uwb_index;
+    uint8_t role; // DeviceRole: 0 TAG, 1 ANCHOR
+    char version[STATUS_VERSION_LEN];
+    uint8_t ip[4];
+    bool link_up;
+    int ranges[NUM_ANCHORS]; // cm, 0 where the anchor has no range
+    uint32_t frames; // Range frames since boot
+    uint32_t fixes; // Positions sent since boot
+    uint32_t dropped; // Datagrams and frames that never went out
+};
+
+/// @brief Rates the renderer derives from the model's counters.
+struct StatusRates {
+    float frames_per_s;
+    float fixes_per_s;
+};
+
+/// @brief The text on screen, a line per display page. set_line() marks the
+/// lines whose text changed so only their pages are redrawn and pushed.
+template <size_t LINES, size_t COLUMNS>
+class TextScreen {
+public:
+    TextScreen() : dirty(0), renders(0), pushed(0) {
+        memset(text, 0, sizeof(text));
+        invalidate();
+    }
+
+    /// @brief Cut off at COLUMNS.
+    /// @return True if the line changed.
+    bool set_line(size_t line, const char* s) {
+        char next[COLUMNS + 1];
+        strncpy(next, s, COLUMNS);
+        next[COLUMNS] = '\0';
+        if (strcmp(next, text[line]) == 0) return false;
+
+        memcpy(text[line], next, sizeof(next));
+        dirty |= 1UL << line;
+        return true;
+    }
+
+    /// @brief Marks every line for redrawing, e.g. after the panel was cleared.
+    void invalidate() { dirty = (1UL << LINES) - 1; }
+
+    /// @brief The lines changed since the last call, bit n for line n.
+    uint32_t take_dirty() {
+        uint32_t mask = dirty;
+        dirty = 0;
+        renders++;
+        for (uint32_t m = mask; m; m &= m - 1) pushed++;
+        return mask;
+    }
+
+    const char* line(size_t line) const { return text[line]; }
+
+    /// @brief take_dirty() calls.
+    uint32_t frames() const { return renders; }
+    /// @brief Lines handed out as dirty, each one page over I2C.
+    uint32_t lines_pushed() const { return pushed; }
+
+private:
+    char text[LINES][COLUMNS + 1];
+    uint32_t dirty;
+    uint32_t renders;
+    uint32_t pushed;
+};
+
+typedef TextScreen<STATUS_LINES, STATUS_COLUMNS> StatusScreen;
+
+/// @brief Lays the model out on the screen:
+///
+///   SnowScape  #3 TAG
+///   SW 1.2.3
+///   IP 10.42.0.30 UP
+///   A0  1234  A1    --     (NUM_ANCHORS / 2 lines)
+///   ...
+///   9.8 fix/s  0 lost      (range frames/s when no fixes are sent)
+void status_render(const StatusModel& model, const StatusRates& rates, StatusScreen& screen);
+
+#endif
@@ -0,0 +1,101 @@
+#include "tdma.h"
+
+#include <string.h>
+
+
+TdmaPlanner::TdmaPlanner(const TdmaPolicy& policy, int channel)
+    : policy(policy), cap(UWB_TAG_COUNT), started(false), planned(false), first_heard_ms(0), changed_ms(0),
+      placed(0) {
+    int floor = tdma_min_slot_ms(channel);
+    slot_len = (uint8_t)(policy.slot_ms > floor ? policy.slot_ms : floor);
+    memset(known, 0, sizeof(known));
+    memset(heard_ms, 0, sizeof(heard_ms));
+    memset(slots, TDMA_NO_SLOT, sizeof(slots));
+    memset(&statistics, 0, sizeof(statistics));
+}
+
+
+void TdmaPlanner::heard(uint8_t tag, uint32_t now_ms) {
+    if (!started) {
+        started = true;
+        first_heard_ms = now_ms;
+    }
+    known[tag] = true;
+    heard_ms[tag] = now_ms;
+}
+
+
+uint8_t TdmaPlanner::lowest_free_slot() const {
+    bool used[UWB_TAG_COUNT] = {};
+    for (size_t t = 0; t < TDMA_MAX_DEVICES; t++) {
+        if (slots[t] < UWB_TAG_COUNT) used[slots[t]] = true;
+    }
+    for (uint8_t s = 0; s < UWB_TAG_COUNT; s++) {
+        if (!used[s]) return s;
+    }
+    return TDMA_NO_SLOT;
+}
+
+
+uint8_t TdmaPlanner::capacity_for(size_t tags) const {
+    size_t n = tags + policy.spare_slots;
+    if (n < policy.min_capacity) n = policy.min_capacity;
+    return (uint8_t)(n > UWB_TAG_COUNT ? UWB_TAG_COUNT : n);
+}
+
+
+bool TdmaPlanner::plan(uint32_t now_ms) {
+    if (!started || now_ms - first_heard_ms < policy.settle_ms) return false;
+    bool changed = false;
+
+    // Tags gone quiet give their slot back
+    for (size_t t = 0; t < TDMA_MAX_DEVICES; t++) {
+        if (!known[t] || now_ms - heard_ms[t] < policy.idle_ms) continue;
+        known[t] = false;
+        if (slots[t] == TDMA_NO_SLOT) continue;
+        slots[t] = TDMA_NO_SLOT;
+        placed--;
+        statistics.leaves++;
+        changed = true;
+    }
+
+    // New tags take the lowest free slot. Only past the capacity does
+    // everyone have to switch, and then it grows with spare_slots to spare.
+    bool grow = false;
+    for (size_t t = 0; t < TDMA_MAX_DEVICES; t++) {
+        if (!known[t] || slots[t] != TDMA_NO_SLOT) continue;
+        uint8_t s = lowest_free_slot();
+        if (s == TDMA_NO_SLOT) break; // All UWB_TAG_COUNT taken
+        slots[t] = s;
+        placed++;
+        statistics.joins++;
+        changed = true;
+        grow |= s >= cap;
+    }
+
+    uint8_t target = capacity_for(placed);
+    if (!planned) {
+        // The modules boot with UWB_TAG_COUNT, the first layout always goes out
+        planned = true;
+        cap = target;
+        changed = true;
+    } else if (grow) {
+        cap = target;
+        statistics.grows++;
+    } else if (target < cap && now_ms - changed_ms >= policy.hold_ms) {
+        // Tags above the new capacity move down into the free slots below it
+        for (size_t t = 0; t < TDMA_MAX_DEVICES; t++) {
+            if (slots[t] == TDMA_NO_SLOT || slots[t] < target) continue;
+            slots[t] = TDMA_NO_SLOT;
+            slots[t] = lowest_free_slot();
+        }
+        cap = target;
+        statistics.shrinks++;
+        changed = true;
+    }
+
+    if (!changed) return false;
+    changed_ms = now_ms;
+    statistics.layouts++;
+    return true;
+}
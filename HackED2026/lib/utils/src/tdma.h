@@ -0,0 +1,105 @@
+#ifndef TDMA_H
+#define TDMA_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uwb_config.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// The AT firmware's ranging schedule: every tag gets the slot matching its
+// module id (AT+SETCFG), and a superframe is AT+SETCAP's tag capacity times
+// its slot time. A tag whose id is at or above the capacity never ranges, and
+// a tag and anchor only range while their capacity and slot time agree.
+
+#define TDMA_MIN_SLOT_MS_6M8 10 // Shortest slot time on the 6.8M channel
+#define TDMA_MIN_SLOT_MS_850K 15 // And on the 850K one
+#define TDMA_NO_SLOT 0xFF // Anchors, and tags the planner hasn't placed
+#define TDMA_MAX_DEVICES 256 // By uwb_index
+
+/// @brief Shortest slot time the module accepts on a channel, 0: 850K, 1: 6.8M.
+inline int tdma_min_slot_ms(int channel) { return channel == 1 ? TDMA_MIN_SLOT_MS_6M8 : TDMA_MIN_SLOT_MS_850K; }
+
+/// @brief A device's part of a layout, as one control command argument:
+/// capacity, slot time and the tag's slot, a byte each.
+inline int32_t tdma_pack(uint8_t capacity, uint8_t slot_ms, uint8_t slot) {
+    return (int32_t)((uint32_t)capacity | (uint32_t)slot_ms << 8 | (uint32_t)slot << 16);
+}
+
+inline void tdma_unpack(int32_t arg, uint8_t& capacity, uint8_t& slot_ms, uint8_t& slot) {
+    capacity = (uint8_t)arg;
+    slot_ms = (uint8_t)(arg >> 8);
+    slot = (uint8_t)(arg >> 16);
+}
+
+/// @brief When the planner changes the layout. Defaults suit tags that send
+/// a range frame every superframe and stats every TRACE_EXPORT_INTERVAL_MS.
+struct TdmaPolicy {
+    uint8_t spare_slots = 1; // Kept free on a grow, so the next tag joins without moving the others
+    uint8_t min_capacity = 2;
+    uint8_t slot_ms = 0; // 0: the channel's minimum
+    uint32_t settle_ms = 2000; // Listening before the first layout, so every tag is in it
+    uint32_t idle_ms = 15000; // A tag silent this long gives up its slot
+    uint32_t hold_ms = 10000; // Shortest time between a change and a shrink
+};
+
+struct TdmaPlannerStats {
+    uint32_t layouts; // plan() calls that changed something
+    uint32_t grows;
+    uint32_t shrinks;
+    uint32_t joins; // Tags given a slot
+    uint32_t leaves; // Tags that went idle and lost theirs
+};
+
+/// @brief Works out the smallest layout that gives every tag heard from
+/// recently a slot of its own. Tags keep their slot across changes unless a
+/// shrink needs it back; a new tag takes the lowest free one. Only decides,
+/// see CapacityManager for getting it onto the modules.
+class TdmaPlanner {
+public:
+    /// @param channel 0: 850K, 1: 6.8M, for the slot time floor.
+    explicit TdmaPlanner(const TdmaPolicy& policy = TdmaPolicy(), int channel = 1);
+
+    /// @brief Any telemetry from the tag, ranges or not: a tag without a
+    /// slot still sends its stats.
+    void heard(uint8_t tag, uint32_t now_ms);
+
+    /// @brief Updates the layout.
+    /// @return True if the capacity, slot time or a tag's slot changed.
+    bool plan(uint32_t now_ms);
+
+    uint8_t capacity() const { return cap; }
+    uint8_t slot_ms() const { return slot_len; }
+    uint32_t superframe_ms() const { return (uint32_t)cap * slot_len; }
+    /// @brief TDMA_NO_SLOT if the tag has none.
+    uint8_t slot(uint8_t tag) const { return slots[tag]; }
+    /// @brief Tags with a slot.
+    size_t active() const { return placed; }
+    const TdmaPlannerStats& stats() const { return statistics; }
+
+private:
+    uint8_t lowest_free_slot() const;
+    uint8_t capacity_for(size_t tags) const;
+
+    TdmaPolicy policy;
+    uint8_t cap;
+    uint8_t slot_len;
+    bool started; // First tag heard, settle_ms running
+    bool planned; // The first layout is out
+    uint32_t first_heard_ms;
+    uint32_t changed_ms;
+    bool known[TDMA_MAX_DEVICES];
+    uint32_t heard_ms[TDMA_MAX_DEVICES];
+    uint8_t slots[TDMA_MAX_DEVICES];
+    size_t placed;
+    TdmaPlannerStats statistics;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "telemetry.h"
+
+#include "wire_format.h"
+
+#include <math.h>
+
+static size_t frame_length(const TelemetryHeader& header) {
+    if (header.type == TELEMETRY_POSITION) return TELEMETRY_POSITION_LEN;
+    if (header.type == TELEMETRY_CALIBRATION) return 2 * (size_t)header.anchor_count;
+    if (header.type == TELEMETRY_STATS) return 0; // Variable, checked by trace_decode_stats()
+    if (header.type == TELEMETRY_HEAP) return TELEMETRY_HEAP_LEN;
+    if (header.type == TELEMETRY_BOOT) return 0; // After a 4-byte prefix, checked by boot_decode_report()
+    return 8 + 2 * (size_t)header.anchor_count;
+}
+
+static int32_t to_mm(float cm) {
+    return (int32_t)lroundf(cm * 10.0f);
+}
+
+
+bool telemetry_decode_header(const uint8_t* data, size_t len, TelemetryHeader& header) {
+    if (len < TELEMETRY_HEADER_LEN) return false;
+    if (get_u16(data) != TELEMETRY_MAGIC) return false;
+
+    header.version = data[2];
+    header.type = data[3];
+    header.device_id = data[4];
+    header.frame_count = data[5];
+    header.anchor_count = data[6];
+
+    if (header.version != TELEMETRY_VERSION) return false;
+
+    return len >= TELEMETRY_HEADER_LEN + header.frame_count * frame_length(header);
+}
+
+
+int telemetry_decode_frames(const uint8_t* data, size_t len, TelemetryFrame* frames, size_t max_frames) {
+    TelemetryHeader header;
+    if (!telemetry_decode_header(data, len, header)) return -1;
+    if (header.type != TELEMETRY_RANGES) return -1;
+
+    size_t frame_len = frame_length(header);
+    size_t count = header.frame_count < max_frames ? header.frame_count : max_frames;
+    const uint8_t* p = data + TELEMETRY_HEADER_LEN;
+
+    for (size_t i = 0; i < count; i++, p += frame_len) {
+        frames[i].seq = get_u32(p);
+        frames[i].timestamp_us = get_u32(p + 4);
+        for (int a = 0; a < NUM_ANCHORS; a++) {
+            frames[i].ranges[a] = a < header.anchor_count ? get_i16(p + 8 + 2 * a) : 0;
+        }
+    }
+
+    return (int)count;
+}
+
+
+size_t telemetry_encode_position(uint8_t* out, uint8_t device_id, const TelemetryPosition& fix) {
+    put_u16(out, TELEMETRY_MAGIC);
+    out[2] = TELEMETRY_VERSION;
+    out[3] = TELEMETRY_POSITION;
+    out[4] = device_id;
+    out[5] = 1;
+    out[6] = 0;
+    out[7] = 0;
+
+    uint8_t* p = out + TELEMETRY_HEADER_LEN;
+    put_u32(p, fix.seq);
+    put_u32(p + 4, fix.timestamp_us);
+    for (int d = 0; d < 3; d++) put_u32(p + 8 + 4 * d, (uint32_t)to_mm(fix.position[d]));
+
+    int32_t residual = to_mm(fix.rms_residual);
+    put_u16(p + 20, (uint16_t)(residual < 0 ? 0 : residual > UINT16_MAX ? UINT16_MAX : residual));
+    p[22] = fix.anchors_used;
+    p[23] = 0;
+
+    return TELEMETRY_HEADER_LEN + TELEMETRY_POSITION_LEN;
+}
+
+
+int telemetry_decode_positions(const uint8_t* data, size_t len, TelemetryPosition* fixes, size_t max_fixes) {
+    TelemetryHeader header;
+    if (!telemetry_decode_header(data, len, header)) return -1;
+    if (header.type != TELEMETRY_POSITION) return -1;
+
+    size_t count = header.frame_count < max_fixes ? header.frame_count : max_fixes;
+    const uint8_t* p = data + TELEMETRY_HEADER_LEN;
+
+    for (size_t i = 0; i < count; i++, p += TELEMETRY_POSITION_LEN) {
+        fixes[i].seq = get_u32(p);
+        fixes[i].timestamp_us = get_u32(p + 4);
+        for (int d = 0; d < 3; d++) fixes[i].position[d] = (int32_t)get_u32(p + 8 + 4 * d) / 10.0f;
+        fixes[i].rms_residual = get_u16(p + 20) / 10.0f;
+        fixes[i].anchors_used = p[22];
+    }
+
+    return (int)count;
+}
+
+
+size_t telemetry_encode_calibration(uint8_t* out, uint8_t device_id, const int* distances, size_t devices) {
+    if (devices > TELEMETRY_CALIBRATION_MAX_DEVICES) return 0;
+
+    put_u16(out, TELEMETRY_MAGIC);
+    out[2] = TELEMETRY_VERSION;
+    out[3] = TELEMETRY_CALIBRATION;
+    out[4] = device_id;
+    out[5] = (uint8_t)devices;
+    out[6] = (uint8_t)devices;
+    out[7] = 0;
+
+    uint8_t* p = out + TELEMETRY_HEADER_LEN;
+    for (size_t i = 0; i < devices * devices; i++, p += 2) put_i16(p, clamp_i16(distances[i]));
+
+    return TELEMETRY_HEADER_LEN + 2 * devices * devices;
+}
+
+
+int telemetry_decode_calibration(const uint8_t* data, size_t len, int* distances, size_t max_devices) {
+    TelemetryHeader header;
+    if (!telemetry_decode_header(data, len, header)) return -1;
+    if (header.type != TELEMETRY_CALIBRATION) return -1;
+    if (header.frame_count != header.anchor_count || header.anchor_count > max_devices) return -1;
+
+    size_t n = header.anchor_count;
+    const uint8_t* p = data + TELEMETRY_HEADER_LEN;
+    for (size_t i = 0; i < n * n; i++, p += 2) distances[i] = get_i16(p);
+
+    return (int)n;
+}
+
+
+TelemetryBatcher::TelemetryBatcher(uint8_t device_id, uint8_t batch_frames, uint32_t deadline_us,
+                                   FlushFn flush, void* ctx)
+    : device_id(device_id), flush_fn(flush), ctx(ctx), frame_count(0), first_frame_us(0),
+      seq(0), packets(0) {
+    set_batch(batch_frames, deadline_us);
+}
+
+
+void TelemetryBatcher::set_batch(uint8_t frames, uint32_t deadline) {
+    if (frames == 0) frames = 1;
+    if (frames > TELEMETRY_MAX_FRAMES) frames = TELEMETRY_MAX_FRAMES;
+    batch_frames = frames;
+    deadline_us = deadline;
+
+    if (frame_count >= batch_frames) flush();
+}
+
+
+uint32_t TelemetryBatcher::add(const int ranges[NUM_ANCHORS], uint32_t timestamp_us) {
+    if (frame_count == 0) first_frame_us = timestamp_us;
+
+    uint8_t* p = packet + TELEMETRY_HEADER_LEN + frame_count * TELEMETRY_FRAME_LEN;
+    put_u32(p, seq);
+    put_u32(p + 4, timestamp_us);
+    for (int a = 0; a < NUM_ANCHORS; a++) put_i16(p + 8 + 2 * a, clamp_i16(ranges[a]));
+
+    frame_count++;
+    uint32_t assigned = seq++;
+
+    if (frame_count >= batch_frames) flush();
+    return assigned;
+}
+
+
+void TelemetryBatcher::poll(uint32_t now_us) {
+    if (frame_count > 0 && (uint32_t)(now_us - first_frame_us) >= deadline_us) flush();
+}
+
+
+void TelemetryBatcher::flush() {
+    if (frame_count == 0) return;
+
+    put_u16(packet, TELEMETRY_MAGIC);
+    packet[2] = TELEMETRY_VERSION;
+    packet[3] = TELEMETRY_RANGES;
+    packet[4] = device_id;
+    packet[5] = frame_count;
+    packet[6] = NUM_ANCHORS;
+    packet[7] = 0;
+
+    size_t len = TELEMETRY_HEADER_LEN + frame_count * TELEMETRY_FRAME_LEN;
+    frame_count = 0;
+    packets++;
+
+    if (flush_fn) flush_fn(packet, len, ctx);
+}
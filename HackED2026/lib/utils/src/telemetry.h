@@ -0,0 +1,195 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uwb_config.h"
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// Packet layout, all fields little-endian:
+//
+//   header (8 bytes)
+//     u16 magic         TELEMETRY_MAGIC
+//     u8  version       TELEMETRY_VERSION
+//     u8  type          TelemetryType
+//     u8  device_id     uwb_index of the sender
+//     u8  frame_count   frames that follow
+//     u8  anchor_count  ranges per frame, NUM_ANCHORS on the sender
+//     u8  reserved
+//   frame (8 + 2 * anchor_count bytes), frame_count times
+//     u32 seq           per-device frame counter, +1 per frame
+//     u32 timestamp_us  micros() when the frame's first UART byte was read,
+//                       wraps every ~71 min. See clock_sync.h for the host's view
+//     i16 ranges[anchor_count]  cm, clamped to the i16 range
+//
+// TELEMETRY_POSITION packets carry solved fixes instead, anchor_count is 0:
+//   frame (24 bytes), frame_count times
+//     u32 seq, u32 timestamp_us  as above, counted separately from ranges
+//     i32 x, y, z      mm
+//     u16 rms_residual mm
+//     u8  anchors_used
+//     u8  reserved
+//
+// TELEMETRY_CALIBRATION packets carry the anchor-to-anchor distance matrix,
+// anchor_count is the number of devices calibrated, n:
+//   frame (2 * n bytes), n times, one per row
+//     i16 distances[n]  cm, -1 where it couldn't be measured
+//
+// TELEMETRY_STATS packets carry the Tracer's latency histograms, see trace.h.
+// frame_count is the number of histograms, anchor_count is 0:
+//   u32 uptime_us
+//   u16 cycles_per_us  to turn stage values into microseconds
+//   histogram, frame_count times, variable length
+//     u8  kind          TraceKind
+//     u8  id            TraceStage, or the command slot
+//     u8  name_len      0 for stages, then that many name bytes
+//     var count, max    LEB128 varints
+//     u8  used          non-empty buckets that follow
+//     (u8 index, var count), used times
+//
+// TELEMETRY_HEAP packets carry a HeapMonitor's stats, see heap_monitor.h.
+// frame_count is 1, anchor_count is 0:
+//   frame (32 bytes)
+//     u32 uptime_ms
+//     u32 total, free, min_free, largest_block, min_largest_block  bytes
+//     u16 fragmentation, max_fragmentation  permille
+//     u32 samples
+//
+// TELEMETRY_BOOT packets carry a BootTimer's phases, see boot.h. frame_count
+// is the number of phases, anchor_count is 0:
+//   u16 buffered       datagrams held until WiFi was up
+//   u16 dropped        of those, lost to a full buffer
+//   phase (12 bytes), frame_count times
+//     u8  phase         BootPhase
+//     u8  done          0 if it hadn't finished when the report was sent
+//     u16 reserved
+//     u32 start_us, end_us  micros() since reset
+
+#define TELEMETRY_MAGIC 0x5353 // "SS"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_HEADER_LEN 8
+#define TELEMETRY_FRAME_LEN (8 + 2 * NUM_ANCHORS)
+#define TELEMETRY_POSITION_LEN 24
+#define TELEMETRY_HEAP_LEN 32
+#define TELEMETRY_CALIBRATION_MAX_DEVICES 16
+#define TELEMETRY_CALIBRATION_MAX_PACKET \
+    (TELEMETRY_HEADER_LEN + 2 * TELEMETRY_CALIBRATION_MAX_DEVICES * TELEMETRY_CALIBRATION_MAX_DEVICES)
+
+#define TELEMETRY_MAX_FRAMES 16 // Most frames a batcher will hold
+#define TELEMETRY_MAX_PACKET (TELEMETRY_HEADER_LEN + TELEMETRY_MAX_FRAMES * TELEMETRY_FRAME_LEN)
+
+#define TELEMETRY_DEFAULT_BATCH 4 // Frames per datagram
+#define TELEMETRY_DEFAULT_DEADLINE_US 50000 // Longest a frame waits for its batch
+
+enum TelemetryType { TELEMETRY_RANGES = 1, TELEMETRY_POSITION = 2, TELEMETRY_CALIBRATION = 3, TELEMETRY_STATS = 4,
+                     TELEMETRY_HEAP = 5, TELEMETRY_BOOT = 6 };
+
+struct TelemetryHeader {
+    uint8_t version;
+    uint8_t type;
+    uint8_t device_id;
+    uint8_t frame_count;
+    uint8_t anchor_count;
+};
+
+struct TelemetryFrame {
+    uint32_t seq;
+    uint32_t timestamp_us;
+    int ranges[NUM_ANCHORS];
+};
+
+struct TelemetryPosition {
+    uint32_t seq;
+    uint32_t timestamp_us;
+    /// @brief cm, like the ranges. z is 0 for 2D fixes.
+    float position[3];
+    float rms_residual;
+    uint8_t anchors_used;
+};
+
+/// @brief Reads the header of a packet.
+/// @return False if it is not a telemetry packet this build understands, or
+/// is shorter than its header says.
+bool telemetry_decode_header(const uint8_t* data, size_t len, TelemetryHeader& header);
+
+/// @brief Decodes the frames of a TELEMETRY_RANGES packet. Anchors beyond
+/// NUM_ANCHORS are dropped, missing ones read as 0.
+/// @return The number of frames written, or -1 if the packet is malformed.
+int telemetry_decode_frames(const uint8_t* data, size_t len, TelemetryFrame* frames, size_t max_frames);
+
+/// @brief Writes a single-fix TELEMETRY_POSITION packet.
+/// @param out At least TELEMETRY_HEADER_LEN + TELEMETRY_POSITION_LEN bytes.
+/// @return The packet length.
+size_t telemetry_encode_position(uint8_t* out, uint8_t device_id, const TelemetryPosition& fix);
+
+/// @brief Decodes the frames of a TELEMETRY_POSITION packet.
+/// @return The number of fixes written, or -1 if the packet is malformed.
+int telemetry_decode_positions(const uint8_t* data, size_t len, TelemetryPosition* fixes, size_t max_fixes);
+
+/// @brief Writes a TELEMETRY_CALIBRATION packet.
+/// @param out At least TELEMETRY_CALIBRATION_MAX_PACKET bytes.
+/// @param distances Row-major, devices x devices.
+/// @return The packet length, 0 if there are too many devices.
+size_t telemetry_encode_calibration(uint8_t* out, uint8_t device_id, const int* distances, size_t devices);
+
+/// @brief Decodes a TELEMETRY_CALIBRATION packet.
+/// @param distances Row-major, n x n; room for max_devices x max_devices.
+/// @return The number of devices, or -1 if the packet is malformed or larger
+/// than max_devices.
+int telemetry_decode_calibration(const uint8_t* data, size_t len, int* distances, size_t max_devices);
+
+/// @brief Collects range frames and hands them out as one datagram once the
+/// batch is full or its oldest frame reaches the flush deadline.
+class TelemetryBatcher {
+public:
+    typedef void (*FlushFn)(const uint8_t* packet, size_t len, void* ctx);
+
+    /// @param device_id Written into every header.
+    /// @param batch_frames Frames per datagram, capped at TELEMETRY_MAX_FRAMES.
+    /// @param deadline_us How long the first frame of a batch may wait.
+    /// @param flush Called with each finished packet.
+    /// @param ctx Passed back to flush.
+    TelemetryBatcher(uint8_t device_id, uint8_t batch_frames, uint32_t deadline_us,
+                     FlushFn flush, void* ctx);
+
+    /// @brief Appends a frame, flushing if that fills the batch.
+    /// @return The sequence number the frame was given.
+    uint32_t add(const int ranges[NUM_ANCHORS], uint32_t timestamp_us);
+
+    /// @brief Flushes a partial batch that has waited past the deadline.
+    void poll(uint32_t now_us);
+
+    /// @brief Sends whatever is batched now.
+    void flush();
+
+    void set_batch(uint8_t batch_frames, uint32_t deadline_us);
+
+    uint8_t batch_size() const { return batch_frames; }
+    uint32_t deadline() const { return deadline_us; }
+    uint32_t next_seq() const { return seq; }
+    uint32_t packets_sent() const { return packets; }
+    size_t buffered() const { return frame_count; }
+
+private:
+    uint8_t device_id;
+    uint8_t batch_frames;
+    uint32_t deadline_us;
+    FlushFn flush_fn;
+    void* ctx;
+
+    uint8_t packet[TELEMETRY_MAX_PACKET];
+    uint8_t frame_count;
+    uint32_t first_frame_us;
+    uint32_t seq;
+    uint32_t packets;
+};
+
+#endif
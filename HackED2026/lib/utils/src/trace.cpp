@@ -0,0 +1,189 @@
+#include "trace.h"
+
+#include <string.h>
+
+#include "telemetry.h"
+#include "wire_format.h"
+
+static const char* const STAGE_NAMES[TRACE_STAGE_COUNT] = {
+    "uart_read", "filter", "solve", "telemetry", "udp_send", "frame", "uart_line",
+};
+
+
+const char* trace_stage_name(uint8_t stage) {
+    return stage < TRACE_STAGE_COUNT ? STAGE_NAMES[stage] : "?";
+}
+
+
+////////////
+// TRACER //
+////////////
+
+Tracer::Tracer() : commands_used(0) {
+    memset(command_names, 0, sizeof(command_names));
+}
+
+
+void Tracer::record_command(const char* command, uint32_t latency_us) {
+    // "AT+SETCFG=3,0,1,1" -> "SETCFG", "AT?" -> "AT"
+    if (strncmp(command, "AT+", 3) == 0) command += 3;
+    size_t len = strcspn(command, "=?");
+    if (len > TRACE_COMMAND_NAME_LEN - 1) len = TRACE_COMMAND_NAME_LEN - 1;
+
+    size_t slot = 0;
+    for (; slot < commands_used; slot++) {
+        if (strncmp(command_names[slot], command, len) == 0 && command_names[slot][len] == '\0') break;
+    }
+
+    if (slot == commands_used) {
+        if (commands_used >= TRACE_MAX_COMMANDS - 1) {
+            // Full. The last slot is kept for the catch-all, so no command
+            // ever shares a histogram with one that was named
+            slot = TRACE_MAX_COMMANDS - 1;
+            if (commands_used < TRACE_MAX_COMMANDS) {
+                strcpy(command_names[slot], "other");
+                commands_used = TRACE_MAX_COMMANDS;
+            }
+        } else {
+            memcpy(command_names[slot], command, len);
+            command_names[slot][len] = '\0';
+            commands_used++;
+        }
+    }
+
+    commands[slot].record(latency_us);
+}
+
+
+void Tracer::clear() {
+    for (size_t i = 0; i < TRACE_STAGE_COUNT; i++) stages[i].clear();
+    for (size_t i = 0; i < TRACE_MAX_COMMANDS; i++) commands[i].clear();
+    memset(command_names, 0, sizeof(command_names));
+    commands_used = 0;
+}
+
+
+//////////////////
+// STATS PACKET //
+//////////////////
+
+// Worst case for one histogram: kind, id, name, two varints, used, every bucket
+static const size_t ENTRY_MAX_LEN = 3 + TRACE_COMMAND_NAME_LEN + 10 + 1 + TRACE_BUCKETS * 6;
+
+
+static size_t encode_entry(uint8_t* p, uint8_t kind, uint8_t id, const char* name, const LogHistogram& h) {
+    uint8_t* start = p;
+    size_t name_len = name ? strlen(name) : 0;
+
+    *p++ = kind;
+    *p++ = id;
+    *p++ = (uint8_t)name_len;
+    memcpy(p, name, name_len);
+    p += name_len;
+    p += put_varint(p, h.count());
+    p += put_varint(p, h.max());
+
+    uint8_t* used = p++;
+    *used = 0;
+    for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+        if (h.bucket_count(i) == 0) continue;
+        *p++ = (uint8_t)i;
+        p += put_varint(p, h.bucket_count(i));
+        (*used)++;
+    }
+
+    return p - start;
+}
+
+
+size_t trace_encode_stats(uint8_t* out, size_t max_len, uint8_t device_id, const Tracer& tracer,
+                          uint32_t uptime_us) {
+    if (max_len > TRACE_MAX_PACKET) max_len = TRACE_MAX_PACKET;
+
+    put_u16(out, TELEMETRY_MAGIC);
+    out[2] = TELEMETRY_VERSION;
+    out[3] = TELEMETRY_STATS;
+    out[4] = device_id;
+    out[5] = 0;
+    out[6] = 0;
+    out[7] = 0;
+    put_u32(out + TELEMETRY_HEADER_LEN, uptime_us);
+    put_u16(out + TELEMETRY_HEADER_LEN + 4, trace_cycles_per_us());
+    size_t len = TELEMETRY_HEADER_LEN + 6;
+
+    // Encoded into scratch first, so one that doesn't fit can be left out whole
+    uint8_t entry[ENTRY_MAX_LEN];
+    size_t total = TRACE_STAGE_COUNT + tracer.command_count();
+
+    for (size_t i = 0; i < total; i++) {
+        bool stage = i < TRACE_STAGE_COUNT;
+        const LogHistogram& h = stage ? tracer.stage(i) : tracer.command(i - TRACE_STAGE_COUNT);
+        if (h.count() == 0) continue;
+
+        size_t n = stage ? encode_entry(entry, TRACE_KIND_STAGE, (uint8_t)i, nullptr, h)
+                         : encode_entry(entry, TRACE_KIND_COMMAND, (uint8_t)(i - TRACE_STAGE_COUNT),
+                                        tracer.command_name(i - TRACE_STAGE_COUNT), h);
+        if (len + n > max_len) continue;
+
+        memcpy(out + len, entry, n);
+        len += n;
+        out[5]++;
+    }
+
+    return len;
+}
+
+
+bool trace_decode_stats(const uint8_t* data, size_t len, TraceReport& report) {
+    TelemetryHeader header;
+    if (!telemetry_decode_header(data, len, header) || header.type != TELEMETRY_STATS) return false;
+    if (len < TELEMETRY_HEADER_LEN + 6) return false;
+    if (header.frame_count > TRACE_STAGE_COUNT + TRACE_MAX_COMMANDS) return false;
+
+    const uint8_t* p = data + TELEMETRY_HEADER_LEN;
+    const uint8_t* end = data + len;
+    report.uptime_us = get_u32(p);
+    report.cycles_per_us = get_u16(p + 4);
+    report.count = 0;
+    p += 6;
+
+    for (size_t i = 0; i < header.frame_count; i++) {
+        TraceEntry& e = report.entries[report.count];
+        if (end - p < 3) return false;
+        e.kind = p[0];
+        e.id = p[1];
+        size_t name_len = p[2];
+        p += 3;
+        if (name_len >= TRACE_COMMAND_NAME_LEN || (size_t)(end - p) < name_len) return false;
+        memcpy(e.name, p, name_len);
+        e.name[name_len] = '\0';
+        p += name_len;
+
+        if (e.kind == TRACE_KIND_STAGE) strcpy(e.name, trace_stage_name(e.id));
+
+        uint32_t count, max;
+        size_t n;
+        if (!(n = get_varint(p, end, count))) return false;
+        p += n;
+        if (!(n = get_varint(p, end, max))) return false;
+        p += n;
+        if (p >= end) return false;
+        size_t used = *p++;
+
+        e.histogram.clear();
+        for (size_t b = 0; b < used; b++) {
+            uint32_t bucket_count;
+            if (p >= end) return false;
+            size_t index = *p++;
+            if (!(n = get_varint(p, end, bucket_count))) return false;
+            p += n;
+            e.histogram.add(index, bucket_count);
+        }
+        e.histogram.set_max(max);
+        if (e.histogram.count() != count) return false;
+
+        report.count++;
+    }
+
+    return true;
+}
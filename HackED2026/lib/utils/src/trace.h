@@ -0,0 +1,206 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+////////////
+// IMPORTS //
+////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+/////////////////////////////
+// PREPROCESSOR DIRECTIVES //
+/////////////////////////////
+
+// Log-linear buckets: each power of two is split into TRACE_SUB_BUCKETS, so a
+// percentile is off by at most 25%. Values below TRACE_SUB_BUCKETS get a
+// bucket each. 124 buckets cover all of u32.
+#define TRACE_SUB_BUCKETS 4
+#define TRACE_BUCKETS 124
+
+#define TRACE_MAX_COMMANDS 16 // AT commands timed separately; the firmware sends 11. Past 15 they share "other"
+#define TRACE_COMMAND_NAME_LEN 12 // Including the null terminator
+#define TRACE_EXPORT_INTERVAL_MS 5000
+#define TRACE_MAX_PACKET 1200 // Histograms that don't fit are left out of the packet
+
+// Per-frame stages. They may nest: TRACE_TELEMETRY includes the
+// TRACE_UDP_SEND of a batch it flushes, TRACE_FRAME includes all of them.
+enum TraceStage {
+    TRACE_UART_READ = 0, // Draining SERIAL_AT into the parser, per read that got bytes
+    TRACE_FILTER, // RangeQuality::filter and/or RangeFilter::add
+    TRACE_SOLVE, // Multilateration
+    TRACE_TELEMETRY, // TelemetryBatcher::add
+    TRACE_UDP_SEND, // beginPacket() ... endPacket()
+    TRACE_FRAME, // One range frame, parsed to handed off
+    TRACE_UART_LINE, // Wall time from a line's first byte read to its newline: module -> MCU
+    TRACE_STAGE_COUNT
+};
+
+enum TraceKind {
+    TRACE_KIND_STAGE = 0, // Values in CPU cycles
+    TRACE_KIND_COMMAND = 1 // Values in microseconds
+};
+
+/// @brief Free-running cycle counter: the CPU's CCOUNT register on the board
+/// (one cycle to read), nanoseconds on the host. Wraps, so only differences
+/// of at most a few seconds mean anything.
+inline uint32_t trace_cycles() {
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/// @brief trace_cycles() ticks per microsecond.
+inline uint16_t trace_cycles_per_us() {
+#ifdef ARDUINO
+    return (uint16_t)getCpuFrequencyMhz();
+#else
+    return 1000;
+#endif
+}
+
+const char* trace_stage_name(uint8_t stage);
+
+/// @brief Fixed-size latency histogram. record() is a count-leading-zeros, a
+/// shift and an increment, cheap enough to leave on in production.
+class LogHistogram {
+public:
+    LogHistogram() { clear(); }
+
+    void clear() {
+        for (size_t i = 0; i < TRACE_BUCKETS; i++) counts[i] = 0;
+        total = 0;
+        peak = 0;
+    }
+
+    void record(uint32_t value) {
+        counts[bucket(value)]++;
+        total++;
+        if (value > peak) peak = value;
+    }
+
+    /// @brief Adds n samples to one bucket, e.g. when decoding a packet.
+    void add(size_t index, uint32_t n) {
+        if (index >= TRACE_BUCKETS) return;
+        counts[index] += n;
+        total += n;
+    }
+    void set_max(uint32_t value) { peak = value; }
+
+    /// @brief Adds every sample of another histogram, e.g. one per thread.
+    void merge(const LogHistogram& other) {
+        for (size_t i = 0; i < TRACE_BUCKETS; i++) counts[i] += other.counts[i];
+        total += other.total;
+        if (other.peak > peak) peak = other.peak;
+    }
+
+    /// @brief Upper bound of the bucket holding the p-th sample (0..1), but
+    /// never more than the largest value recorded.
+    uint32_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)(p * (total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < TRACE_BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) return upper(i) < peak ? upper(i) : peak;
+        }
+        return peak;
+    }
+
+    uint32_t count() const { return total; }
+    uint32_t max() const { return peak; }
+    uint32_t bucket_count(size_t index) const { return counts[index]; }
+
+    static size_t bucket(uint32_t value) {
+        if (value < TRACE_SUB_BUCKETS) return value;
+        int msb = 31 - __builtin_clz(value);
+        return (size_t)(msb - 1) * TRACE_SUB_BUCKETS + ((value >> (msb - 2)) & (TRACE_SUB_BUCKETS - 1));
+    }
+
+    /// @brief Largest value that lands in the bucket.
+    static uint32_t upper(size_t index) {
+        if (index < TRACE_SUB_BUCKETS) return (uint32_t)index;
+        int msb = (int)(index / TRACE_SUB_BUCKETS) + 1;
+        uint64_t top = (uint64_t)(TRACE_SUB_BUCKETS + index % TRACE_SUB_BUCKETS + 1) << (msb - 2);
+        return (uint32_t)(top - 1);
+    }
+
+private:
+    uint32_t counts[TRACE_BUCKETS];
+    uint32_t total;
+    uint32_t peak;
+};
+
+/// @brief Latency histograms per stage (CPU cycles) and per AT command name
+/// (microseconds). About 8 KB, all static.
+///
+/// Not locked: every histogram must have a single writer. In pipeline mode
+/// TRACE_UART_READ belongs to the ingest task and the other stages to the
+/// processing task. A reader on another core may see a count that is one
+/// behind, which is fine for statistics.
+class Tracer {
+public:
+    Tracer();
+
+    void record(TraceStage stage, uint32_t cycles) { stages[stage].record(cycles); }
+
+    /// @brief Files the latency under the command's name, e.g. "SETCFG" for
+    /// "AT+SETCFG=3,0,1,1".
+    void record_command(const char* command, uint32_t latency_us);
+
+    const LogHistogram& stage(size_t stage) const { return stages[stage]; }
+    size_t command_count() const { return commands_used; }
+    const char* command_name(size_t i) const { return command_names[i]; }
+    const LogHistogram& command(size_t i) const { return commands[i]; }
+
+    void clear();
+
+private:
+    LogHistogram stages[TRACE_STAGE_COUNT];
+    LogHistogram commands[TRACE_MAX_COMMANDS];
+    char command_names[TRACE_MAX_COMMANDS][TRACE_COMMAND_NAME_LEN];
+    size_t commands_used;
+};
+
+/// @brief One histogram out of a stats packet.
+struct TraceEntry {
+    uint8_t kind; // TraceKind
+    uint8_t id; // TraceStage, or the command slot
+    char name[TRACE_COMMAND_NAME_LEN];
+    LogHistogram histogram;
+};
+
+/// @brief A decoded stats packet.
+struct TraceReport {
+    uint32_t uptime_us;
+    uint16_t cycles_per_us;
+    size_t count;
+    TraceEntry entries[TRACE_STAGE_COUNT + TRACE_MAX_COMMANDS];
+
+    /// @brief Converts a value of the given entry to microseconds.
+    double to_us(const TraceEntry& entry, uint32_t value) const {
+        return entry.kind == TRACE_KIND_STAGE && cycles_per_us ? (double)value / cycles_per_us : value;
+    }
+};
+
+/// @brief Writes a TELEMETRY_STATS packet with every histogram that has
+/// samples. Counts are totals since boot, so a lost packet loses nothing.
+/// @param out At least max_len bytes, up to TRACE_MAX_PACKET are used.
+/// @return The packet length.
+size_t trace_encode_stats(uint8_t* out, size_t max_len, uint8_t device_id, const Tracer& tracer,
+                          uint32_t uptime_us);
+
+/// @brief Decodes a TELEMETRY_STATS packet.
+/// @return False if the packet is malformed.
+bool trace_decode_stats(const uint8_t* data, size_t len, TraceReport& report);
+
+#endif
@@ -1,31 +1,118 @@
+// Only the board build uses this file; the native env compiles the portable
+// modules in this library on their own.
+#ifdef ARDUINO
+
 #include <utils.h>
 
+#include <Preferences.h>
+#include <esp_heap_caps.h>
+
 HardwareSerial SERIAL_AT(2);
 Adafruit_SSD1306 display(128, 64, &Wire, -1);
 
+// Connects the AT engine to the module's UART
+class SerialAtPort : public AtPort {
+public:
+    int available() override { return SERIAL_AT.available(); }
+    int read() override { return SERIAL_AT.read(); }
+    void write_line(const char* line) override { SERIAL_AT.println(line); }
+};
+
+static uint32_t at_clock() { return micros(); }
+
+static SerialAtPort at_port;
+AtEngine at_engine(at_port, at_clock);
+ModuleConfigurator module_config(at_engine, at_clock);
+RangeStreamParser uart_parser;
+RangeFilter range_filter(STABILITY_THRESHOLD);
+RangeQuality range_quality;
+SampleQueue pipeline_queue;
+IngestStage ingest_stage(pipeline_queue);
+VersionString module_version;
+Tracer tracer;
+HeapMonitor heap_monitor;
+BootTimer boot_timer;
+StatusModel status_model;
+// The status task copies status_model on core 0 while the loop (and the
+// pipeline's process task) write it: both sides hold this, briefly
+static portMUX_TYPE status_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void count_status(uint32_t& counter) {
+    portENTER_CRITICAL(&status_lock);
+    counter++;
+    portEXIT_CRITICAL(&status_lock);
+}
+StatusScreen status_screen;
+ControlChannel control;
+static bool status_task_running = false;
+static bool pipeline_running = false; // The ingest task owns SERIAL_AT
+static uint32_t line_start_us = 0; // First byte of the line uart_parser is on, see read_frame()
+static uint32_t frame_us = 0; // Of the line read_frame() last completed
+static Preferences settings; // NVS, see board_settings()
+
+// The TDMA layout last committed by the laptop's capacity manager, see
+// module_config_for(). Until then the boot defaults of cap_cmd().
+static uint8_t tdma_capacity = UWB_TAG_COUNT;
+static uint8_t tdma_slot_ms = TDMA_MIN_SLOT_MS_6M8;
+static uint8_t tdma_slot = TDMA_NO_SLOT; // A tag's module id in place of its uwb_index
+static int32_t tdma_staged = -1;
+
+// What was sent before WiFi came up, see poll_wifi()
+static DatagramBuffer<BOOT_BUFFER_BYTES> boot_buffer;
+static bool wifi_up = false;
+static bool boot_reported = false;
+static uint32_t wifi_up_ms = 0;
+static uint16_t boot_buffered = 0;
+
+// Nothing in it is known until run time except UWB_TAG_COUNT, so it goes in flash
+static constexpr auto AT_CAP_COMMAND = const_string("AT+SETCAP=") + const_decimal<UWB_TAG_COUNT>() +
+                                       const_string(",10,1");
+static_assert(AT_CAP_COMMAND.length() < AT_COMMAND_LEN, "AT+SETCAP doesn't fit in an AT command");
+
+// read_frame() and at_engine both read SERIAL_AT. Whichever stops mid-line
+// hands the bytes it has to the other, so no line is ever split between them.
+static size_t parser_take_line(char* out, size_t len, void*) {
+    if (!uart_parser.in_line()) return 0;
+    size_t n = uart_parser.line_length() < len ? uart_parser.line_length() : len;
+    memcpy(out, uart_parser.line(), n);
+    uart_parser.reset();
+    return n;
+}
+
+
+static void parser_give_line(const char* text, size_t len, void*) {
+    // It started somewhere inside the command, this is as close as it gets
+    line_start_us = micros();
+    for (size_t i = 0; i < len; i++) uart_parser.feed(text[i]);
+}
+
 ///////////////////
 // CONFIGURATION //
 ///////////////////
 
 void init_setup(DeviceInfo& device, DeviceRole new_role) {
-    // Start the UWB module cleanly
+    at_engine.set_tracer(&tracer);
+    at_engine.set_line_share(parser_take_line, parser_give_line, nullptr);
+    control.set_device_id(device.uwb_index);
+    radio_mesh().set_id(device.uwb_index);
+
+    // Start the UWB module cleanly. It boots while the rest is set up.
     pinMode(RESET, OUTPUT);
     digitalWrite(RESET, HIGH);
+    boot_timer.begin(BOOT_MODULE_READY, micros());
 
-    // Set up WiFI
+    // Set up WiFI. Association runs in the background, poll_wifi() picks it up.
+    boot_timer.begin(BOOT_WIFI, micros());
     WiFi.begin(SSID, PASSWORD); 
-    while (WiFi.status() != WL_CONNECTED) delay(500);
-    delay(1000);
-    device.udp.begin(LOCAL_PORT);
 
     // Set up the board
     SERIAL_LOG.begin(115200);
     SERIAL_AT.begin(115200, SERIAL_8N1, IO_RXD2, IO_TXD2);
-    SERIAL_AT.println("AT"); // Sanity check the UWB module.
 
     // Initialize the OLED display
+    boot_timer.begin(BOOT_OLED, micros());
     Wire.begin(I2C_SDA, I2C_SCL);
-    delay(1000);
+    while (millis() < BOOT_OLED_POWER_UP_MS) delay(1);
     // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
     if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C))
     { // Address 0x3C for 128x32
@@ -34,163 +121,545 @@ void init_setup(DeviceInfo& device, DeviceRole new_role) {
             ; // Don't proceed, loop forever
     }
     display.clearDisplay();
+    boot_timer.end(BOOT_OLED, micros());
+
+    // Sanity check the UWB module
+    if (!module_config.wait_ready(MODULE_READY_TIMEOUT_MS)) SERIAL_LOG.println("UWB module not answering");
+    boot_timer.end(BOOT_MODULE_READY, micros());
 
     // Display the firmware version
-    String version = parse_software_version(device, send_radio_data("AT+GETVER?", 2000, 0));
-    set_role(device, new_role, version);
+    boot_timer.begin(BOOT_VERSION, micros());
+    module_version = parse_software_version(device, send_radio_data("AT+GETVER?", 2000, 0));
+    boot_timer.end(BOOT_VERSION, micros());
+
+    boot_timer.begin(BOOT_ROLE, micros());
+    set_role(device, new_role, module_version.c_str());
+    boot_timer.end(BOOT_ROLE, micros());
+
+    boot_timer.begin(BOOT_FIRST_RANGE, micros());
+    start_status_display();
+    poll_wifi(device);
 }
 
 
-String config_cmd(DeviceInfo& device) {
-    String temp = "AT+SETCFG=";
-    temp = temp + device.uwb_index; // Set device id
-    temp = temp + "," + device.current_role; // Set device role (0:Tag / 1:Anchor)
-    temp = temp + ",1"; // Set frequency 850k or 6.8M
-    temp = temp + ",1"; // Set range filter
+static void log_boot_report() {
+    SERIAL_LOG.printf("Boot report, %u datagrams buffered, %lu dropped:\n", boot_buffered,
+                      (unsigned long)boot_buffer.dropped());
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+        const BootPhaseTiming& p = boot_timer.phase(i);
+        if (!p.started) continue;
+        SERIAL_LOG.printf("  %-12s %7.3f s -> ", boot_phase_name(i), p.start_us / 1e6);
+        if (p.done) SERIAL_LOG.printf("%7.3f s (%.3f s)\n", p.end_us / 1e6, (p.end_us - p.start_us) / 1e6);
+        else SERIAL_LOG.printf("not done\n");
+    }
+}
+
 
-    return temp;
+bool poll_wifi(DeviceInfo& device) {
+    if (wifi_up) {
+        if (!boot_reported && (boot_timer.done(BOOT_FIRST_RANGE) || millis() - wifi_up_ms > BOOT_REPORT_WAIT_MS)) {
+            boot_reported = true; // Before the send, which comes back through here
+            uint8_t packet[TELEMETRY_HEADER_LEN + 4 + BOOT_PHASE_COUNT * BOOT_PHASE_LEN];
+            send_wifi_packet(device, packet, boot_encode_report(packet, device.uwb_index, boot_timer, boot_buffered,
+                                                                (uint16_t)boot_buffer.dropped()));
+            log_boot_report();
+        }
+        return true;
+    }
+    if (WiFi.status() != WL_CONNECTED) return false;
+
+    wifi_up = true;
+    portENTER_CRITICAL(&status_lock);
+    status_model.link_up = true;
+    portEXIT_CRITICAL(&status_lock);
+    wifi_up_ms = millis();
+    boot_timer.end(BOOT_WIFI, micros());
+    device.udp.begin(LOCAL_PORT);
+
+    boot_timer.begin(BOOT_FIRST_SEND, micros());
+    boot_buffered = (uint16_t)boot_buffer.count();
+    boot_buffer.drain([&](const uint8_t* data, size_t len) { send_wifi_packet(device, data, len); });
+    boot_timer.end(BOOT_FIRST_SEND, micros());
+    return true;
 }
 
 
-String cap_cmd() {
-    String temp = "AT+SETCAP=";
-    temp = temp + UWB_TAG_COUNT; // Set Tag capacity
-    temp = temp + ",10"; //  Time of a single time slot  6.5M : 10MS  850K ： 15MS
-    //X3:extMode, whether to increase the passthrough command when transmitting
-    //(0: normal packet when communicating, 1: extended packet when communicating)
-    temp = temp + ",1";
-    
+CommandString config_cmd(DeviceInfo& device) {
+    CommandString temp("AT+SETCFG=");
+    temp += device.uwb_index; // Set device id
+    temp += ',';
+    temp += (int)device.current_role; // Set device role (0:Tag / 1:Anchor)
+    temp += ",1"; // Set frequency 850k or 6.8M
+    temp += ",1"; // Set range filter
+
     return temp;
-}    
+}
+
+
+const char* cap_cmd() {
+    // AT+SETCAP=<tag capacity>,<slot ms>,<ext mode>
+    // Time of a single time slot  6.5M : 10MS  850K ： 15MS
+    // X3:extMode, whether to increase the passthrough command when transmitting
+    // (0: normal packet when communicating, 1: extended packet when communicating)
+    return AT_CAP_COMMAND.c_str();
+}
+
+
+ModuleConfig module_config_for(DeviceInfo& device) {
+    ModuleConfig config;
+    config.id = device.current_role == TAG && tdma_slot != TDMA_NO_SLOT ? tdma_slot : device.uwb_index;
+    config.role = device.current_role;
+    config.channel = 1; // Same as config_cmd()
+    config.range_filter = 1;
+    config.tag_capacity = tdma_capacity; // Same as cap_cmd() until a CONTROL_COMMIT_TDMA
+    config.slot_ms = tdma_slot_ms;
+    config.ext_mode = 1;
+    config.report = 1; // Automatic distance reporting on
+    config.antenna_delay = -1;
+
+    return config;
+}
 
 
 ///////////////////
 // COMMUNICATION //
 ///////////////////
 
-String send_radio_data(String command, const int timeout, boolean debug) {
-    String response = "";
-
-
+const char* send_radio_data(const char* command, const int timeout, boolean debug) {
     // Sends the string to other devices via radio
     // The command string contains 'AT+DATA=<# of chars>,<message>'
-    SERIAL_AT.println(command); // send the read character to the SERIAL_LOG
+    AtResult result = at_engine.run(command, timeout);
 
-    long int time = millis();
-
-    while ((time + timeout) > millis()) {
-        while (SERIAL_AT.available()) {
-            // The esp has data so display its output to the serial window
-            char c = SERIAL_AT.read(); // read the next character.
-            response += c;
-        }
+    if (debug) {
+        SERIAL_LOG.printf("%s -> %s (%lu us%s)\n", command, result.response,
+                          (unsigned long)result.latency_us,
+                          result.status == AT_TIMEOUT ? ", timed out" : "");
     }
 
-    return response;
+    return result.response;
 }
 
 
-void send_wifi_data(DeviceInfo& device, const String& message) {
-    String msg = String(device.uwb_index) + ": " + message;
+void send_wifi_data(DeviceInfo& device, const char* message) {
+    if (!poll_wifi(device)) {
+        FixedString<AT_RESPONSE_LEN + 8> text;
+        text.appendf("%d: %s", device.uwb_index, message);
+        boot_buffer.push((const uint8_t*)text.c_str(), text.length());
+        return;
+    }
+
+    // Written in pieces straight into the packet buffer, nothing to join first
     device.udp.beginPacket(device.target_ip, TARGET_PORT);
-    device.udp.print(msg);
+    device.udp.print(device.uwb_index);
+    device.udp.print(": ");
+    device.udp.print(message);
     device.udp.endPacket();
 }
 
 
-bool read_serial(String& message, boolean debug) {
-    if (!SERIAL_AT.available()) return false;
+AtLineType read_frame(boolean debug) {
+    if (!SERIAL_AT.available()) return LINE_NONE;
+    uint32_t start = trace_cycles();
+
+    while (SERIAL_AT.available()) {
+        // One micros() per line, not per byte
+        if (!uart_parser.in_line()) line_start_us = micros();
+        AtLineType type = uart_parser.feed((char)SERIAL_AT.read());
+        if (type == LINE_NONE) continue;
+        tracer.record(TRACE_UART_READ, trace_cycles() - start);
+        frame_us = line_start_us;
+        if (type == LINE_RANGE) {
+            tracer.record(TRACE_UART_LINE, (micros() - frame_us) * trace_cycles_per_us());
+            boot_timer.end(BOOT_FIRST_RANGE, micros());
+            portENTER_CRITICAL(&status_lock);
+            memcpy(status_model.ranges, uart_parser.range().ranges, sizeof(status_model.ranges));
+            status_model.frames++;
+            portEXIT_CRITICAL(&status_lock);
+        } else if (type == LINE_RDATA) {
+            // Handlers may run AT commands, which is fine here: none is in flight
+            const RDataFrame& r = uart_parser.rdata();
+            radio_mesh().feed(r.sender_id, r.message, r.length, frame_us);
+        }
 
-    String line = SERIAL_AT.readStringUntil('\n');
-    line.trim();
+        if (debug) {
+            Serial.print("RAW: ");
+            Serial.println(uart_parser.line());
+        }
+        return type;
+    }
 
-    if (line.length() == 0) return false;
+    tracer.record(TRACE_UART_READ, trace_cycles() - start);
+    return LINE_NONE;
+}
 
-    if (debug) {
-        Serial.print("RAW: ");
-        Serial.println(line);
+
+void send_wifi_packet(DeviceInfo& device, const uint8_t* data, size_t len) {
+    if (!poll_wifi(device)) {
+        boot_buffer.push(data, len);
+        return;
     }
-    
-    message = line;    
+
+    uint32_t start = trace_cycles();
+    device.udp.beginPacket(device.target_ip, TARGET_PORT);
+    device.udp.write(data, len);
+    if (!device.udp.endPacket()) count_status(status_model.dropped);
+    tracer.record(TRACE_UDP_SEND, trace_cycles() - start);
+}
+
+
+void send_telemetry_packet(const uint8_t* packet, size_t len, void* ctx) {
+    send_wifi_packet(*(DeviceInfo*)ctx, packet, len);
+}
+
+
+bool send_position(DeviceInfo& device, const PositionSolver& solver, const int ranges[NUM_ANCHORS], uint32_t seq,
+                   const float* weights) {
+    PositionSolver::Result result;
+    uint32_t start = trace_cycles();
+    bool solved = solver.solve(ranges, result, weights);
+    tracer.record(TRACE_SOLVE, trace_cycles() - start);
+    if (!solved) return false;
+    if (weights) range_quality.add_residuals(result.residuals, weights);
+    count_status(status_model.fixes);
+
+    TelemetryPosition fix = {};
+    fix.seq = seq;
+    fix.timestamp_us = last_frame_us(); // When the ranges it was solved from arrived
+    fix.position[0] = result.position[0];
+    fix.position[1] = result.position[1];
+    fix.rms_residual = result.rms_residual;
+    fix.anchors_used = result.anchors_used;
+
+    uint8_t packet[TELEMETRY_HEADER_LEN + TELEMETRY_POSITION_LEN];
+    send_wifi_packet(device, packet, telemetry_encode_position(packet, device.uwb_index, fix));
+    return true;
+}
+
+
+bool send_tracked_position(DeviceInfo& device, TagTracker& tracker, const int ranges[NUM_ANCHORS], uint32_t seq) {
+    uint32_t now = last_frame_us();
+    uint32_t start = trace_cycles();
+    tracker.update(ranges, now);
+    tracer.record(TRACE_SOLVE, trace_cycles() - start);
+
+    TrackerEstimate estimate;
+    if (!tracker.estimate(now, estimate)) return false;
+    count_status(status_model.fixes);
+
+    TelemetryPosition fix = {};
+    fix.seq = seq;
+    fix.timestamp_us = estimate.timestamp_us;
+    fix.position[0] = estimate.position[0];
+    fix.position[1] = estimate.position[1];
+    fix.rms_residual = estimate.innovation_rms;
+    fix.anchors_used = estimate.anchors_used;
+
+    uint8_t packet[TELEMETRY_HEADER_LEN + TELEMETRY_POSITION_LEN];
+    send_wifi_packet(device, packet, telemetry_encode_position(packet, device.uwb_index, fix));
+    return true;
+}
+
+
+uint32_t last_frame_us() { return frame_us; }
+
+
+bool read_serial(LineString& message, boolean debug) {
+    message.clear();
+    if (read_frame(debug) == LINE_NONE) return false;
+
+    message.append(uart_parser.line());
+    message.trim();
+    return message.length() > 0;
+}
+
+
+void send_trace_stats(DeviceInfo& device) {
+    static uint8_t packet[TRACE_MAX_PACKET];
+    send_wifi_packet(device, packet, trace_encode_stats(packet, sizeof(packet), device.uwb_index, tracer, micros()));
+}
+
+
+void send_heap_stats(DeviceInfo& device) {
+    heap_monitor.sample(heap_caps_get_free_size(MALLOC_CAP_8BIT), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+                        heap_caps_get_total_size(MALLOC_CAP_8BIT), millis());
+
+    uint8_t packet[TELEMETRY_HEADER_LEN + TELEMETRY_HEAP_LEN];
+    send_wifi_packet(device, packet, heap_encode_stats(packet, device.uwb_index, heap_monitor.stats()));
+}
+
+
+bool poll_trace_stats(DeviceInfo& device) {
+    static uint32_t last_ms = 0;
+    if (millis() - last_ms < TRACE_EXPORT_INTERVAL_MS) return false;
+
+    last_ms = millis();
+    send_trace_stats(device);
+    send_heap_stats(device);
     return true;
 }
 
 
+static_assert(CONTROL_MAX_PACKET >= CONTROL_HEADER_LEN + CONTROL_MAX_ACKS * CONTROL_ACK_LEN,
+              "poll_control() writes the acks into the receive buffer");
+
+bool poll_control(DeviceInfo& device, TelemetryBatcher* telemetry, ControlHandler handler, void* ctx) {
+    static uint32_t last_ms = 0;
+    static uint8_t packet[CONTROL_MAX_PACKET];
+
+    if (millis() - last_ms < CONTROL_POLL_INTERVAL_MS) return false;
+    last_ms = millis();
+    if (!poll_wifi(device)) return false;
+
+    // A packet at a time, so its acks (one per command at most) always fit
+    bool ran = false;
+    for (int i = 0; i < CONTROL_PACKETS_PER_POLL && device.udp.parsePacket() > 0; i++) {
+        uint32_t received_us = micros();
+        int len = device.udp.read(packet, sizeof(packet));
+        if (len <= 0) continue;
+
+        uint8_t reply[CONTROL_HEADER_LEN + CONTROL_SYNC_REPLY_LEN];
+        size_t reply_len = control.answer_sync(packet, len, received_us, micros(), reply);
+        if (reply_len) {
+            device.udp.beginPacket(device.udp.remoteIP(), device.udp.remotePort());
+            device.udp.write(reply, reply_len);
+            device.udp.endPacket();
+            continue;
+        }
+        if (!control.receive(packet, len)) continue;
+
+        ControlCommand command;
+        while (control.next(command)) {
+            uint8_t status = handler ? handler(device, command, ctx) : CONTROL_UNKNOWN;
+            if (status == CONTROL_UNKNOWN) status = handle_control(device, command, telemetry);
+            control.complete(command, status);
+            ran = true;
+        }
+
+        // Acks go back to whoever sent the commands, not to target_ip
+        size_t ack_len = control.encode_acks(packet);
+        if (!ack_len) continue;
+        device.udp.beginPacket(device.udp.remoteIP(), device.udp.remotePort());
+        device.udp.write(packet, ack_len);
+        if (!device.udp.endPacket()) count_status(status_model.dropped);
+    }
+    return ran;
+}
+
+
+uint8_t handle_control(DeviceInfo& device, const ControlCommand& command, TelemetryBatcher* telemetry) {
+    switch (command.opcode) {
+    case CONTROL_PING:
+        return CONTROL_OK;
+
+    case CONTROL_SET_BATCH:
+        if (!telemetry) return CONTROL_REJECTED;
+        if (command.arg < 1 || command.arg > TELEMETRY_MAX_FRAMES) return CONTROL_INVALID;
+        telemetry->set_batch((uint8_t)command.arg, telemetry->deadline());
+        return CONTROL_OK;
+
+    case CONTROL_SET_DEADLINE:
+        if (!telemetry) return CONTROL_REJECTED;
+        if (command.arg < 0) return CONTROL_INVALID;
+        telemetry->set_batch(telemetry->batch_size(), (uint32_t)command.arg);
+        return CONTROL_OK;
+
+    case CONTROL_SET_DELAY: {
+        if (pipeline_running) return CONTROL_REJECTED;
+        if (command.arg < 0 || command.arg > UINT16_MAX) return CONTROL_INVALID;
+        uint32_t failures = module_config.stats().failures;
+        set_delay(command.arg);
+        return module_config.stats().failures == failures ? CONTROL_OK : CONTROL_FAILED;
+    }
+
+    case CONTROL_SET_ROLE: {
+        if (pipeline_running) return CONTROL_REJECTED;
+        if (command.arg != TAG && command.arg != ANCHOR) return CONTROL_INVALID;
+        uint32_t failures = module_config.stats().failures;
+        set_role(device, (DeviceRole)command.arg, module_version.c_str());
+        return module_config.stats().failures == failures ? CONTROL_OK : CONTROL_FAILED;
+    }
+
+    case CONTROL_STAGE_TDMA: {
+        if (pipeline_running) return CONTROL_REJECTED;
+        uint8_t capacity, slot_ms, slot;
+        tdma_unpack(command.arg, capacity, slot_ms, slot);
+        if (capacity == 0 || capacity > UWB_TAG_COUNT) return CONTROL_INVALID;
+        if (slot_ms < tdma_min_slot_ms(module_config_for(device).channel)) return CONTROL_INVALID;
+        if (device.current_role == TAG ? slot >= capacity : slot != TDMA_NO_SLOT) return CONTROL_INVALID;
+        tdma_staged = command.arg;
+        return CONTROL_OK;
+    }
+
+    case CONTROL_COMMIT_TDMA:
+        // Nothing checked here, so every board the laptop commits switches at once
+        if (pipeline_running || command.arg != tdma_staged) return CONTROL_REJECTED;
+        tdma_unpack(command.arg, tdma_capacity, tdma_slot_ms, tdma_slot);
+        tdma_staged = -1;
+        // AT+SETCAP, and AT+SETCFG for a tag that moves: neither needs a restart
+        return module_config.apply(module_config_for(device), CONFIG_TRANSIENT) ? CONTROL_OK : CONTROL_FAILED;
+
+    default:
+        return CONTROL_UNKNOWN;
+    }
+}
+
+
 /////////////
 // HELPERS //
 /////////////
 
-void updateOLED(DeviceInfo& device, const String& message) {
+void updateOLED(DeviceInfo& device, const char* message) {
+    portENTER_CRITICAL(&status_lock);
+    status_model.uwb_index = device.uwb_index;
+    status_model.role = device.current_role;
+    strncpy(status_model.version, message, STATUS_VERSION_LEN - 1);
+    for (int i = 0; i < 4; i++) status_model.ip[i] = device.local_ip[i];
+    portEXIT_CRITICAL(&status_lock);
+    if (status_task_running) return;
+
+    // Still booting: nobody else is on the bus, draw it all now
+    StatusRates rates = {};
+    status_render(status_model, rates, status_screen);
+    status_screen.take_dirty();
+
     display.clearDisplay();
     display.setTextSize(1);
     display.setTextColor(SSD1306_WHITE);
+    for (int i = 0; i < STATUS_LINES; i++) {
+        display.setCursor(0, i * 8);
+        display.print(status_screen.line(i));
+    }
+    display.display();
+}
 
-    display.setCursor(0, 0);
-    display.println("SnowScape");
 
-    display.setCursor(0, 12);
-    display.print("ID: ");
-    display.println(device.uwb_index);
+// Sends one 128x8 page of the frame buffer, instead of the whole frame display() sends
+static void push_page(uint8_t page) {
+    display.ssd1306_command(SSD1306_PAGEADDR);
+    display.ssd1306_command(page);
+    display.ssd1306_command(page);
+    display.ssd1306_command(SSD1306_COLUMNADDR);
+    display.ssd1306_command(0);
+    display.ssd1306_command(127);
+
+    const uint8_t* row = display.getBuffer() + page * 128;
+    for (int at = 0; at < 128; at += OLED_I2C_CHUNK) {
+        Wire.beginTransmission(OLED_ADDRESS);
+        Wire.write((uint8_t)0x40); // Data follows
+        Wire.write(row + at, OLED_I2C_CHUNK);
+        Wire.endTransmission();
+    }
+}
 
-    display.setCursor(0, 22);
-    display.print("Role: ");
-    display.println(device.current_role == TAG ? "TAG" : "ANCHOR");
 
-    display.setCursor(0, 32);
-    display.print("SW: ");
-    display.println(message);
+static void status_task(void*) {
+    StatusRates rates = {};
+    StatusModel model;
+    portENTER_CRITICAL(&status_lock);
+    uint32_t last_frames = status_model.frames, last_fixes = status_model.fixes;
+    portEXIT_CRITICAL(&status_lock);
+    TickType_t wake = xTaskGetTickCount();
+    Wire.setClock(OLED_I2C_CLOCK);
+
+    for (;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(STATUS_INTERVAL_MS));
+
+        // A consistent copy, then the slow part without the lock
+        portENTER_CRITICAL(&status_lock);
+        model = status_model;
+        portEXIT_CRITICAL(&status_lock);
+        model.dropped += boot_buffer.dropped() + pipeline_queue.overflows();
+        float frames_per_s = (model.frames - last_frames) * 1000.0f / STATUS_INTERVAL_MS;
+        float fixes_per_s = (model.fixes - last_fixes) * 1000.0f / STATUS_INTERVAL_MS;
+        rates.frames_per_s += STATUS_RATE_SMOOTHING * (frames_per_s - rates.frames_per_s);
+        rates.fixes_per_s += STATUS_RATE_SMOOTHING * (fixes_per_s - rates.fixes_per_s);
+        last_frames = model.frames;
+        last_fixes = model.fixes;
+
+        status_render(model, rates, status_screen);
+        uint32_t dirty = status_screen.take_dirty();
+        for (uint8_t page = 0; dirty; page++, dirty >>= 1) {
+            if (!(dirty & 1)) continue;
+            display.fillRect(0, page * 8, 128, 8, SSD1306_BLACK);
+            display.setCursor(0, page * 8);
+            display.print(status_screen.line(page));
+            push_page(page);
+        }
+    }
+}
 
-    display.setCursor(0, 42);
-    display.print("IP: ");
-    display.println(device.local_ip.toString());
 
-    display.display();
+void start_status_display() {
+    if (status_task_running) return;
+    status_task_running = true;
+    xTaskCreatePinnedToCore(status_task, "status_oled", STATUS_STACK_SIZE, nullptr, STATUS_TASK_PRIORITY, nullptr,
+                            STATUS_TASK_CORE);
 }
 
 
 // void set_role(DeviceRole& current_role, DeviceRole new_role, int uwb_index, const String& message, IPAddress local_ip) {
-void set_role(DeviceInfo& device, DeviceRole new_role, const String& message) {   
+void set_role(DeviceInfo& device, DeviceRole new_role, const char* message) {
     if (device.current_role == new_role) return;
 
     device.current_role = new_role;
 
-    send_radio_data("AT?", 2000, 1); // Verify that serial port communication to the module works
-    send_radio_data("AT+RESTORE", 5000, 0); // Clear config info and reset the config to default
-    send_radio_data(config_cmd(device), 2000, 0); // Runs AT+SETCFG
-    send_radio_data(cap_cmd(), 2000, 0); // Run AT+SETCAP to set the system refresh rate
-    send_radio_data("AT+SETRPT=1", 2000, 0); // Set automatic distance reporting status (1 = on)
-    send_radio_data("AT+SAVE", 2000, 0); // Save the config in non-volatile flash
-    send_radio_data("AT+RESTART", 2000, 0); // Reload the config saved in flash memory
+    // Verify that serial port communication to the module works
+    if (!module_config.wait_ready(MODULE_READY_TIMEOUT_MS)) SERIAL_LOG.println("UWB module not answering");
+
+    // Until the module's config is known this is AT+RESTORE, the whole config,
+    // AT+SAVE and AT+RESTART. After that only AT+SETCFG changes.
+    bool ok = module_config.apply(module_config_for(device), CONFIG_TRANSIENT);
+    SERIAL_LOG.printf("Role switch to %s %s in %lu us\n", new_role == TAG ? "TAG" : "ANCHOR",
+                      ok ? "done" : "FAILED", (unsigned long)module_config.stats().last_us);
 
     updateOLED(device, message);
 }
 
 
+// What outlives a reflash: the antenna delay and the tag's calibration
+static Preferences& board_settings() {
+    static bool opened = false;
+    if (!opened) opened = settings.begin(SETTINGS_NAMESPACE, false);
+    return settings;
+}
+
+
+int saved_antenna_delay(int fallback) {
+    return board_settings().getUShort(SETTINGS_DELAY_KEY, (uint16_t)fallback);
+}
+
+
 void set_delay(int delay) {
-    send_radio_data(String("AT+SETANT=") + String(delay), 2000, 0);
+    // Only when it changes, NVS writes wear the flash
+    if (board_settings().getUShort(SETTINGS_DELAY_KEY, 0) != delay) {
+        board_settings().putUShort(SETTINGS_DELAY_KEY, (uint16_t)delay);
+    }
+
+    ModuleConfig target;
+    if (module_config.cached(target)) {
+        target.antenna_delay = delay;
+        module_config.apply(target, CONFIG_PERSIST);
+        return;
+    }
+
+    // Nothing configured through module_config yet
+    CommandString command;
+    command.appendf("AT+SETANT=%d", delay);
+    send_radio_data(command.c_str(), 2000, 0);
     send_radio_data("AT+SAVE", 2000, 0); // Save the config in non-volatile flash
     send_radio_data("AT+RESTART", 2000, 0); // Reload the config saved in flash memory
+    module_config.wait_ready(MODULE_READY_TIMEOUT_MS);
 }
 
 
 bool get_raw_ranges(DeviceInfo& device, int parsed_ranges[]) {
-    String message = "";
-    read_serial(message, 0);
-    
-    if (message.length() > 0) {
-        parse_range(message, parsed_ranges);
+    if (read_frame(0) == LINE_RANGE) {
+        const RangeFrame& frame = uart_parser.range();
+        memcpy(parsed_ranges, frame.ranges, sizeof(frame.ranges));
         
-        // send_wifi_data(device, 
-        //     String("Raw Value: ") +
-        //     String(parsed_ranges[0]) + ", " + 
-        //     String(parsed_ranges[1]) + ", " + 
-        //     String(parsed_ranges[2]) + ", " + 
-        //     String(parsed_ranges[3]) + ", " + 
-        //     String(parsed_ranges[4]) + ", " + 
-        //     String(parsed_ranges[5]) + ", " + 
-        //     String(parsed_ranges[6]) + ", " + 
-        //     String(parsed_ranges[7]) + "\n"
-        // );
+        // LineString message("Raw Value: ");
+        // for (int a = 0; a < NUM_ANCHORS; a++) message.appendf(a ? ", %d" : "%d", parsed_ranges[a]);
+        // send_wifi_data(device, message.c_str());
 
         return true;
 
@@ -200,276 +669,286 @@ bool get_raw_ranges(DeviceInfo& device, int parsed_ranges[]) {
 }
 
 
-void get_converged_ranges(DeviceInfo& device, int parsed_ranges[NUM_ANCHORS]) {
-    struct RangeBuffer buff_array[NUM_ANCHORS] = {};
-    int index = 0;
-    bool filled = false;
+bool get_weighted_ranges(DeviceInfo& device, int parsed_ranges[NUM_ANCHORS], float weights[NUM_ANCHORS]) {
+    if (read_frame(0) != LINE_RANGE) return false;
 
-    while (true) {
-        // Returns a list of distances
-        if (!get_raw_ranges(device, parsed_ranges)) {
-            delay(10);
-            continue;
-        };        
+    const RangeFrame& frame = uart_parser.range();
+    uint32_t start = trace_cycles();
+    range_quality.filter(frame.ranges, frame.rssi_count ? frame.rssi : nullptr, parsed_ranges, weights);
+    tracer.record(TRACE_FILTER, trace_cycles() - start);
+    return true;
+}
 
-        for (int i = 0; i < NUM_ANCHORS; i++)  {
-            buff_array[i].buffer[index] = parsed_ranges[i];
-        }
 
-        index = (index + 1) % BUFF_SIZE; 
+uint32_t get_converged_ranges(DeviceInfo& device, int parsed_ranges[NUM_ANCHORS]) {
+    int filtered[NUM_ANCHORS];
+    float weights[NUM_ANCHORS];
 
-        // At this point, we know we've gone through the whole buffer
-        if (index == 0)
-            filled = true;
+    // One flaky anchor no longer holds up the rest, each converges on its own,
+    // and a single spike no longer throws a converged window back out
+    if (read_frame(0) == LINE_RANGE) {
+        const RangeFrame& frame = uart_parser.range();
+        uint32_t start = trace_cycles();
+        range_quality.filter(frame.ranges, frame.rssi_count ? frame.rssi : nullptr, filtered, weights);
+        range_filter.add(filtered, last_frame_us());
+        tracer.record(TRACE_FILTER, trace_cycles() - start);
+    }
 
-        if (!filled)
-            continue;
+    return range_filter.estimate(parsed_ranges);
+}
 
-        bool can_return = true;
+//////////////
+// PIPELINE //
+//////////////
 
-        // Reset max, min, and sum after every buffer update
-        for (int i = 0; i < NUM_ANCHORS; i++) {
-            int max = buff_array[i].buffer[0];
-            int min = buff_array[i].buffer[0];
-            int sum = 0;
+static void ingest_task(void*) {
+    char buf[PIPELINE_READ_CHUNK];
 
-            for (int j = 0; j < BUFF_SIZE; j++) {
-                int v = buff_array[i].buffer[j];
-                
-                if (v > max) max = v;
-                if (v < min) min = v;
+    for (;;) {
+        int n = SERIAL_AT.available();
+        if (n <= 0) {
+            vTaskDelay(1); // ~11 bytes arrive per tick at 115200 baud
+            continue;
+        }
 
-                if (v > 0 && sum > LONG_MAX - v) {
-                    send_wifi_data(device, "WARNING: sum approaching LONG_MAX");
-                }
-                if (v < 0 && sum < LONG_MIN - v) {
-                    send_wifi_data(device, "WARNING: sum approaching LONG_MIN");
-                }
+        if (n > (int)sizeof(buf)) n = sizeof(buf);
+        size_t got = SERIAL_AT.read((uint8_t*)buf, n);
+        ingest_stage.ingest(buf, got, micros());
+    }
+}
 
-                sum += v;
-            }
 
-            if (max - min > STABILITY_THRESHOLD) {
-                can_return = false;
-                break;
-            }
+static void process_task(void* arg) {
+    ProcessStage* stage = (ProcessStage*)arg;
 
-            // Calculate the mean distance to the ith anchor
-            parsed_ranges[i] = sum / BUFF_SIZE;
+    for (;;) {
+        if (stage->run_once(micros()) == 0) vTaskDelay(1);
+        // This task is the only writer of frames in pipeline mode
+        uint32_t processed = stage->samples_processed();
+        if (processed == status_model.frames) continue;
 
-        }
+        boot_timer.end(BOOT_FIRST_RANGE, micros());
+        int ranges[NUM_ANCHORS];
+        range_filter.estimate(ranges);
+        portENTER_CRITICAL(&status_lock);
+        memcpy(status_model.ranges, ranges, sizeof(status_model.ranges));
+        status_model.frames = processed;
+        portEXIT_CRITICAL(&status_lock);
+    }
+}
 
-        // can_return is true when all distances have converged
-        if (can_return) return;
 
-        delay(5);
-    }
+ProcessStage& start_pipeline(TelemetryBatcher& telemetry,
+                             ProcessStage::FrameHook hook, void* ctx) {
+    static ProcessStage stage(pipeline_queue, range_filter, telemetry);
+    stage.set_hook(hook, ctx);
+    stage.set_tracer(&tracer);
+    ingest_stage.set_tracer(&tracer);
+    pipeline_running = true;
+
+    // Ingest outranks processing so the UART never waits on the network
+    xTaskCreatePinnedToCore(ingest_task, "uwb_ingest", PIPELINE_STACK_SIZE, nullptr, 3, nullptr,
+                            PIPELINE_INGEST_CORE);
+    xTaskCreatePinnedToCore(process_task, "uwb_process", PIPELINE_STACK_SIZE, &stage, 2, nullptr,
+                            PIPELINE_PROCESS_CORE);
+
+    return stage;
 }
 
 /////////////
 // PARSERS //
 /////////////
 
-String parse_software_version(DeviceInfo& device, String version) {
-    // Remove \0 from the beginning of the string
-    while (version.length() > 0 && version[0] == '\0') {
-        version.remove(0, 1);  // remove the first character
-    }
-    
-    int start = version.indexOf("software:");
-    if (start < 0) return "";
+VersionString parse_software_version(DeviceInfo& device, const char* version) {
+    VersionString out;
 
-    start += strlen("software:");
+    // at_engine already drops the \0 the module sends after a restart
+    const char* start = strstr(version, "software:");
+    if (!start) return out;
 
-    int end = version.indexOf(",", start);
+    start += strlen("software:");
 
-    return version.substring(start, end);
+    const char* end = strchr(start, ',');
+    out.append(start, end ? (size_t)(end - start) : strlen(start));
+    return out;
 }
 
 
-void parse_range(String message, int ranges[]) {
-    int i = 0;
-
-    // Convert Arduino String to C string
-    char buf[128];               // Make sure buffer is big enough
-    message.toCharArray(buf, sizeof(buf));
-
-    char *start = strstr(buf, "range:(");
-    if (!start) return;
-    // Move past "range:(""
-    start += 7;
+// Lines that are already in memory go through the same parser as the UART
+static AtLineType parse_line(RangeStreamParser& parser, const char* line) {
+    AtLineType type = LINE_NONE;
+    for (const char* c = line; *c; c++) type = parser.feed(*c);
+    // A line that already ended in '\n' finished on its last byte
+    if (type == LINE_NONE) type = parser.feed('\n');
+    return type;
+}
 
-    char *end = strchr(start, ')');
-    if(!end) return;
 
-    char temp[128];  // Make sure it's large enough
-    size_t len = end - start;
-    strncpy(temp, start, len);
-    temp[len] = '\0';
+void parse_range(const char* message, int ranges[]) {
+    RangeStreamParser parser;
+    if (parse_line(parser, message) != LINE_RANGE) return;
 
-    // Tokenize by comma
-    char *token = strtok(temp, ",");
-    while (token && i < 8) {
-        ranges[i++] = atoi(token);  // Convert to int
-        token = strtok(NULL, ",");
-    }
+    const RangeFrame& frame = parser.range();
+    memcpy(ranges, frame.ranges, frame.count * sizeof(int));
 }
 
 // For parsing R+DATA messages
-RData parse_rdata(const String& line) {
+RData parse_rdata(const char* line) {
     RData result;
     result.valid = false;  // default to invalid
 
-    if (!line.startsWith("AT+RDATA=")) return result;
-
-    // Remove the prefix
-    String data = line.substring(strlen("AT+RDATA="));
-    data.trim();
-
-    int commaCount = 0;
-    int lastPos = 0;
-    for (int i = 0; i < data.length(); i++) {
-        if (data[i] == ',') {
-            commaCount++;
-            if (commaCount == 1) {  // sender ID is after the first comma
-                result.senderID = data.substring(lastPos, i);
-                result.senderID.trim();
-            }
-            if (commaCount == 4) {  // message starts after the 4th comma
-                result.message = data.substring(i + 1);
-                result.message.trim();
-                break;  // done parsing
-            }
-            lastPos = i + 1;
-        }
-    }
+    RangeStreamParser parser;
+    if (parse_line(parser, line) != LINE_RDATA) return result;
 
-    result.valid = (result.senderID.length() > 0 && result.message.length() > 0);
+    const RDataFrame& frame = parser.rdata();
+    result.senderID = frame.sender_id;
+    memcpy(result.message, frame.message, frame.length + 1);
+    result.valid = true;
     return result;
 }
 
 
-//////////////
-// BARRIERS //
-//////////////
+/////////////////
+// CALIBRATION //
+/////////////////
+
+// Lines that arrived while an AT command was in flight, see calibration_line()
+static const size_t CALIBRATION_DEFERRED_LINES = 4;
+static char deferred_lines[CALIBRATION_DEFERRED_LINES][AT_LINE_LEN];
+static size_t deferred_count = 0;
+static uint32_t deferred_dropped = 0; // Didn't fit, AT+RANGE first
+static uint32_t deferred_dropped_rdata = 0; // Of those, mesh frames: a round that waits for its timeout
 
-//-----------------------------------------------------------------------------
 
-/* C: send a get_distance(x, y) string. Block until a distance is received, or 
-until the timeout period is reached. If a distance is received, return it. If not,
-loop again */
-int get_distance(int id1, int id2) { 
+static void send_mesh_text(const char* text, size_t len, void*) {
+    char command[AT_COMMAND_LEN];
+    snprintf(command, sizeof(command), "AT+DATA=%u,%s", (unsigned)len, text);
+    at_engine.run(command, 1000);
+}
 
-    const unsigned long timeout_ms = 200;  // timeout per attempt
-    String message;
 
-    while (true) {
-        // Send out a request for the distance between boards id1 and id2
-        String request = "AT+DATA=17,get_distance(" + String(id1) + "," + String(id2) + ")";
+MeshDispatcher& radio_mesh() {
+    // Built on first use, so before any global that registers with it
+    static MeshDispatcher mesh(0, send_mesh_text, nullptr);
+    return mesh;
+}
 
-        send_radio_data(request, 1000, 0);
 
-        unsigned long start_time = millis();
+void log_mesh_stats() {
+    const MeshDispatcher& mesh = radio_mesh();
+    for (uint8_t type = 0; type < MESH_TYPE_COUNT; type++) {
+        const MeshTypeStats& s = mesh.stats(type);
+        if (s.sent == 0 && s.received == 0) continue;
+        SERIAL_LOG.printf("Mesh %-12s %4lu sent %4lu received %3lu lost %3lu dup", mesh_type_name(type),
+                          (unsigned long)s.sent, (unsigned long)s.received, (unsigned long)s.lost,
+                          (unsigned long)s.duplicates);
+        if (s.round_trip_us.count()) {
+            SERIAL_LOG.printf(", reply p50 %.1f ms p99 %.1f ms", s.round_trip_us.percentile(0.5) / 1e3,
+                              s.round_trip_us.percentile(0.99) / 1e3);
+        }
+        SERIAL_LOG.printf("\n");
+    }
+    if (mesh.stats().malformed || deferred_dropped) {
+        SERIAL_LOG.printf("Mesh: %lu malformed, %lu deferred lines dropped (%lu AT+RDATA)\n",
+                          (unsigned long)mesh.stats().malformed, (unsigned long)deferred_dropped,
+                          (unsigned long)deferred_dropped_rdata);
+    }
+}
 
-        while (millis() - start_time < timeout_ms) {
-            // Now listen until the distance is returned
-            // message = "";
 
-            // If a message is received...
-            if (read_serial(message, 0)) {
-                message.trim();
-                int distance = message.toInt();
+static bool is_rdata(const char* line, size_t len) {
+    return len >= 8 && strncmp(line, "AT+RDATA", 8) == 0;
+}
 
-                return distance;
-            }
 
-            delay(1);
-        } 
+// Lines that arrive while one of our own AT+DATA commands is in flight. They
+// are handled later by pump_calibration(): dispatching them here could send
+// AT commands from inside at_engine.poll().
+static void calibration_line(const char* line, size_t len, void*) {
+    if (deferred_count == CALIBRATION_DEFERRED_LINES) {
+        deferred_dropped++;
+        if (!is_rdata(line, len)) return;
+
+        // A lost range is one sample fewer, a lost mesh frame stalls a round:
+        // make room by dropping the oldest AT+RANGE
+        size_t victim = 0;
+        while (victim < deferred_count && is_rdata(deferred_lines[victim], strlen(deferred_lines[victim]))) victim++;
+        if (victim == deferred_count) {
+            deferred_dropped_rdata++;
+            return;
+        }
+        memmove(deferred_lines[victim], deferred_lines[victim + 1],
+                (deferred_count - victim - 1) * sizeof(deferred_lines[0]));
+        deferred_count--;
     }
+    if (len > AT_LINE_LEN - 1) len = AT_LINE_LEN - 1;
+
+    memcpy(deferred_lines[deferred_count], line, len);
+    deferred_lines[deferred_count][len] = '\0';
+    deferred_count++;
 }
 
-//-----------------------------------------------------------------------------
 
-/* F: Continuously read the serial monitor until "ID,ACK" is received from each
-anchor */
-const int NUM_IDS = 4;  // IDs 0..3
+void switch_calibration_role(bool measuring, void* ctx) {
+    set_role(*(DeviceInfo*)ctx, measuring ? TAG : ANCHOR, module_version.c_str());
+}
 
-// Returns true if all IDs have been received
-bool all_received(bool received[]) {
-    for (int i = 0; i < NUM_IDS; i++) {
-        if (!received[i]) return false;
-    }
-    return true;
+
+void send_calibration_matrix(DeviceInfo& device, const CalibrationCoordinator& coordinator) {
+    uint8_t packet[TELEMETRY_CALIBRATION_MAX_PACKET];
+    size_t len = telemetry_encode_calibration(packet, device.uwb_index, coordinator.distances(),
+                                              coordinator.devices());
+    if (len > 0) send_wifi_packet(device, packet, len);
 }
 
-// TODO: Received messages will be of the form AT+RDATA...
-void listen_for_ack() {
-    bool received[NUM_IDS] = { false };
-    String message;
-
-    unsigned long start_time = millis();
-    const unsigned long timeout_ms = 5000;  // total listen timeout
-
-    while (!all_received(received) && millis() - start_time < timeout_ms) {
-        if (read_serial(message, 0)) {  
-            message.trim();
-            // Message format: "ID,ACK"
-            int commaIndex = message.indexOf(',');
-            if (commaIndex > 0) {
-                // Parse the message
-                int id = message.substring(0, commaIndex).toInt();
-                String ack = message.substring(commaIndex + 1);
-                ack.trim();
-
-                if (ack == "ACK" && id >= 0 && id < NUM_IDS && !received[id]){
-                    received[id] = true;
-                }
-            }
-        }
-        delay(1); // small delay to prevent tight CPU loop
-    }
 
-    if (all_received(received)) {
-        Serial.println("All ACKs received!");
-    } else {
-        Serial.println("Timeout reached before receiving all ACKs.");
-    }
+bool load_calibration_cache(CalibrationCache& out) {
+    uint8_t record[CAL_CACHE_MAX_LEN];
+    size_t len = board_settings().getBytes(SETTINGS_CALIBRATION_KEY, record, sizeof(record));
+    return len > 0 && calibration_cache_decode(record, len, out);
 }
 
-//-----------------------------------------------------------------------------
 
-/* Q: Continuously read the serial monitor until "SUCCESS" is received, but only 
-from device x */
-bool wait_for_measurement(int sender_id) {
-    String message;
-    unsigned long start_time = millis();
-    const unsigned long timeout_ms = 5000;  // timeout per attempt
+bool save_calibration_cache(const CalibrationCache& cache) {
+    uint8_t record[CAL_CACHE_MAX_LEN];
+    size_t len = calibration_cache_encode(cache, record, sizeof(record));
+    return len > 0 && board_settings().putBytes(SETTINGS_CALIBRATION_KEY, record, len) == len;
+}
 
-    while (millis() - start_time < timeout_ms) {
-        if (read_serial(message, 0)) {  // returns true if a line was read
-            message.trim();
-            RData r = parse_rdata(message);
 
-            // If the sender is the other 'get_distance' device and the message is 'SUCCESS'
-            if (r.valid && r.senderID.toInt() == sender_id && r.message == "SUCCESS") {
-                return true;  // measurement received successfully
-            }
+void pump_calibration(CalibrationCoordinator* coordinator, CalibrationParticipant* participant) {
+    at_engine.set_unsolicited_handler(calibration_line, nullptr);
+
+    // The mesh handlers run AT commands, which defer lines of their own while
+    // these are dispatched: take them all out first, so those go in free slots
+    static char batch[CALIBRATION_DEFERRED_LINES][AT_LINE_LEN];
+    size_t batch_count = deferred_count;
+    memcpy(batch, deferred_lines, batch_count * sizeof(batch[0]));
+    deferred_count = 0;
+
+    static RangeStreamParser deferred_parser;
+    for (size_t i = 0; i < batch_count; i++) {
+        for (const char* c = batch[i]; *c; c++) deferred_parser.feed(*c);
+        AtLineType type = deferred_parser.feed('\n');
+        if (type == LINE_RDATA) {
+            const RDataFrame& r = deferred_parser.rdata();
+            radio_mesh().feed(r.sender_id, r.message, r.length, micros());
+        } else if (type == LINE_RANGE && participant) {
+            participant->on_ranges(deferred_parser.range().ranges, NUM_ANCHORS, micros());
         }
-        delay(1);  // small delay to avoid tight CPU loop
     }
 
-    // Timeout reached without receiving SUCCESS from the specified device
-    return false;
-}
-
-//-----------------------------------------------------------------------------
+    // AT+RDATA goes to the mesh inside read_frame()
+    if (read_frame(0) == LINE_RANGE && participant) {
+        participant->on_ranges(uart_parser.range().ranges, NUM_ANCHORS, last_frame_us());
+    }
 
-/* N/O: Block until "calibration complete" is received, or, until 
-"get_distance(x, y)" is received where x or y matches the device's ID. Determine
-if it was x or y that matched. */
-// measurement_loop() {}
+    uint32_t now = micros();
+    if (coordinator) coordinator->poll(now);
+    if (participant) participant->poll(now);
 
-//-----------------------------------------------------------------------------
+    bool over = (!coordinator || coordinator->finished()) && (!participant || participant->done());
+    if (over) at_engine.set_unsolicited_handler(nullptr, nullptr);
+}
 
-/* The tag needs to recieve a go-ahead from the laptop*/
-// receive_wifi_data(ok_signal);
\ No newline at end of file
+#endif
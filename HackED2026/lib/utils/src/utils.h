@@ -13,29 +13,115 @@
 #include <WiFiUdp.h>
 #include "wifi_credentials.h"
 #include <stdbool.h>
+#include "at_engine.h"
+#include "boot.h"
+#include "calibration.h"
+#include "calibration_cache.h"
+#include "control.h"
+#include "fixed_string.h"
+#include "heap_monitor.h"
+#include "mesh.h"
+#include "module_config.h"
+#include "multilateration.h"
+#include "pipeline.h"
+#include "position_tracker.h"
+#include "range_filter.h"
+#include "range_parser.h"
+#include "range_quality.h"
+#include "status_display.h"
+#include "tdma.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "uwb_config.h"
 
 /////////////////////////////
 // PREPROCESSOR DIRECTIVES //
 /////////////////////////////
 
-#define UWB_TAG_COUNT 64
 #define SERIAL_LOG Serial // A way to talk to the user
 #define RESET 16
 #define IO_RXD2 18 // For the ESP32 to DW3000 module
 #define IO_TXD2 17 // For the ESP32 to DW3000 module
 #define I2C_SDA 39 // For the OLED display
 #define I2C_SCL 38 // For the OLED display
-#define LOCAL_PORT 4210
-#define TARGET_PORT 4210 // My computer port
+#define OLED_ADDRESS 0x3C
+#define OLED_I2C_CLOCK 400000 // Hz, a page is then ~3 ms on the bus
+#define OLED_I2C_CHUNK 32 // Data bytes per I2C transaction, fits every Wire buffer
 
-#define NUM_ANCHORS 8
-#define BUFF_SIZE 5 // The number of ranges in the buffer at a time
-#define STABILITY_THRESHOLD 10 // The total variance range measurements can have
+// Pipeline mode: WiFi runs on core 0, so the UART gets core 1 to itself
+#define PIPELINE_INGEST_CORE 1
+#define PIPELINE_PROCESS_CORE 0
+#define PIPELINE_STACK_SIZE 4096
+
+// The status display task: lowest priority, on the WiFi core, out of the way
+#define STATUS_TASK_CORE 0
+#define STATUS_TASK_PRIORITY 1
+#define STATUS_STACK_SIZE 3072
+
+#define VERSION_LEN 24 // Module software version, including the null terminator
+
+// NVS, what the board keeps across reflashes
+#define SETTINGS_NAMESPACE "uwb"
+#define SETTINGS_DELAY_KEY "delay" // u16, see saved_antenna_delay()
+#define SETTINGS_CALIBRATION_KEY "calibration" // Blob, see calibration_cache.h
 
 enum DeviceRole { TAG = 0, ANCHOR = 1, UNINITIALIZED = 2 };
 
+// Stack-allocated text for the helpers below, nothing here touches the heap
+typedef FixedString<AT_COMMAND_LEN> CommandString;
+typedef FixedString<PARSER_LINE_LEN> LineString;
+typedef FixedString<VERSION_LEN> VersionString;
+
+// 2D fixes from the anchor ranges, the field is treated as flat
+typedef Multilateration<NUM_ANCHORS, 2> PositionSolver;
+// Same, but tracked across frames instead of solved per frame
+typedef PositionTracker<NUM_ANCHORS> TagTracker;
+
 extern HardwareSerial SERIAL_AT;
 extern Adafruit_SSD1306 display;
+/// @brief Queues commands to the UWB module over SERIAL_AT. send_radio_data()
+/// goes through it; call at_engine.poll() from loop() when using submit().
+extern AtEngine at_engine;
+/// @brief What the module is configured with. set_role() and set_delay() go
+/// through it so only changed settings are sent; its stats() time each switch.
+extern ModuleConfigurator module_config;
+/// @brief Everything read off SERIAL_AT outside of an AT command goes through
+/// this, see read_frame().
+extern RangeStreamParser uart_parser;
+/// @brief Fed by get_converged_ranges(). Query it for per-anchor status/age.
+extern RangeFilter range_filter;
+/// @brief Pre-filters every frame get_weighted_ranges() and
+/// get_converged_ranges() read. Its stats() count outliers and dropouts.
+extern RangeQuality range_quality;
+/// @brief Carries samples from the UART task to the processing task in
+/// pipeline mode. Its overflows() are frames the processing side lost.
+extern SampleQueue pipeline_queue;
+extern IngestStage ingest_stage;
+/// @brief The module's software version, from AT+GETVER? in init_setup().
+extern VersionString module_version;
+/// @brief Per-stage and per-AT-command latency histograms. at_engine, the
+/// pipeline stages and the helpers below record into it; see trace.h.
+extern Tracer tracer;
+/// @brief Free heap, largest free block and fragmentation since boot, fed by
+/// poll_trace_stats(). Watch it over long runs with trace_report.
+extern HeapMonitor heap_monitor;
+/// @brief When each step of init_setup() started and finished, and when the
+/// first range and the WiFi link came. Sent as a TELEMETRY_BOOT packet.
+extern BootTimer boot_timer;
+/// @brief What the OLED shows. The hot paths in utils.cpp update it under a
+/// spinlock the display task copies it with, see start_status_display().
+/// Read-only outside utils.cpp.
+extern StatusModel status_model;
+/// @brief The text on the OLED. Its frames() and lines_pushed() count what
+/// the display task drew.
+extern StatusScreen status_screen;
+/// @brief Sequence window and queue for the laptop's commands, see
+/// poll_control(). Its stats() count duplicates and commands turned away.
+extern ControlChannel control;
+/// @brief Messages to and from the other boards over AT+DATA, see mesh.h.
+/// read_frame() feeds it every AT+RDATA. A function rather than a global so
+/// the programs' globals can register handlers from their constructors.
+MeshDispatcher& radio_mesh();
 
 
 // Bundles device-specific data together for easier parameter passing.
@@ -56,15 +142,13 @@ struct DeviceInfo {
     WiFiUDP udp;
 };
 
-struct RangeBuffer {
-    int buffer[BUFF_SIZE];
-    // Not all anchor distances converge at the same time. I don't
-    bool continue_flag;
-};
+/// @brief Runs one command from the laptop, see poll_control().
+/// @return A ControlStatus; CONTROL_UNKNOWN hands it on to handle_control().
+typedef uint8_t (*ControlHandler)(DeviceInfo& device, const ControlCommand& command, void* ctx);
 
 struct RData {
-    String senderID;
-    String message;
+    int senderID;
+    char message[RDATA_MESSAGE_LEN];
     bool valid;  // Indicates whether parsing succeeded
 };
 
@@ -72,75 +156,277 @@ struct RData {
 // FUNCTION PROTOTYPES //
 /////////////////////////
 
-/// @brief Used in setup() to init WiFi, the OLED display, and the device role
+/// @brief Used in setup() to init WiFi, the OLED display, and the device role.
+/// WiFi associates in the background meanwhile, and init_setup() returns
+/// without waiting for it: ranging starts right away, and whatever is sent
+/// before the link is up waits in a buffer, see poll_wifi().
 /// @param device 
 /// @param new_role 
 void init_setup(DeviceInfo& device, DeviceRole new_role);
 
 
+/// @brief Non-blocking. The first time WiFi is found associated, opens the
+/// UDP socket and sends the datagrams buffered until then. The boot report
+/// follows once the first range is in, or BOOT_REPORT_WAIT_MS after that.
+/// The send functions below call it; loops that send nothing should too.
+/// @param device 
+/// @return True if the link is up.
+bool poll_wifi(DeviceInfo& device);
+
+
 /// @brief Builds AT+SETCFG command.
 /// @param device 
 /// @return 
-String config_cmd(DeviceInfo& device);
+CommandString config_cmd(DeviceInfo& device);
 
 
-/// @brief Builds the AT+SETCAP command.
+/// @brief The boot-time AT+SETCAP command. Built at compile time, it only
+/// depends on UWB_TAG_COUNT. A CONTROL_COMMIT_TDMA replaces it, see
+/// module_config_for().
 /// @return Command string for capacity settings.
-String cap_cmd();
+const char* cap_cmd();
 
 
-/// @brief Sends strings from one device to all devices via radio.
+/// @brief The settings config_cmd() and cap_cmd() describe, for
+/// module_config.apply(). The antenna delay is left as the module has it.
+/// Once the laptop has committed a TDMA layout, its capacity and slot time
+/// are used instead, and a tag's slot as its module id.
+/// @param device 
+/// @return 
+ModuleConfig module_config_for(DeviceInfo& device);
+
+
+/// @brief Sends strings from one device to all devices via radio. Returns as
+/// soon as the module answers OK/ERR, `timeout` is only the upper bound.
 /// @param command 
 /// @param timeout 
-/// @param debug 
-/// @return 
-String send_radio_data(String command, const int timeout, boolean debug);
+/// @param debug Logs the reply and its round-trip latency.
+/// @return Every line the module sent back, newline separated. Only valid
+/// until the next command; copy it to keep it.
+const char* send_radio_data(const char* command, const int timeout, boolean debug);
 
 
 /// @brief Sends strings via UDP for wireless, computer-based logging.
+/// Buffered until WiFi is up.
 /// @param device 
 /// @param message 
-void send_wifi_data(DeviceInfo& device, const String& message);
+void send_wifi_data(DeviceInfo& device, const char* message);
 
 
-/// @brief Refreshes the OLED display with useful information.
+/// @brief Sends one binary datagram via UDP, e.g. a telemetry packet.
+/// Buffered until WiFi is up.
 /// @param device 
-/// @param message 
-void updateOLED(DeviceInfo& device, const String& message);
+/// @param data 
+/// @param len 
+void send_wifi_packet(DeviceInfo& device, const uint8_t* data, size_t len);
+
+
+/// @brief TelemetryBatcher flush callback. Pass the DeviceInfo as ctx.
+void send_telemetry_packet(const uint8_t* packet, size_t len, void* ctx);
+
+
+/// @brief Sends the tracer's histograms as a TELEMETRY_STATS packet.
+/// @param device 
+void send_trace_stats(DeviceInfo& device);
+
+
+/// @brief Samples the heap into heap_monitor and sends it as a
+/// TELEMETRY_HEAP packet.
+/// @param device 
+void send_heap_stats(DeviceInfo& device);
+
+
+/// @brief Non-blocking. Calls send_trace_stats() and send_heap_stats() every
+/// TRACE_EXPORT_INTERVAL_MS. Call it from whichever task does the other
+/// UDP sends, WiFiUDP isn't safe to share between tasks.
+/// @param device 
+/// @return True if a packet went out.
+bool poll_trace_stats(DeviceInfo& device);
+
+
+/// @brief Non-blocking. Every CONTROL_POLL_INTERVAL_MS, reads the laptop's
+/// command datagrams off the UDP socket, runs the new commands and sends the
+/// acks back in one datagram. Resent commands are answered without running
+/// them again. Clock syncs are answered as they are read. Like the sends,
+/// call it from the task that owns the socket.
+/// @param device 
+/// @param telemetry For CONTROL_SET_BATCH / SET_DEADLINE, null if there is none.
+/// @param handler Optional, gets each command before handle_control() does.
+/// @param ctx Passed to the handler.
+/// @return True if a command was run.
+bool poll_control(DeviceInfo& device, TelemetryBatcher* telemetry, ControlHandler handler = nullptr,
+                  void* ctx = nullptr);
+
+
+/// @brief What every board does with a command: pings, the telemetry batch,
+/// the antenna delay, the role and the TDMA layout. Those last three block
+/// while the module is reconfigured, and are rejected once start_pipeline()
+/// has given the module's UART to the ingest task.
+/// @return A ControlStatus.
+uint8_t handle_control(DeviceInfo& device, const ControlCommand& command, TelemetryBatcher* telemetry);
+
+
+/// @brief Solves a fix from the ranges and sends it as a TELEMETRY_POSITION
+/// packet.
+/// @param device 
+/// @param solver Anchor positions must already be set.
+/// @param ranges 
+/// @param seq Counts fixes, separately from the range frames.
+/// @param weights Optional, from get_weighted_ranges(). The fix's residuals
+/// then go back into range_quality.
+/// @return True if a fix was solved and sent.
+bool send_position(DeviceInfo& device, const PositionSolver& solver, const int ranges[NUM_ANCHORS], uint32_t seq,
+                   const float* weights = nullptr);
+
+
+/// @brief Folds the ranges into the tracker and sends its estimate as a
+/// TELEMETRY_POSITION packet. The packet's rms_residual carries the tracker's
+/// innovation RMS and anchors_used the ranges that passed its gate.
+/// @param device 
+/// @param tracker Anchor positions must already be set.
+/// @param ranges 
+/// @param seq Counts fixes, separately from the range frames.
+/// @return True if there is a track and its estimate was sent.
+bool send_tracked_position(DeviceInfo& device, TagTracker& tracker, const int ranges[NUM_ANCHORS], uint32_t seq);
 
 
-/// @brief 
+/// @brief Refreshes the OLED display with useful information. Once the
+/// display task runs this only updates status_model; before that it draws
+/// the screen itself.
+/// @param device 
+/// @param message The module's software version.
+void updateOLED(DeviceInfo& device, const char* message);
+
+
+/// @brief Starts the task that redraws the OLED from status_model every
+/// STATUS_INTERVAL_MS, pushing only the pages whose text changed. From then
+/// on it owns the I2C bus. init_setup() calls it.
+void start_status_display();
+
+
+/// @brief Switches the module between tag and anchor. The first call does the
+/// full restore and saves to flash; later ones only send what changed and
+/// leave flash alone, so the module boots back into the first role.
 /// @param device 
 /// @param new_role 
 /// @param message 
-void set_role(DeviceInfo& device, DeviceRole new_role, const String& message);
+void set_role(DeviceInfo& device, DeviceRole new_role, const char* message);
 
 
-/// @brief 
-/// @param device 
+/// @brief Sets the antenna delay and saves it to flash, and to NVS for
+/// saved_antenna_delay().
 /// @param delay 
 void set_delay(int delay);
 
 
+/// @brief The antenna delay set_delay() last saved to NVS, e.g. from
+/// uwb_control delay, so a reflash keeps what was tuned.
+/// @param fallback The program's default, until something is saved.
+int saved_antenna_delay(int fallback);
+
+
 /// @brief Reads the serial port between the MCU and the chip for incoming messages
-/// @param message 
+/// @param message Trimmed, cut off at PARSER_LINE_LEN like the parser's copy.
 /// @param debug 
 /// @return 
-bool read_serial(String& message, boolean debug);
+bool read_serial(LineString& message, boolean debug);
 
 
+/// @brief Drains SERIAL_AT into uart_parser without blocking. Partial lines are
+/// kept for the next call.
+/// @param debug 
+/// @return The type of line that completed, LINE_NONE if none did. The frame
+/// itself is in uart_parser.range() / .rdata() / .line().
+AtLineType read_frame(boolean debug);
+
+
+/// @brief micros() when the first byte of the line read_frame() (or
+/// read_serial()) last completed was read off SERIAL_AT. What range frames
+/// and fixes are stamped with, so the laptop sees when the module reported.
+uint32_t last_frame_us();
+
+
+/// @brief Non-blocking. Fills parsed_ranges when an AT+RANGE frame completes.
+/// @return True if parsed_ranges was updated.
 bool get_raw_ranges(DeviceInfo& device, int parsed_ranges[]);
 
 
-void get_converged_ranges(DeviceInfo& device, int parsed_ranges[NUM_ANCHORS]);
+/// @brief Non-blocking. Passes any new AT+RANGE frame through range_quality
+/// and returns what it makes of it: spikes replaced by the window median,
+/// short gaps bridged, and a weight per anchor for the solver.
+/// @param device 
+/// @param parsed_ranges 0 for anchors with a weight of 0.
+/// @param weights 
+/// @return True if parsed_ranges and weights were updated.
+bool get_weighted_ranges(DeviceInfo& device, int parsed_ranges[NUM_ANCHORS], float weights[NUM_ANCHORS]);
+
+
+/// @brief Non-blocking. Feeds any new AT+RANGE frame, after range_quality,
+/// into range_filter and writes its current estimate: window means for
+/// converged anchors, the latest range for the rest.
+/// @param device 
+/// @param parsed_ranges 
+/// @return Bitmask of the anchors that have converged.
+uint32_t get_converged_ranges(DeviceInfo& device, int parsed_ranges[NUM_ANCHORS]);
+
+
+/// @brief Splits the per-frame work across both cores: a UART ingest/parse
+/// task on PIPELINE_INGEST_CORE and a filter/telemetry task on
+/// PIPELINE_PROCESS_CORE, joined by pipeline_queue. A slow endPacket() then
+/// no longer stops the UART being drained. Call at the end of setup(); from
+/// then on nothing else may read SERIAL_AT (get_raw_ranges, send_radio_data).
+/// @param telemetry Gets every frame; its flush runs on the processing core.
+/// @param hook Optional, called per frame on the processing core.
+/// @param ctx Passed to the hook.
+/// @return The processing stage, for its counters.
+ProcessStage& start_pipeline(TelemetryBatcher& telemetry,
+                             ProcessStage::FrameHook hook = nullptr, void* ctx = nullptr);
+
+
+/// @brief CalibrationParticipant::RoleFn. Pass the DeviceInfo as ctx.
+void switch_calibration_role(bool measuring, void* ctx);
+
+
+/// @brief Sends the coordinator's distance matrix to the laptop as a
+/// TELEMETRY_CALIBRATION packet.
+/// @param device 
+/// @param coordinator 
+void send_calibration_matrix(DeviceInfo& device, const CalibrationCoordinator& coordinator);
+
+
+/// @brief The calibration save_calibration_cache() last kept in NVS.
+/// @return False if there is none, or it doesn't decode.
+bool load_calibration_cache(CalibrationCache& out);
+
+
+/// @brief Keeps a calibration in NVS, to be checked on the next boot instead
+/// of measured again.
+bool save_calibration_cache(const CalibrationCache& cache);
+
+
+/// @brief Non-blocking. Reads the UART, so every AT+RDATA reaches the
+/// calibration objects through radio_mesh() (and every AT+RANGE the
+/// participant), and runs their timeouts. Lines that arrive during one of
+/// their own AT+DATA sends are caught too. Call from a loop until the
+/// calibration is over; either pointer may be null.
+void pump_calibration(CalibrationCoordinator* coordinator, CalibrationParticipant* participant);
+
+
+/// @brief Prints what radio_mesh() sent and received so far, per message
+/// type, with the loss and round trips it saw.
+void log_mesh_stats();
 
 
 /// @brief Parses the software version in the AT+GETVER command
 /// @param msg 
-/// @return 
-String parse_software_version(DeviceInfo& device, String version);
+/// @return Empty if the reply has no version.
+VersionString parse_software_version(DeviceInfo& device, const char* version);
+
+
+void parse_range(const char* message, int ranges[]);
 
 
-void parse_range(String message, int ranges[]);
+/// @brief Parses an AT+RDATA=<sender>,<x>,<x>,<len>,<message> line.
+RData parse_rdata(const char* line);
 
 #endif
@@ -0,0 +1,15 @@
+#ifndef UWB_CONFIG_H
+#define UWB_CONFIG_H
+
+// System-wide sizes shared by the firmware and the host tools. Nothing in here
+// may depend on Arduino.
+
+#define UWB_TAG_COUNT 64
+#define LOCAL_PORT 4210
+#define TARGET_PORT 4210 // My computer port
+
+#define NUM_ANCHORS 8
+#define BUFF_SIZE 5 // The number of ranges in the buffer at a time
+#define STABILITY_THRESHOLD 10 // The total variance range measurements can have
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef WIRE_FORMAT_H
+#define WIRE_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Little-endian field access for the binary packet formats. Byte-wise so it
+// works on unaligned buffers and doesn't depend on the host's byte order.
+
+inline void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+inline void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+inline void put_u64(uint8_t* p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+inline void put_i16(uint8_t* p, int16_t v) { put_u16(p, (uint16_t)v); }
+
+inline uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t get_u64(const uint8_t* p) { return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32); }
+
+inline int16_t get_i16(const uint8_t* p) { return (int16_t)get_u16(p); }
+
+/// @brief LEB128: 7 bits per byte, low bits first, high bit set on all but
+/// the last. Small counts take one byte, a u32 at most five.
+/// @return Bytes written.
+inline size_t put_varint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/// @return Bytes read, 0 if the varint runs past end or is too long.
+inline size_t get_varint(const uint8_t* p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (size_t n = 0; n < 5 && p + n < end; n++) {
+        v |= (uint32_t)(p[n] & 0x7F) << (7 * n);
+        if (!(p[n] & 0x80)) return n + 1;
+    }
+    return 0;
+}
+
+/// @brief Clamps to what fits in an i16 field.
+inline int16_t clamp_i16(int v) {
+    if (v > INT16_MAX) return INT16_MAX;
+    if (v < INT16_MIN) return INT16_MIN;
+    return (int16_t)v;
+}
+
+#endif
@@ -14,12 +14,15 @@ DeviceInfo device = {
 void setup() {
     // Initialize device
     init_setup(device, ANCHOR);
-    // The higher the delay, the shorter the estimated distance
-    set_delay(16450);
-    String command = "AT+GETANT?";
-    send_wifi_data(device, send_radio_data(command, 2000, 0));
+    // The higher the delay, the shorter the estimated distance. Whatever
+    // uwb_control last set wins over the default
+    set_delay(saved_antenna_delay(16450));
+    send_wifi_data(device, send_radio_data("AT+GETANT?", 2000, 0));
 }
 
 void loop () {
     // Request the antennae delay
+    // Sends the reply above and the boot report once WiFi is up
+    poll_wifi(device);
+    poll_control(device, nullptr);
 }
\ No newline at end of file
@@ -1,5 +1,16 @@
 #include "utils.h"
 
+// 1: solve the position here and stream fixes, 0: stream the raw ranges
+#define SEND_POSITIONS 0
+// With SEND_POSITIONS, 1: fixes come from a PositionTracker fed every frame,
+// 0: each frame is solved on its own
+#define TRACK_POSITIONS 1
+// With SEND_POSITIONS, 1: ranges go through range_quality first, which
+// replaces spikes, bridges short dropouts and weights each anchor
+#define WEIGHT_RANGES 1
+// 1: UART ingest and filtering/telemetry run as tasks on separate cores
+#define USE_PIPELINE 0
+
 // This information is specific to each board. Set to connect to my laptop.
 DeviceInfo device = {
     .uwb_index = 3,
@@ -11,32 +22,75 @@ DeviceInfo device = {
     .udp = WiFiUDP()
 };
 
+// Batches range frames into binary datagrams, see telemetry.h
+TelemetryBatcher telemetry(device.uwb_index, TELEMETRY_DEFAULT_BATCH, TELEMETRY_DEFAULT_DEADLINE_US,
+                           send_telemetry_packet, &device);
+
+// Anchor coordinates in cm, indexed by anchor uwb_index. Same as frontend.py.
+const float ANCHOR_POSITIONS[][2] = { { 0, 0 }, { 980, 0 }, { 1035, 719 } };
+PositionSolver solver;
+TagTracker tracker;
+float range_weights[NUM_ANCHORS]; // Per anchor, from get_weighted_ranges()
+uint32_t fix_seq = 0;
+
+
+// Pipeline mode: runs on the processing core, which owns the UDP socket
+void on_pipeline_frame(const RangeSample&, const RangeFilter&, void* ctx) {
+    // Only while frames come in, the UDP socket can't be shared with loop()
+    DeviceInfo& device = *(DeviceInfo*)ctx;
+    poll_trace_stats(device);
+    poll_control(device, &telemetry);
+}
+
 
 void setup() {
     // Initialize device
     init_setup(device, TAG);
+
+    for (size_t i = 0; i < sizeof(ANCHOR_POSITIONS) / sizeof(ANCHOR_POSITIONS[0]); i++) {
+        solver.set_anchor(i, ANCHOR_POSITIONS[i]);
+        tracker.set_anchor(i, ANCHOR_POSITIONS[i]);
+    }
+
+#if USE_PIPELINE
+    start_pipeline(telemetry, on_pipeline_frame, &device);
+#endif
 }
 
 void loop () {
-    // String message = "";
+#if USE_PIPELINE
+    // The pipeline tasks do all the work
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    return;
+#endif
+
+    // LineString message;
     // read_serial(message, 0);
     // if (message.length() > 0)
-    //     send_wifi_data(device, message);
+    //     send_wifi_data(device, message.c_str());
 
     int parsed_ranges[NUM_ANCHORS] = {0};
     // get_converged_ranges(device, converged_ranges);
-    if (get_raw_ranges(device, parsed_ranges)) {;
-
-        send_wifi_data(device, 
-            String("Raw Value: ") +
-            String(parsed_ranges[0]) + ", " + 
-            String(parsed_ranges[1]) + ", " + 
-            String(parsed_ranges[2]) + ", " + 
-            String(parsed_ranges[3]) + ", " + 
-            String(parsed_ranges[4]) + ", " + 
-            String(parsed_ranges[5]) + ", " + 
-            String(parsed_ranges[6]) + ", " + 
-            String(parsed_ranges[7]) + "\n"
-        );
+#if SEND_POSITIONS && WEIGHT_RANGES
+    bool got_ranges = get_weighted_ranges(device, parsed_ranges, range_weights);
+#else
+    bool got_ranges = get_raw_ranges(device, parsed_ranges);
+#endif
+    if (got_ranges) {
+        uint32_t start = trace_cycles();
+#if SEND_POSITIONS && TRACK_POSITIONS
+        if (send_tracked_position(device, tracker, parsed_ranges, fix_seq)) fix_seq++;
+#elif SEND_POSITIONS
+        if (send_position(device, solver, parsed_ranges, fix_seq, WEIGHT_RANGES ? range_weights : nullptr)) fix_seq++;
+#else
+        telemetry.add(parsed_ranges, last_frame_us());
+        tracer.record(TRACE_TELEMETRY, trace_cycles() - start);
+#endif
+        tracer.record(TRACE_FRAME, trace_cycles() - start);
     }
+
+    // Sends a partial batch once its first frame has waited long enough
+    telemetry.poll(micros());
+    poll_trace_stats(device);
+    poll_control(device, &telemetry);
 }
\ No newline at end of file
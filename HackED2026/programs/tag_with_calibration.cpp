@@ -11,53 +11,101 @@ DeviceInfo device = {
     .udp = WiFiUDP()
 };
 
+// Batches range frames into binary datagrams, see telemetry.h
+TelemetryBatcher telemetry(device.uwb_index, TELEMETRY_DEFAULT_BATCH, TELEMETRY_DEFAULT_DEADLINE_US,
+                           send_telemetry_packet, &device);
+
+
+// Anchors 0..CALIBRATION_ANCHORS-1 measure the distances between each other
+#define CALIBRATION_ANCHORS 4
+
+CalibrationCoordinator calibration(radio_mesh());
+
+// Longest to wait for the laptop's CONTROL_CALIBRATION_OK, the anchors are told either way
+#define CALIBRATION_OK_TIMEOUT_MS 120000
+bool calibration_ok = false;
+uint32_t calibration_ok_unix = 0; // The laptop's clock, stamped on the saved calibration
+
+
+uint8_t on_control(DeviceInfo&, const ControlCommand& command, void*) {
+    if (command.opcode != CONTROL_CALIBRATION_OK) return CONTROL_UNKNOWN;
+    calibration_ok = true;
+    calibration_ok_unix = (uint32_t)command.arg;
+    return CONTROL_OK;
+}
+
+
+/// @brief Measures a round of pairs against the calibration saved last time.
+/// @return True if it still holds, and the full calibration can be skipped.
+bool check_saved_calibration(const CalibrationCache& saved) {
+    calibration.check(CALIBRATION_ANCHORS, micros());
+    while (!calibration.measured()) pump_calibration(&calibration, nullptr);
+
+    size_t compared;
+    int drift = calibration_drift_cm(saved, calibration.distances(), CALIBRATION_ANCHORS, compared);
+    bool holds = calibration_cache_holds(saved, calibration.distances(), CALIBRATION_ANCHORS);
+    SERIAL_LOG.printf("Saved calibration: %d cm drift over %u pairs in %lu ms, %s\n", drift, (unsigned)compared,
+                      (unsigned long)(calibration.stats().elapsed_us / 1000), holds ? "kept" : "recalibrating");
+    return holds;
+}
+
 
 void setup() {
     // Initialize device
     init_setup(device, TAG);
 
-    int a0a1 = get_distance(0, 1);
-    int a0a2 = get_distance(0, 2);
-    int a0v3 = get_distance(0, 3); 
-    int a1a2 = get_distance(1, 2); 
-    int a1v3 = get_distance(1, 3); 
-    int a2v3 = get_distance(2, 3); 
-
-    char distances[64];
-    sprintf(distances, "%d %d %d %d %d %d", a0a1, a0a2, a0v3, a1a2, a1v3, a2v3);
-
-    // Send the distances to the laptop
-    send_wifi_data(device, distances);
-    
-    // Wait until the laptop running the program has calculated the position of 
-    // every device, and sends an ok signal
-    // TODO
-    receive_wifi_data(ok_signal);
-    
-    // Inform all anchors that the calibration is complete
-    send_radio_data("AT+DATA=20,CALIBRATION COMPLETE", 1000, 0);
-    
-    // Wait until all anchors send their okay signal
-    listen_for_ack();
+    // A few fresh pairs against what was saved, and a full calibration only
+    // if nothing was saved or the anchors have moved since
+    CalibrationCache saved;
+    bool warm = load_calibration_cache(saved) && saved.devices == CALIBRATION_ANCHORS &&
+                check_saved_calibration(saved);
+
+    if (!warm) {
+        // Rounds of disjoint anchor pairs, each pair measured by one of its anchors
+        calibration.start(CALIBRATION_ANCHORS, micros());
+        while (!calibration.measured()) pump_calibration(&calibration, nullptr);
+
+        // Send the distances to the laptop
+        send_calibration_matrix(device, calibration);
 
+        // Wait until the laptop running the program has calculated the position of
+        // every device, and sends an ok signal (uwb_control calibration-ok)
+        uint32_t wait_start = millis();
+        while (!calibration_ok && millis() - wait_start < CALIBRATION_OK_TIMEOUT_MS) {
+            poll_control(device, &telemetry, on_control);
+            delay(1);
+        }
 
+        // Only what the laptop accepted is worth checking against next boot
+        if (calibration_ok) {
+            calibration_cache_init(saved, calibration.distances(), CALIBRATION_ANCHORS, calibration_ok_unix);
+            if (!save_calibration_cache(saved)) SERIAL_LOG.println("Couldn't save the calibration");
+        } else {
+            SERIAL_LOG.println("No calibration OK from the laptop, going on without it");
+        }
+    }
+
+    // Inform all anchors that the calibration is complete, and wait until they
+    // all acknowledge (or the retries run out)
+    calibration.finish(micros());
+    while (!calibration.finished()) pump_calibration(&calibration, nullptr);
+
+    const CalibrationStats& stats = calibration.stats();
+    SERIAL_LOG.printf("Calibration: %lu ms, %lu rounds, %lu retries, %lu pairs failed, %lu missing ACKs\n",
+                      (unsigned long)(stats.elapsed_us / 1000), (unsigned long)stats.rounds,
+                      (unsigned long)stats.retries, (unsigned long)stats.failed_pairs,
+                      (unsigned long)stats.missing_acks);
+    log_mesh_stats();
 }
 
 void loop () {
     int parsed_ranges[NUM_ANCHORS] = {0};
     // get_converged_ranges(device, converged_ranges);
-    if (get_raw_ranges(device, parsed_ranges)) {;
-
-        send_wifi_data(device, 
-            String("Raw Value: ") +
-            String(parsed_ranges[0]) + ", " + 
-            String(parsed_ranges[1]) + ", " + 
-            String(parsed_ranges[2]) + ", " + 
-            String(parsed_ranges[3]) + ", " + 
-            String(parsed_ranges[4]) + ", " + 
-            String(parsed_ranges[5]) + ", " + 
-            String(parsed_ranges[6]) + ", " + 
-            String(parsed_ranges[7]) + "\n"
-        );
+    if (get_raw_ranges(device, parsed_ranges)) {
+        telemetry.add(parsed_ranges, last_frame_us());
     }
+
+    // Sends a partial batch once its first frame has waited long enough
+    telemetry.poll(micros());
+    poll_control(device, &telemetry);
 }
@@ -18,9 +18,10 @@ void setup() {
 }
 
 void loop () {
-    String message = "";
+    LineString message;
     read_serial(message, 0);
     if (message.length() > 0)
-        send_wifi_data(device, message);
+        send_wifi_data(device, message.c_str());
+    poll_control(device, nullptr);
 }
 